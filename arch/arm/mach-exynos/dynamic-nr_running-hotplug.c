@@ -36,31 +36,38 @@ static unsigned int can_hotplug;
 static void exynos4_integrated_dvfs_hotplug(unsigned int freq_old,
 					unsigned int freq_new)
 {
+	/*
+	 * Use the scheduler's decayed runnable average rather than the
+	 * instantaneous nr_running(), which mostly reflects whatever
+	 * happened to be woken right before the frequency transition.
+	 */
+	unsigned long nr_run = (sched_nr_running_avg() + 50) / 100;
+
 	total_num_target_freq++;
 	freq_in_trg = 800000;
 
-	if (nr_running() <= 1) {
+	if (nr_run <= 1) {
 		ctn_nr_running_over2 = 0;
 		ctn_nr_running_over3 = 0;
 		ctn_nr_running_over4 = 0;
 		ctn_nr_running_under2++;
 		ctn_nr_running_under3++;
 		ctn_nr_running_under4++;
-	} else if ((nr_running() > 1) && (nr_running() <= 2)) {
+	} else if ((nr_run > 1) && (nr_run <= 2)) {
 		ctn_nr_running_over2++;
 		ctn_nr_running_over3 = 0;
 		ctn_nr_running_over4 = 0;
 		ctn_nr_running_under2 = 0;
 		ctn_nr_running_under3++;
 		ctn_nr_running_under4++;
-	} else if ((nr_running() > 2) && (nr_running() <= 3)) {
+	} else if ((nr_run > 2) && (nr_run <= 3)) {
 		ctn_nr_running_over2++;
 		ctn_nr_running_over3++;
 		ctn_nr_running_over4 = 0;
 		ctn_nr_running_under2 = 0;
 		ctn_nr_running_under3 = 0;
 		ctn_nr_running_under4++;
-	} else if (nr_running() > 3) {
+	} else if (nr_run > 3) {
 		ctn_nr_running_over2++;
 		ctn_nr_running_over3++;
 		ctn_nr_running_over4++;
@@ -70,17 +77,17 @@ static void exynos4_integrated_dvfs_hotplug(unsigned int freq_old,
 	}
 
 	if (soc_is_exynos4412()) {
-		if ((cpu_online(3) == 0) && (nr_running() >= 2)) {
+		if ((cpu_online(3) == 0) && (nr_run >= 2)) {
 			if (ctn_nr_running_over2 >= 4) {		/* over 400ms, tunnable */
 				cpu_up(3);
 				watch_dog_hook();//yan
 			}
-		} else if ((cpu_online(2) == 0) && (nr_running() >= 3)) {
+		} else if ((cpu_online(2) == 0) && (nr_run >= 3)) {
 			if (ctn_nr_running_over3 >= 4) {		/* over 400ms, tunnable */
 				cpu_up(2);
 				watch_dog_hook();//yan
 			}
-		} else if ((cpu_online(1) == 0) && (nr_running() >= 4)) {
+		} else if ((cpu_online(1) == 0) && (nr_run >= 4)) {
 			if (ctn_nr_running_over4 >= 8) {		/* over 800ms, tunnable */
 				cpu_up(1);
 				watch_dog_hook();//yan
@@ -95,15 +102,15 @@ static void exynos4_integrated_dvfs_hotplug(unsigned int freq_old,
 		}
 	} /* end of else */
 	if (soc_is_exynos4412()) {
-		if ((cpu_online(1) == 1) && (nr_running() < 4)) {
+		if ((cpu_online(1) == 1) && (nr_run < 4)) {
 			if (ctn_nr_running_under4 >= 8) {		/* over 800ms, tunnable */
 				cpu_down(1);
 			}
-		} else if ((cpu_online(2) == 1) && (nr_running() < 3)) {
+		} else if ((cpu_online(2) == 1) && (nr_run < 3)) {
 			if (ctn_nr_running_under3 >= 8) {		/* over 800ms, tunnable */
 				cpu_down(2);
 			}
-		} else if ((cpu_online(3) == 1) && (nr_running() < 2)) {
+		} else if ((cpu_online(3) == 1) && (nr_run < 2)) {
 			if (ctn_nr_running_under2 >= 8) {		/* over 800ms, tunnable */
 				cpu_down(3);
 			}
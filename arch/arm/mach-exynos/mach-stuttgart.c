@@ -1509,6 +1509,7 @@ static struct s3c_mshci_platdata exynos4_mshc_pdata __initdata = {
 	.cd_type		= S3C_MSHCI_CD_PERMANENT,
 	.has_wp_gpio		= true,
 	.wp_gpio		= 0xffffffff,
+	.host_caps2		= MMC_CAP2_PACKED_CMD,
 #if defined(CONFIG_EXYNOS4_MSHC_8BIT) && \
 	defined(CONFIG_EXYNOS4_MSHC_DDR)
 	.max_width		= 8,
@@ -75,6 +75,8 @@ void s3c_mshci_set_platdata(struct s3c_mshci_platdata *pd)
 		set->max_width = pd->max_width;
 	if (pd->host_caps)
 		set->host_caps |= pd->host_caps;
+	if (pd->host_caps2)
+		set->host_caps2 |= pd->host_caps2;
 	if (soc_is_exynos4210()) {
 		if (pd->host_caps && samsung_rev() != EXYNOS4210_REV_1_1) {
 			printk(KERN_INFO "MSHC: This exynos4 is EVT1.0. "
@@ -32,6 +32,7 @@ enum ms_cd_types {
  * struct s3c_mshci_platdata() - Platform device data for Samsung MSHCI
  * @max_width: The maximum number of data bits supported.
  * @host_caps: Standard MMC host capabilities bit field.
+ * @host_caps2: Standard MMC host capabilities bit field 2 (MMC_CAP2_*).
  * @cd_type: Type of Card Detection method (see cd_types enum above)
  * @wp_gpio: The gpio number using for WP.
  * @has_wp_gpio: Check using wp_gpio or not.
@@ -60,6 +61,7 @@ enum ms_cd_types {
 struct s3c_mshci_platdata {
 	unsigned int	max_width;
 	unsigned int	host_caps;
+	unsigned int	host_caps2;
 	enum ms_cd_types	cd_type;
 
 	char		**clocks;	/* set of clock sources */
@@ -286,6 +286,7 @@ void blk_sync_queue(struct request_queue *q)
 {
 	del_timer_sync(&q->timeout);
 	cancel_delayed_work_sync(&q->delay_work);
+	blk_stage_sync(q);
 }
 EXPORT_SYMBOL(blk_sync_queue);
 
@@ -545,6 +546,9 @@ blk_init_allocated_queue_node(struct request_queue *q, request_fn_proc *rfn,
 
 	q->sg_reserved_size = INT_MAX;
 
+	if (blk_stage_init(q))
+		return NULL;
+
 	/*
 	 * all done
 	 */
@@ -1197,6 +1201,210 @@ out:
 	return ret;
 }
 
+#ifdef CONFIG_BLK_PERCPU_STAGING
+/*
+ * Per-cpu request staging.
+ *
+ * With a single queue_lock per device every submitter serializes on it
+ * twice per bio, once to look for a merge and once to insert the new
+ * request, and each insertion kicks the driver.  A queue with a non-zero
+ * stage_batch instead collects unplugged requests on a list private to the
+ * submitting cpu, merges later bios into them under that list's own lock,
+ * and inserts the whole list into the elevator under one queue_lock hold
+ * once stage_batch requests are waiting.  Batching only happens while the
+ * device is busy: with nothing in flight a request is dispatched at once,
+ * waiting would only add latency.  Whatever is still staged when the
+ * driver asks for its next request is picked up by blk_peek_request(),
+ * and kblockd sweeps up the rest so nothing is left behind on an idle cpu.
+ */
+static bool blk_stage_merge(struct request_queue *q, struct bio *bio)
+{
+	struct blk_stage_ctx *ctx;
+	struct request *rq;
+	bool ret = false;
+
+	if (blk_queue_nomerges(q))
+		return false;
+
+	local_irq_disable();
+	ctx = this_cpu_ptr(q->stage_ctx);
+	spin_lock(&ctx->lock);
+	list_for_each_entry_reverse(rq, &ctx->list, queuelist) {
+		int el_ret = elv_try_merge(rq, bio);
+
+		if (el_ret == ELEVATOR_BACK_MERGE)
+			ret = bio_attempt_back_merge(q, rq, bio);
+		else if (el_ret == ELEVATOR_FRONT_MERGE)
+			ret = bio_attempt_front_merge(q, rq, bio);
+		if (ret) {
+			ctx->merged++;
+			break;
+		}
+	}
+	spin_unlock(&ctx->lock);
+	local_irq_enable();
+
+	return ret;
+}
+
+/*
+ * Insert a batch taken off a staging list. The requests were accounted
+ * when they were staged, so this is a raw insert, like a plug flush.
+ */
+static void blk_stage_insert(struct request_queue *q, struct list_head *list)
+{
+	struct request *rq;
+
+	while (!list_empty(list)) {
+		rq = list_entry_rq(list->next);
+		list_del_init(&rq->queuelist);
+		__elv_add_request(q, rq, ELEVATOR_INSERT_SORT_MERGE);
+	}
+}
+
+/*
+ * Move everything staged on any cpu into the elevator.
+ * Call with the queue lock held and interrupts disabled.
+ */
+void __blk_stage_drain(struct request_queue *q)
+{
+	struct blk_stage_ctx *ctx;
+	LIST_HEAD(list);
+	int cpu;
+
+	if (!q->stage_ctx)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		ctx = per_cpu_ptr(q->stage_ctx, cpu);
+		/* racy peek, anything added after it gets its own kick */
+		if (list_empty(&ctx->list))
+			continue;
+
+		spin_lock(&ctx->lock);
+		list_splice_init(&ctx->list, &list);
+		if (ctx->count)
+			ctx->batches++;
+		ctx->count = 0;
+		spin_unlock(&ctx->lock);
+
+		blk_stage_insert(q, &list);
+	}
+}
+
+static void blk_stage_request(struct request_queue *q, struct request *rq)
+{
+	struct blk_stage_ctx *ctx;
+	unsigned int count;
+	LIST_HEAD(list);
+	bool dispatch;
+
+	local_irq_disable();
+	ctx = this_cpu_ptr(q->stage_ctx);
+	spin_lock(&ctx->lock);
+	list_add_tail(&rq->queuelist, &ctx->list);
+	ctx->staged++;
+	count = ++ctx->count;
+	/* unlocked look at in_flight, the kblockd sweep covers a stale read */
+	dispatch = count >= q->stage_batch || !queue_in_flight(q);
+	if (dispatch) {
+		list_splice_init(&ctx->list, &list);
+		ctx->count = 0;
+		ctx->batches++;
+	}
+	spin_unlock(&ctx->lock);
+
+	if (dispatch) {
+		spin_lock(q->queue_lock);
+		blk_stage_insert(q, &list);
+		__blk_run_queue(q);
+		spin_unlock(q->queue_lock);
+	} else if (count == 1)
+		kblockd_schedule_work(q, &q->stage_work);
+	local_irq_enable();
+}
+
+static void blk_stage_work(struct work_struct *work)
+{
+	struct request_queue *q =
+		container_of(work, struct request_queue, stage_work);
+
+	spin_lock_irq(q->queue_lock);
+	__blk_stage_drain(q);
+	__blk_run_queue(q);
+	spin_unlock_irq(q->queue_lock);
+}
+
+int blk_stage_init(struct request_queue *q)
+{
+	int cpu;
+
+	if (q->stage_ctx)
+		return 0;
+
+	q->stage_ctx = alloc_percpu(struct blk_stage_ctx);
+	if (!q->stage_ctx)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct blk_stage_ctx *ctx = per_cpu_ptr(q->stage_ctx, cpu);
+
+		spin_lock_init(&ctx->lock);
+		INIT_LIST_HEAD(&ctx->list);
+	}
+	INIT_WORK(&q->stage_work, blk_stage_work);
+	return 0;
+}
+
+void blk_stage_sync(struct request_queue *q)
+{
+	if (q->stage_ctx)
+		cancel_work_sync(&q->stage_work);
+}
+
+void blk_stage_exit(struct request_queue *q)
+{
+	free_percpu(q->stage_ctx);
+	q->stage_ctx = NULL;
+}
+
+/**
+ * blk_queue_stage_batch - set how many requests a cpu may stage
+ * @q:     the request queue for the device
+ * @batch: requests staged per cpu before they are inserted, 0 disables
+ *
+ * Description:
+ *    Lets submitters on different cpus queue requests without taking
+ *    the queue lock for every one of them, see the comment above
+ *    blk_stage_merge(). Useful for devices that only work on one or two
+ *    requests at a time but are fed from several cpus at once.
+ **/
+void blk_queue_stage_batch(struct request_queue *q, unsigned int batch)
+{
+	if (!q->stage_ctx)
+		return;
+
+	spin_lock_irq(q->queue_lock);
+	q->stage_batch = batch;
+	if (!batch) {
+		__blk_stage_drain(q);
+		__blk_run_queue(q);
+	}
+	spin_unlock_irq(q->queue_lock);
+}
+EXPORT_SYMBOL(blk_queue_stage_batch);
+#else
+static inline bool blk_stage_merge(struct request_queue *q, struct bio *bio)
+{
+	return false;
+}
+
+static inline void blk_stage_request(struct request_queue *q,
+				     struct request *rq)
+{
+}
+#endif /* CONFIG_BLK_PERCPU_STAGING */
+
 void init_request_from_bio(struct request *req, struct bio *bio)
 {
 	req->cpu = bio->bi_comp_cpu;
@@ -1239,6 +1447,17 @@ static int __make_request(struct request_queue *q, struct bio *bio)
 	if (attempt_plug_merge(current, q, bio))
 		goto out;
 
+	/*
+	 * A staging queue does not look into the elevator at all here,
+	 * staged requests get merged with it when they are inserted.
+	 */
+	if (blk_queue_staging(q)) {
+		if (blk_stage_merge(q, bio))
+			goto out;
+		spin_lock_irq(q->queue_lock);
+		goto get_rq;
+	}
+
 	spin_lock_irq(q->queue_lock);
 
 	el_ret = elv_merge(q, &req, bio);
@@ -1305,6 +1524,9 @@ get_rq:
 		}
 		list_add_tail(&req->queuelist, &plug->list);
 		drive_stat_acct(req, 1);
+	} else if (blk_queue_staging(q) && where == ELEVATOR_INSERT_SORT) {
+		drive_stat_acct(req, 1);
+		blk_stage_request(q, req);
 	} else {
 		spin_lock_irq(q->queue_lock);
 		add_acct_request(q, req, where);
@@ -1828,6 +2050,9 @@ struct request *blk_peek_request(struct request_queue *q)
 	struct request *rq;
 	int ret;
 
+	if (blk_queue_staging(q))
+		__blk_stage_drain(q);
+
 	while ((rq = __elv_next_request(q)) != NULL) {
 		if (!(rq->cmd_flags & REQ_STARTED)) {
 			/*
@@ -217,6 +217,50 @@ QUEUE_SYSFS_BIT_FNS(random, ADD_RANDOM, 0);
 QUEUE_SYSFS_BIT_FNS(iostats, IO_STAT, 0);
 #undef QUEUE_SYSFS_BIT_FNS
 
+#ifdef CONFIG_BLK_PERCPU_STAGING
+static ssize_t queue_stage_batch_show(struct request_queue *q, char *page)
+{
+	return queue_var_show(q->stage_batch, page);
+}
+
+static ssize_t
+queue_stage_batch_store(struct request_queue *q, const char *page,
+			size_t count)
+{
+	unsigned long batch;
+	ssize_t ret;
+
+	if (!q->stage_ctx)
+		return -EINVAL;
+
+	ret = queue_var_store(&batch, page, count);
+	if (batch > q->nr_requests)
+		batch = q->nr_requests;
+	blk_queue_stage_batch(q, batch);
+
+	return ret;
+}
+
+static ssize_t queue_stage_stats_show(struct request_queue *q, char *page)
+{
+	unsigned long staged = 0, merged = 0, batches = 0;
+	int cpu;
+
+	if (!q->stage_ctx)
+		return sprintf(page, "0 0 0\n");
+
+	for_each_possible_cpu(cpu) {
+		struct blk_stage_ctx *ctx = per_cpu_ptr(q->stage_ctx, cpu);
+
+		staged += ctx->staged;
+		merged += ctx->merged;
+		batches += ctx->batches;
+	}
+
+	return sprintf(page, "%lu %lu %lu\n", staged, merged, batches);
+}
+#endif
+
 static ssize_t queue_nomerges_show(struct request_queue *q, char *page)
 {
 	return queue_var_show((blk_queue_nomerges(q) << 1) |
@@ -380,6 +424,19 @@ static struct queue_sysfs_entry queue_random_entry = {
 	.store = queue_store_random,
 };
 
+#ifdef CONFIG_BLK_PERCPU_STAGING
+static struct queue_sysfs_entry queue_stage_batch_entry = {
+	.attr = {.name = "stage_batch", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_stage_batch_show,
+	.store = queue_stage_batch_store,
+};
+
+static struct queue_sysfs_entry queue_stage_stats_entry = {
+	.attr = {.name = "stage_stats", .mode = S_IRUGO },
+	.show = queue_stage_stats_show,
+};
+#endif
+
 static struct attribute *default_attrs[] = {
 	&queue_requests_entry.attr,
 	&queue_ra_entry.attr,
@@ -402,6 +459,10 @@ static struct attribute *default_attrs[] = {
 	&queue_rq_affinity_entry.attr,
 	&queue_iostats_entry.attr,
 	&queue_random_entry.attr,
+#ifdef CONFIG_BLK_PERCPU_STAGING
+	&queue_stage_batch_entry.attr,
+	&queue_stage_stats_entry.attr,
+#endif
 	NULL,
 };
 
@@ -477,6 +538,8 @@ static void blk_release_queue(struct kobject *kobj)
 
 	blk_throtl_exit(q);
 
+	blk_stage_exit(q);
+
 	if (rl->rq_pool)
 		mempool_destroy(rl->rq_pool);
 
@@ -49,6 +49,54 @@ static inline void blk_clear_rq_complete(struct request *rq)
  */
 #define ELV_ON_HASH(rq)		(!hlist_unhashed(&(rq)->hash))
 
+#ifdef CONFIG_BLK_PERCPU_STAGING
+/*
+ * Requests staged on one cpu, waiting to be inserted into the elevator
+ * in one batch. ->lock nests inside the queue lock.
+ */
+struct blk_stage_ctx {
+	spinlock_t		lock;
+	struct list_head	list;
+	unsigned int		count;
+
+	unsigned long		staged;		/* requests staged */
+	unsigned long		merged;		/* bios merged while staged */
+	unsigned long		batches;	/* insertions into the elevator */
+} ____cacheline_aligned_in_smp;
+
+static inline bool blk_queue_staging(struct request_queue *q)
+{
+	return q->stage_batch != 0;
+}
+
+int blk_stage_init(struct request_queue *q);
+void blk_stage_exit(struct request_queue *q);
+void blk_stage_sync(struct request_queue *q);
+void __blk_stage_drain(struct request_queue *q);
+#else
+static inline bool blk_queue_staging(struct request_queue *q)
+{
+	return false;
+}
+
+static inline int blk_stage_init(struct request_queue *q)
+{
+	return 0;
+}
+
+static inline void blk_stage_sync(struct request_queue *q)
+{
+}
+
+static inline void blk_stage_exit(struct request_queue *q)
+{
+}
+
+static inline void __blk_stage_drain(struct request_queue *q)
+{
+}
+#endif
+
 void blk_insert_flush(struct request *rq);
 void blk_abort_flushes(struct request_queue *q);
 
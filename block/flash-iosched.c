@@ -0,0 +1,635 @@
+/*
+ *  Flash i/o scheduler.
+ *
+ *  A scheduler for devices without a seek penalty, eMMC in particular,
+ *  where the one thing that hurts is a read stuck behind a long run of
+ *  writes.  Requests are split into three classes: reads, sync writes and
+ *  async writes, each served in fifo order.  Reads always go first, but
+ *  every class has an expiry time and writes get a batch of their own
+ *  after writes_starved read batches, so nothing waits forever.  Async
+ *  writes are further limited to a quota per time window, and the quota
+ *  shrinks whenever reads complete slower than read_lat_target in a window
+ *  in which async writes were dispatched.  There is no idling.
+ *
+ *  See Documentation/block/flash-iosched.txt
+ */
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/elevator.h>
+#include <linux/bio.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/init.h>
+#include <linux/compiler.h>
+#include <linux/rbtree.h>
+#include <linux/timer.h>
+#include <linux/math64.h>
+#include <linux/workqueue.h>
+
+enum flash_class {
+	FLASH_READ,
+	FLASH_SYNC_WRITE,
+	FLASH_ASYNC_WRITE,
+	FLASH_NR_CLASSES,
+};
+
+static const int read_expire = HZ / 8;		/* reads are served first anyway */
+static const int sync_write_expire = HZ / 4;
+static const int async_write_expire = 2 * HZ;	/* these limits are SOFT! */
+static const int read_batch = 16;
+static const int write_batch = 8;
+static const int writes_starved = 4;	/* read batches before a write batch */
+static const int async_starved = 2;	/* sync write batches before an async one */
+static const int async_window = HZ / 10;
+static const int read_lat_target = 10000;	/* usecs */
+static const int async_quota_min = 2;
+static const int async_quota_max = 64;
+
+struct flash_data {
+	struct request_queue *queue;
+
+	/*
+	 * requests are present on both sort_list and fifo_list, the
+	 * sort_list is only used to find front merges
+	 */
+	struct rb_root sort_list[2];
+	struct list_head fifo_list[FLASH_NR_CLASSES];
+
+	/*
+	 * the batch being dispatched, and how far along it is
+	 */
+	int batch_class;
+	int batched;
+	bool batch_forced;		/* writes starved, don't yield to reads */
+	unsigned int read_batches;	/* read batches since the last write batch */
+	unsigned int sync_batches;	/* sync batches since the last async one */
+
+	/*
+	 * async write throttling, see flash_window_roll()
+	 */
+	unsigned long window_end;
+	int async_quota;
+	int async_dispatched;
+	bool window_throttled;
+	u64 window_read_lat;		/* sum of read latencies, ~usecs */
+	unsigned int window_reads;
+	struct timer_list window_timer;
+	struct work_struct unplug_work;
+
+	/*
+	 * statistics
+	 */
+	unsigned long dispatched[FLASH_NR_CLASSES];
+	unsigned long expired;		/* batches started by an expiry */
+	unsigned long starved;		/* write batches forced by writes_starved */
+	unsigned long throttled;	/* windows in which the quota ran out */
+	unsigned int read_lat_avg;	/* moving average, ~usecs */
+
+	/*
+	 * settings that change how the i/o scheduler behaves
+	 */
+	int fifo_expire[FLASH_NR_CLASSES];
+	int read_batch;
+	int write_batch;
+	int writes_starved;
+	int async_starved;
+	int async_window;
+	int read_lat_target;
+	int async_quota_min;
+	int async_quota_max;
+	int front_merges;
+};
+
+static inline int flash_class(struct request *rq)
+{
+	if (rq_data_dir(rq) == READ)
+		return FLASH_READ;
+	return rq_is_sync(rq) ? FLASH_SYNC_WRITE : FLASH_ASYNC_WRITE;
+}
+
+/*
+ * Request timestamps live in elevator_private[0] between activation and
+ * completion.  Nanoseconds shifted down by ten, roughly microseconds,
+ * truncated to 32 bits; only ever used for differences.
+ */
+static inline u32 flash_now(void)
+{
+	return (u32)(ktime_to_ns(ktime_get()) >> 10);
+}
+
+static inline struct rb_root *
+flash_rb_root(struct flash_data *fd, struct request *rq)
+{
+	return &fd->sort_list[rq_data_dir(rq)];
+}
+
+static void flash_add_request(struct request_queue *q, struct request *rq)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+	const int class = flash_class(rq);
+
+	elv_rb_add(flash_rb_root(fd, rq), rq);
+	rq_set_fifo_time(rq, jiffies + fd->fifo_expire[class]);
+	list_add_tail(&rq->queuelist, &fd->fifo_list[class]);
+}
+
+static void flash_remove_request(struct request_queue *q, struct request *rq)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+
+	rq_fifo_clear(rq);
+	elv_rb_del(flash_rb_root(fd, rq), rq);
+}
+
+static int
+flash_merge(struct request_queue *q, struct request **req, struct bio *bio)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+	struct request *__rq;
+
+	if (fd->front_merges) {
+		sector_t sector = bio->bi_sector + bio_sectors(bio);
+
+		__rq = elv_rb_find(&fd->sort_list[bio_data_dir(bio)], sector);
+		if (__rq) {
+			BUG_ON(sector != blk_rq_pos(__rq));
+
+			if (elv_rq_merge_ok(__rq, bio)) {
+				*req = __rq;
+				return ELEVATOR_FRONT_MERGE;
+			}
+		}
+	}
+
+	return ELEVATOR_NO_MERGE;
+}
+
+static void flash_merged_request(struct request_queue *q,
+				 struct request *req, int type)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+
+	/*
+	 * if the merge was a front merge, we need to reposition request
+	 */
+	if (type == ELEVATOR_FRONT_MERGE) {
+		elv_rb_del(flash_rb_root(fd, req), req);
+		elv_rb_add(flash_rb_root(fd, req), req);
+	}
+}
+
+static void
+flash_merged_requests(struct request_queue *q, struct request *req,
+		      struct request *next)
+{
+	/*
+	 * if next expires before rq, assign its expire time to rq
+	 * and move into next position (next will be deleted) in fifo
+	 */
+	if (!list_empty(&req->queuelist) && !list_empty(&next->queuelist) &&
+	    flash_class(req) == flash_class(next)) {
+		if (time_before(rq_fifo_time(next), rq_fifo_time(req))) {
+			list_move(&req->queuelist, &next->queuelist);
+			rq_set_fifo_time(req, rq_fifo_time(next));
+		}
+	}
+
+	flash_remove_request(q, next);
+}
+
+static int flash_allow_merge(struct request_queue *q, struct request *rq,
+			     struct bio *bio)
+{
+	/* keep sync writes out of the throttled async class and back */
+	if (bio_data_dir(bio) == WRITE &&
+	    !(bio->bi_rw & REQ_SYNC) != !rq_is_sync(rq))
+		return 0;
+	return 1;
+}
+
+static void flash_schedule_dispatch(struct flash_data *fd)
+{
+	kblockd_schedule_work(fd->queue, &fd->unplug_work);
+}
+
+static void flash_kick_queue(struct work_struct *work)
+{
+	struct flash_data *fd =
+		container_of(work, struct flash_data, unplug_work);
+	struct request_queue *q = fd->queue;
+
+	spin_lock_irq(q->queue_lock);
+	__blk_run_queue(q);
+	spin_unlock_irq(q->queue_lock);
+}
+
+static void flash_window_timer(unsigned long data)
+{
+	flash_schedule_dispatch((struct flash_data *)data);
+}
+
+/*
+ * Start a new throttling window once the old one is over.  If reads were
+ * slower than the target while async writes were going out, halve the
+ * async quota; if the quota was used up and reads were fine, grow it by
+ * a quarter.
+ */
+static void flash_window_roll(struct flash_data *fd)
+{
+	int quota = fd->async_quota;
+
+	if (time_before(jiffies, fd->window_end))
+		return;
+
+	if (fd->window_reads && fd->async_dispatched &&
+	    div_u64(fd->window_read_lat, fd->window_reads) >
+	    fd->read_lat_target)
+		quota /= 2;
+	else if (fd->async_dispatched >= quota)
+		quota += max(quota / 4, 1);
+
+	fd->async_quota = clamp(quota, fd->async_quota_min,
+				fd->async_quota_max);
+	fd->async_dispatched = 0;
+	fd->window_throttled = false;
+	fd->window_read_lat = 0;
+	fd->window_reads = 0;
+	fd->window_end = jiffies + fd->async_window;
+}
+
+static inline bool flash_async_allowed(struct flash_data *fd)
+{
+	return fd->async_dispatched < fd->async_quota;
+}
+
+static inline bool flash_expired(struct flash_data *fd, int class)
+{
+	struct request *rq;
+
+	if (list_empty(&fd->fifo_list[class]))
+		return false;
+	rq = rq_entry_fifo(fd->fifo_list[class].next);
+	return time_after(jiffies, rq_fifo_time(rq));
+}
+
+static void flash_start_batch(struct flash_data *fd, int class, bool forced)
+{
+	if (class == FLASH_READ) {
+		if (!list_empty(&fd->fifo_list[FLASH_SYNC_WRITE]) ||
+		    !list_empty(&fd->fifo_list[FLASH_ASYNC_WRITE]))
+			fd->read_batches++;
+	} else {
+		fd->read_batches = 0;
+		if (class == FLASH_SYNC_WRITE) {
+			if (!list_empty(&fd->fifo_list[FLASH_ASYNC_WRITE]))
+				fd->sync_batches++;
+		} else
+			fd->sync_batches = 0;
+	}
+	fd->batch_class = class;
+	fd->batched = 0;
+	fd->batch_forced = forced;
+}
+
+/*
+ * Pick the class to dispatch from next, or -1 if there is nothing that
+ * may go out right now.
+ */
+static int flash_select_class(struct flash_data *fd)
+{
+	const bool reads = !list_empty(&fd->fifo_list[FLASH_READ]);
+	const bool sync = !list_empty(&fd->fifo_list[FLASH_SYNC_WRITE]);
+	const bool async_queued = !list_empty(&fd->fifo_list[FLASH_ASYNC_WRITE]);
+	const bool async = async_queued && flash_async_allowed(fd);
+	int class = fd->batch_class;
+
+	/*
+	 * keep going with the current batch, but a write batch yields to
+	 * reads unless it was forced, and even then to expired reads
+	 */
+	if (class >= 0 && !list_empty(&fd->fifo_list[class])) {
+		int limit = class == FLASH_READ ? fd->read_batch :
+						  fd->write_batch;
+
+		if (fd->batched < limit &&
+		    (class == FLASH_READ || !reads ||
+		     (fd->batch_forced && !flash_expired(fd, FLASH_READ))) &&
+		    (class != FLASH_ASYNC_WRITE || async || fd->batch_forced))
+			return class;
+	}
+
+	/*
+	 * expired writes first, this is what bounds their latency
+	 */
+	if (flash_expired(fd, FLASH_SYNC_WRITE)) {
+		fd->expired++;
+		flash_start_batch(fd, FLASH_SYNC_WRITE, true);
+		return FLASH_SYNC_WRITE;
+	}
+	if (flash_expired(fd, FLASH_ASYNC_WRITE)) {
+		fd->expired++;
+		flash_start_batch(fd, FLASH_ASYNC_WRITE, true);
+		return FLASH_ASYNC_WRITE;
+	}
+
+	if (reads) {
+		if ((sync || async) && fd->read_batches >= fd->writes_starved) {
+			fd->starved++;
+			class = sync && (!async ||
+					 fd->sync_batches < fd->async_starved) ?
+				FLASH_SYNC_WRITE : FLASH_ASYNC_WRITE;
+			flash_start_batch(fd, class, true);
+			return class;
+		}
+		flash_start_batch(fd, FLASH_READ, false);
+		return FLASH_READ;
+	}
+
+	if (sync && (!async || fd->sync_batches < fd->async_starved)) {
+		flash_start_batch(fd, FLASH_SYNC_WRITE, false);
+		return FLASH_SYNC_WRITE;
+	}
+	if (async) {
+		flash_start_batch(fd, FLASH_ASYNC_WRITE, false);
+		return FLASH_ASYNC_WRITE;
+	}
+
+	/*
+	 * only throttled async writes are left, come back for them when
+	 * the window is over
+	 */
+	if (async_queued && !fd->window_throttled) {
+		fd->window_throttled = true;
+		fd->throttled++;
+		mod_timer(&fd->window_timer, fd->window_end);
+	}
+	return -1;
+}
+
+static void flash_dispatch_request(struct flash_data *fd, struct request *rq)
+{
+	const int class = flash_class(rq);
+
+	flash_remove_request(fd->queue, rq);
+	elv_dispatch_add_tail(fd->queue, rq);
+
+	fd->dispatched[class]++;
+	if (class == FLASH_ASYNC_WRITE)
+		fd->async_dispatched++;
+}
+
+static int flash_dispatch_requests(struct request_queue *q, int force)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+	struct request *rq;
+	int class, dispatched = 0;
+
+	if (unlikely(force)) {
+		for (class = 0; class < FLASH_NR_CLASSES; class++) {
+			while (!list_empty(&fd->fifo_list[class])) {
+				rq = rq_entry_fifo(fd->fifo_list[class].next);
+				flash_dispatch_request(fd, rq);
+				dispatched++;
+			}
+		}
+		fd->batch_class = -1;
+		return dispatched;
+	}
+
+	flash_window_roll(fd);
+
+	class = flash_select_class(fd);
+	if (class < 0)
+		return 0;
+
+	rq = rq_entry_fifo(fd->fifo_list[class].next);
+	flash_dispatch_request(fd, rq);
+	fd->batched++;
+
+	return 1;
+}
+
+static void flash_activate_request(struct request_queue *q, struct request *rq)
+{
+	rq->elevator_private[0] = (void *)(unsigned long)flash_now();
+}
+
+static void flash_completed_request(struct request_queue *q,
+				    struct request *rq)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+	u32 lat;
+
+	if (rq_data_dir(rq) != READ)
+		return;
+
+	lat = flash_now() - (u32)(unsigned long)rq->elevator_private[0];
+	fd->window_read_lat += lat;
+	fd->window_reads++;
+	/* 1/8 weight for the newest sample */
+	fd->read_lat_avg = fd->read_lat_avg - (fd->read_lat_avg >> 3) +
+			   (lat >> 3);
+}
+
+static void flash_exit_queue(struct elevator_queue *e)
+{
+	struct flash_data *fd = e->elevator_data;
+	int class;
+
+	del_timer_sync(&fd->window_timer);
+	cancel_work_sync(&fd->unplug_work);
+
+	for (class = 0; class < FLASH_NR_CLASSES; class++)
+		BUG_ON(!list_empty(&fd->fifo_list[class]));
+
+	kfree(fd);
+}
+
+/*
+ * initialize elevator private data (flash_data).
+ */
+static void *flash_init_queue(struct request_queue *q)
+{
+	struct flash_data *fd;
+	int class;
+
+	fd = kmalloc_node(sizeof(*fd), GFP_KERNEL | __GFP_ZERO, q->node);
+	if (!fd)
+		return NULL;
+
+	fd->queue = q;
+	for (class = 0; class < FLASH_NR_CLASSES; class++)
+		INIT_LIST_HEAD(&fd->fifo_list[class]);
+	fd->sort_list[READ] = RB_ROOT;
+	fd->sort_list[WRITE] = RB_ROOT;
+	fd->batch_class = -1;
+	setup_timer(&fd->window_timer, flash_window_timer, (unsigned long)fd);
+	INIT_WORK(&fd->unplug_work, flash_kick_queue);
+
+	fd->fifo_expire[FLASH_READ] = read_expire;
+	fd->fifo_expire[FLASH_SYNC_WRITE] = sync_write_expire;
+	fd->fifo_expire[FLASH_ASYNC_WRITE] = async_write_expire;
+	fd->read_batch = read_batch;
+	fd->write_batch = write_batch;
+	fd->writes_starved = writes_starved;
+	fd->async_starved = async_starved;
+	fd->async_window = async_window;
+	fd->read_lat_target = read_lat_target;
+	fd->async_quota_min = async_quota_min;
+	fd->async_quota_max = async_quota_max;
+	fd->async_quota = async_quota_max;
+	fd->front_merges = 1;
+	fd->window_end = jiffies + fd->async_window;
+	return fd;
+}
+
+/*
+ * sysfs parts below
+ */
+
+static ssize_t
+flash_var_show(int var, char *page)
+{
+	return sprintf(page, "%d\n", var);
+}
+
+static ssize_t
+flash_var_store(int *var, const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	*var = simple_strtol(p, &p, 10);
+	return count;
+}
+
+#define SHOW_FUNCTION(__FUNC, __VAR, __CONV)				\
+static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
+{									\
+	struct flash_data *fd = e->elevator_data;			\
+	int __data = __VAR;						\
+	if (__CONV)							\
+		__data = jiffies_to_msecs(__data);			\
+	return flash_var_show(__data, (page));				\
+}
+SHOW_FUNCTION(flash_read_expire_show, fd->fifo_expire[FLASH_READ], 1);
+SHOW_FUNCTION(flash_sync_write_expire_show, fd->fifo_expire[FLASH_SYNC_WRITE], 1);
+SHOW_FUNCTION(flash_async_write_expire_show, fd->fifo_expire[FLASH_ASYNC_WRITE], 1);
+SHOW_FUNCTION(flash_read_batch_show, fd->read_batch, 0);
+SHOW_FUNCTION(flash_write_batch_show, fd->write_batch, 0);
+SHOW_FUNCTION(flash_writes_starved_show, fd->writes_starved, 0);
+SHOW_FUNCTION(flash_async_starved_show, fd->async_starved, 0);
+SHOW_FUNCTION(flash_async_window_show, fd->async_window, 1);
+SHOW_FUNCTION(flash_read_lat_target_show, fd->read_lat_target, 0);
+SHOW_FUNCTION(flash_async_quota_min_show, fd->async_quota_min, 0);
+SHOW_FUNCTION(flash_async_quota_max_show, fd->async_quota_max, 0);
+SHOW_FUNCTION(flash_front_merges_show, fd->front_merges, 0);
+#undef SHOW_FUNCTION
+
+#define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
+static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)	\
+{									\
+	struct flash_data *fd = e->elevator_data;			\
+	int __data;							\
+	int ret = flash_var_store(&__data, (page), count);		\
+	if (__data < (MIN))						\
+		__data = (MIN);						\
+	else if (__data > (MAX))					\
+		__data = (MAX);						\
+	if (__CONV)							\
+		*(__PTR) = msecs_to_jiffies(__data);			\
+	else								\
+		*(__PTR) = __data;					\
+	return ret;							\
+}
+STORE_FUNCTION(flash_read_expire_store, &fd->fifo_expire[FLASH_READ], 0, INT_MAX, 1);
+STORE_FUNCTION(flash_sync_write_expire_store, &fd->fifo_expire[FLASH_SYNC_WRITE], 0, INT_MAX, 1);
+STORE_FUNCTION(flash_async_write_expire_store, &fd->fifo_expire[FLASH_ASYNC_WRITE], 0, INT_MAX, 1);
+STORE_FUNCTION(flash_read_batch_store, &fd->read_batch, 1, INT_MAX, 0);
+STORE_FUNCTION(flash_write_batch_store, &fd->write_batch, 1, INT_MAX, 0);
+STORE_FUNCTION(flash_writes_starved_store, &fd->writes_starved, 0, INT_MAX, 0);
+STORE_FUNCTION(flash_async_starved_store, &fd->async_starved, 0, INT_MAX, 0);
+STORE_FUNCTION(flash_async_window_store, &fd->async_window, 1, INT_MAX, 1);
+STORE_FUNCTION(flash_read_lat_target_store, &fd->read_lat_target, 0, INT_MAX, 0);
+STORE_FUNCTION(flash_async_quota_min_store, &fd->async_quota_min, 1, INT_MAX, 0);
+STORE_FUNCTION(flash_async_quota_max_store, &fd->async_quota_max, 1, INT_MAX, 0);
+STORE_FUNCTION(flash_front_merges_store, &fd->front_merges, 0, 1, 0);
+#undef STORE_FUNCTION
+
+static ssize_t flash_stats_show(struct elevator_queue *e, char *page)
+{
+	struct flash_data *fd = e->elevator_data;
+
+	return sprintf(page,
+		       "dispatched: %lu %lu %lu\n"
+		       "expired: %lu\n"
+		       "starved: %lu\n"
+		       "throttled: %lu\n"
+		       "async_quota: %d\n"
+		       "read_lat_avg: %u\n",
+		       fd->dispatched[FLASH_READ],
+		       fd->dispatched[FLASH_SYNC_WRITE],
+		       fd->dispatched[FLASH_ASYNC_WRITE],
+		       fd->expired, fd->starved, fd->throttled,
+		       fd->async_quota, fd->read_lat_avg);
+}
+
+#define FLASH_ATTR(name) \
+	__ATTR(name, S_IRUGO|S_IWUSR, flash_##name##_show, \
+				      flash_##name##_store)
+
+static struct elv_fs_entry flash_attrs[] = {
+	FLASH_ATTR(read_expire),
+	FLASH_ATTR(sync_write_expire),
+	FLASH_ATTR(async_write_expire),
+	FLASH_ATTR(read_batch),
+	FLASH_ATTR(write_batch),
+	FLASH_ATTR(writes_starved),
+	FLASH_ATTR(async_starved),
+	FLASH_ATTR(async_window),
+	FLASH_ATTR(read_lat_target),
+	FLASH_ATTR(async_quota_min),
+	FLASH_ATTR(async_quota_max),
+	FLASH_ATTR(front_merges),
+	__ATTR(stats, S_IRUGO, flash_stats_show, NULL),
+	__ATTR_NULL
+};
+
+static struct elevator_type iosched_flash = {
+	.ops = {
+		.elevator_merge_fn = 		flash_merge,
+		.elevator_merged_fn =		flash_merged_request,
+		.elevator_merge_req_fn =	flash_merged_requests,
+		.elevator_allow_merge_fn =	flash_allow_merge,
+		.elevator_dispatch_fn =		flash_dispatch_requests,
+		.elevator_add_req_fn =		flash_add_request,
+		.elevator_activate_req_fn =	flash_activate_request,
+		.elevator_completed_req_fn =	flash_completed_request,
+		.elevator_former_req_fn =	elv_rb_former_request,
+		.elevator_latter_req_fn =	elv_rb_latter_request,
+		.elevator_init_fn =		flash_init_queue,
+		.elevator_exit_fn =		flash_exit_queue,
+	},
+
+	.elevator_attrs = flash_attrs,
+	.elevator_name = "flash",
+	.elevator_owner = THIS_MODULE,
+};
+
+static int __init flash_init(void)
+{
+	elv_register(&iosched_flash);
+
+	return 0;
+}
+
+static void __exit flash_exit(void)
+{
+	elv_unregister(&iosched_flash);
+}
+
+module_init(flash_init);
+module_exit(flash_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Read-prioritizing IO scheduler for flash storage");
@@ -256,6 +256,10 @@ int __init cpu_dev_init(void)
 	if (!err)
 		err = sched_create_sysfs_power_savings_entries(&cpu_sysdev_class);
 #endif
+#ifdef CONFIG_SMP
+	if (!err)
+		err = sched_create_sysfs_packing_entries(&cpu_sysdev_class);
+#endif
 
 	return err;
 }
@@ -0,0 +1,567 @@
+/*
+ * Null block device driver.
+ *
+ * A request based block device that does no I/O at all: every request
+ * is completed right away, from the softirq, or after a fixed service
+ * time with only a few requests in flight at once, which is roughly how
+ * an eMMC card behaves.  Since the device itself costs nothing, whatever
+ * limits its throughput is the block layer above it.
+ *
+ * The driver can also run a small fio-like job on its own disk when it is
+ * loaded: one kernel thread per job, each keeping iodepth bios in flight
+ * and reporting IOPS, bandwidth and completion latency.  The disk stays
+ * around afterwards for use with fio or dd from user space.
+ *
+ * See Documentation/block/null_blk.txt.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/fs.h>
+#include <linux/hrtimer.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+#include <linux/math64.h>
+
+#define NULL_IRQ_NONE		0
+#define NULL_IRQ_SOFTIRQ	1
+#define NULL_IRQ_TIMER		2
+
+static int size_mb = 1024;
+module_param(size_mb, int, 0444);
+MODULE_PARM_DESC(size_mb, "Size of the device in MB");
+
+static int bs = 512;
+module_param(bs, int, 0444);
+MODULE_PARM_DESC(bs, "Logical block size");
+
+static int irqmode = NULL_IRQ_SOFTIRQ;
+module_param(irqmode, int, 0444);
+MODULE_PARM_DESC(irqmode, "Completion: 0-inline, 1-softirq, 2-timer");
+
+static unsigned long completion_nsec = 100000;
+module_param(completion_nsec, ulong, 0444);
+MODULE_PARM_DESC(completion_nsec, "Service time of one request in timer mode");
+
+static int hw_queue_depth = 2;
+module_param(hw_queue_depth, int, 0444);
+MODULE_PARM_DESC(hw_queue_depth, "Requests the device works on at once in timer mode");
+
+static int stage_batch = 16;
+module_param(stage_batch, int, 0444);
+MODULE_PARM_DESC(stage_batch, "Per-cpu request staging batch, 0 disables");
+
+static int bench_runtime;
+module_param(bench_runtime, int, 0444);
+MODULE_PARM_DESC(bench_runtime, "Seconds to run the built-in job for, 0 skips it");
+
+static char *bench_rw = "randread";
+module_param(bench_rw, charp, 0444);
+MODULE_PARM_DESC(bench_rw, "Job type: read, write, randread or randwrite");
+
+static int bench_bs = 4096;
+module_param(bench_bs, int, 0444);
+MODULE_PARM_DESC(bench_bs, "Job block size in bytes");
+
+static int bench_iodepth = 4;
+module_param(bench_iodepth, int, 0444);
+MODULE_PARM_DESC(bench_iodepth, "Bios each job keeps in flight");
+
+static int bench_jobs;
+module_param(bench_jobs, int, 0444);
+MODULE_PARM_DESC(bench_jobs, "Number of jobs, one per online cpu if 0");
+
+static bool bench_plug;
+module_param(bench_plug, bool, 0444);
+MODULE_PARM_DESC(bench_plug, "Submit each round of bios under a plug");
+
+struct nullb {
+	struct request_queue	*q;
+	struct gendisk		*disk;
+
+	/* timer mode: requests being "serviced", oldest first */
+	struct list_head	inflight;
+	unsigned int		nr_inflight;
+	struct hrtimer		timer;
+	bool			in_timer;
+};
+
+static struct nullb *nullb;
+static int null_major;
+
+static void null_start_rq(struct nullb *nullb, struct request *rq)
+{
+	switch (irqmode) {
+	case NULL_IRQ_NONE:
+		__blk_end_request_all(rq, 0);
+		break;
+	case NULL_IRQ_SOFTIRQ:
+		blk_complete_request(rq);
+		break;
+	case NULL_IRQ_TIMER:
+		list_add_tail(&rq->queuelist, &nullb->inflight);
+		/* the timer callback re-arms itself while work is left */
+		if (!nullb->nr_inflight++ && !nullb->in_timer)
+			hrtimer_start(&nullb->timer, ns_to_ktime(completion_nsec),
+				      HRTIMER_MODE_REL);
+		break;
+	}
+}
+
+static void null_request_fn(struct request_queue *q)
+{
+	struct nullb *nullb = q->queuedata;
+	struct request *rq;
+
+	while (irqmode != NULL_IRQ_TIMER ||
+	       nullb->nr_inflight < hw_queue_depth) {
+		rq = blk_fetch_request(q);
+		if (!rq)
+			break;
+		null_start_rq(nullb, rq);
+	}
+}
+
+static void null_softirq_done_fn(struct request *rq)
+{
+	blk_end_request_all(rq, 0);
+}
+
+static enum hrtimer_restart null_timer_fn(struct hrtimer *timer)
+{
+	struct nullb *nullb = container_of(timer, struct nullb, timer);
+	struct request_queue *q = nullb->q;
+	enum hrtimer_restart ret = HRTIMER_NORESTART;
+	struct request *rq;
+	unsigned long flags;
+
+	spin_lock_irqsave(q->queue_lock, flags);
+	rq = list_first_entry(&nullb->inflight, struct request, queuelist);
+	list_del_init(&rq->queuelist);
+	nullb->nr_inflight--;
+	__blk_end_request_all(rq, 0);
+
+	nullb->in_timer = true;
+	__blk_run_queue(q);
+	nullb->in_timer = false;
+
+	if (nullb->nr_inflight) {
+		hrtimer_forward_now(timer, ns_to_ktime(completion_nsec));
+		ret = HRTIMER_RESTART;
+	}
+	spin_unlock_irqrestore(q->queue_lock, flags);
+
+	return ret;
+}
+
+static const struct block_device_operations null_fops = {
+	.owner		= THIS_MODULE,
+};
+
+/*
+ * The built-in job.
+ */
+struct null_bench_io {
+	struct list_head	list;
+	struct null_bench_job	*job;
+	struct page		**pages;
+	int			nr_pages;
+	u64			start;
+};
+
+struct null_bench_job {
+	struct task_struct	*task;
+	struct block_device	*bdev;
+	struct null_bench_io	*ios;
+
+	spinlock_t		lock;
+	struct list_head	done;
+	int			inflight;
+	wait_queue_head_t	wait;
+
+	sector_t		first;
+	u32			nr_blocks, next;
+	struct rnd_state	rnd;
+
+	u64			nr_ios, lat_sum, lat_max;
+	int			errors;
+};
+
+static bool bench_write, bench_random;
+static atomic_t bench_running;
+static DECLARE_COMPLETION(bench_done);
+
+static void null_bench_end_io(struct bio *bio, int err)
+{
+	struct null_bench_io *io = bio->bi_private;
+	struct null_bench_job *job = io->job;
+	u64 lat = ktime_to_ns(ktime_get()) - io->start;
+	unsigned long flags;
+
+	bio_put(bio);
+
+	/* the job may be gone as soon as the lock is dropped */
+	spin_lock_irqsave(&job->lock, flags);
+	if (err)
+		job->errors++;
+	job->nr_ios++;
+	job->lat_sum += lat;
+	if (lat > job->lat_max)
+		job->lat_max = lat;
+	list_add_tail(&io->list, &job->done);
+	job->inflight--;
+	wake_up(&job->wait);
+	spin_unlock_irqrestore(&job->lock, flags);
+}
+
+static bool null_bench_idle(struct null_bench_job *job)
+{
+	bool idle;
+
+	spin_lock_irq(&job->lock);
+	idle = !job->inflight;
+	spin_unlock_irq(&job->lock);
+
+	return idle;
+}
+
+static sector_t null_bench_sector(struct null_bench_job *job)
+{
+	u32 block;
+
+	if (bench_random) {
+		block = prandom32(&job->rnd) % job->nr_blocks;
+	} else {
+		block = job->next++;
+		if (job->next == job->nr_blocks)
+			job->next = 0;
+	}
+	return job->first + (sector_t)block * (bench_bs >> 9);
+}
+
+static int null_bench_submit(struct null_bench_job *job,
+			     struct null_bench_io *io)
+{
+	struct bio *bio;
+	int i, n, len = bench_bs;
+
+	bio = bio_alloc(GFP_NOIO, io->nr_pages);
+	bio->bi_bdev = job->bdev;
+	bio->bi_sector = null_bench_sector(job);
+	bio->bi_end_io = null_bench_end_io;
+	bio->bi_private = io;
+	for (i = 0; i < io->nr_pages; i++) {
+		n = min_t(int, len, PAGE_SIZE);
+		/* a short bio would be measured as a full one */
+		if (bio_add_page(bio, io->pages[i], n, 0) != n) {
+			bio_put(bio);
+			return -EIO;
+		}
+		len -= n;
+	}
+
+	spin_lock_irq(&job->lock);
+	job->inflight++;
+	spin_unlock_irq(&job->lock);
+	io->start = ktime_to_ns(ktime_get());
+	submit_bio(bench_write ? WRITE : READ, bio);
+	return 0;
+}
+
+static int null_bench_thread(void *data)
+{
+	struct null_bench_job *job = data;
+	unsigned long end = jiffies + bench_runtime * HZ;
+	struct null_bench_io *io, *tmp;
+	struct blk_plug plug;
+	LIST_HEAD(list);
+	int ret = 0;
+
+	/* the ios start out on ->done without having been accounted */
+	list_splice_init(&job->done, &list);
+
+	while (time_before(jiffies, end) && !kthread_should_stop()) {
+		if (bench_plug)
+			blk_start_plug(&plug);
+		list_for_each_entry_safe(io, tmp, &list, list) {
+			list_del(&io->list);
+			ret = null_bench_submit(job, io);
+			if (ret)
+				break;
+		}
+		if (bench_plug)
+			blk_finish_plug(&plug);
+		if (ret) {
+			/* the job ends, the ios that were left are freed */
+			spin_lock_irq(&job->lock);
+			job->errors++;
+			spin_unlock_irq(&job->lock);
+			break;
+		}
+
+		wait_event(job->wait, !list_empty(&job->done));
+		spin_lock_irq(&job->lock);
+		list_splice_init(&job->done, &list);
+		spin_unlock_irq(&job->lock);
+	}
+	wait_event(job->wait, null_bench_idle(job));
+
+	if (atomic_dec_and_test(&bench_running))
+		complete(&bench_done);
+	return 0;
+}
+
+static void null_bench_free_ios(struct null_bench_job *job)
+{
+	int i, j;
+
+	if (!job->ios)
+		return;
+	for (i = 0; i < bench_iodepth; i++) {
+		struct null_bench_io *io = &job->ios[i];
+
+		if (!io->pages)
+			continue;
+		for (j = 0; j < io->nr_pages; j++)
+			if (io->pages[j])
+				__free_page(io->pages[j]);
+		kfree(io->pages);
+	}
+	kfree(job->ios);
+}
+
+static int null_bench_alloc_ios(struct null_bench_job *job)
+{
+	int nr_pages = DIV_ROUND_UP(bench_bs, PAGE_SIZE);
+	int i, j;
+
+	job->ios = kcalloc(bench_iodepth, sizeof(*job->ios), GFP_KERNEL);
+	if (!job->ios)
+		return -ENOMEM;
+
+	for (i = 0; i < bench_iodepth; i++) {
+		struct null_bench_io *io = &job->ios[i];
+
+		io->job = job;
+		io->nr_pages = nr_pages;
+		io->pages = kcalloc(nr_pages, sizeof(*io->pages), GFP_KERNEL);
+		if (!io->pages)
+			return -ENOMEM;
+		for (j = 0; j < nr_pages; j++) {
+			io->pages[j] = alloc_page(GFP_KERNEL);
+			if (!io->pages[j])
+				return -ENOMEM;
+		}
+		list_add_tail(&io->list, &job->done);
+	}
+	return 0;
+}
+
+static void null_bench_report(const char *name, u64 nr_ios, u64 lat_sum,
+			      u64 lat_max, u64 elapsed_ns)
+{
+	u64 iops = div64_u64(nr_ios * NSEC_PER_SEC, elapsed_ns);
+	u64 kbps = div_u64(iops * bench_bs, 1024);
+	u64 lat_avg = nr_ios ? div64_u64(lat_sum, nr_ios) : 0;
+
+	printk(KERN_INFO "null_blk: %s: %llu IOPS, %llu KB/s, lat avg "
+	       "%llu usec max %llu usec\n", name, (unsigned long long)iops,
+	       (unsigned long long)kbps,
+	       (unsigned long long)div_u64(lat_avg, NSEC_PER_USEC),
+	       (unsigned long long)div_u64(lat_max, NSEC_PER_USEC));
+}
+
+static int null_bench_run(struct nullb *nullb)
+{
+	struct null_bench_job *jobs;
+	struct block_device *bdev;
+	u64 per_job;
+	u64 start, elapsed, nr_ios = 0, lat_sum = 0, lat_max = 0;
+	int i, cpu, nr_jobs, errors = 0, ret;
+	char name[16];
+
+	if (!strcmp(bench_rw, "read") || !strcmp(bench_rw, "randread"))
+		bench_write = false;
+	else if (!strcmp(bench_rw, "write") || !strcmp(bench_rw, "randwrite"))
+		bench_write = true;
+	else
+		return -EINVAL;
+	bench_random = !strncmp(bench_rw, "rand", 4);
+
+	/* every io is a single bio, so it has to fit the queue limits */
+	if (bench_bs < bs || bench_bs % bs ||
+	    bench_bs > queue_max_hw_sectors(nullb->q) << 9 ||
+	    bench_iodepth < 1)
+		return -EINVAL;
+
+	nr_jobs = bench_jobs ? bench_jobs : num_online_cpus();
+	per_job = div_u64(get_capacity(nullb->disk), bench_bs >> 9);
+	per_job = min_t(u64, div_u64(per_job, nr_jobs), UINT_MAX);
+	if (!per_job)
+		return -EINVAL;
+
+	bdev = bdget_disk(nullb->disk, 0);
+	if (!bdev)
+		return -ENOMEM;
+	ret = blkdev_get(bdev, bench_write ? FMODE_WRITE : FMODE_READ, NULL);
+	if (ret)
+		return ret;
+
+	jobs = kcalloc(nr_jobs, sizeof(*jobs), GFP_KERNEL);
+	if (!jobs) {
+		ret = -ENOMEM;
+		goto out_put;
+	}
+
+	cpu = cpumask_first(cpu_online_mask);
+	for (i = 0; i < nr_jobs; i++) {
+		struct null_bench_job *job = &jobs[i];
+
+		job->bdev = bdev;
+		spin_lock_init(&job->lock);
+		INIT_LIST_HEAD(&job->done);
+		init_waitqueue_head(&job->wait);
+		job->first = (sector_t)i * per_job * (bench_bs >> 9);
+		job->nr_blocks = per_job;
+		prandom32_seed(&job->rnd, i + 1);
+
+		ret = null_bench_alloc_ios(job);
+		if (ret)
+			goto out_free;
+
+		job->task = kthread_create(null_bench_thread, job,
+					   "null_bench/%d", i);
+		if (IS_ERR(job->task)) {
+			ret = PTR_ERR(job->task);
+			job->task = NULL;
+			goto out_free;
+		}
+		kthread_bind(job->task, cpu);
+		cpu = cpumask_next(cpu, cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpu_online_mask);
+	}
+
+	atomic_set(&bench_running, nr_jobs);
+	start = ktime_to_ns(ktime_get());
+	for (i = 0; i < nr_jobs; i++)
+		wake_up_process(jobs[i].task);
+	wait_for_completion(&bench_done);
+	elapsed = ktime_to_ns(ktime_get()) - start;
+
+	printk(KERN_INFO "null_blk: %s bs=%d iodepth=%d jobs=%d%s "
+	       "irqmode=%d stage_batch=%d\n", bench_rw, bench_bs,
+	       bench_iodepth, nr_jobs, bench_plug ? " plug" : "", irqmode,
+	       stage_batch);
+	for (i = 0; i < nr_jobs; i++) {
+		snprintf(name, sizeof(name), "job%d", i);
+		null_bench_report(name, jobs[i].nr_ios, jobs[i].lat_sum,
+				  jobs[i].lat_max, elapsed);
+		nr_ios += jobs[i].nr_ios;
+		lat_sum += jobs[i].lat_sum;
+		lat_max = max(lat_max, jobs[i].lat_max);
+		errors += jobs[i].errors;
+	}
+	null_bench_report("all", nr_ios, lat_sum, lat_max, elapsed);
+	if (errors)
+		printk(KERN_WARNING "null_blk: %d I/O errors\n", errors);
+	ret = 0;
+
+out_free:
+	for (i = 0; i < nr_jobs; i++) {
+		/* only reached with threads that were never woken */
+		if (ret && jobs[i].task)
+			kthread_stop(jobs[i].task);
+		null_bench_free_ios(&jobs[i]);
+	}
+	kfree(jobs);
+out_put:
+	blkdev_put(bdev, bench_write ? FMODE_WRITE : FMODE_READ);
+	return ret;
+}
+
+static int __init null_init(void)
+{
+	int ret = -ENOMEM;
+
+	if (bs < 512 || bs > PAGE_SIZE || !is_power_of_2(bs))
+		return -EINVAL;
+	if (irqmode < NULL_IRQ_NONE || irqmode > NULL_IRQ_TIMER ||
+	    hw_queue_depth < 1 || stage_batch < 0)
+		return -EINVAL;
+
+	null_major = register_blkdev(0, "nullb");
+	if (null_major < 0)
+		return null_major;
+
+	nullb = kzalloc(sizeof(*nullb), GFP_KERNEL);
+	if (!nullb)
+		goto out_unregister;
+	INIT_LIST_HEAD(&nullb->inflight);
+	hrtimer_init(&nullb->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	nullb->timer.function = null_timer_fn;
+
+	nullb->q = blk_init_queue(null_request_fn, NULL);
+	if (!nullb->q)
+		goto out_free;
+	nullb->q->queuedata = nullb;
+	blk_queue_logical_block_size(nullb->q, bs);
+	blk_queue_physical_block_size(nullb->q, bs);
+	blk_queue_softirq_done(nullb->q, null_softirq_done_fn);
+	blk_queue_stage_batch(nullb->q, stage_batch);
+	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, nullb->q);
+
+	nullb->disk = alloc_disk(1);
+	if (!nullb->disk)
+		goto out_cleanup;
+	nullb->disk->major = null_major;
+	nullb->disk->first_minor = 0;
+	nullb->disk->fops = &null_fops;
+	nullb->disk->private_data = nullb;
+	nullb->disk->queue = nullb->q;
+	strcpy(nullb->disk->disk_name, "nullb0");
+	set_capacity(nullb->disk, (sector_t)size_mb << (20 - 9));
+	add_disk(nullb->disk);
+
+	if (bench_runtime > 0) {
+		ret = null_bench_run(nullb);
+		if (ret)
+			printk(KERN_ERR "null_blk: job failed to run: %d\n", ret);
+	}
+
+	return 0;
+
+out_cleanup:
+	blk_cleanup_queue(nullb->q);
+out_free:
+	kfree(nullb);
+out_unregister:
+	unregister_blkdev(null_major, "nullb");
+	return ret;
+}
+
+static void __exit null_exit(void)
+{
+	del_gendisk(nullb->disk);
+	/* the timer completes requests, it must not run into a dead queue */
+	hrtimer_cancel(&nullb->timer);
+	blk_cleanup_queue(nullb->q);
+	put_disk(nullb->disk);
+	kfree(nullb);
+	unregister_blkdev(null_major, "nullb");
+}
+
+module_init(null_init);
+module_exit(null_exit);
+
+MODULE_DESCRIPTION("Null block device and block layer benchmark");
+MODULE_LICENSE("GPL");
@@ -1470,7 +1470,9 @@ static int ft5x0x_ts_probe(struct i2c_client *client, const struct i2c_device_id
 
 	INIT_WORK(&ft5x0x_ts->pen_event_work, ft5x0x_ts_pen_irq_work);
 
-	ft5x0x_ts->ts_workqueue = create_singlethread_workqueue(dev_name(&client->dev));
+	/* touch reports are latency critical, process them on RT workers */
+	ft5x0x_ts->ts_workqueue = alloc_ordered_workqueue(dev_name(&client->dev),
+						WQ_MEM_RECLAIM | WQ_HIGHPRI_RT);
 	if (!ft5x0x_ts->ts_workqueue) {
 		err = -ESRCH;
 		ctp_debug_info("==create_singlethread_workqueue failed=\n");
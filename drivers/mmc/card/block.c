@@ -32,6 +32,7 @@
 #include <linux/scatterlist.h>
 #include <linux/string_helpers.h>
 #include <linux/delay.h>
+#include <linux/ktime.h>
 #include <linux/capability.h>
 #include <linux/compat.h>
 
@@ -115,6 +116,8 @@ struct mmc_blk_data {
 	 */
 	unsigned int	part_curr;
 	struct device_attribute force_ro;
+	struct device_attribute packed_window;
+	struct device_attribute packed_stats;
 };
 
 static DEFINE_MUTEX(open_lock);
@@ -207,6 +210,82 @@ out:
 	return ret;
 }
 
+static ssize_t packed_window_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	int ret;
+	struct mmc_blk_data *md = mmc_blk_get(dev_to_disk(dev));
+
+	ret = snprintf(buf, PAGE_SIZE, "%u\n", md->queue.packed_window_us);
+	mmc_blk_put(md);
+	return ret;
+}
+
+static ssize_t packed_window_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	int ret;
+	char *end;
+	struct mmc_blk_data *md = mmc_blk_get(dev_to_disk(dev));
+	unsigned long usecs = simple_strtoul(buf, &end, 0);
+	if (end == buf || usecs > USEC_PER_SEC) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	md->queue.packed_window_us = usecs;
+	ret = count;
+out:
+	mmc_blk_put(md);
+	return ret;
+}
+
+static const char *mmc_packed_stop_names[MMC_PACKED_STOP_NR] = {
+	[MMC_PACKED_STOP_EMPTY]		= "empty",
+	[MMC_PACKED_STOP_WINDOW]	= "window",
+	[MMC_PACKED_STOP_MAX_REQS]	= "max_reqs",
+	[MMC_PACKED_STOP_MAX_BLKS]	= "max_blocks",
+	[MMC_PACKED_STOP_MAX_SEGS]	= "max_segs",
+	[MMC_PACKED_STOP_DIR]		= "direction",
+	[MMC_PACKED_STOP_REL_WR]	= "rel_wr",
+	[MMC_PACKED_STOP_DISCARD_FLUSH]	= "discard_flush",
+};
+
+static ssize_t packed_stats_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct mmc_blk_data *md = mmc_blk_get(dev_to_disk(dev));
+	struct mmc_packed_stats *st = &md->queue.packed_stats;
+	static const char *dir[2] = { "read", "write" };
+	int i, j, n = 0;
+
+	for (i = 0; i < 2; i++)
+		n += snprintf(buf + n, PAGE_SIZE - n,
+			      "%s_packs %lu\n%s_packed_reqs %lu\n",
+			      dir[i], st->packs[i], dir[i], st->reqs[i]);
+
+	/* requests per pack: 1 2 3-4 5-8 9-16 17-32 33-64 */
+	for (i = 0; i < 2; i++) {
+		n += snprintf(buf + n, PAGE_SIZE - n, "%s_hist", dir[i]);
+		for (j = 0; j < MMC_PACKED_HIST_BUCKETS; j++)
+			n += snprintf(buf + n, PAGE_SIZE - n, " %lu",
+				      st->hist[i][j]);
+		n += snprintf(buf + n, PAGE_SIZE - n, "\n");
+	}
+
+	for (i = 0; i < MMC_PACKED_STOP_NR; i++)
+		n += snprintf(buf + n, PAGE_SIZE - n, "stop_%s %lu\n",
+			      mmc_packed_stop_names[i], st->stop[i]);
+
+	n += snprintf(buf + n, PAGE_SIZE - n,
+		      "window_waits %lu\nwindow_reqs %lu\n",
+		      st->window_waits, st->window_reqs);
+
+	mmc_blk_put(md);
+	return n;
+}
+
 static int mmc_blk_open(struct block_device *bdev, fmode_t mode)
 {
 	struct mmc_blk_data *md = mmc_blk_get(bdev->bd_disk);
@@ -1178,6 +1257,58 @@ static void mmc_blk_rw_rq_prep(struct mmc_queue_req *mqrq,
 	mmc_queue_bounce_pre(mqrq);
 }
 
+/*
+ * Writes up to this size are held back for the coalescing window, larger
+ * ones are not worth delaying.
+ */
+#define MMC_BLK_PACKED_SMALL	64	/* sectors */
+#define MMC_BLK_PACKED_POLL_US	50
+
+static bool mmc_blk_host_busy(struct mmc_card *card)
+{
+	struct mmc_async_req *areq = card->host->areq;
+
+	return areq && !completion_done(&areq->mrq->completion);
+}
+
+/*
+ * Called when the queue ran dry while packing small writes.  As long as
+ * the previous request is still on the bus the pack could not be issued
+ * anyway, so give the writers a little longer to add to it.  New requests
+ * don't wake us up here, mmc_request() only does that for an idle queue
+ * thread, so poll for them.
+ */
+static bool mmc_blk_packed_wait(struct mmc_queue *mq, ktime_t *end)
+{
+	ktime_t now = ktime_get();
+
+	if (!mq->packed_window_us || !mmc_blk_host_busy(mq->card))
+		return false;
+
+	if (!end->tv64) {
+		*end = ktime_add_us(now, mq->packed_window_us);
+		mq->packed_stats.window_waits++;
+	} else if (now.tv64 >= end->tv64)
+		return false;
+
+	usleep_range(MMC_BLK_PACKED_POLL_US, 2 * MMC_BLK_PACKED_POLL_US);
+	return true;
+}
+
+static void mmc_blk_packed_account(struct mmc_queue *mq, int rw, u8 reqs,
+				   enum mmc_packed_stop stop)
+{
+	struct mmc_packed_stats *st = &mq->packed_stats;
+	int bucket = min(fls(reqs - 1), MMC_PACKED_HIST_BUCKETS - 1);
+
+	if (reqs > 1) {
+		st->packs[rw]++;
+		st->reqs[rw] += reqs;
+	}
+	st->hist[rw][bucket]++;
+	st->stop[stop]++;
+}
+
 static u8 mmc_blk_prep_packed_list(struct mmc_queue *mq, struct request *req)
 {
 	struct request_queue *q = mq->queue;
@@ -1187,6 +1318,8 @@ static u8 mmc_blk_prep_packed_list(struct mmc_queue *mq, struct request *req)
 	bool en_rel_wr = card->ext_csd.rel_param & EXT_CSD_WR_REL_PARAM_EN;
 	unsigned int req_sectors = 0, phys_segments = 0;
 	unsigned int max_blk_count, max_phys_segs;
+	enum mmc_packed_stop stop = MMC_PACKED_STOP_MAX_REQS;
+	ktime_t window_end = ktime_set(0, 0);
 	u8 put_back = 0;
 	u8 max_packed_rw = 0;
 	u8 reqs = 0;
@@ -1231,16 +1364,25 @@ static u8 mmc_blk_prep_packed_list(struct mmc_queue *mq, struct request *req)
 		spin_lock_irq(q->queue_lock);
 		next = blk_fetch_request(q);
 		spin_unlock_irq(q->queue_lock);
-		if (!next)
+		if (!next) {
+			if (rq_data_dir(cur) == WRITE &&
+			    blk_rq_sectors(cur) <= MMC_BLK_PACKED_SMALL &&
+			    mmc_blk_packed_wait(mq, &window_end))
+				continue;
+			stop = window_end.tv64 ? MMC_PACKED_STOP_WINDOW :
+				MMC_PACKED_STOP_EMPTY;
 			break;
+		}
 
 		if (next->cmd_flags & REQ_DISCARD ||
 				next->cmd_flags & REQ_FLUSH) {
+			stop = MMC_PACKED_STOP_DISCARD_FLUSH;
 			put_back = 1;
 			break;
 		}
 
 		if (rq_data_dir(cur) != rq_data_dir(next)) {
+			stop = MMC_PACKED_STOP_DIR;
 			put_back = 1;
 			break;
 		}
@@ -1248,22 +1390,27 @@ static u8 mmc_blk_prep_packed_list(struct mmc_queue *mq, struct request *req)
 		if (mmc_req_rel_wr(next) &&
 				(md->flags & MMC_BLK_REL_WR) &&
 				!en_rel_wr) {
+			stop = MMC_PACKED_STOP_REL_WR;
 			put_back = 1;
 			break;
 		}
 
 		req_sectors += blk_rq_sectors(next);
 		if (req_sectors > max_blk_count) {
+			stop = MMC_PACKED_STOP_MAX_BLKS;
 			put_back = 1;
 			break;
 		}
 
 		phys_segments +=  next->nr_phys_segments;
 		if (phys_segments > max_phys_segs) {
+			stop = MMC_PACKED_STOP_MAX_SEGS;
 			put_back = 1;
 			break;
 		}
 
+		if (window_end.tv64)
+			mq->packed_stats.window_reqs++;
 		list_add_tail(&next->queuelist, &mq->mqrq_cur->packed_list);
 		cur = next;
 		reqs++;
@@ -1275,6 +1422,8 @@ static u8 mmc_blk_prep_packed_list(struct mmc_queue *mq, struct request *req)
 		spin_unlock_irq(q->queue_lock);
 	}
 
+	mmc_blk_packed_account(mq, rq_data_dir(req), reqs + 1, stop);
+
 	if (reqs > 0) {
 		list_add(&req->queuelist, &mq->mqrq_cur->packed_list);
 		mq->mqrq_cur->packed_num = ++reqs;
@@ -1961,6 +2110,10 @@ static void mmc_blk_remove_req(struct mmc_blk_data *md)
 	if (md) {
 		if (md->disk->flags & GENHD_FL_UP) {
 			device_remove_file(disk_to_dev(md->disk), &md->force_ro);
+			device_remove_file(disk_to_dev(md->disk),
+					   &md->packed_window);
+			device_remove_file(disk_to_dev(md->disk),
+					   &md->packed_stats);
 
 			/* Stop new requests from getting into the queue */
 			del_gendisk(md->disk);
@@ -1998,8 +2151,33 @@ static int mmc_add_disk(struct mmc_blk_data *md)
 	md->force_ro.attr.mode = S_IRUGO | S_IWUSR;
 	ret = device_create_file(disk_to_dev(md->disk), &md->force_ro);
 	if (ret)
-		del_gendisk(md->disk);
+		goto force_ro_fail;
+
+	md->packed_window.show = packed_window_show;
+	md->packed_window.store = packed_window_store;
+	sysfs_attr_init(&md->packed_window.attr);
+	md->packed_window.attr.name = "packed_window_us";
+	md->packed_window.attr.mode = S_IRUGO | S_IWUSR;
+	ret = device_create_file(disk_to_dev(md->disk), &md->packed_window);
+	if (ret)
+		goto packed_window_fail;
+
+	md->packed_stats.show = packed_stats_show;
+	sysfs_attr_init(&md->packed_stats.attr);
+	md->packed_stats.attr.name = "packed_stats";
+	md->packed_stats.attr.mode = S_IRUGO;
+	ret = device_create_file(disk_to_dev(md->disk), &md->packed_stats);
+	if (ret)
+		goto packed_stats_fail;
+
+	return 0;
 
+packed_stats_fail:
+	device_remove_file(disk_to_dev(md->disk), &md->packed_window);
+packed_window_fail:
+	device_remove_file(disk_to_dev(md->disk), &md->force_ro);
+force_ro_fail:
+	del_gendisk(md->disk);
 	return ret;
 }
 
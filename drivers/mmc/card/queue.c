@@ -22,6 +22,18 @@
 
 #define MMC_QUEUE_BOUNCESZ	65536
 
+/*
+ * The card works on at most two requests at a time, the rest can wait
+ * on the submitting cpus and reach the elevator in batches.
+ */
+#define MMC_QUEUE_STAGE_BATCH	16
+
+/*
+ * How long a small write may wait for more writes to pack with it while
+ * the previous request is still on the bus.
+ */
+#define MMC_QUEUE_PACKED_WINDOW_US	500
+
 #define MMC_QUEUE_SUSPENDED	(1 << 0)
 
 /*
@@ -177,8 +189,10 @@ int mmc_init_queue(struct mmc_queue *mq, struct mmc_card *card,
 	mq->mqrq_cur = mqrq_cur;
 	mq->mqrq_prev = mqrq_prev;
 	mq->queue->queuedata = mq;
+	mq->packed_window_us = MMC_QUEUE_PACKED_WINDOW_US;
 
 	blk_queue_prep_rq(mq->queue, mmc_prep_request);
+	blk_queue_stage_batch(mq->queue, MMC_QUEUE_STAGE_BATCH);
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, mq->queue);
 	if (mmc_can_erase(card))
 		mmc_queue_setup_discard(mq->queue, card);
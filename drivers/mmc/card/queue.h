@@ -35,6 +35,31 @@ struct mmc_queue_req {
 	u8		packed_num;
 };
 
+/* Why mmc_blk_prep_packed_list() stopped adding requests to a pack */
+enum mmc_packed_stop {
+	MMC_PACKED_STOP_EMPTY = 0,	/* nothing more queued */
+	MMC_PACKED_STOP_WINDOW,		/* coalescing window ran out */
+	MMC_PACKED_STOP_MAX_REQS,	/* card's max_packed_reads/writes */
+	MMC_PACKED_STOP_MAX_BLKS,	/* host's max_blk_count */
+	MMC_PACKED_STOP_MAX_SEGS,	/* queue's max_segments */
+	MMC_PACKED_STOP_DIR,		/* next request goes the other way */
+	MMC_PACKED_STOP_REL_WR,		/* reliable write the card can't pack */
+	MMC_PACKED_STOP_DISCARD_FLUSH,	/* next request is a discard or flush */
+	MMC_PACKED_STOP_NR,
+};
+
+/* Requests per pack, power of two buckets: 1, 2, 3-4, ... 33-64 */
+#define MMC_PACKED_HIST_BUCKETS	7
+
+struct mmc_packed_stats {
+	unsigned long		packs[2];	/* READ, WRITE */
+	unsigned long		reqs[2];
+	unsigned long		hist[2][MMC_PACKED_HIST_BUCKETS];
+	unsigned long		stop[MMC_PACKED_STOP_NR];
+	unsigned long		window_waits;	/* times the window was used */
+	unsigned long		window_reqs;	/* requests it picked up */
+};
+
 struct mmc_queue {
 	struct mmc_card		*card;
 	struct task_struct	*thread;
@@ -46,6 +71,8 @@ struct mmc_queue {
 	struct mmc_queue_req	mqrq[2];
 	struct mmc_queue_req	*mqrq_cur;
 	struct mmc_queue_req	*mqrq_prev;
+	unsigned int		packed_window_us;
+	struct mmc_packed_stats	packed_stats;
 };
 
 extern int mmc_init_queue(struct mmc_queue *, struct mmc_card *, spinlock_t *,
@@ -473,6 +473,8 @@ static int __devinit mshci_s3c_probe(struct platform_device *pdev)
 	else
 		host->mmc->caps = 0;
 
+	host->mmc->caps2 = pdata->host_caps2;
+
 	if (pdata->cd_type == S3C_MSHCI_CD_PERMANENT) {
 		host->quirks |= MSHCI_QUIRK_BROKEN_PRESENT_BIT;
 		host->mmc->caps |= MMC_CAP_NONREMOVABLE;
@@ -450,61 +450,94 @@ static void mshci_set_mdma_desc(u8 *desc_vir, u8 *desc_phy,
 					sizeof(struct mshci_idmac);
 }
 
-static int mshci_mdma_table_pre(struct mshci_host *host,
-	struct mmc_data *data)
+static enum dma_data_direction mshci_dma_dir(struct mmc_data *data)
 {
-	int direction;
-
-	u8 *desc_vir, *desc_phy;
-	dma_addr_t addr;
-	int len;
-
-	struct scatterlist *sg;
-	int i;
-	u32 des_flag;
-	u32 size_idmac = sizeof(struct mshci_idmac);
-
 	if (data->flags & MMC_DATA_READ)
-		direction = DMA_FROM_DEVICE;
+		return DMA_FROM_DEVICE;
 	else
-		direction = DMA_TO_DEVICE;
+		return DMA_TO_DEVICE;
+}
+
+static int mshci_map_sg(struct mshci_host *host, struct mmc_data *data)
+{
+	int direction = mshci_dma_dir(data);
 
 	if (host->ops->dma_map_sg && data->blocks >= 2048) {
 		/* if transfer size is bigger than 1MiB */
-		host->sg_count = host->ops->dma_map_sg(host,
+		return host->ops->dma_map_sg(host,
 			mmc_dev(host->mmc),
 			data->sg, data->sg_len, direction, 2);
 	} else if (host->ops->dma_map_sg && data->blocks >= 128) {
 		/* if transfer size is bigger than 64KiB */
-		host->sg_count = host->ops->dma_map_sg(host,
+		return host->ops->dma_map_sg(host,
 			mmc_dev(host->mmc),
 			data->sg, data->sg_len, direction, 1);
 	} else if (host->ops->dma_map_sg) {
-		host->sg_count = host->ops->dma_map_sg(host,
+		return host->ops->dma_map_sg(host,
 			mmc_dev(host->mmc),
 			data->sg, data->sg_len, direction, 0);
 	} else {
-		host->sg_count = dma_map_sg(mmc_dev(host->mmc),
+		return dma_map_sg(mmc_dev(host->mmc),
 			data->sg, data->sg_len, direction);
 	}
+}
 
-	if (host->sg_count == 0)
+static void mshci_unmap_sg(struct mshci_host *host, struct mmc_data *data)
+{
+	int direction = mshci_dma_dir(data);
+
+	if (host->ops->dma_unmap_sg && data->blocks >= 2048) {
+		/* if transfer size is bigger than 1MiB */
+		host->ops->dma_unmap_sg(host, mmc_dev(host->mmc),
+			data->sg, data->sg_len, direction, 2);
+	} else if (host->ops->dma_unmap_sg && data->blocks >= 128) {
+		/* if transfer size is bigger than 64KiB */
+		host->ops->dma_unmap_sg(host, mmc_dev(host->mmc),
+			data->sg, data->sg_len, direction, 1);
+	} else if (host->ops->dma_unmap_sg) {
+		/* if transfer size is lower than 64KiB */
+		host->ops->dma_unmap_sg(host, mmc_dev(host->mmc),
+			data->sg, data->sg_len, direction, 0);
+	} else {
+		dma_unmap_sg(mmc_dev(host->mmc),
+			data->sg, data->sg_len, direction);
+	}
+}
+
+/*
+ * Maps the data and builds its descriptor chain in one of the tables,
+ * see MSHCI_IDMA_TABLES.
+ */
+static int mshci_mdma_table_pre(struct mshci_host *host,
+	struct mmc_data *data, int table)
+{
+	u8 *desc_vir, *desc_phy;
+	dma_addr_t addr, *table_addr = &host->idma_table_addr[table];
+	int len;
+
+	struct scatterlist *sg;
+	int i, sg_count;
+	u32 des_flag;
+	u32 size_idmac = sizeof(struct mshci_idmac);
+
+	sg_count = mshci_map_sg(host, data);
+	if (sg_count == 0)
 		goto fail;
 
-	desc_vir = host->idma_desc;
+	desc_vir = host->idma_tables[table];
 
 	/* to know phy address */
-	host->idma_addr = dma_map_single(mmc_dev(host->mmc),
-				host->idma_desc,
+	*table_addr = dma_map_single(mmc_dev(host->mmc),
+				host->idma_tables[table],
 				MSHCI_MAX_DMA_LIST * size_idmac,
 				DMA_TO_DEVICE);
-	if (dma_mapping_error(mmc_dev(host->mmc), host->idma_addr))
+	if (dma_mapping_error(mmc_dev(host->mmc), *table_addr))
 		goto unmap_entries;
-	BUG_ON(host->idma_addr & 0x3);
+	BUG_ON(*table_addr & 0x3);
 
-	desc_phy = (u8 *)host->idma_addr;
+	desc_phy = (u8 *)*table_addr;
 
-	for_each_sg(data->sg, sg, host->sg_count, i) {
+	for_each_sg(data->sg, sg, sg_count, i) {
 		addr = sg_dma_address(sg);
 		len = sg_dma_len(sg);
 
@@ -520,8 +553,8 @@ static int mshci_mdma_table_pre(struct mshci_host *host,
 		 * If this triggers then we have a calculation bug
 		 * somewhere. :/
 		 */
-		WARN_ON((desc_vir - host->idma_desc) > MSHCI_MAX_DMA_LIST * \
-				size_idmac);
+		WARN_ON((desc_vir - host->idma_tables[table]) >
+				MSHCI_MAX_DMA_LIST * size_idmac);
 	}
 
 	/*
@@ -530,66 +563,54 @@ static int mshci_mdma_table_pre(struct mshci_host *host,
 	((struct mshci_idmac *)(desc_vir-size_idmac))->des0 |= MSHCI_IDMAC_LD;
 
 	/* it has to dma map again to resync vir data to phy data  */
-	host->idma_addr = dma_map_single(mmc_dev(host->mmc),
-				host->idma_desc,
+	*table_addr = dma_map_single(mmc_dev(host->mmc),
+				host->idma_tables[table],
 				MSHCI_MAX_DMA_LIST * size_idmac,
 				DMA_TO_DEVICE);
-	if (dma_mapping_error(mmc_dev(host->mmc), host->idma_addr))
+	if (dma_mapping_error(mmc_dev(host->mmc), *table_addr))
 		goto unmap_entries;
-	BUG_ON(host->idma_addr & 0x3);
+	BUG_ON(*table_addr & 0x3);
 
+	host->sg_count = sg_count;
 	return 0;
 
 unmap_entries:
-	if (host->ops->dma_unmap_sg && data->blocks >= 2048) {
-		/* if transfer size is bigger than 1MiB */
-		host->ops->dma_unmap_sg(host, mmc_dev(host->mmc),
-			data->sg, data->sg_len, direction, 2);
-	} else if (host->ops->dma_unmap_sg && data->blocks >= 128) {
-		/* if transfer size is bigger than 64KiB */
-		host->ops->dma_unmap_sg(host, mmc_dev(host->mmc),
-			data->sg, data->sg_len, direction, 1);
-	} else if (host->ops->dma_unmap_sg) {
-		/* if transfer size is lower than 64KiB */
-		host->ops->dma_unmap_sg(host, mmc_dev(host->mmc),
-			data->sg, data->sg_len, direction, 0);
-	} else {
-		dma_unmap_sg(mmc_dev(host->mmc),
-			data->sg, data->sg_len, direction);
-	}
+	mshci_unmap_sg(host, data);
 fail:
 	return -EINVAL;
 }
 
 static void mshci_idma_table_post(struct mshci_host *host,
-	struct mmc_data *data)
+	struct mmc_data *data, dma_addr_t table_addr)
 {
-	int direction;
+	dma_unmap_single(mmc_dev(host->mmc), table_addr,
+		MSHCI_MAX_DMA_LIST*sizeof(struct mshci_idmac), DMA_TO_DEVICE);
 
-	if (data->flags & MMC_DATA_READ)
-		direction = DMA_FROM_DEVICE;
-	else
-		direction = DMA_TO_DEVICE;
+	mshci_unmap_sg(host, data);
+}
 
-	dma_unmap_single(mmc_dev(host->mmc), host->idma_addr,
-		MSHCI_MAX_DMA_LIST*sizeof(struct mshci_idmac), DMA_TO_DEVICE);
+/*
+ * mshc's IDMAC can't transfer data that is not aligned or has length not
+ * divided by 4 byte.
+ */
+static bool mshci_dma_aligned(struct mmc_data *data)
+{
+	struct scatterlist *sg;
+	int i;
 
-	if (host->ops->dma_unmap_sg && data->blocks >= 2048) {
-		/* if transfer size is bigger than 1MiB */
-		host->ops->dma_unmap_sg(host, mmc_dev(host->mmc),
-			data->sg, data->sg_len, direction, 2);
-	} else if (host->ops->dma_unmap_sg && data->blocks >= 128) {
-		/* if transfer size is bigger than 64KiB */
-		host->ops->dma_unmap_sg(host, mmc_dev(host->mmc),
-			data->sg, data->sg_len, direction, 1);
-	} else if (host->ops->dma_unmap_sg) {
-		/* if transfer size is lower than 64KiB */
-		host->ops->dma_unmap_sg(host, mmc_dev(host->mmc),
-			data->sg, data->sg_len, direction, 0);
-	} else {
-		dma_unmap_sg(mmc_dev(host->mmc),
-			data->sg, data->sg_len, direction);
+	for_each_sg(data->sg, sg, data->sg_len, i) {
+		if (sg->length & 0x3) {
+			DBG("Reverting to PIO because of "
+				"transfer size (%d)\n",
+				sg->length);
+			return false;
+		} else if (sg->offset & 0x3) {
+			DBG("Reverting to PIO because of "
+				"bad alignment\n");
+			return false;
+		}
 	}
+	return true;
 }
 
 static u32 mshci_calc_timeout(struct mshci_host *host, struct mmc_data *data)
@@ -611,7 +632,7 @@ static void mshci_set_transfer_irqs(struct mshci_host *host)
 static void mshci_prepare_data(struct mshci_host *host, struct mmc_data *data)
 {
 	u32 count;
-	u32 ret;
+	int ret, table;
 
 	WARN_ON(host->data);
 
@@ -638,30 +659,18 @@ static void mshci_prepare_data(struct mshci_host *host, struct mmc_data *data)
 	 * FIXME: This doesn't account for merging when mapping the
 	 * scatterlist.
 	 */
-	if (host->flags & MSHCI_REQ_USE_DMA) {
-		/* mshc's IDMAC can't transfer data that is not aligned
-		 * or has length not divided by 4 byte. */
-		int i;
-		struct scatterlist *sg;
-
-			for_each_sg(data->sg, sg, data->sg_len, i) {
-				if (sg->length & 0x3) {
-					DBG("Reverting to PIO because of "
-						"transfer size (%d)\n",
-						sg->length);
-					host->flags &= ~MSHCI_REQ_USE_DMA;
-					break;
-			} else if (sg->offset & 0x3) {
-				DBG("Reverting to PIO because of "
-					"bad alignment\n");
-				host->flags &= ~MSHCI_REQ_USE_DMA;
-				break;
-			}
-		}
-	}
+	if ((host->flags & MSHCI_REQ_USE_DMA) && !mshci_dma_aligned(data))
+		host->flags &= ~MSHCI_REQ_USE_DMA;
 
 	if (host->flags & MSHCI_REQ_USE_DMA) {
-		ret = mshci_mdma_table_pre(host, data);
+		/* mapped and built by mshci_pre_req() */
+		if (data->host_cookie) {
+			table = data->host_cookie - 1;
+			ret = 0;
+		} else {
+			table = MSHCI_IDMA_TABLE_SYNC;
+			ret = mshci_mdma_table_pre(host, data, table);
+		}
 		if (ret) {
 			/*
 			 * This only happens when someone fed
@@ -670,6 +679,7 @@ static void mshci_prepare_data(struct mshci_host *host, struct mmc_data *data)
 			WARN_ON(1);
 			host->flags &= ~MSHCI_REQ_USE_DMA;
 		} else {
+			host->idma_addr = host->idma_table_addr[table];
 			mshci_writel(host, host->idma_addr,
 				MSHCI_DBADDR);
 		}
@@ -738,7 +748,9 @@ static void mshci_finish_data(struct mshci_host *host)
 	host->data = NULL;
 
 	if (host->flags & MSHCI_REQ_USE_DMA) {
-		mshci_idma_table_post(host, data);
+		/* mshci_post_req() unmaps what mshci_pre_req() mapped */
+		if (!data->host_cookie)
+			mshci_idma_table_post(host, data, host->idma_addr);
 		/* disable IDMAC and DMA interrupt */
 		mshci_writel(host, (mshci_readl(host, MSHCI_CTRL) &
 				~(DMA_ENABLE|ENABLE_IDMAC)), MSHCI_CTRL);
@@ -1176,8 +1188,50 @@ out:
 	spin_unlock_irqrestore(&host->lock, flags);
 }
 
+/*
+ * Map the next request and build its descriptors while the current one is
+ * still on the bus, so that starting it is down to a few register writes.
+ */
+static void mshci_pre_req(struct mmc_host *mmc, struct mmc_request *mrq,
+			  bool is_first_req)
+{
+	struct mshci_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+	int table;
+
+	if (!data)
+		return;
+
+	data->host_cookie = 0;
+	if (!(host->flags & MSHCI_USE_IDMA) || !mshci_dma_aligned(data))
+		return;
+
+	table = host->idma_next;
+	if (mshci_mdma_table_pre(host, data, table))
+		return;
+
+	host->idma_next ^= 1;
+	data->host_cookie = table + 1;
+}
+
+static void mshci_post_req(struct mmc_host *mmc, struct mmc_request *mrq,
+			   int err)
+{
+	struct mshci_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+
+	if (!data || !data->host_cookie)
+		return;
+
+	mshci_idma_table_post(host, data,
+		host->idma_table_addr[data->host_cookie - 1]);
+	data->host_cookie = 0;
+}
+
 static struct mmc_host_ops mshci_ops = {
 	.request	= mshci_request,
+	.pre_req	= mshci_pre_req,
+	.post_req	= mshci_post_req,
 	.set_ios	= mshci_set_ios,
 	.get_ro		= mshci_get_ro,
 	.enable_sdio_irq = mshci_enable_sdio_irq,
@@ -1683,7 +1737,8 @@ int mshci_add_host(struct mshci_host *host)
 	if (host->flags & MSHCI_USE_IDMA) {
 		/* We need to allocate descriptors for all sg entries
 		 * MSHCI_MAX_DMA_LIST transfer for each of those entries. */
-		host->idma_desc = kmalloc(MSHCI_MAX_DMA_LIST * \
+		host->idma_desc = kmalloc(MSHCI_IDMA_TABLES * \
+					MSHCI_MAX_DMA_LIST * \
 					sizeof(struct mshci_idmac), GFP_KERNEL);
 		if (!host->idma_desc) {
 			kfree(host->idma_desc);
@@ -1691,6 +1746,12 @@ int mshci_add_host(struct mshci_host *host)
 				"buffers. Falling back to standard DMA.\n",
 				mmc_hostname(mmc));
 			host->flags &= ~MSHCI_USE_IDMA;
+		} else {
+			for (count = 0; count < MSHCI_IDMA_TABLES; count++)
+				host->idma_tables[count] = host->idma_desc +
+					count * MSHCI_MAX_DMA_LIST *
+					sizeof(struct mshci_idmac);
+			host->idma_next = 0;
 		}
 	}
 
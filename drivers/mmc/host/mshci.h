@@ -384,12 +384,23 @@ struct mshci_host {
 
 	int			sg_count;	/* Mapped sg entries */
 
-	u8			*idma_desc;	/* ADMA descriptor table */
+	u8			*idma_desc;	/* ADMA descriptor tables */
 	u8			*align_buffer;	/* Bounce buffer */
 
 	dma_addr_t		idma_addr;	/* Mapped ADMA descr. table */
 	dma_addr_t		align_addr;	/* Mapped bounce buffer */
 
+	/*
+	 * pre_req() alternates between the first two descriptor tables, so
+	 * the next request is built while the current one is on the bus.
+	 * Requests that come without pre_req() use the last one.
+	 */
+#define MSHCI_IDMA_TABLES	3
+#define MSHCI_IDMA_TABLE_SYNC	(MSHCI_IDMA_TABLES - 1)
+	u8			*idma_tables[MSHCI_IDMA_TABLES];
+	dma_addr_t		idma_table_addr[MSHCI_IDMA_TABLES];
+	int			idma_next;	/* table for next pre_req() */
+
 	struct tasklet_struct	card_tasklet;	/* Tasklet structures */
 	struct tasklet_struct	finish_tasklet;
 
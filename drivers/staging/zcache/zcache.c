@@ -1206,6 +1206,7 @@ out:
 static struct shrinker zcache_shrinker = {
 	.shrink = shrink_zcache_memory,
 	.seeks = DEFAULT_SEEKS,
+	.flags = SHRINKER_ASYNC,
 };
 
 /*
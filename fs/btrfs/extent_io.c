@@ -2998,6 +2998,9 @@ static inline struct page *extent_buffer_page(struct extent_buffer *eb,
 	p = radix_tree_lookup(&mapping->page_tree, i);
 	rcu_read_unlock();
 
+	/* A shadow entry of an evicted page is no page */
+	if (radix_tree_exceptional_entry(p))
+		return NULL;
 	return p;
 }
 
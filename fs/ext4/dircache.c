@@ -0,0 +1,618 @@
+/*
+ *  linux/fs/ext4/dircache.c
+ *
+ * In-memory name index of large directories
+ *
+ * Looking a name up in a directory without htree reads its blocks until
+ * the name turns up, and all of them when it does not, which is what
+ * every create has to find out first.  With htree, dx_probe still walks
+ * the index blocks for each lookup.  Once a directory has
+ * EXT4_DC_MIN_BLOCKS blocks, its first lookup reads it all and builds a
+ * hash table of the names in it, which maps the hash of each name to the
+ * logical block holding it.  Lookups then only search the block the table
+ * points at, and a name the table does not have is known not to exist
+ * without reading anything.  For directories without htree the largest
+ * free space of each block is kept as well, so that a new entry goes
+ * straight to a block where it fits.
+ *
+ * Every change to the entries of the directory updates the table, so
+ * that it stays exact; when that fails (no memory to grow it) the table
+ * is dropped and the directory searched on disk again.  All of it is
+ * serialized by the i_mutex of the directory, which the VFS holds for
+ * lookups as well as for changes.  Only "." and "..", which may be looked
+ * up without it, are never looked up in the table.
+ *
+ * Tables are only built by lookups made outside of a transaction, as
+ * reading a large directory with a handle open would hold up the commit;
+ * ext4_find_entry() under a handle searches on disk until some plain
+ * lookup has built the table.  Tables are flex arrays of single pages,
+ * so that neither building nor growing one needs vmalloc under GFP_NOFS.
+ * Directories with more names than a flex array holds are searched on
+ * disk.
+ *
+ * The tables are on an LRU list, from which the shrinker frees those
+ * not used since it last looked at them, if it can lock their directory.
+ */
+
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/flex_array.h>
+#include <linux/hash.h>
+#include <linux/dcache.h>
+#include <linux/buffer_head.h>
+#include "ext4.h"
+#include "ext4_jbd2.h"
+
+/* Smaller directories are searched about as fast without a table */
+#define EXT4_DC_MIN_BLOCKS	4
+/* Blocks read at once while building a table */
+#define EXT4_DC_RA_SIZE		16
+#define EXT4_DC_MIN_BITS	6
+/* Marks a free slot of the table, and unknown space in dc_room */
+#define EXT4_DC_FREE		(~0U)
+#define EXT4_DC_ROOM_UNKNOWN	0xffff
+/* Most slots a table and blocks dc_room can have */
+#define EXT4_DC_MAX_SLOTS	(FLEX_ARRAY_NR_BASE_PTRS * \
+		FLEX_ARRAY_ELEMENTS_PER_PART(sizeof(struct ext4_dc_entry)))
+#define EXT4_DC_MAX_ROOM	(FLEX_ARRAY_NR_BASE_PTRS * \
+				 FLEX_ARRAY_ELEMENTS_PER_PART(sizeof(u16)))
+
+struct ext4_dc_entry {
+	u32		hash;
+	ext4_lblk_t	block;		/* EXT4_DC_FREE if the slot is free */
+};
+
+struct ext4_dir_cache {
+	struct list_head	dc_lru;
+	struct inode		*dc_inode;
+	unsigned int		dc_bits;	/* log2 of the slots in dc_table */
+	unsigned int		dc_count;	/* names in dc_table */
+	unsigned int		dc_nr_room;	/* blocks in dc_room */
+	int			dc_referenced;	/* used since the shrinker ran */
+	struct flex_array	*dc_table;	/* of struct ext4_dc_entry */
+	struct flex_array	*dc_room;	/* largest free space per block */
+};
+
+static LIST_HEAD(ext4_dc_lru);
+static DEFINE_SPINLOCK(ext4_dc_lock);
+static unsigned int ext4_dc_nr_caches;
+static unsigned long ext4_dc_nr_slots;	/* in all tables */
+
+static inline struct ext4_dc_entry *ext4_dc_slot(struct flex_array *table,
+						 u32 i)
+{
+	return flex_array_get(table, i);
+}
+
+static inline u16 *ext4_dc_room_of(struct ext4_dir_cache *dc,
+				   ext4_lblk_t block)
+{
+	return flex_array_get(dc->dc_room, block);
+}
+
+/* A table of 1 << bits free slots, all of them allocated */
+static struct flex_array *ext4_dc_alloc_table(unsigned int bits)
+{
+	struct flex_array *table;
+	u32 i;
+
+	table = flex_array_alloc(sizeof(struct ext4_dc_entry), 1U << bits,
+				 GFP_NOFS | __GFP_NOWARN);
+	if (!table)
+		return NULL;
+	if (flex_array_prealloc(table, 0, 1U << bits,
+				GFP_NOFS | __GFP_NOWARN)) {
+		flex_array_free(table);
+		return NULL;
+	}
+	for (i = 0; i < (1U << bits); i++)
+		ext4_dc_slot(table, i)->block = EXT4_DC_FREE;
+	return table;
+}
+
+/* Make dc_room cover blocks 0..nr-1, the new ones of unknown space */
+static int ext4_dc_grow_room(struct ext4_dir_cache *dc, ext4_lblk_t nr)
+{
+	ext4_lblk_t block;
+
+	if (nr <= dc->dc_nr_room)
+		return 0;
+	if (nr > EXT4_DC_MAX_ROOM)
+		return -EFBIG;
+	if (flex_array_prealloc(dc->dc_room, dc->dc_nr_room,
+				nr - dc->dc_nr_room, GFP_NOFS | __GFP_NOWARN))
+		return -ENOMEM;
+	for (block = dc->dc_nr_room; block < nr; block++)
+		*ext4_dc_room_of(dc, block) = EXT4_DC_ROOM_UNKNOWN;
+	dc->dc_nr_room = nr;
+	return 0;
+}
+
+static void ext4_dc_destroy(struct ext4_dir_cache *dc)
+{
+	if (dc->dc_table) {
+		spin_lock(&ext4_dc_lock);
+		ext4_dc_nr_slots -= 1UL << dc->dc_bits;
+		spin_unlock(&ext4_dc_lock);
+		flex_array_free(dc->dc_table);
+	}
+	if (dc->dc_room)
+		flex_array_free(dc->dc_room);
+	kfree(dc);
+}
+
+static inline u32 ext4_dc_hash(const char *name, int len)
+{
+	return full_name_hash((const unsigned char *) name, len);
+}
+
+static void __ext4_dc_insert(struct flex_array *table, unsigned int bits,
+			     u32 hash, ext4_lblk_t block)
+{
+	u32 mask = (1U << bits) - 1;
+	u32 i = hash_32(hash, bits);
+	struct ext4_dc_entry *e;
+
+	while ((e = ext4_dc_slot(table, i))->block != EXT4_DC_FREE)
+		i = (i + 1) & mask;
+	e->hash = hash;
+	e->block = block;
+}
+
+static int ext4_dc_resize(struct ext4_dir_cache *dc, unsigned int bits)
+{
+	struct flex_array *table;
+	struct ext4_dc_entry *e;
+	unsigned int i;
+
+	if ((1UL << bits) > EXT4_DC_MAX_SLOTS)
+		return -EFBIG;
+	table = ext4_dc_alloc_table(bits);
+	if (!table)
+		return -ENOMEM;
+	if (dc->dc_table) {
+		for (i = 0; i < (1U << dc->dc_bits); i++) {
+			e = ext4_dc_slot(dc->dc_table, i);
+			if (e->block != EXT4_DC_FREE)
+				__ext4_dc_insert(table, bits, e->hash,
+						 e->block);
+		}
+		flex_array_free(dc->dc_table);
+	}
+	spin_lock(&ext4_dc_lock);
+	if (dc->dc_table)
+		ext4_dc_nr_slots -= 1UL << dc->dc_bits;
+	ext4_dc_nr_slots += 1UL << bits;
+	spin_unlock(&ext4_dc_lock);
+	dc->dc_table = table;
+	dc->dc_bits = bits;
+	return 0;
+}
+
+static int ext4_dc_insert(struct ext4_dir_cache *dc, u32 hash,
+			  ext4_lblk_t block)
+{
+	int err;
+
+	/* Keep the table at most 3/4 full */
+	if ((dc->dc_count + 1) * 4 > (3U << dc->dc_bits)) {
+		err = ext4_dc_resize(dc, dc->dc_bits + 1);
+		if (err)
+			return err;
+	}
+	__ext4_dc_insert(dc->dc_table, dc->dc_bits, hash, block);
+	dc->dc_count++;
+	return 0;
+}
+
+/* Free slot i, moving back the entries after it that probed past it */
+static void ext4_dc_remove(struct ext4_dir_cache *dc, u32 i)
+{
+	struct flex_array *table = dc->dc_table;
+	u32 mask = (1U << dc->dc_bits) - 1;
+	u32 j = i, home;
+	struct ext4_dc_entry *e;
+
+	for (;;) {
+		j = (j + 1) & mask;
+		e = ext4_dc_slot(table, j);
+		if (e->block == EXT4_DC_FREE)
+			break;
+		home = hash_32(e->hash, dc->dc_bits);
+		/* it stays if its home slot is cyclically in (i, j] */
+		if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+			continue;
+		*ext4_dc_slot(table, i) = *e;
+		i = j;
+	}
+	ext4_dc_slot(table, i)->block = EXT4_DC_FREE;
+	dc->dc_count--;
+}
+
+/*
+ * The largest entry add_dirent_to_buf() could place in the block.  It
+ * is only used to skip blocks, so a damaged block just reports none.
+ */
+static unsigned int ext4_dc_block_room(struct inode *dir,
+				       struct buffer_head *bh)
+{
+	unsigned int blocksize = dir->i_sb->s_blocksize;
+	char *p = bh->b_data, *end = bh->b_data + blocksize;
+	struct ext4_dir_entry_2 *de;
+	unsigned int rlen, nlen, room = 0;
+
+	while (p < end) {
+		de = (struct ext4_dir_entry_2 *) p;
+		rlen = ext4_rec_len_from_disk(de->rec_len, blocksize);
+		if (rlen < EXT4_DIR_REC_LEN(1) || rlen > end - p)
+			return 0;
+		nlen = de->inode ? EXT4_DIR_REC_LEN(de->name_len) : 0;
+		if (rlen > nlen && rlen - nlen > room)
+			room = rlen - nlen;
+		p += rlen;
+	}
+	return min(room, (unsigned int) EXT4_DC_ROOM_UNKNOWN - 1);
+}
+
+static int ext4_dc_set_room(struct ext4_dir_cache *dc, ext4_lblk_t block,
+			    struct inode *dir, struct buffer_head *bh)
+{
+	int err;
+
+	if (!dc->dc_room)
+		return 0;
+	err = ext4_dc_grow_room(dc, block + 1);
+	if (err)
+		return err;
+	*ext4_dc_room_of(dc, block) = ext4_dc_block_room(dir, bh);
+	return 0;
+}
+
+static int ext4_dc_scan_block(struct ext4_dir_cache *dc, struct inode *dir,
+			      struct buffer_head *bh, ext4_lblk_t block)
+{
+	unsigned int blocksize = dir->i_sb->s_blocksize;
+	unsigned int offset = 0;
+	struct ext4_dir_entry_2 *de;
+	int err;
+
+	while (offset < blocksize) {
+		de = (struct ext4_dir_entry_2 *) (bh->b_data + offset);
+		if (ext4_check_dir_entry(dir, NULL, de, bh,
+			(block << EXT4_BLOCK_SIZE_BITS(dir->i_sb)) + offset))
+			return -EIO;
+		if (de->inode) {
+			err = ext4_dc_insert(dc, ext4_dc_hash(de->name,
+							      de->name_len),
+					     block);
+			if (err)
+				return err;
+		}
+		offset += ext4_rec_len_from_disk(de->rec_len, blocksize);
+	}
+	return ext4_dc_set_room(dc, block, dir, bh);
+}
+
+/*
+ * Read the whole directory into a new table.  The index blocks of an
+ * htree directory look like blocks with one empty entry, so the same
+ * scan works for those.
+ */
+static struct ext4_dir_cache *ext4_dc_build(struct inode *dir,
+					    ext4_lblk_t nblocks, int *err)
+{
+	struct super_block *sb = dir->i_sb;
+	struct buffer_head *bhs[EXT4_DC_RA_SIZE];
+	struct ext4_dir_cache *dc;
+	ext4_lblk_t block;
+	unsigned int bits = EXT4_DC_MIN_BITS;
+	int i, nr;
+
+	dc = kzalloc(sizeof(*dc), GFP_NOFS);
+	if (!dc) {
+		*err = -ENOMEM;
+		return NULL;
+	}
+	dc->dc_inode = dir;
+	/* Guess at 64 bytes per entry, the table grows if needed */
+	while ((1ULL << bits) * 3 / 4 <
+	       ((u64) nblocks << (EXT4_BLOCK_SIZE_BITS(sb) - 6)))
+		bits++;
+	*err = ext4_dc_resize(dc, bits);
+	if (*err)
+		goto out;
+	if (!is_dx(dir)) {
+		dc->dc_room = flex_array_alloc(sizeof(u16), EXT4_DC_MAX_ROOM,
+					       GFP_NOFS);
+		if (!dc->dc_room) {
+			*err = -ENOMEM;
+			goto out;
+		}
+		*err = ext4_dc_grow_room(dc, nblocks);
+		if (*err)
+			goto out;
+	}
+
+	for (block = 0; block < nblocks; block += nr) {
+		nr = min_t(ext4_lblk_t, EXT4_DC_RA_SIZE, nblocks - block);
+		for (i = 0; i < nr; i++) {
+			bhs[i] = ext4_getblk(NULL, dir, block + i, 0, err);
+			if (bhs[i])
+				ll_rw_block(READ_META, 1, &bhs[i]);
+		}
+		for (i = 0; i < nr; i++) {
+			if (!bhs[i]) {
+				/* a hole, let the full search deal with it */
+				if (!*err)
+					*err = -EIO;
+				continue;
+			}
+			if (!*err) {
+				wait_on_buffer(bhs[i]);
+				if (buffer_uptodate(bhs[i]))
+					*err = ext4_dc_scan_block(dc, dir,
+							bhs[i], block + i);
+				else
+					*err = -EIO;
+			}
+			brelse(bhs[i]);
+		}
+		if (*err)
+			goto out;
+	}
+	return dc;
+out:
+	ext4_dc_destroy(dc);
+	return NULL;
+}
+
+/*
+ * Fill blocks with the logical blocks that may hold the name.  Returns
+ * how many there are, 0 if the name does not exist, or -1 if the
+ * directory has to be searched on disk: it is small, or has no table
+ * and one could not be built (or not now, under a handle), or the name
+ * has too many candidates.
+ */
+int ext4_dc_candidates(struct inode *dir, const struct qstr *d_name,
+		       ext4_lblk_t *blocks, int max)
+{
+	struct ext4_inode_info *ei = EXT4_I(dir);
+	struct ext4_dir_cache *dc = ei->i_dir_cache;
+	struct ext4_dc_entry *e;
+	ext4_lblk_t nblocks;
+	u32 hash, mask, i;
+	int nr = 0, j, err;
+
+	if (!dc) {
+		nblocks = dir->i_size >> EXT4_BLOCK_SIZE_BITS(dir->i_sb);
+		if (nblocks < EXT4_DC_MIN_BLOCKS ||
+		    ext4_test_inode_state(dir, EXT4_STATE_NO_DIR_CACHE) ||
+		    ext4_journal_current_handle())
+			return -1;
+		dc = ext4_dc_build(dir, nblocks, &err);
+		if (!dc) {
+			/*
+			 * Don't read a damaged or too large directory again
+			 * on every lookup
+			 */
+			if (err == -EIO || err == -EFBIG)
+				ext4_set_inode_state(dir,
+						     EXT4_STATE_NO_DIR_CACHE);
+			return -1;
+		}
+		spin_lock(&ext4_dc_lock);
+		ei->i_dir_cache = dc;
+		list_add_tail(&dc->dc_lru, &ext4_dc_lru);
+		ext4_dc_nr_caches++;
+		spin_unlock(&ext4_dc_lock);
+	}
+	dc->dc_referenced = 1;
+
+	hash = ext4_dc_hash((const char *) d_name->name, d_name->len);
+	mask = (1U << dc->dc_bits) - 1;
+	for (i = hash_32(hash, dc->dc_bits);
+	     (e = ext4_dc_slot(dc->dc_table, i))->block != EXT4_DC_FREE;
+	     i = (i + 1) & mask) {
+		if (e->hash != hash)
+			continue;
+		for (j = 0; j < nr; j++)
+			if (blocks[j] == e->block)
+				break;
+		if (j < nr)
+			continue;
+		if (nr == max)
+			return -1;
+		blocks[nr++] = e->block;
+	}
+	return nr;
+}
+
+/*
+ * The first block at or after start that may have room for an entry of
+ * reclen bytes, or start if that is not known.  The caller checks the
+ * block anyway.
+ */
+ext4_lblk_t ext4_dc_room(struct inode *dir, ext4_lblk_t start,
+			 unsigned int reclen)
+{
+	struct ext4_dir_cache *dc = EXT4_I(dir)->i_dir_cache;
+
+	if (!dc || !dc->dc_room)
+		return start;
+	while (start < dc->dc_nr_room && *ext4_dc_room_of(dc, start) < reclen)
+		start++;
+	return start;
+}
+
+/* A name was added to block, whose buffer is bh */
+void ext4_dc_add(struct inode *dir, const char *name, int len,
+		 ext4_lblk_t block, struct buffer_head *bh)
+{
+	struct ext4_dir_cache *dc = EXT4_I(dir)->i_dir_cache;
+
+	if (!dc)
+		return;
+	if (ext4_dc_insert(dc, ext4_dc_hash(name, len), block) ||
+	    ext4_dc_set_room(dc, block, dir, bh))
+		ext4_dc_drop(dir);
+}
+
+/* do_split() moved the entries now in bh from oldblock to newblock */
+void ext4_dc_split(struct inode *dir, struct buffer_head *bh,
+		   ext4_lblk_t oldblock, ext4_lblk_t newblock)
+{
+	struct ext4_dir_cache *dc = EXT4_I(dir)->i_dir_cache;
+	unsigned int blocksize = dir->i_sb->s_blocksize;
+	char *p = bh->b_data, *end = bh->b_data + blocksize;
+	struct ext4_dir_entry_2 *de;
+	struct ext4_dc_entry *e;
+	u32 hash, mask, i;
+
+	if (!dc)
+		return;
+	mask = (1U << dc->dc_bits) - 1;
+	while (p < end) {
+		de = (struct ext4_dir_entry_2 *) p;
+		if (de->inode) {
+			hash = ext4_dc_hash(de->name, de->name_len);
+			for (i = hash_32(hash, dc->dc_bits);
+			     (e = ext4_dc_slot(dc->dc_table, i))->block !=
+			     EXT4_DC_FREE; i = (i + 1) & mask)
+				if (e->hash == hash && e->block == oldblock)
+					break;
+			if (e->block == EXT4_DC_FREE)
+				goto drop;
+			e->block = newblock;
+		}
+		p += ext4_rec_len_from_disk(de->rec_len, blocksize);
+	}
+	/* The split only happens in htree directories, which have no dc_room */
+	return;
+drop:
+	ext4_dc_drop(dir);
+}
+
+/* The entry for name was deleted from the block whose buffer is bh */
+void ext4_dc_delete(struct inode *dir, const char *name, int len,
+		    struct buffer_head *bh)
+{
+	struct ext4_dir_cache *dc = EXT4_I(dir)->i_dir_cache;
+	struct buffer_head *bh2;
+	struct ext4_dc_entry *e;
+	u32 hash, mask, i, found = EXT4_DC_FREE;
+	int nr = 0, err;
+
+	if (!dc)
+		return;
+	hash = ext4_dc_hash(name, len);
+	mask = (1U << dc->dc_bits) - 1;
+	for (i = hash_32(hash, dc->dc_bits);
+	     (e = ext4_dc_slot(dc->dc_table, i))->block != EXT4_DC_FREE;
+	     i = (i + 1) & mask) {
+		if (e->hash != hash)
+			continue;
+		nr++;
+		found = i;
+	}
+	if (nr > 1) {
+		/* Names with the same hash, tell them apart by the buffer */
+		found = EXT4_DC_FREE;
+		for (i = hash_32(hash, dc->dc_bits);
+		     (e = ext4_dc_slot(dc->dc_table, i))->block !=
+		     EXT4_DC_FREE; i = (i + 1) & mask) {
+			if (e->hash != hash)
+				continue;
+			bh2 = ext4_getblk(NULL, dir, e->block, 0, &err);
+			brelse(bh2);
+			if (bh2 == bh) {
+				found = i;
+				break;
+			}
+		}
+	}
+	if (found == EXT4_DC_FREE)
+		goto drop;
+	i = ext4_dc_slot(dc->dc_table, found)->block;
+	ext4_dc_remove(dc, found);
+	if (ext4_dc_set_room(dc, i, dir, bh))
+		goto drop;
+	return;
+drop:
+	ext4_dc_drop(dir);
+}
+
+/* Forget the table of the directory, if it has one */
+void ext4_dc_drop(struct inode *dir)
+{
+	struct ext4_inode_info *ei = EXT4_I(dir);
+	struct ext4_dir_cache *dc;
+
+	/* The shrinker clears it under ext4_dc_lock before freeing it */
+	if (!ei->i_dir_cache)
+		return;
+	spin_lock(&ext4_dc_lock);
+	dc = ei->i_dir_cache;
+	if (dc) {
+		ei->i_dir_cache = NULL;
+		list_del(&dc->dc_lru);
+		ext4_dc_nr_caches--;
+	}
+	spin_unlock(&ext4_dc_lock);
+	if (dc)
+		ext4_dc_destroy(dc);
+}
+
+/*
+ * nr_to_scan counts slots of the tables, which is what their memory is
+ * mostly made of.  Tables used since the last pass get another round.
+ */
+static int ext4_dc_shrink(struct shrinker *shrink, struct shrink_control *sc)
+{
+	LIST_HEAD(free_list);
+	struct ext4_dir_cache *dc, *tmp;
+	struct inode *dir;
+	long nr_to_scan = sc->nr_to_scan;
+	unsigned long count;
+	unsigned int nr;
+
+	spin_lock(&ext4_dc_lock);
+	for (nr = ext4_dc_nr_caches; nr_to_scan > 0 && nr; nr--) {
+		dc = list_first_entry(&ext4_dc_lru, struct ext4_dir_cache,
+				      dc_lru);
+		list_move_tail(&dc->dc_lru, &ext4_dc_lru);
+		if (dc->dc_referenced) {
+			dc->dc_referenced = 0;
+			continue;
+		}
+		dir = dc->dc_inode;
+		if (!mutex_trylock(&dir->i_mutex))
+			continue;
+		EXT4_I(dir)->i_dir_cache = NULL;
+		list_move(&dc->dc_lru, &free_list);
+		ext4_dc_nr_caches--;
+		mutex_unlock(&dir->i_mutex);
+		nr_to_scan -= 1L << dc->dc_bits;
+	}
+	count = ext4_dc_nr_slots;
+	spin_unlock(&ext4_dc_lock);
+
+	list_for_each_entry_safe(dc, tmp, &free_list, dc_lru)
+		ext4_dc_destroy(dc);
+	return min_t(unsigned long, count / 100 * sysctl_vfs_cache_pressure,
+		     INT_MAX);
+}
+
+static struct shrinker ext4_dc_shrinker = {
+	.shrink = ext4_dc_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
+void __init ext4_init_dir_cache(void)
+{
+	register_shrinker(&ext4_dc_shrinker);
+}
+
+void ext4_exit_dir_cache(void)
+{
+	unregister_shrinker(&ext4_dc_shrinker);
+}
@@ -755,6 +755,9 @@ struct ext4_ext_cache {
 	__u32		ec_len; /* must be 32bit to return holes */
 };
 
+struct ext4_fc_track;
+struct ext4_dir_cache;
+
 /*
  * fourth extended file system inode data in memory
  */
@@ -866,6 +869,19 @@ struct ext4_inode_info {
 	 */
 	tid_t i_sync_tid;
 	tid_t i_datasync_tid;
+
+	/*
+	 * Fast commit state for transaction i_fc_tid: whether the inode
+	 * can be fast committed at all, and what it changed since its last
+	 * fast commit.  See fast_commit.c.
+	 */
+	spinlock_t i_fc_lock;
+	tid_t i_fc_tid;
+	unsigned int i_fc_ineligible;
+	struct ext4_fc_track *i_fc;
+
+	/* In-memory name index of a large directory, see dircache.c */
+	struct ext4_dir_cache *i_dir_cache;
 };
 
 /*
@@ -924,6 +940,9 @@ struct ext4_inode_info {
 #define test_opt(sb, opt)		(EXT4_SB(sb)->s_mount_opt & \
 					 EXT4_MOUNT_##opt)
 
+#define EXT4_MOUNT2_FAST_COMMIT		0x00000001 /* Log fsync()s in the
+						    * fast commit area */
+
 #define clear_opt2(sb, opt)		EXT4_SB(sb)->s_mount_opt2 &= \
 						~EXT4_MOUNT2_##opt
 #define set_opt2(sb, opt)		EXT4_SB(sb)->s_mount_opt2 |= \
@@ -1076,6 +1095,22 @@ struct ext4_super_block {
 #define EXT4_MF_MNTDIR_SAMPLED	0x0001
 #define EXT4_MF_FS_ABORTED	0x0002	/* Fatal error detected */
 
+/*
+ * Fast commits
+ */
+#define EXT4_FC_DEF_BLOCKS	256	/* Size of the fast commit area */
+#define EXT4_FC_MAX_RANGES	16	/* Allocations tracked per inode */
+#define EXT4_FC_MAX_BLOCKS	4	/* Tree blocks tracked per inode */
+
+enum {
+	EXT4_FC_STAT_FAST,		/* fsyncs done with a fast commit */
+	EXT4_FC_STAT_INELIGIBLE,	/* full commits: can't be logged */
+	EXT4_FC_STAT_COMMITTING,	/* full commits: already started */
+	EXT4_FC_STAT_NOSPC,		/* full commits: area or block full */
+	EXT4_FC_STAT_ERROR,		/* full commits: I/O or memory error */
+	EXT4_FC_NR_STATS,
+};
+
 /*
  * fourth extended-fs super-block data in memory
  */
@@ -1171,10 +1206,19 @@ struct ext4_sb_info {
 	unsigned int s_mb_stats;
 	unsigned int s_mb_order2_reqs;
 	unsigned int s_mb_group_prealloc;
+	unsigned int s_mb_optimize_scan;
 	unsigned int s_max_writeback_mb_bump;
-	/* where last allocation was done - for stream allocation */
-	unsigned long s_mb_last_group;
-	unsigned long s_mb_last_start;
+	/*
+	 * where last allocation was done - for stream allocation, one goal
+	 * per slot so that concurrent streams don't share one
+	 */
+	struct ext4_mb_goal *s_mb_last_goals;
+	unsigned int s_mb_nr_last_goals;
+
+	/* groups by the order of their largest free extent */
+	struct list_head *s_mb_largest_free_orders;
+	spinlock_t *s_mb_largest_free_orders_locks;
+	atomic_t s_mb_groups_initialized;
 
 	/* stats for buddy allocator */
 	atomic_t s_bal_reqs;	/* number of reqs with len > 1 */
@@ -1191,6 +1235,7 @@ struct ext4_sb_info {
 	atomic_t s_mb_preallocated;
 	atomic_t s_mb_discarded;
 	atomic_t s_lock_busy;
+	struct ext4_mb_lat_stats __percpu *s_mb_lat_stats;
 
 	/* locality groups */
 	struct ext4_locality_group __percpu *s_locality_groups;
@@ -1215,6 +1260,12 @@ struct ext4_sb_info {
 
 	/* Kernel thread for multiple mount protection */
 	struct task_struct *s_mmp_tsk;
+
+	/* Fast commits */
+	tid_t s_fc_ineligible_tid;	/* transaction that changed the fs
+					 * in ways fast commits can't log */
+	void *s_fc_bufs[EXT4_FC_MAX_BLOCKS + 1];
+	atomic_t s_fc_stats[EXT4_FC_NR_STATS];
 };
 
 static inline struct ext4_sb_info *EXT4_SB(struct super_block *sb)
@@ -1254,6 +1305,7 @@ enum {
 	EXT4_STATE_DIO_UNWRITTEN,	/* need convert on dio done*/
 	EXT4_STATE_NEWENTRY,		/* File just added to dir */
 	EXT4_STATE_DELALLOC_RESERVED,	/* blks already reserved for delalloc */
+	EXT4_STATE_NO_DIR_CACHE,	/* dir could not be read into a dircache */
 };
 
 #define EXT4_INODE_BIT_FNS(name, field, offset)				\
@@ -1758,10 +1810,41 @@ extern int ext4_htree_store_dirent(struct file *dir_file, __u32 hash,
 				    struct ext4_dir_entry_2 *dirent);
 extern void ext4_htree_free_dir_info(struct dir_private_info *p);
 
+/* dircache.c */
+#define EXT4_DC_MAX_CANDIDATES	4
+extern int ext4_dc_candidates(struct inode *dir, const struct qstr *d_name,
+			      ext4_lblk_t *blocks, int max);
+extern ext4_lblk_t ext4_dc_room(struct inode *dir, ext4_lblk_t start,
+				unsigned int reclen);
+extern void ext4_dc_add(struct inode *dir, const char *name, int len,
+			ext4_lblk_t block, struct buffer_head *bh);
+extern void ext4_dc_split(struct inode *dir, struct buffer_head *bh,
+			  ext4_lblk_t oldblock, ext4_lblk_t newblock);
+extern void ext4_dc_delete(struct inode *dir, const char *name, int len,
+			   struct buffer_head *bh);
+extern void ext4_dc_drop(struct inode *dir);
+extern void __init ext4_init_dir_cache(void);
+extern void ext4_exit_dir_cache(void);
+
 /* fsync.c */
 extern int ext4_sync_file(struct file *, int);
 extern int ext4_flush_completed_IO(struct inode *);
 
+/* fast_commit.c */
+extern void ext4_fc_track_range(handle_t *handle, struct inode *inode,
+				ext4_fsblk_t pblk, unsigned int len);
+extern void ext4_fc_track_block(handle_t *handle, struct inode *inode,
+				ext4_fsblk_t blocknr);
+extern void ext4_fc_mark_ineligible(handle_t *handle, struct inode *inode);
+extern void ext4_fc_mark_fs_ineligible(handle_t *handle,
+				       struct super_block *sb);
+extern int ext4_fc_commit(struct inode *inode, tid_t tid);
+extern int ext4_fc_replay(journal_t *journal, const void *records,
+			  unsigned int len);
+extern int ext4_fc_setup(struct super_block *sb);
+extern void ext4_fc_release(struct super_block *sb);
+extern void ext4_fc_clear_inode(struct inode *inode);
+
 /* hash.c */
 extern int ext4fs_dirhash(const char *name, int len, struct
 			  dx_hash_info *hinfo);
@@ -2057,7 +2140,9 @@ struct ext4_group_info {
 	ext4_grpblk_t	bb_free;	/* total free blocks */
 	ext4_grpblk_t	bb_fragments;	/* nr of freespace fragments */
 	ext4_grpblk_t	bb_largest_free_order;/* order of largest frag in BG */
+	ext4_group_t	bb_group;	/* group number */
 	struct          list_head bb_prealloc_list;
+	struct          list_head bb_largest_free_order_node;
 #ifdef DOUBLE_CHECK
 	void            *bb_bitmap;
 #endif
@@ -2111,6 +2196,21 @@ static inline void ext4_lock_group(struct super_block *sb, ext4_group_t group)
 	}
 }
 
+/*
+ * Take the group lock only if nobody holds it; allocators use this to
+ * move on to another group rather than queue up behind each other.
+ */
+static inline int ext4_trylock_group(struct super_block *sb,
+				     ext4_group_t group)
+{
+	if (spin_trylock(ext4_group_lock_ptr(sb, group))) {
+		atomic_add_unless(&EXT4_SB(sb)->s_lock_busy, -1, 0);
+		return 1;
+	}
+	atomic_add_unless(&EXT4_SB(sb)->s_lock_busy, 1, EXT4_MAX_CONTENTION);
+	return 0;
+}
+
 static inline void ext4_unlock_group(struct super_block *sb,
 					ext4_group_t group)
 {
@@ -103,6 +103,7 @@ static int ext4_ext_dirty(handle_t *handle, struct inode *inode,
 	if (path->p_bh) {
 		/* path points to block */
 		err = ext4_handle_dirty_metadata(handle, inode, path->p_bh);
+		ext4_fc_track_block(handle, inode, path->p_bh->b_blocknr);
 	} else {
 		/* path points to leaf/index in inode body */
 		err = ext4_mark_inode_dirty(handle, inode);
@@ -1166,6 +1167,8 @@ static int ext4_ext_create_new_leaf(handle_t *handle, struct inode *inode,
 	struct ext4_ext_path *curp;
 	int depth, i, err = 0;
 
+	/* the tree changes shape, which fast commits don't log */
+	ext4_fc_mark_ineligible(handle, inode);
 repeat:
 	i = depth = ext_depth(inode);
 
@@ -3567,6 +3570,7 @@ int ext4_ext_map_blocks(handle_t *handle, struct inode *inode,
 	newblock = ext4_mb_new_blocks(handle, &ar, &err);
 	if (!newblock)
 		goto out2;
+	ext4_fc_track_range(handle, inode, newblock, ar.len);
 	ext_debug("allocate new block: goal %llu, found %llu/%u\n",
 		  ar.goal, newblock, allocated);
 
@@ -0,0 +1,607 @@
+/*
+ *  linux/fs/ext4/fast_commit.c
+ *
+ * Fast commits: fsync() without a full journal commit
+ *
+ * Normally fsync() commits the running transaction, which writes every
+ * metadata block anybody changed in it.  With the fast_commit mount
+ * option an fsync of a regular file only logs what that file changed:
+ * its on-disk inode, the blocks it was given and the images of the
+ * extent tree blocks it modified, in one to a few blocks of the fast
+ * commit area at the end of the journal (see jbd2_fc_write()).  The
+ * transaction commits in full later as usual, from the commit timer or
+ * because a fast commit did not fit.
+ *
+ * Recovery replays the fast commits on top of the last full commit, so
+ * they may only contain changes that make sense on their own there.
+ * Anything else makes the inode ineligible until the next transaction,
+ * and its fsync falls back to a full commit:
+ *  - namespace and link count changes, new inodes, orphans
+ *  - freeing blocks, which covers truncate and punching holes
+ *  - extent tree blocks allocated or freed, extended attributes
+ *  - extent swapping and migration, resizing (the whole fs)
+ *  - files without extents, data=journal and quotas
+ *
+ * The records, little endian as everything else on disk:
+ *
+ *	EXT4_FC_TAG_ALLOC	blocks to mark in use in their group
+ *	EXT4_FC_TAG_INODE	the on-disk inode to write back
+ */
+
+#include <linux/fs.h>
+#include <linux/jbd2.h>
+#include <linux/slab.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/quotaops.h>
+#include "ext4.h"
+#include "ext4_jbd2.h"
+
+#define EXT4_FC_TAG_ALLOC	1
+#define EXT4_FC_TAG_INODE	2
+
+struct ext4_fc_tl {
+	__le16	fc_tag;
+	__le16	fc_len;		/* bytes of value after the tl */
+};
+
+struct ext4_fc_alloc {
+	__le64	fc_pblk;
+	__le32	fc_len;
+	__le32	fc_ino;
+};
+
+struct ext4_fc_inode {
+	__le32	fc_ino;
+	__u8	fc_raw_inode[0];
+};
+
+/* What an inode changed in i_fc_tid since its last fast commit */
+struct ext4_fc_track {
+	unsigned int	nr_ranges;
+	unsigned int	nr_blocks;
+	struct {
+		ext4_fsblk_t	pblk;
+		unsigned int	len;
+	} ranges[EXT4_FC_MAX_RANGES];
+	ext4_fsblk_t	blocks[EXT4_FC_MAX_BLOCKS];
+};
+
+static inline int ext4_fc_enabled(struct super_block *sb)
+{
+	return test_opt2(sb, FAST_COMMIT) && EXT4_SB(sb)->s_fc_bufs[0];
+}
+
+/*
+ * Returns the tracking of @inode for the transaction of @handle with
+ * i_fc_lock held, or NULL if the inode can't be fast committed in it
+ */
+static struct ext4_fc_track *ext4_fc_track_get(handle_t *handle,
+					       struct inode *inode)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	struct ext4_fc_track *new = NULL;
+	tid_t tid = handle->h_transaction->t_tid;
+
+	if (!ei->i_fc)
+		new = kmalloc(sizeof(*new), GFP_NOFS);
+
+	spin_lock(&ei->i_fc_lock);
+	if (!ei->i_fc) {
+		ei->i_fc = new;
+		new = NULL;
+	}
+	if (ei->i_fc_tid != tid) {
+		ei->i_fc_tid = tid;
+		ei->i_fc_ineligible = 0;
+		if (ei->i_fc)
+			ei->i_fc->nr_ranges = ei->i_fc->nr_blocks = 0;
+	}
+	if (!ei->i_fc)
+		ei->i_fc_ineligible = 1;
+	if (ei->i_fc_ineligible) {
+		spin_unlock(&ei->i_fc_lock);
+		kfree(new);
+		return NULL;
+	}
+	kfree(new);
+	return ei->i_fc;
+}
+
+/* Blocks @inode was given, called with i_data_sem held for writing */
+void ext4_fc_track_range(handle_t *handle, struct inode *inode,
+			 ext4_fsblk_t pblk, unsigned int len)
+{
+	struct ext4_fc_track *track;
+	unsigned int n;
+
+	if (!ext4_handle_valid(handle) || !ext4_fc_enabled(inode->i_sb))
+		return;
+	track = ext4_fc_track_get(handle, inode);
+	if (!track)
+		return;
+
+	n = track->nr_ranges;
+	if (n && track->ranges[n - 1].pblk + track->ranges[n - 1].len == pblk)
+		track->ranges[n - 1].len += len;
+	else if (n < EXT4_FC_MAX_RANGES) {
+		track->ranges[n].pblk = pblk;
+		track->ranges[n].len = len;
+		track->nr_ranges++;
+	} else
+		EXT4_I(inode)->i_fc_ineligible = 1;
+	spin_unlock(&EXT4_I(inode)->i_fc_lock);
+}
+
+/* An extent tree block of @inode was modified, i_data_sem as above */
+void ext4_fc_track_block(handle_t *handle, struct inode *inode,
+			 ext4_fsblk_t blocknr)
+{
+	struct ext4_fc_track *track;
+	unsigned int i;
+
+	if (!ext4_handle_valid(handle) || !ext4_fc_enabled(inode->i_sb))
+		return;
+	track = ext4_fc_track_get(handle, inode);
+	if (!track)
+		return;
+
+	for (i = 0; i < track->nr_blocks; i++)
+		if (track->blocks[i] == blocknr)
+			break;
+	if (i == track->nr_blocks) {
+		if (i < EXT4_FC_MAX_BLOCKS)
+			track->blocks[track->nr_blocks++] = blocknr;
+		else
+			EXT4_I(inode)->i_fc_ineligible = 1;
+	}
+	spin_unlock(&EXT4_I(inode)->i_fc_lock);
+}
+
+/* @inode changed in a way fast commits can't log */
+void ext4_fc_mark_ineligible(handle_t *handle, struct inode *inode)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+
+	if (!ext4_handle_valid(handle) || !ext4_fc_enabled(inode->i_sb))
+		return;
+	spin_lock(&ei->i_fc_lock);
+	ei->i_fc_tid = handle->h_transaction->t_tid;
+	ei->i_fc_ineligible = 1;
+	spin_unlock(&ei->i_fc_lock);
+}
+
+/*
+ * The whole fs changed in a way fast commits can't log, in the
+ * transaction of @handle or without one in the running transaction
+ */
+void ext4_fc_mark_fs_ineligible(handle_t *handle, struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	journal_t *journal = sbi->s_journal;
+
+	if (!journal)
+		return;
+	if (ext4_handle_valid(handle)) {
+		sbi->s_fc_ineligible_tid = handle->h_transaction->t_tid;
+		return;
+	}
+	read_lock(&journal->j_state_lock);
+	if (journal->j_running_transaction)
+		sbi->s_fc_ineligible_tid =
+			journal->j_running_transaction->t_tid;
+	else
+		sbi->s_fc_ineligible_tid = journal->j_transaction_sequence;
+	read_unlock(&journal->j_state_lock);
+}
+
+static void *ext4_fc_add_tl(void *p, int tag, unsigned int len)
+{
+	struct ext4_fc_tl *tl = p;
+
+	tl->fc_tag = cpu_to_le16(tag);
+	tl->fc_len = cpu_to_le16(len);
+	return tl + 1;
+}
+
+/*
+ * Copy what @inode has to log into the fast commit buffers: the records
+ * go to s_fc_bufs[0], the tree block images to the ones after it.
+ * Called with i_data_sem held, so that the extent tree is stable.
+ */
+static int ext4_fc_snapshot(struct inode *inode, struct ext4_fc_track *track,
+			    struct jbd2_fc_image *images, unsigned int *len)
+{
+	struct super_block *sb = inode->i_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	unsigned int inode_size = EXT4_INODE_SIZE(sb);
+	struct ext4_fc_alloc *alloc;
+	struct ext4_fc_inode *raw;
+	struct buffer_head *bh;
+	struct ext4_iloc iloc;
+	void *p = sbi->s_fc_bufs[0];
+	unsigned int i;
+	int err;
+
+	/* jbd2 needs room for its header and tags in the same block */
+	if (track->nr_ranges * (sizeof(struct ext4_fc_tl) + sizeof(*alloc)) +
+	    sizeof(struct ext4_fc_tl) + sizeof(*raw) + inode_size +
+	    sizeof(jbd2_fc_header_t) +
+	    track->nr_blocks * sizeof(jbd2_fc_tag_t) > sb->s_blocksize)
+		return -E2BIG;
+
+	for (i = 0; i < track->nr_ranges; i++) {
+		alloc = ext4_fc_add_tl(p, EXT4_FC_TAG_ALLOC, sizeof(*alloc));
+		alloc->fc_pblk = cpu_to_le64(track->ranges[i].pblk);
+		alloc->fc_len = cpu_to_le32(track->ranges[i].len);
+		alloc->fc_ino = cpu_to_le32(inode->i_ino);
+		p = alloc + 1;
+	}
+
+	err = ext4_get_inode_loc(inode, &iloc);
+	if (err)
+		return err;
+	raw = ext4_fc_add_tl(p, EXT4_FC_TAG_INODE, sizeof(*raw) + inode_size);
+	raw->fc_ino = cpu_to_le32(inode->i_ino);
+	memcpy(raw->fc_raw_inode, ext4_raw_inode(&iloc), inode_size);
+	brelse(iloc.bh);
+	p = raw->fc_raw_inode + inode_size;
+	*len = p - sbi->s_fc_bufs[0];
+
+	for (i = 0; i < track->nr_blocks; i++) {
+		bh = sb_bread(sb, track->blocks[i]);
+		if (!bh)
+			return -EIO;
+		images[i].blocknr = track->blocks[i];
+		images[i].data = sbi->s_fc_bufs[i + 1];
+		memcpy(images[i].data, bh->b_data, sb->s_blocksize);
+		brelse(bh);
+	}
+	return 0;
+}
+
+/**
+ * ext4_fc_commit() - make the changes of @inode in @tid durable
+ * @inode: inode being fsynced
+ * @tid: transaction holding its changes
+ *
+ * Returns 0 once they are on disk, or an error if the caller has to
+ * commit @tid in full instead.
+ */
+int ext4_fc_commit(struct inode *inode, tid_t tid)
+{
+	struct super_block *sb = inode->i_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	journal_t *journal = sbi->s_journal;
+	struct jbd2_fc_image images[EXT4_FC_MAX_BLOCKS];
+	struct ext4_fc_track track;
+	unsigned int len = 0;
+	int taken = 0, stat, err;
+
+	if (!ext4_fc_enabled(sb))
+		return -EOPNOTSUPP;
+
+	if (!S_ISREG(inode->i_mode) ||
+	    !ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS) ||
+	    ext4_should_journal_data(inode) || sb_any_quota_loaded(sb) ||
+	    sbi->s_fc_ineligible_tid == tid) {
+		err = -EINVAL;
+		goto out;
+	}
+
+	err = jbd2_fc_begin(journal, tid);
+	if (err)
+		goto out;
+
+	track.nr_ranges = track.nr_blocks = 0;
+	down_read(&ei->i_data_sem);
+	spin_lock(&ei->i_fc_lock);
+	if (ei->i_fc_tid == tid) {
+		if (ei->i_fc_ineligible)
+			err = -EINVAL;
+		else if (ei->i_fc) {
+			track = *ei->i_fc;
+			ei->i_fc->nr_ranges = ei->i_fc->nr_blocks = 0;
+			taken = 1;
+		}
+	}
+	spin_unlock(&ei->i_fc_lock);
+	if (!err)
+		err = ext4_fc_snapshot(inode, &track, images, &len);
+	up_read(&ei->i_data_sem);
+
+	if (!err)
+		err = jbd2_fc_write(journal, tid, sbi->s_fc_bufs[0], len,
+				    images, track.nr_blocks);
+	if (err && taken) {
+		/*
+		 * What was taken out of the tracking is only in @tid now.  If
+		 * the inode moved on to the next transaction, @tid is being
+		 * committed in full anyway.
+		 */
+		spin_lock(&ei->i_fc_lock);
+		if (ei->i_fc_tid == tid)
+			ei->i_fc_ineligible = 1;
+		spin_unlock(&ei->i_fc_lock);
+	}
+	jbd2_fc_end(journal);
+
+out:
+	switch (err) {
+	case 0:
+		stat = EXT4_FC_STAT_FAST;
+		break;
+	case -EINVAL:
+		stat = EXT4_FC_STAT_INELIGIBLE;
+		break;
+	case -EALREADY:
+	case -EAGAIN:
+		stat = EXT4_FC_STAT_COMMITTING;
+		break;
+	case -ENOSPC:
+	case -E2BIG:
+		stat = EXT4_FC_STAT_NOSPC;
+		break;
+	default:
+		stat = EXT4_FC_STAT_ERROR;
+		break;
+	}
+	atomic_inc(&sbi->s_fc_stats[stat]);
+	return err;
+}
+
+/*
+ * Replay
+ */
+
+static int ext4_fc_check_alloc(struct super_block *sb,
+			       struct ext4_fc_alloc *alloc)
+{
+	ext4_fsblk_t pblk = le64_to_cpu(alloc->fc_pblk);
+	unsigned int len = le32_to_cpu(alloc->fc_len);
+	ext4_group_t group, last_group;
+
+	if (!len || pblk < le32_to_cpu(EXT4_SB(sb)->s_es->s_first_data_block) ||
+	    pblk + len > ext4_blocks_count(EXT4_SB(sb)->s_es))
+		return 0;
+	ext4_get_group_no_and_offset(sb, pblk, &group, NULL);
+	ext4_get_group_no_and_offset(sb, pblk + len - 1, &last_group, NULL);
+	return group == last_group &&
+		ext4_data_block_valid(EXT4_SB(sb), pblk, len);
+}
+
+static int ext4_fc_replay_alloc(struct super_block *sb,
+				struct ext4_fc_alloc *alloc)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	ext4_fsblk_t pblk = le64_to_cpu(alloc->fc_pblk);
+	unsigned int len = le32_to_cpu(alloc->fc_len);
+	struct buffer_head *bitmap_bh, *gdp_bh;
+	struct ext4_group_desc *gdp;
+	ext4_grpblk_t bit, i;
+	ext4_group_t group;
+	unsigned int newly = 0;
+
+	ext4_get_group_no_and_offset(sb, pblk, &group, &bit);
+	gdp = ext4_get_group_desc(sb, group, &gdp_bh);
+	if (!gdp)
+		return -EIO;
+	bitmap_bh = ext4_read_block_bitmap(sb, group);
+	if (!bitmap_bh)
+		return -EIO;
+
+	/* An earlier fast commit of the same transaction may have it set */
+	ext4_lock_group(sb, group);
+	for (i = bit; i < bit + len; i++)
+		if (!ext4_set_bit(i, bitmap_bh->b_data))
+			newly++;
+	if (gdp->bg_flags & cpu_to_le16(EXT4_BG_BLOCK_UNINIT)) {
+		gdp->bg_flags &= cpu_to_le16(~EXT4_BG_BLOCK_UNINIT);
+		ext4_free_blks_set(sb, gdp,
+				   ext4_free_blocks_after_init(sb, group, gdp));
+	}
+	ext4_free_blks_set(sb, gdp, ext4_free_blks_count(sb, gdp) - newly);
+	gdp->bg_checksum = ext4_group_desc_csum(sbi, group, gdp);
+	ext4_unlock_group(sb, group);
+
+	if (sbi->s_log_groups_per_flex && sbi->s_flex_groups)
+		atomic_sub(newly, &sbi->s_flex_groups[
+				ext4_flex_group(sbi, group)].free_blocks);
+
+	mark_buffer_dirty(bitmap_bh);
+	mark_buffer_dirty(gdp_bh);
+	brelse(bitmap_bh);
+	return 0;
+}
+
+static int ext4_fc_replay_inode(struct super_block *sb,
+				struct ext4_fc_inode *raw)
+{
+	unsigned long ino = le32_to_cpu(raw->fc_ino);
+	unsigned int inode_size = EXT4_INODE_SIZE(sb);
+	struct ext4_group_desc *gdp;
+	struct buffer_head *bh;
+	ext4_fsblk_t block;
+	ext4_group_t group;
+	unsigned long offset;
+
+	group = (ino - 1) / EXT4_INODES_PER_GROUP(sb);
+	offset = ((ino - 1) % EXT4_INODES_PER_GROUP(sb)) * inode_size;
+	gdp = ext4_get_group_desc(sb, group, NULL);
+	if (!gdp)
+		return -EIO;
+	block = ext4_inode_table(sb, gdp) + offset / sb->s_blocksize;
+	bh = sb_bread(sb, block);
+	if (!bh)
+		return -EIO;
+	lock_buffer(bh);
+	memcpy(bh->b_data + offset % sb->s_blocksize, raw->fc_raw_inode,
+	       inode_size);
+	unlock_buffer(bh);
+	mark_buffer_dirty(bh);
+	brelse(bh);
+	return 0;
+}
+
+/*
+ * j_fc_replay of the journal: apply the records of one fast commit.
+ * They are all checked before anything is changed.
+ */
+int ext4_fc_replay(journal_t *journal, const void *records, unsigned int len)
+{
+	struct super_block *sb = journal->j_private;
+	struct ext4_fc_inode *raw;
+	const struct ext4_fc_tl *tl;
+	const void *p, *end = records + len;
+	unsigned long ino;
+	int pass, err;
+
+	for (pass = 0; pass < 2; pass++) {
+		for (p = records; p < end; p = tl + 1 + le16_to_cpu(tl->fc_len)) {
+			tl = p;
+			if ((void *)(tl + 1) > end ||
+			    (void *)(tl + 1) + le16_to_cpu(tl->fc_len) > end)
+				goto corrupt;
+
+			switch (le16_to_cpu(tl->fc_tag)) {
+			case EXT4_FC_TAG_ALLOC:
+				if (le16_to_cpu(tl->fc_len) !=
+				    sizeof(struct ext4_fc_alloc))
+					goto corrupt;
+				if (!pass) {
+					if (!ext4_fc_check_alloc(sb,
+							(void *)(tl + 1)))
+						goto corrupt;
+					break;
+				}
+				err = ext4_fc_replay_alloc(sb, (void *)(tl + 1));
+				if (err)
+					return err;
+				break;
+			case EXT4_FC_TAG_INODE:
+				raw = (void *)(tl + 1);
+				if (le16_to_cpu(tl->fc_len) != sizeof(*raw) +
+				    EXT4_INODE_SIZE(sb))
+					goto corrupt;
+				ino = le32_to_cpu(raw->fc_ino);
+				if (!pass) {
+					if (ino < EXT4_FIRST_INO(sb) ||
+					    ino > le32_to_cpu(
+					    EXT4_SB(sb)->s_es->s_inodes_count))
+						goto corrupt;
+					break;
+				}
+				err = ext4_fc_replay_inode(sb, raw);
+				if (err)
+					return err;
+				break;
+			default:
+				goto corrupt;
+			}
+		}
+	}
+	return 0;
+
+corrupt:
+	ext4_msg(sb, KERN_ERR, "corrupt fast commit record at offset %u",
+		 (unsigned int)(p - records));
+	return -EIO;
+}
+
+/*
+ * Setup and statistics
+ */
+
+static int ext4_fc_info_show(struct seq_file *seq, void *v)
+{
+	struct super_block *sb = seq->private;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+
+	seq_printf(seq, "fast commits: %d\n",
+		   atomic_read(&sbi->s_fc_stats[EXT4_FC_STAT_FAST]));
+	seq_printf(seq, "full commits instead:\n");
+	seq_printf(seq, "  ineligible: %d\n",
+		   atomic_read(&sbi->s_fc_stats[EXT4_FC_STAT_INELIGIBLE]));
+	seq_printf(seq, "  already committing: %d\n",
+		   atomic_read(&sbi->s_fc_stats[EXT4_FC_STAT_COMMITTING]));
+	seq_printf(seq, "  no space: %d\n",
+		   atomic_read(&sbi->s_fc_stats[EXT4_FC_STAT_NOSPC]));
+	seq_printf(seq, "  errors: %d\n",
+		   atomic_read(&sbi->s_fc_stats[EXT4_FC_STAT_ERROR]));
+	return 0;
+}
+
+static int ext4_fc_info_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ext4_fc_info_show, PDE(inode)->data);
+}
+
+static const struct file_operations ext4_fc_info_fops = {
+	.owner		= THIS_MODULE,
+	.open		= ext4_fc_info_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/*
+ * Set up the fast commit area, which only works while the journal is
+ * empty: at mount, and when remounting read-write
+ */
+int ext4_fc_setup(struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	journal_t *journal = sbi->s_journal;
+	int i, err;
+
+	if (!journal || sbi->s_fc_bufs[0])
+		return 0;
+
+	for (i = 0; i <= EXT4_FC_MAX_BLOCKS; i++) {
+		sbi->s_fc_bufs[i] = kmalloc(sb->s_blocksize, GFP_KERNEL);
+		if (!sbi->s_fc_bufs[i]) {
+			err = -ENOMEM;
+			goto out_free;
+		}
+	}
+	err = jbd2_fc_setup(journal, min_t(unsigned int, EXT4_FC_DEF_BLOCKS,
+					   journal->j_maxlen / 16));
+	if (err)
+		goto out_free;
+
+	/* Nothing before this was tracked */
+	ext4_fc_mark_fs_ineligible(NULL, sb);
+	if (sbi->s_proc)
+		proc_create_data("fc_info", S_IRUGO, sbi->s_proc,
+				 &ext4_fc_info_fops, sb);
+	return 0;
+
+out_free:
+	for (i = 0; i <= EXT4_FC_MAX_BLOCKS; i++) {
+		kfree(sbi->s_fc_bufs[i]);
+		sbi->s_fc_bufs[i] = NULL;
+	}
+	return err;
+}
+
+void ext4_fc_release(struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	int i;
+
+	if (!sbi->s_fc_bufs[0])
+		return;
+	if (sbi->s_proc)
+		remove_proc_entry("fc_info", sbi->s_proc);
+	for (i = 0; i <= EXT4_FC_MAX_BLOCKS; i++) {
+		kfree(sbi->s_fc_bufs[i]);
+		sbi->s_fc_bufs[i] = NULL;
+	}
+}
+
+void ext4_fc_clear_inode(struct inode *inode)
+{
+	kfree(EXT4_I(inode)->i_fc);
+	EXT4_I(inode)->i_fc = NULL;
+}
@@ -679,23 +679,44 @@ static void ext4_mb_mark_free_simple(struct super_block *sb,
 
 /*
  * Cache the order of the largest free extent we have available in this block
- * group.
+ * group, and keep the group on the list of that order, so that the
+ * allocator can find groups with large enough free extents without
+ * scanning them all.  Groups without free blocks are on no list.
+ *
+ * Must be called under group lock!
  */
 static void
 mb_set_largest_free_order(struct super_block *sb, struct ext4_group_info *grp)
 {
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
 	int i;
 	int bits;
-
-	grp->bb_largest_free_order = -1; /* uninit */
+	int order = -1; /* uninit */
 
 	bits = sb->s_blocksize_bits + 1;
 	for (i = bits; i >= 0; i--) {
 		if (grp->bb_counters[i] > 0) {
-			grp->bb_largest_free_order = i;
+			order = i;
 			break;
 		}
 	}
+
+	if (order == grp->bb_largest_free_order)
+		return;
+
+	if (grp->bb_largest_free_order >= 0) {
+		i = grp->bb_largest_free_order;
+		spin_lock(&sbi->s_mb_largest_free_orders_locks[i]);
+		list_del_init(&grp->bb_largest_free_order_node);
+		spin_unlock(&sbi->s_mb_largest_free_orders_locks[i]);
+	}
+	grp->bb_largest_free_order = order;
+	if (order >= 0) {
+		spin_lock(&sbi->s_mb_largest_free_orders_locks[order]);
+		list_add_tail(&grp->bb_largest_free_order_node,
+			      &sbi->s_mb_largest_free_orders[order]);
+		spin_unlock(&sbi->s_mb_largest_free_orders_locks[order]);
+	}
 }
 
 static noinline_for_stack
@@ -742,7 +763,8 @@ void ext4_mb_generate_buddy(struct super_block *sb,
 	}
 	mb_set_largest_free_order(sb, grp);
 
-	clear_bit(EXT4_GROUP_INFO_NEED_INIT_BIT, &(grp->bb_state));
+	if (test_and_clear_bit(EXT4_GROUP_INFO_NEED_INIT_BIT, &(grp->bb_state)))
+		atomic_inc(&EXT4_SB(sb)->s_mb_groups_initialized);
 
 	period = get_cycles() - period;
 	spin_lock(&EXT4_SB(sb)->s_bal_lock);
@@ -1516,13 +1538,29 @@ static int mb_mark_used(struct ext4_buddy *e4b, struct ext4_free_extent *ex)
 	return ret;
 }
 
+/*
+ * Stream allocations go on where the last one left off.  With a single
+ * such goal, all files being streamed out at the same time would be
+ * sent to the same group and contend on its lock and buddy, so there is
+ * a goal per slot and each file keeps to the slot of its inode number.
+ * The slots start out spread over the filesystem.  The goals are only
+ * hints and are read and written without locking.
+ */
+static struct ext4_mb_goal *
+ext4_mb_stream_goal(struct ext4_allocation_context *ac)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(ac->ac_sb);
+
+	return &sbi->s_mb_last_goals[ac->ac_inode->i_ino %
+				     sbi->s_mb_nr_last_goals];
+}
+
 /*
  * Must be called under group lock!
  */
 static void ext4_mb_use_best_found(struct ext4_allocation_context *ac,
 					struct ext4_buddy *e4b)
 {
-	struct ext4_sb_info *sbi = EXT4_SB(ac->ac_sb);
 	int ret;
 
 	BUG_ON(ac->ac_b_ex.fe_group != e4b->bd_group);
@@ -1553,10 +1591,10 @@ static void ext4_mb_use_best_found(struct ext4_allocation_context *ac,
 	get_page(ac->ac_buddy_page);
 	/* store last allocated for subsequent stream allocation */
 	if (ac->ac_flags & EXT4_MB_STREAM_ALLOC) {
-		spin_lock(&sbi->s_md_lock);
-		sbi->s_mb_last_group = ac->ac_f_ex.fe_group;
-		sbi->s_mb_last_start = ac->ac_f_ex.fe_start;
-		spin_unlock(&sbi->s_md_lock);
+		struct ext4_mb_goal *goal = ext4_mb_stream_goal(ac);
+
+		goal->group = ac->ac_f_ex.fe_group;
+		goal->start = ac->ac_f_ex.fe_start;
 	}
 }
 
@@ -1954,11 +1992,149 @@ static int ext4_mb_good_group(struct ext4_allocation_context *ac,
 	return 0;
 }
 
+/*
+ * Scan a group that looked good for criteria cr before its buddy was
+ * loaded.  Before the last criteria a group somebody else has locked is
+ * passed over: there are other groups to try, and queueing up behind
+ * another allocator in the same group is what we'd rather avoid.
+ */
+static int ext4_mb_scan_group(struct ext4_allocation_context *ac,
+			      ext4_group_t group, int cr)
+{
+	struct super_block *sb = ac->ac_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_buddy e4b;
+	int err;
+
+	err = ext4_mb_load_buddy(sb, group, &e4b);
+	if (err)
+		return err;
+
+	if (cr < 3) {
+		if (!ext4_trylock_group(sb, group)) {
+			ext4_mb_unload_buddy(&e4b);
+			if (sbi->s_mb_stats)
+				this_cpu_inc(sbi->s_mb_lat_stats->busy_skips);
+			return 0;
+		}
+	} else
+		ext4_lock_group(sb, group);
+
+	/*
+	 * We need to check again after locking the
+	 * block group
+	 */
+	if (!ext4_mb_good_group(ac, group, cr)) {
+		ext4_unlock_group(sb, group);
+		ext4_mb_unload_buddy(&e4b);
+		return 0;
+	}
+
+	ac->ac_groups_scanned++;
+	if (cr == 0)
+		ext4_mb_simple_scan_group(ac, &e4b);
+	else if (cr == 1 && sbi->s_stripe &&
+			!(ac->ac_g_ex.fe_len % sbi->s_stripe))
+		ext4_mb_scan_aligned(ac, &e4b);
+	else
+		ext4_mb_complex_scan_group(ac, &e4b);
+
+	ext4_unlock_group(sb, group);
+	ext4_mb_unload_buddy(&e4b);
+	return 0;
+}
+
+/*
+ * The smallest order of largest free extent a group must have to be
+ * worth scanning at criteria cr, or -1 if the index can't tell.  Only
+ * criteria 0, which wants a free buddy of the order of the request, is
+ * decided by the largest free order.  Criteria 1 goes by the average
+ * fragment size, which a group may satisfy without having any buddy of
+ * the order of the goal, so it scans the groups in order.
+ */
+static int ext4_mb_index_order(struct ext4_allocation_context *ac, int cr)
+{
+	if (!EXT4_SB(ac->ac_sb)->s_mb_optimize_scan)
+		return -1;
+
+	return cr == 0 ? ac->ac_2order : -1;
+}
+
+/*
+ * Pick a group with a free extent of at least 2^order blocks from the
+ * index.  The smallest such extents are tried first, to keep the large
+ * ones for requests that need them, and the group picked goes to the
+ * back of its list, so that allocators coming in at the same time are
+ * handed different groups.  Indexed groups are initialized, so
+ * ext4_mb_good_group() won't sleep here.
+ */
+static int ext4_mb_find_group_by_order(struct ext4_allocation_context *ac,
+				       int cr, int order, ext4_group_t ngroups,
+				       ext4_group_t *group)
+{
+	struct super_block *sb = ac->ac_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_group_info *grp;
+	int found = 0;
+
+	for (; order < MB_NUM_ORDERS(sb) && !found; order++) {
+		if (list_empty(&sbi->s_mb_largest_free_orders[order]))
+			continue;
+
+		spin_lock(&sbi->s_mb_largest_free_orders_locks[order]);
+		list_for_each_entry(grp, &sbi->s_mb_largest_free_orders[order],
+				    bb_largest_free_order_node) {
+			/* non-extent files are limited to low groups */
+			if (grp->bb_group >= ngroups ||
+			    !ext4_mb_good_group(ac, grp->bb_group, cr))
+				continue;
+
+			*group = grp->bb_group;
+			list_move_tail(&grp->bb_largest_free_order_node,
+				       &sbi->s_mb_largest_free_orders[order]);
+			found = 1;
+			break;
+		}
+		spin_unlock(&sbi->s_mb_largest_free_orders_locks[order]);
+	}
+	return found;
+}
+
+/*
+ * Scan the groups the index hands out for criteria cr.  Returns 1 if
+ * the groups need scanning in order as well: when the index gave up
+ * before running out of groups, or doesn't know all groups yet because
+ * some have never been initialized.
+ */
+static int ext4_mb_scan_by_index(struct ext4_allocation_context *ac, int cr,
+				 int order, ext4_group_t ngroups, int *err)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(ac->ac_sb);
+	ext4_group_t group;
+	int i;
+
+	for (i = 0; i < MB_MAX_INDEX_TRIES; i++) {
+		if (!ext4_mb_find_group_by_order(ac, cr, order, ngroups,
+						 &group))
+			break;
+
+		if (sbi->s_mb_stats)
+			this_cpu_inc(sbi->s_mb_lat_stats->index_hits);
+		*err = ext4_mb_scan_group(ac, group, cr);
+		if (*err || ac->ac_status != AC_STATUS_CONTINUE)
+			return 0;
+	}
+
+	return i == MB_MAX_INDEX_TRIES ||
+		atomic_read(&sbi->s_mb_groups_initialized) <
+		ext4_get_groups_count(ac->ac_sb);
+}
+
 static noinline_for_stack int
 ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 {
 	ext4_group_t ngroups, group, i;
-	int cr;
+	int cr, order;
 	int err = 0;
 	struct ext4_sb_info *sbi;
 	struct super_block *sb;
@@ -2001,13 +2177,12 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 			ac->ac_2order = i - 1;
 	}
 
-	/* if stream allocation is enabled, use global goal */
+	/* if stream allocation is enabled, use the stream's goal */
 	if (ac->ac_flags & EXT4_MB_STREAM_ALLOC) {
-		/* TBD: may be hot point */
-		spin_lock(&sbi->s_md_lock);
-		ac->ac_g_ex.fe_group = sbi->s_mb_last_group;
-		ac->ac_g_ex.fe_start = sbi->s_mb_last_start;
-		spin_unlock(&sbi->s_md_lock);
+		struct ext4_mb_goal *goal = ext4_mb_stream_goal(ac);
+
+		ac->ac_g_ex.fe_group = ACCESS_ONCE(goal->group);
+		ac->ac_g_ex.fe_start = ACCESS_ONCE(goal->start);
 	}
 
 	/* Let's just scan groups to find more-less suitable blocks */
@@ -2019,11 +2194,22 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 repeat:
 	for (; cr < 4 && ac->ac_status == AC_STATUS_CONTINUE; cr++) {
 		ac->ac_criteria = cr;
+
+		order = ext4_mb_index_order(ac, cr);
+		if (order >= 0 &&
+		    !ext4_mb_scan_by_index(ac, cr, order, ngroups, &err)) {
+			if (err)
+				goto out;
+			continue;
+		}
+
 		/*
 		 * searching for the right group start
 		 * from the goal value specified
 		 */
 		group = ac->ac_g_ex.fe_group;
+		if (group >= ngroups)
+			group = 0;
 
 		for (i = 0; i < ngroups; group++, i++) {
 			if (group == ngroups)
@@ -2033,34 +2219,10 @@ repeat:
 			if (!ext4_mb_good_group(ac, group, cr))
 				continue;
 
-			err = ext4_mb_load_buddy(sb, group, &e4b);
+			err = ext4_mb_scan_group(ac, group, cr);
 			if (err)
 				goto out;
 
-			ext4_lock_group(sb, group);
-
-			/*
-			 * We need to check again after locking the
-			 * block group
-			 */
-			if (!ext4_mb_good_group(ac, group, cr)) {
-				ext4_unlock_group(sb, group);
-				ext4_mb_unload_buddy(&e4b);
-				continue;
-			}
-
-			ac->ac_groups_scanned++;
-			if (cr == 0)
-				ext4_mb_simple_scan_group(ac, &e4b);
-			else if (cr == 1 && sbi->s_stripe &&
-					!(ac->ac_g_ex.fe_len % sbi->s_stripe))
-				ext4_mb_scan_aligned(ac, &e4b);
-			else
-				ext4_mb_complex_scan_group(ac, &e4b);
-
-			ext4_unlock_group(sb, group);
-			ext4_mb_unload_buddy(&e4b);
-
 			if (ac->ac_status != AC_STATUS_CONTINUE)
 				break;
 		}
@@ -2118,6 +2280,50 @@ static void *ext4_mb_seq_groups_next(struct seq_file *seq, void *v, loff_t *pos)
 	return (void *) ((unsigned long) group);
 }
 
+static void ext4_mb_seq_show_latency(struct seq_file *seq,
+				     struct super_block *sb)
+{
+	static const char * const paths[MB_LAT_PATHS] = {
+		"prealloc", "goal", "cr0", "cr1", "cr2", "cr3",
+	};
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_mb_lat_stats sum;
+	int cpu, i;
+
+	memset(&sum, 0, sizeof(sum));
+	for_each_possible_cpu(cpu) {
+		struct ext4_mb_lat_stats *stats;
+
+		stats = per_cpu_ptr(sbi->s_mb_lat_stats, cpu);
+		for (i = 0; i < MB_LAT_PATHS; i++) {
+			sum.total[i] += stats->total[i];
+			sum.count[i] += stats->count[i];
+		}
+		for (i = 0; i < MB_LAT_BUCKETS; i++)
+			sum.hist[i] += stats->hist[i];
+		sum.max = max(sum.max, stats->max);
+		sum.index_hits += stats->index_hits;
+		sum.busy_skips += stats->busy_skips;
+	}
+
+	seq_printf(seq, "# allocator latency, collected while mb_stats is "
+		   "set (%s)\n", sbi->s_mb_stats ? "on" : "off");
+	seq_printf(seq, "#%-9s %-10s %-10s\n", "path", "count", "avg_us");
+	for (i = 0; i < MB_LAT_PATHS; i++)
+		seq_printf(seq, "#%-9s %-10lu %-10llu\n", paths[i],
+			   sum.count[i], sum.count[i] ?
+			   div_u64(sum.total[i], sum.count[i]) : 0);
+	seq_printf(seq, "#%-9s", "usecs");
+	for (i = 0; i < MB_LAT_BUCKETS - 1; i++)
+		seq_printf(seq, " <%-9u", 4U << (2 * i));
+	seq_printf(seq, " >=%u\n#%-9s", 4U << (2 * (MB_LAT_BUCKETS - 2)), "");
+	for (i = 0; i < MB_LAT_BUCKETS; i++)
+		seq_printf(seq, " %-10lu", sum.hist[i]);
+	seq_printf(seq, "\n# max %lu us, %lu groups from the index, "
+		   "%lu busy groups passed over\n",
+		   sum.max, sum.index_hits, sum.busy_skips);
+}
+
 static int ext4_mb_seq_groups_show(struct seq_file *seq, void *v)
 {
 	struct super_block *sb = seq->private;
@@ -2131,13 +2337,15 @@ static int ext4_mb_seq_groups_show(struct seq_file *seq, void *v)
 	} sg;
 
 	group--;
-	if (group == 0)
+	if (group == 0) {
+		ext4_mb_seq_show_latency(seq, sb);
 		seq_printf(seq, "#%-5s: %-5s %-5s %-5s "
 				"[ %-5s %-5s %-5s %-5s %-5s %-5s %-5s "
 				  "%-5s %-5s %-5s %-5s %-5s %-5s %-5s ]\n",
 			   "group", "free", "frags", "first",
 			   "2^0", "2^1", "2^2", "2^3", "2^4", "2^5", "2^6",
 			   "2^7", "2^8", "2^9", "2^10", "2^11", "2^12", "2^13");
+	}
 
 	i = (sb->s_blocksize_bits + 2) * sizeof(sg.info.bb_counters[0]) +
 		sizeof(struct ext4_group_info);
@@ -2257,9 +2465,11 @@ int ext4_mb_add_groupinfo(struct super_block *sb, ext4_group_t group,
 	}
 
 	INIT_LIST_HEAD(&meta_group_info[i]->bb_prealloc_list);
+	INIT_LIST_HEAD(&meta_group_info[i]->bb_largest_free_order_node);
 	init_rwsem(&meta_group_info[i]->alloc_sem);
 	meta_group_info[i]->bb_free_root = RB_ROOT;
 	meta_group_info[i]->bb_largest_free_order = -1;  /* uninit */
+	meta_group_info[i]->bb_group = group;
 
 #ifdef DOUBLE_CHECK
 	{
@@ -2418,6 +2628,7 @@ static int ext4_groupinfo_create_slab(size_t size)
 int ext4_mb_init(struct super_block *sb, int needs_recovery)
 {
 	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	ext4_group_t ngroups;
 	unsigned i, j;
 	unsigned offset;
 	unsigned max;
@@ -2457,6 +2668,22 @@ int ext4_mb_init(struct super_block *sb, int needs_recovery)
 		i++;
 	} while (i <= sb->s_blocksize_bits + 1);
 
+	i = MB_NUM_ORDERS(sb);
+	sbi->s_mb_largest_free_orders =
+		kmalloc(i * sizeof(struct list_head), GFP_KERNEL);
+	sbi->s_mb_largest_free_orders_locks =
+		kmalloc(i * sizeof(spinlock_t), GFP_KERNEL);
+	if (sbi->s_mb_largest_free_orders == NULL ||
+	    sbi->s_mb_largest_free_orders_locks == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	for (j = 0; j < i; j++) {
+		INIT_LIST_HEAD(&sbi->s_mb_largest_free_orders[j]);
+		spin_lock_init(&sbi->s_mb_largest_free_orders_locks[j]);
+	}
+	atomic_set(&sbi->s_mb_groups_initialized, 0);
+
 	/* init file for buddy data */
 	ret = ext4_mb_init_backend(sb);
 	if (ret != 0) {
@@ -2472,6 +2699,25 @@ int ext4_mb_init(struct super_block *sb, int needs_recovery)
 	sbi->s_mb_stream_request = MB_DEFAULT_STREAM_THRESHOLD;
 	sbi->s_mb_order2_reqs = MB_DEFAULT_ORDER2_REQS;
 	sbi->s_mb_group_prealloc = MB_DEFAULT_GROUP_PREALLOC;
+	sbi->s_mb_optimize_scan = MB_DEFAULT_OPTIMIZE_SCAN;
+
+	ngroups = ext4_get_groups_count(sb);
+	sbi->s_mb_nr_last_goals = min_t(unsigned, num_possible_cpus(), ngroups);
+	sbi->s_mb_last_goals = kzalloc(sbi->s_mb_nr_last_goals *
+				       sizeof(struct ext4_mb_goal), GFP_KERNEL);
+	if (sbi->s_mb_last_goals == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < sbi->s_mb_nr_last_goals; i++)
+		sbi->s_mb_last_goals[i].group =
+			ngroups / sbi->s_mb_nr_last_goals * i;
+
+	sbi->s_mb_lat_stats = alloc_percpu(struct ext4_mb_lat_stats);
+	if (sbi->s_mb_lat_stats == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
 
 	sbi->s_locality_groups = alloc_percpu(struct ext4_locality_group);
 	if (sbi->s_locality_groups == NULL) {
@@ -2497,6 +2743,10 @@ out:
 	if (ret) {
 		kfree(sbi->s_mb_offsets);
 		kfree(sbi->s_mb_maxs);
+		kfree(sbi->s_mb_largest_free_orders);
+		kfree(sbi->s_mb_largest_free_orders_locks);
+		kfree(sbi->s_mb_last_goals);
+		free_percpu(sbi->s_mb_lat_stats);
 	}
 	return ret;
 }
@@ -2548,6 +2798,9 @@ int ext4_mb_release(struct super_block *sb)
 	}
 	kfree(sbi->s_mb_offsets);
 	kfree(sbi->s_mb_maxs);
+	kfree(sbi->s_mb_largest_free_orders);
+	kfree(sbi->s_mb_largest_free_orders_locks);
+	kfree(sbi->s_mb_last_goals);
 	if (sbi->s_buddy_cache)
 		iput(sbi->s_buddy_cache);
 	if (sbi->s_mb_stats) {
@@ -2575,6 +2828,7 @@ int ext4_mb_release(struct super_block *sb)
 	}
 
 	free_percpu(sbi->s_locality_groups);
+	free_percpu(sbi->s_mb_lat_stats);
 	if (sbi->s_proc)
 		remove_proc_entry("mb_groups", sbi->s_proc);
 
@@ -3059,6 +3313,40 @@ static void ext4_mb_collect_stats(struct ext4_allocation_context *ac)
 		trace_ext4_mballoc_prealloc(ac);
 }
 
+/*
+ * Account the time ext4_mb_new_blocks() took for ac by the way the
+ * blocks were found
+ */
+static void ext4_mb_collect_latency(struct ext4_allocation_context *ac,
+				    ktime_t start)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(ac->ac_sb);
+	struct ext4_mb_lat_stats *stats;
+	s64 usecs = ktime_us_delta(ktime_get(), start);
+	int path, bucket;
+
+	if (ac->ac_op == EXT4_MB_HISTORY_PREALLOC)
+		path = MB_LAT_PREALLOC;
+	else if (ac->ac_status == AC_STATUS_FOUND && !ac->ac_groups_scanned)
+		path = MB_LAT_GOAL;
+	else
+		path = MB_LAT_CR0 + ac->ac_criteria;
+
+	if (usecs < 0)
+		usecs = 0;
+	bucket = usecs ? (fls64(usecs) - 1) / 2 : 0;
+	if (bucket >= MB_LAT_BUCKETS)
+		bucket = MB_LAT_BUCKETS - 1;
+
+	stats = get_cpu_ptr(sbi->s_mb_lat_stats);
+	stats->total[path] += usecs;
+	stats->count[path]++;
+	stats->hist[bucket]++;
+	if (usecs > stats->max)
+		stats->max = usecs;
+	put_cpu_ptr(sbi->s_mb_lat_stats);
+}
+
 /*
  * Called on failure; free up any blocks from the inode PA for this
  * context.  We don't need this for MB_GROUP_PA because we only change
@@ -4218,6 +4506,7 @@ ext4_fsblk_t ext4_mb_new_blocks(handle_t *handle,
 	ext4_fsblk_t block = 0;
 	unsigned int inquota = 0;
 	unsigned int reserv_blks = 0;
+	ktime_t start = ktime_set(0, 0);
 
 	sb = ar->inode->i_sb;
 	sbi = EXT4_SB(sb);
@@ -4277,6 +4566,8 @@ ext4_fsblk_t ext4_mb_new_blocks(handle_t *handle,
 		ar->len = 0;
 		goto out;
 	}
+	if (sbi->s_mb_stats)
+		start = ktime_get();
 
 	ac->ac_op = EXT4_MB_HISTORY_PREALLOC;
 	if (!ext4_mb_use_preallocated(ac)) {
@@ -4327,6 +4618,8 @@ repeat:
 		ar->len = 0;
 		ext4_mb_show_ac(ac);
 	}
+	if (start.tv64)
+		ext4_mb_collect_latency(ac, start);
 	ext4_mb_release_context(ac);
 out:
 	if (ac)
@@ -4475,6 +4768,7 @@ void ext4_free_blocks(handle_t *handle, struct inode *inode,
 	}
 
 	sbi = EXT4_SB(sb);
+	ext4_fc_mark_ineligible(handle, inode);
 	if (!(flags & EXT4_FREE_BLOCKS_VALIDATED) &&
 	    !ext4_data_block_valid(sbi, block, count)) {
 		ext4_error(sb, "Freeing blocks not in datazone - "
@@ -94,6 +94,21 @@ extern u8 mb_enable_debug;
  */
 #define MB_DEFAULT_GROUP_PREALLOC	512
 
+/*
+ * find groups for 2^N and larger requests through the index of groups
+ * by largest free extent instead of scanning them in order
+ */
+#define MB_DEFAULT_OPTIMIZE_SCAN	1
+
+/*
+ * How many groups the index hands out at one criteria before mballoc
+ * falls back to scanning the groups in order
+ */
+#define MB_MAX_INDEX_TRIES		8
+
+/* number of buddy orders, order 0 being the bitmap */
+#define MB_NUM_ORDERS(sb)		((sb)->s_blocksize_bits + 2)
+
 
 struct ext4_free_data {
 	/* this links the free block information from group_info */
@@ -197,6 +212,38 @@ struct ext4_allocation_context {
 	struct ext4_locality_group *ac_lg;
 };
 
+/* stream allocation goal, see ext4_mb_stream_goal() */
+struct ext4_mb_goal {
+	ext4_group_t	group;
+	ext4_grpblk_t	start;
+};
+
+/*
+ * Allocator latency, collected per cpu when mb_stats is set and shown
+ * in /proc/fs/ext4/<dev>/mb_groups.  Allocations are accounted by how
+ * they were satisfied; the histogram buckets are powers of 4 usecs.
+ */
+enum {
+	MB_LAT_PREALLOC,		/* from preallocated space */
+	MB_LAT_GOAL,			/* at the goal */
+	MB_LAT_CR0,			/* buddy search, criteria 0 to 3 */
+	MB_LAT_CR1,
+	MB_LAT_CR2,
+	MB_LAT_CR3,
+	MB_LAT_PATHS
+};
+
+#define MB_LAT_BUCKETS		8
+
+struct ext4_mb_lat_stats {
+	u64		total[MB_LAT_PATHS];	/* usecs */
+	unsigned long	count[MB_LAT_PATHS];
+	unsigned long	hist[MB_LAT_BUCKETS];
+	unsigned long	max;			/* usecs */
+	unsigned long	index_hits;		/* groups found in the index */
+	unsigned long	busy_skips;		/* locked groups passed over */
+};
+
 #define AC_STATUS_CONTINUE	1
 #define AC_STATUS_FOUND		2
 #define AC_STATUS_BREAK		3
@@ -837,6 +837,43 @@ static inline int search_dirblock(struct buffer_head *bh,
 	return 0;
 }
 
+/*
+ * Search the blocks the dircache of the directory says the name may be
+ * in.  Returns 0 if the directory has to be searched on disk, and 1 with
+ * the buffer of the entry in *res_bh, or NULL if there is none, if not.
+ */
+static int ext4_dc_find_entry(struct inode *dir, const struct qstr *d_name,
+			      struct ext4_dir_entry_2 **res_dir,
+			      struct buffer_head **res_bh)
+{
+	ext4_lblk_t blocks[EXT4_DC_MAX_CANDIDATES];
+	struct buffer_head *bh;
+	int nr, i, ret, err;
+
+	nr = ext4_dc_candidates(dir, d_name, blocks, EXT4_DC_MAX_CANDIDATES);
+	if (nr < 0)
+		return 0;
+	*res_bh = NULL;
+	for (i = 0; i < nr; i++) {
+		bh = ext4_bread(NULL, dir, blocks[i], 0, &err);
+		if (!bh) {
+			/* let the full search skip and report it */
+			ext4_dc_drop(dir);
+			return 0;
+		}
+		ret = search_dirblock(bh, dir, d_name,
+			blocks[i] << EXT4_BLOCK_SIZE_BITS(dir->i_sb), res_dir);
+		if (ret == 1) {
+			EXT4_I(dir)->i_dir_start_lookup = blocks[i];
+			*res_bh = bh;
+			return 1;
+		}
+		brelse(bh);
+		if (ret < 0)
+			break;
+	}
+	return 1;
+}
 
 /*
  *	ext4_find_entry()
@@ -882,6 +919,8 @@ static struct buffer_head * ext4_find_entry (struct inode *dir,
 		nblocks = 1;
 		goto restart;
 	}
+	if (ext4_dc_find_entry(dir, d_name, res_dir, &bh))
+		return bh;
 	if (is_dx(dir)) {
 		bh = ext4_dx_find_entry(dir, d_name, res_dir, &err);
 		/*
@@ -1151,12 +1190,13 @@ static struct ext4_dir_entry_2* dx_pack_dirents(char *base, unsigned blocksize)
  */
 static struct ext4_dir_entry_2 *do_split(handle_t *handle, struct inode *dir,
 			struct buffer_head **bh,struct dx_frame *frame,
-			struct dx_hash_info *hinfo, int *error)
+			struct dx_hash_info *hinfo, ext4_lblk_t *block,
+			int *error)
 {
 	unsigned blocksize = dir->i_sb->s_blocksize;
 	unsigned count, continued;
 	struct buffer_head *bh2;
-	ext4_lblk_t newblock;
+	ext4_lblk_t oldblock = dx_get_block(frame->at), newblock;
 	u32 hash2;
 	struct dx_map_entry *map;
 	char *data1 = (*bh)->b_data, *data2;
@@ -1216,12 +1256,15 @@ static struct ext4_dir_entry_2 *do_split(handle_t *handle, struct inode *dir,
 					    blocksize);
 	dxtrace(dx_show_leaf (hinfo, (struct ext4_dir_entry_2 *) data1, blocksize, 1));
 	dxtrace(dx_show_leaf (hinfo, (struct ext4_dir_entry_2 *) data2, blocksize, 1));
+	ext4_dc_split(dir, bh2, oldblock, newblock);
 
 	/* Which block gets the new entry? */
+	*block = oldblock;
 	if (hinfo->hash >= hash2)
 	{
 		swap(*bh, bh2);
 		de = de2;
+		*block = newblock;
 	}
 	dx_insert_block(frame, hash2 + continued, newblock);
 	err = ext4_handle_dirty_metadata(handle, dir, bh2);
@@ -1254,7 +1297,7 @@ errout:
  */
 static int add_dirent_to_buf(handle_t *handle, struct dentry *dentry,
 			     struct inode *inode, struct ext4_dir_entry_2 *de,
-			     struct buffer_head *bh)
+			     struct buffer_head *bh, ext4_lblk_t block)
 {
 	struct inode	*dir = dentry->d_parent->d_inode;
 	const char	*name = dentry->d_name.name;
@@ -1323,6 +1366,8 @@ static int add_dirent_to_buf(handle_t *handle, struct dentry *dentry,
 	ext4_update_dx_flag(dir);
 	dir->i_version++;
 	ext4_mark_inode_dirty(handle, dir);
+	if (inode)
+		ext4_dc_add(dir, name, namelen, block, bh);
 	BUFFER_TRACE(bh, "call ext4_handle_dirty_metadata");
 	err = ext4_handle_dirty_metadata(handle, dir, bh);
 	if (err)
@@ -1381,6 +1426,7 @@ static int make_indexed_dir(handle_t *handle, struct dentry *dentry,
 		return retval;
 	}
 	ext4_set_inode_flag(dir, EXT4_INODE_INDEX);
+	ext4_dc_drop(dir);
 	data1 = bh2->b_data;
 
 	memcpy (data1, de, len);
@@ -1417,7 +1463,7 @@ static int make_indexed_dir(handle_t *handle, struct dentry *dentry,
 	ext4_handle_dirty_metadata(handle, dir, frame->bh);
 	ext4_handle_dirty_metadata(handle, dir, bh);
 
-	de = do_split(handle,dir, &bh, frame, &hinfo, &retval);
+	de = do_split(handle,dir, &bh, frame, &hinfo, &block, &retval);
 	if (!de) {
 		/*
 		 * Even if the block split failed, we have to properly write
@@ -1430,7 +1476,7 @@ static int make_indexed_dir(handle_t *handle, struct dentry *dentry,
 	}
 	dx_release(frames);
 
-	retval = add_dirent_to_buf(handle, dentry, inode, de, bh);
+	retval = add_dirent_to_buf(handle, dentry, inode, de, bh, block);
 	brelse(bh);
 	return retval;
 }
@@ -1454,7 +1500,7 @@ static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
 	struct super_block *sb;
 	int	retval;
 	int	dx_fallback=0;
-	unsigned blocksize;
+	unsigned blocksize, reclen;
 	ext4_lblk_t block, blocks;
 
 	sb = dir->i_sb;
@@ -1466,15 +1512,20 @@ static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
 		if (!retval || (retval != ERR_BAD_DX_DIR))
 			return retval;
 		ext4_clear_inode_flag(dir, EXT4_INODE_INDEX);
+		ext4_dc_drop(dir);
 		dx_fallback++;
 		ext4_mark_inode_dirty(handle, dir);
 	}
 	blocks = dir->i_size >> sb->s_blocksize_bits;
-	for (block = 0; block < blocks; block++) {
+	reclen = EXT4_DIR_REC_LEN(dentry->d_name.len);
+	/* The dircache knows which blocks are too full to bother reading */
+	for (block = ext4_dc_room(dir, 0, reclen); block < blocks;
+	     block = ext4_dc_room(dir, block + 1, reclen)) {
 		bh = ext4_bread(handle, dir, block, 0, &retval);
 		if(!bh)
 			return retval;
-		retval = add_dirent_to_buf(handle, dentry, inode, NULL, bh);
+		retval = add_dirent_to_buf(handle, dentry, inode, NULL, bh,
+					   block);
 		if (retval != -ENOSPC) {
 			brelse(bh);
 			return retval;
@@ -1491,7 +1542,7 @@ static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
 	de = (struct ext4_dir_entry_2 *) bh->b_data;
 	de->inode = 0;
 	de->rec_len = ext4_rec_len_to_disk(blocksize, blocksize);
-	retval = add_dirent_to_buf(handle, dentry, inode, de, bh);
+	retval = add_dirent_to_buf(handle, dentry, inode, de, bh, block);
 	brelse(bh);
 	if (retval == 0)
 		ext4_set_inode_state(inode, EXT4_STATE_NEWENTRY);
@@ -1511,6 +1562,7 @@ static int ext4_dx_add_entry(handle_t *handle, struct dentry *dentry,
 	struct inode *dir = dentry->d_parent->d_inode;
 	struct super_block *sb = dir->i_sb;
 	struct ext4_dir_entry_2 *de;
+	ext4_lblk_t block;
 	int err;
 
 	frame = dx_probe(&dentry->d_name, dir, &hinfo, frames, &err);
@@ -1518,8 +1570,9 @@ static int ext4_dx_add_entry(handle_t *handle, struct dentry *dentry,
 		return err;
 	entries = frame->entries;
 	at = frame->at;
+	block = dx_get_block(frame->at);
 
-	if (!(bh = ext4_bread(handle,dir, dx_get_block(frame->at), 0, &err)))
+	if (!(bh = ext4_bread(handle,dir, block, 0, &err)))
 		goto cleanup;
 
 	BUFFER_TRACE(bh, "get_write_access");
@@ -1527,7 +1580,7 @@ static int ext4_dx_add_entry(handle_t *handle, struct dentry *dentry,
 	if (err)
 		goto journal_error;
 
-	err = add_dirent_to_buf(handle, dentry, inode, NULL, bh);
+	err = add_dirent_to_buf(handle, dentry, inode, NULL, bh, block);
 	if (err != -ENOSPC)
 		goto cleanup;
 
@@ -1621,10 +1674,10 @@ static int ext4_dx_add_entry(handle_t *handle, struct dentry *dentry,
 			goto cleanup;
 		}
 	}
-	de = do_split(handle, dir, &bh, frame, &hinfo, &err);
+	de = do_split(handle, dir, &bh, frame, &hinfo, &block, &err);
 	if (!de)
 		goto cleanup;
-	err = add_dirent_to_buf(handle, dentry, inode, de, bh);
+	err = add_dirent_to_buf(handle, dentry, inode, de, bh, block);
 	goto cleanup;
 
 journal_error:
@@ -1671,6 +1724,7 @@ static int ext4_delete_entry(handle_t *handle,
 					blocksize);
 			else
 				de->inode = 0;
+			ext4_dc_delete(dir, de_del->name, de_del->name_len, bh);
 			dir->i_version++;
 			BUFFER_TRACE(bh, "call ext4_handle_dirty_metadata");
 			err = ext4_handle_dirty_metadata(handle, dir, bh);
@@ -1985,6 +2039,7 @@ int ext4_orphan_add(handle_t *handle, struct inode *inode)
 	if (!ext4_handle_valid(handle))
 		return 0;
 
+	ext4_fc_mark_ineligible(handle, inode);
 	mutex_lock(&EXT4_SB(sb)->s_orphan_lock);
 	if (!list_empty(&EXT4_I(inode)->i_orphan))
 		goto out_unlock;
@@ -2175,6 +2230,7 @@ static int ext4_rmdir(struct inode *dir, struct dentry *dentry)
 	 * zero will ensure that the right thing happens during any
 	 * recovery. */
 	inode->i_size = 0;
+	ext4_dc_drop(inode);
 	ext4_orphan_add(handle, inode);
 	inode->i_ctime = dir->i_ctime = dir->i_mtime = ext4_current_time(inode);
 	ext4_mark_inode_dirty(handle, inode);
@@ -2226,6 +2282,7 @@ static int ext4_unlink(struct inode *dir, struct dentry *dentry)
 			     inode->i_ino, inode->i_nlink);
 		inode->i_nlink = 1;
 	}
+	ext4_fc_mark_ineligible(handle, inode);
 	retval = ext4_delete_entry(handle, dir, de, bh);
 	if (retval)
 		goto end_unlink;
@@ -2376,6 +2433,7 @@ retry:
 
 	inode->i_ctime = ext4_current_time(inode);
 	ext4_inc_count(handle, inode);
+	ext4_fc_mark_ineligible(handle, inode);
 	ihold(inode);
 
 	err = ext4_add_entry(handle, dentry, inode);
@@ -2439,6 +2497,9 @@ static int ext4_rename(struct inode *old_dir, struct dentry *old_dentry,
 		goto end_rename;
 
 	new_inode = new_dentry->d_inode;
+	ext4_fc_mark_ineligible(handle, old_inode);
+	if (new_inode)
+		ext4_fc_mark_ineligible(handle, new_inode);
 	new_bh = ext4_find_entry(new_dir, &new_dentry->d_name, &new_de);
 	if (new_bh) {
 		if (!new_inode) {
@@ -182,6 +182,7 @@ static int setup_new_group_blocks(struct super_block *sb,
 		return PTR_ERR(handle);
 
 	mutex_lock(&sbi->s_resize_lock);
+	ext4_fc_mark_fs_ineligible(handle, sb);
 	if (input->group != sbi->s_groups_count) {
 		err = -EBUSY;
 		goto exit_journal;
@@ -800,6 +801,7 @@ int ext4_group_add(struct super_block *sb, struct ext4_new_group_data *input)
 	}
 
 	mutex_lock(&sbi->s_resize_lock);
+	ext4_fc_mark_fs_ineligible(handle, sb);
 	if (input->group != sbi->s_groups_count) {
 		ext4_warning(sb, "multiple resizers run on filesystem!");
 		err = -EBUSY;
@@ -1039,6 +1041,7 @@ int ext4_group_extend(struct super_block *sb, struct ext4_super_block *es,
 	}
 
 	mutex_lock(&EXT4_SB(sb)->s_resize_lock);
+	ext4_fc_mark_fs_ineligible(handle, sb);
 	if (o_blocks_count != ext4_blocks_count(es)) {
 		ext4_warning(sb, "multiple resizers run on filesystem!");
 		mutex_unlock(&EXT4_SB(sb)->s_resize_lock);
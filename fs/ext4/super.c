@@ -770,6 +770,7 @@ static void ext4_put_super(struct super_block *sb)
 		if (err < 0)
 			ext4_abort(sb, "Couldn't clean up the journal");
 	}
+	ext4_fc_release(sb);
 
 	del_timer(&sbi->s_err_report);
 	ext4_release_system_zone(sb);
@@ -869,6 +870,11 @@ static struct inode *ext4_alloc_inode(struct super_block *sb)
 	ei->cur_aio_dio = NULL;
 	ei->i_sync_tid = 0;
 	ei->i_datasync_tid = 0;
+	spin_lock_init(&ei->i_fc_lock);
+	ei->i_fc_tid = 0;
+	ei->i_fc_ineligible = 0;
+	ei->i_fc = NULL;
+	ei->i_dir_cache = NULL;
 	atomic_set(&ei->i_ioend_count, 0);
 	atomic_set(&ei->i_aiodio_unwritten, 0);
 
@@ -945,6 +951,8 @@ void ext4_clear_inode(struct inode *inode)
 		jbd2_free_inode(EXT4_I(inode)->jinode);
 		EXT4_I(inode)->jinode = NULL;
 	}
+	ext4_fc_clear_inode(inode);
+	ext4_dc_drop(inode);
 }
 
 static inline void ext4_show_quota_options(struct seq_file *seq,
@@ -1118,6 +1126,9 @@ static int ext4_show_options(struct seq_file *seq, struct vfsmount *vfs)
 		seq_printf(seq, ",init_itable=%u",
 			   (unsigned) sbi->s_li_wait_mult);
 
+	if (test_opt2(sb, FAST_COMMIT))
+		seq_puts(seq, ",fast_commit");
+
 	ext4_show_quota_options(seq, sb);
 
 	return 0;
@@ -1292,6 +1303,7 @@ enum {
 	Opt_inode_readahead_blks, Opt_journal_ioprio,
 	Opt_dioread_nolock, Opt_dioread_lock,
 	Opt_discard, Opt_nodiscard, Opt_init_itable, Opt_noinit_itable,
+	Opt_fast_commit, Opt_nofast_commit,
 };
 
 static const match_table_t tokens = {
@@ -1367,6 +1379,8 @@ static const match_table_t tokens = {
 	{Opt_init_itable, "init_itable=%u"},
 	{Opt_init_itable, "init_itable"},
 	{Opt_noinit_itable, "noinit_itable"},
+	{Opt_fast_commit, "fast_commit"},
+	{Opt_nofast_commit, "nofast_commit"},
 	{Opt_err, NULL},
 };
 
@@ -1857,6 +1871,12 @@ set_qf_format:
 		case Opt_noinit_itable:
 			clear_opt(sb, INIT_INODE_TABLE);
 			break;
+		case Opt_fast_commit:
+			set_opt2(sb, FAST_COMMIT);
+			break;
+		case Opt_nofast_commit:
+			clear_opt2(sb, FAST_COMMIT);
+			break;
 		default:
 			ext4_msg(sb, KERN_ERR,
 			       "Unrecognized mount option \"%s\" "
@@ -2530,6 +2550,7 @@ EXT4_RW_ATTR_SBI_UI(mb_min_to_scan, s_mb_min_to_scan);
 EXT4_RW_ATTR_SBI_UI(mb_order2_req, s_mb_order2_reqs);
 EXT4_RW_ATTR_SBI_UI(mb_stream_req, s_mb_stream_request);
 EXT4_RW_ATTR_SBI_UI(mb_group_prealloc, s_mb_group_prealloc);
+EXT4_RW_ATTR_SBI_UI(mb_optimize_scan, s_mb_optimize_scan);
 EXT4_RW_ATTR_SBI_UI(max_writeback_mb_bump, s_max_writeback_mb_bump);
 
 static struct attribute *ext4_attrs[] = {
@@ -2546,6 +2567,7 @@ static struct attribute *ext4_attrs[] = {
 	ATTR_LIST(mb_order2_req),
 	ATTR_LIST(mb_stream_req),
 	ATTR_LIST(mb_group_prealloc),
+	ATTR_LIST(mb_optimize_scan),
 	ATTR_LIST(max_writeback_mb_bump),
 	NULL,
 };
@@ -3572,6 +3594,13 @@ static int ext4_fill_super(struct super_block *sb, void *data, int silent)
 	}
 	set_task_ioprio(sbi->s_journal->j_task, journal_ioprio);
 
+	if (test_opt2(sb, FAST_COMMIT) && !(sb->s_flags & MS_RDONLY)) {
+		err = ext4_fc_setup(sb);
+		if (err)
+			ext4_msg(sb, KERN_WARNING, "fast commits not "
+				 "available (%d)", err);
+	}
+
 	/*
 	 * The journal may have updated the bg summary counts, so we
 	 * need to update the global counters.
@@ -3737,6 +3766,7 @@ failed_mount_wq:
 		jbd2_journal_destroy(sbi->s_journal);
 		sbi->s_journal = NULL;
 	}
+	ext4_fc_release(sb);
 failed_mount3:
 	del_timer(&sbi->s_err_report);
 	if (sbi->s_flex_groups) {
@@ -3995,6 +4025,7 @@ static int ext4_load_journal(struct super_block *sb,
 		}
 	}
 
+	journal->j_fc_replay = ext4_fc_replay;
 	if (!EXT4_HAS_INCOMPAT_FEATURE(sb, EXT4_FEATURE_INCOMPAT_RECOVER))
 		err = jbd2_journal_wipe(journal, !really_read_only);
 	if (!err) {
@@ -4435,6 +4466,27 @@ static int ext4_remount(struct super_block *sb, int *flags, char *data)
 		ext4_register_li_request(sb, first_not_zeroed);
 	}
 
+	/*
+	 * The fast commit area can only be set up in an empty journal.
+	 * If it exists, nothing was tracked while the option was off.
+	 */
+	if (sbi->s_journal && test_opt2(sb, FAST_COMMIT) &&
+	    !(sb->s_flags & MS_RDONLY)) {
+		if (sbi->s_fc_bufs[0])
+			ext4_fc_mark_fs_ineligible(NULL, sb);
+		else {
+			jbd2_journal_lock_updates(sbi->s_journal);
+			err = jbd2_journal_flush(sbi->s_journal);
+			if (!err)
+				err = ext4_fc_setup(sb);
+			jbd2_journal_unlock_updates(sbi->s_journal);
+			if (err)
+				ext4_msg(sb, KERN_WARNING, "fast commits not "
+					 "available (%d)", err);
+			err = 0;
+		}
+	}
+
 	ext4_setup_system_zone(sb);
 	if (sbi->s_journal == NULL)
 		ext4_commit_super(sb, 1);
@@ -4973,6 +5025,7 @@ static int __init ext4_init_fs(void)
 	err = init_inodecache();
 	if (err)
 		goto out1;
+	ext4_init_dir_cache();
 	register_as_ext3();
 	register_as_ext2();
 	err = register_filesystem(&ext4_fs_type);
@@ -4985,6 +5038,7 @@ static int __init ext4_init_fs(void)
 out:
 	unregister_as_ext2();
 	unregister_as_ext3();
+	ext4_exit_dir_cache();
 	destroy_inodecache();
 out1:
 	ext4_exit_xattr();
@@ -5009,6 +5063,7 @@ static void __exit ext4_exit_fs(void)
 	unregister_as_ext2();
 	unregister_as_ext3();
 	unregister_filesystem(&ext4_fs_type);
+	ext4_exit_dir_cache();
 	destroy_inodecache();
 	ext4_exit_xattr();
 	ext4_exit_mballoc();
@@ -23,8 +23,11 @@
 #include <linux/poll.h>
 #include <linux/workqueue.h>
 
-/** Max number of pages that can be used in a single read request */
-#define FUSE_MAX_PAGES_PER_REQ 32
+/** Default max number of pages that can be used in a single read request */
+#define FUSE_DEFAULT_MAX_PAGES_PER_REQ 32
+
+/** Largest max_pages the filesystem may ask for in the INIT reply (1MB) */
+#define FUSE_MAX_MAX_PAGES 256
 
 /** Bias for fi->writectr, meaning new writepages must not be sent */
 #define FUSE_NOWRITE INT_MIN
@@ -32,6 +35,9 @@
 /** It could be as large as PATH_MAX, but would that have any uses? */
 #define FUSE_NAME_MAX 1024
 
+/** Magic number of FUSE superblocks */
+#define FUSE_SUPER_MAGIC 0x65735546
+
 /** Number of dentries for each connection in the control filesystem */
 #define FUSE_CTL_NUM_DENTRIES 5
 
@@ -104,6 +110,15 @@ struct fuse_inode {
 
 struct fuse_conn;
 
+/** Backing file given by the filesystem in an OPEN or CREATE reply */
+struct fuse_passthrough {
+	/** File on the lower filesystem, or NULL */
+	struct file *filp;
+
+	/** Credentials of the daemon, used for I/O on filp */
+	const struct cred *cred;
+};
+
 /** FUSE specific file data */
 struct fuse_file {
 	/** Fuse connection for this file */
@@ -135,6 +150,9 @@ struct fuse_file {
 
 	/** Wait queue head for poll */
 	wait_queue_head_t poll_wait;
+
+	/** Backing file if opened with FOPEN_PASSTHROUGH */
+	struct fuse_passthrough passthrough;
 };
 
 /** One input argument of a request */
@@ -284,8 +302,14 @@ struct fuse_req {
 		struct fuse_lk_in lk_in;
 	} misc;
 
-	/** page vector */
-	struct page *pages[FUSE_MAX_PAGES_PER_REQ];
+	/** page vector, inline_pages unless more pages were asked for */
+	struct page **pages;
+
+	/** size of the page vector */
+	unsigned max_pages;
+
+	/** inline page vector */
+	struct page *inline_pages[FUSE_DEFAULT_MAX_PAGES_PER_REQ];
 
 	/** number of pages in vector */
 	unsigned num_pages;
@@ -307,6 +331,38 @@ struct fuse_req {
 
 	/** Request is stolen from fuse_file->reserved_req */
 	struct file *stolen_file;
+
+	/** Backing file taken from an OPEN or CREATE reply */
+	struct fuse_passthrough passthrough;
+};
+
+/**
+ * An open /dev/fuse file attached to a connection.
+ *
+ * The file passed in the mount options is the first one, further ones
+ * are attached with the FUSE_DEV_IOC_CLONE ioctl.  Each has its own
+ * queue of requests, so that the daemon can dedicate a thread to each
+ * and requests do not all funnel through one queue and one waitq.
+ * Everything in here is protected by fc->lock.
+ */
+struct fuse_dev {
+	/** The connection */
+	struct fuse_conn *fc;
+
+	/** Readers of this device are waiting on this */
+	wait_queue_head_t waitq;
+
+	/** The list of pending requests queued to this device */
+	struct list_head pending;
+
+	/** The list of requests read from this device awaiting a reply */
+	struct list_head processing;
+
+	/** The cpu this device was last read on, -1 before the first read */
+	int cpu;
+
+	/** Entry on fc->devices */
+	struct list_head entry;
 };
 
 /**
@@ -341,14 +397,11 @@ struct fuse_conn {
 	/** Maximum write size */
 	unsigned max_write;
 
-	/** Readers of the connection are waiting on this */
-	wait_queue_head_t waitq;
-
-	/** The list of pending requests */
-	struct list_head pending;
+	/** Maximum number of pages in a read or write request */
+	unsigned max_pages;
 
-	/** The list of requests being processed */
-	struct list_head processing;
+	/** Device files of this connection (struct fuse_dev) */
+	struct list_head devices;
 
 	/** The list of requests under I/O */
 	struct list_head io;
@@ -472,6 +525,13 @@ struct fuse_conn {
 	/** Don't apply umask to creation modes */
 	unsigned dont_mask:1;
 
+	/** Open replies may carry backing files */
+	unsigned passthrough:1;
+
+	/** Buffered writes stay in the page cache, i_size and mtime are
+	    kept by the kernel */
+	unsigned writeback_cache:1;
+
 	/** The number of requests waiting for completion */
 	atomic_t num_waiting;
 
@@ -644,7 +704,7 @@ void fuse_ctl_cleanup(void);
  */
 struct fuse_req *fuse_request_alloc(void);
 
-struct fuse_req *fuse_request_alloc_nofs(void);
+struct fuse_req *fuse_request_alloc_nofs(unsigned npages);
 
 /**
  * Free a request
@@ -656,6 +716,11 @@ void fuse_request_free(struct fuse_req *req);
  */
 struct fuse_req *fuse_get_req(struct fuse_conn *fc);
 
+/**
+ * Get a request with room for npages pages, may fail with -ENOMEM
+ */
+struct fuse_req *fuse_get_req_pages(struct fuse_conn *fc, unsigned npages);
+
 /**
  * Gets a requests for a file operation, always succeeds
  */
@@ -737,8 +802,16 @@ void fuse_flush_writepages(struct inode *inode);
 void fuse_set_nowrite(struct inode *inode);
 void fuse_release_nowrite(struct inode *inode);
 
+void fuse_wait_on_writeback_range(struct inode *inode, pgoff_t idx_from,
+				  pgoff_t idx_to);
+
 u64 fuse_get_attr_version(struct fuse_conn *fc);
 
+/**
+ * Are i_size and mtime kept by the kernel rather than the filesystem?
+ */
+bool fuse_attrs_local(struct inode *inode);
+
 /**
  * File-system tells the kernel to invalidate cache for the given node id.
  */
@@ -761,6 +834,44 @@ long fuse_do_ioctl(struct file *file, unsigned int cmd, unsigned long arg,
 unsigned fuse_file_poll(struct file *file, poll_table *wait);
 int fuse_dev_release(struct inode *inode, struct file *file);
 
+/**
+ * Attach a new device file to the connection, or detach and free one
+ */
+struct fuse_dev *fuse_dev_alloc(struct fuse_conn *fc);
+void fuse_dev_free(struct fuse_dev *fud);
+
 void fuse_write_update_size(struct inode *inode, loff_t pos);
 
+/**
+ * Send the locally kept mtime of a writeback cached file
+ */
+int fuse_write_inode(struct inode *inode, struct writeback_control *wbc);
+
+/**
+ * Take the backing file named in an OPEN or CREATE reply, called in the
+ * context of the daemon writing it
+ */
+void fuse_passthrough_setup(struct fuse_conn *fc, struct fuse_req *req);
+
+/**
+ * Move the backing file from the request to the fuse file
+ */
+void fuse_passthrough_claim(struct fuse_file *ff, struct fuse_req *req);
+
+/**
+ * Check that the backing file can serve I/O on file, drop it if not
+ */
+bool fuse_passthrough_open(struct file *file);
+
+void fuse_passthrough_release(struct fuse_passthrough *passthrough);
+
+ssize_t fuse_passthrough_aio_read(struct kiocb *iocb, const struct iovec *iov,
+				  unsigned long nr_segs, loff_t pos);
+ssize_t fuse_passthrough_aio_write(struct kiocb *iocb, const struct iovec *iov,
+				   unsigned long nr_segs, loff_t pos);
+ssize_t fuse_passthrough_splice_read(struct file *file, loff_t *ppos,
+				     struct pipe_inode_info *pipe, size_t len,
+				     unsigned int flags);
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma);
+
 #endif /* _FS_FUSE_I_H */
@@ -0,0 +1,262 @@
+/*
+  FUSE: Filesystem in Userspace
+  Passthrough of file I/O to backing files
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+#include "fuse_i.h"
+
+#include <linux/file.h>
+#include <linux/pagemap.h>
+#include <linux/cred.h>
+#include <linux/uio.h>
+#include <linux/aio.h>
+#include <linux/splice.h>
+
+/*
+ * A filesystem that keeps its files on another, local filesystem (the
+ * sdcard daemon on top of ext4 being the typical case) would otherwise
+ * copy every read and write through the device.  With FUSE_PASSTHROUGH
+ * negotiated, it can answer OPEN or CREATE with FOPEN_PASSTHROUGH set
+ * and the descriptor of the lower file it opened in passthrough_fd.
+ * Reads, writes and mmap of the FUSE file then go to the lower file and
+ * its page cache directly, with the credentials of the daemon.  Whether
+ * the file may be opened at all is still decided by the daemon, in the
+ * OPEN request; everything else (lookup, getattr, setattr, fsync,
+ * release...) keeps going to it as well.
+ *
+ * The descriptor means something only in the daemon, so it is looked up
+ * while the daemon writes the reply, and the file travels with the
+ * request to the opener.
+ */
+void fuse_passthrough_setup(struct fuse_conn *fc, struct fuse_req *req)
+{
+	struct fuse_open_out *outarg;
+	struct file *lower;
+	struct inode *lower_inode;
+
+	switch (req->in.h.opcode) {
+	case FUSE_OPEN:
+		outarg = req->out.args[0].value;
+		break;
+	case FUSE_CREATE:
+		outarg = req->out.args[1].value;
+		break;
+	default:
+		return;
+	}
+	if (!(outarg->open_flags & FOPEN_PASSTHROUGH))
+		return;
+
+	/* Without a usable backing file the open falls back to the daemon */
+	outarg->open_flags &= ~FOPEN_PASSTHROUGH;
+	lower = fget(outarg->passthrough_fd);
+	if (!lower)
+		return;
+
+	/* Stacking on FUSE again could recurse without bound */
+	lower_inode = lower->f_path.dentry->d_inode;
+	if (!S_ISREG(lower_inode->i_mode) ||
+	    lower_inode->i_sb->s_magic == FUSE_SUPER_MAGIC ||
+	    lower_inode->i_sb->s_stack_depth >= FILESYSTEM_MAX_STACK_DEPTH ||
+	    !lower->f_op || !lower->f_op->aio_read || !lower->f_op->aio_write) {
+		fput(lower);
+		return;
+	}
+
+	req->passthrough.filp = lower;
+	req->passthrough.cred = get_current_cred();
+	outarg->open_flags |= FOPEN_PASSTHROUGH;
+}
+
+void fuse_passthrough_claim(struct fuse_file *ff, struct fuse_req *req)
+{
+	ff->passthrough = req->passthrough;
+	req->passthrough.filp = NULL;
+	req->passthrough.cred = NULL;
+}
+
+bool fuse_passthrough_open(struct file *file)
+{
+	struct fuse_file *ff = file->private_data;
+	struct file *lower = ff->passthrough.filp;
+	fmode_t need = file->f_mode & (FMODE_READ | FMODE_WRITE);
+
+	if (!lower)
+		return false;
+
+	/*
+	 * The lower file has to allow what the FUSE file does, and writes
+	 * must append and sync the same way they would through the daemon
+	 */
+	if ((lower->f_mode & need) != need ||
+	    ((need & FMODE_WRITE) &&
+	     (((file->f_flags ^ lower->f_flags) & O_APPEND) ||
+	      ((file->f_flags & O_DSYNC) && !(lower->f_flags & O_DSYNC))))) {
+		fuse_passthrough_release(&ff->passthrough);
+		return false;
+	}
+	return true;
+}
+
+void fuse_passthrough_release(struct fuse_passthrough *passthrough)
+{
+	if (passthrough->filp) {
+		fput(passthrough->filp);
+		passthrough->filp = NULL;
+	}
+	if (passthrough->cred) {
+		put_cred(passthrough->cred);
+		passthrough->cred = NULL;
+	}
+}
+
+/*
+ * Opens of the same inode that do not pass through fill the page cache of
+ * the FUSE inode, and with writeback caching may keep dirty data there.
+ * Before passthrough I/O on a range, write what is cached there back to
+ * the daemon, wait for it to get to the lower file and drop the pages,
+ * so that neither side works on stale data.  Costs nothing while all
+ * opens pass through and the FUSE page cache stays empty.
+ */
+static int fuse_passthrough_sync_cache(struct inode *inode, loff_t pos,
+				       loff_t count)
+{
+	struct address_space *mapping = inode->i_mapping;
+	loff_t end = pos + count - 1;
+	int err;
+
+	if (!mapping->nrpages || count <= 0)
+		return 0;
+
+	err = filemap_write_and_wait_range(mapping, pos, end);
+	if (err)
+		return err;
+	fuse_wait_on_writeback_range(inode, pos >> PAGE_CACHE_SHIFT,
+				     end >> PAGE_CACHE_SHIFT);
+	return invalidate_inode_pages2_range(mapping, pos >> PAGE_CACHE_SHIFT,
+					     end >> PAGE_CACHE_SHIFT);
+}
+
+static ssize_t fuse_passthrough_rw(struct kiocb *iocb, const struct iovec *iov,
+				   unsigned long nr_segs, loff_t pos, int rw)
+{
+	struct file *file = iocb->ki_filp;
+	struct fuse_file *ff = file->private_data;
+	struct file *lower = ff->passthrough.filp;
+	size_t count = iov_length(iov, nr_segs);
+	const struct cred *old_cred;
+	struct kiocb kiocb;
+	ssize_t ret;
+
+	ret = fuse_passthrough_sync_cache(file->f_mapping->host, pos, count);
+	if (ret)
+		return ret;
+
+	old_cred = override_creds(ff->passthrough.cred);
+	ret = rw_verify_area(rw, lower, &pos, count);
+	if (ret < 0)
+		goto out;
+
+	init_sync_kiocb(&kiocb, lower);
+	kiocb.ki_pos = pos;
+	kiocb.ki_left = count;
+	kiocb.ki_nbytes = count;
+	if (rw == READ)
+		ret = lower->f_op->aio_read(&kiocb, iov, nr_segs, pos);
+	else
+		ret = lower->f_op->aio_write(&kiocb, iov, nr_segs, pos);
+	if (ret == -EIOCBQUEUED)
+		ret = wait_on_sync_kiocb(&kiocb);
+	iocb->ki_pos = kiocb.ki_pos;
+ out:
+	revert_creds(old_cred);
+	return ret;
+}
+
+ssize_t fuse_passthrough_aio_read(struct kiocb *iocb, const struct iovec *iov,
+				  unsigned long nr_segs, loff_t pos)
+{
+	return fuse_passthrough_rw(iocb, iov, nr_segs, pos, READ);
+}
+
+ssize_t fuse_passthrough_aio_write(struct kiocb *iocb, const struct iovec *iov,
+				   unsigned long nr_segs, loff_t pos)
+{
+	struct inode *inode = iocb->ki_filp->f_path.dentry->d_inode;
+	ssize_t ret;
+
+	ret = fuse_passthrough_rw(iocb, iov, nr_segs, pos, WRITE);
+	if (ret > 0) {
+		/* The daemon has the new mtime, the size we know */
+		fuse_write_update_size(inode, iocb->ki_pos);
+		fuse_invalidate_attr(inode);
+		/* Drop pages another open read in meanwhile */
+		if (inode->i_mapping->nrpages)
+			invalidate_inode_pages2_range(inode->i_mapping,
+					pos >> PAGE_CACHE_SHIFT,
+					(iocb->ki_pos - 1) >> PAGE_CACHE_SHIFT);
+	}
+	return ret;
+}
+
+ssize_t fuse_passthrough_splice_read(struct file *file, loff_t *ppos,
+				     struct pipe_inode_info *pipe, size_t len,
+				     unsigned int flags)
+{
+	struct fuse_file *ff = file->private_data;
+	struct file *lower = ff->passthrough.filp;
+	const struct cred *old_cred;
+	ssize_t ret;
+
+	if (!lower->f_op->splice_read)
+		return -EINVAL;
+
+	ret = fuse_passthrough_sync_cache(file->f_mapping->host, *ppos, len);
+	if (ret)
+		return ret;
+
+	old_cred = override_creds(ff->passthrough.cred);
+	ret = rw_verify_area(READ, lower, ppos, len);
+	if (ret >= 0)
+		ret = lower->f_op->splice_read(lower, ppos, pipe, len, flags);
+	revert_creds(old_cred);
+	return ret;
+}
+
+/*
+ * The mapping is handed over to the lower file entirely: faults, dirty
+ * pages and writeback all happen there, and the FUSE page cache is not
+ * involved, so it is synced and emptied first
+ */
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct fuse_file *ff = file->private_data;
+	struct file *lower = ff->passthrough.filp;
+	const struct cred *old_cred;
+	int err;
+
+	if (!lower->f_op->mmap)
+		return -ENODEV;
+
+	err = fuse_passthrough_sync_cache(file->f_mapping->host, 0,
+					  i_size_read(file->f_mapping->host));
+	if (err)
+		return err;
+
+	get_file(lower);
+	vma->vm_file = lower;
+	old_cred = override_creds(ff->passthrough.cred);
+	err = lower->f_op->mmap(lower, vma);
+	revert_creds(old_cred);
+	if (err) {
+		/* the caller drops its reference to file on error */
+		vma->vm_file = file;
+		fput(lower);
+		return err;
+	}
+	fput(file);
+	return 0;
+}
@@ -44,6 +44,9 @@
 #include <linux/backing-dev.h>
 #include <linux/bitops.h>
 #include <linux/ratelimit.h>
+#include <linux/crc32.h>
+#include <linux/blkdev.h>
+#include <linux/percpu.h>
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/jbd2.h>
@@ -83,6 +86,10 @@ EXPORT_SYMBOL(jbd2_journal_ack_err);
 EXPORT_SYMBOL(jbd2_journal_clear_err);
 EXPORT_SYMBOL(jbd2_log_wait_commit);
 EXPORT_SYMBOL(jbd2_log_start_commit);
+EXPORT_SYMBOL(jbd2_fc_setup);
+EXPORT_SYMBOL(jbd2_fc_begin);
+EXPORT_SYMBOL(jbd2_fc_write);
+EXPORT_SYMBOL(jbd2_fc_end);
 EXPORT_SYMBOL(jbd2_journal_start_commit);
 EXPORT_SYMBOL(jbd2_journal_force_commit_nested);
 EXPORT_SYMBOL(jbd2_journal_wipe);
@@ -662,6 +669,254 @@ int jbd2_log_wait_commit(journal_t *journal, tid_t tid)
 	return err;
 }
 
+/*
+ * Fast commits.
+ *
+ * A full commit writes every metadata block a transaction touched, and
+ * an fsync() has to wait for all of them.  A fast commit logs just what
+ * the caller needs to make one change durable: some records only the
+ * filesystem understands plus a few block images, in an area of its own
+ * at the end of the journal.  Recovery replays the fast commits of the
+ * first transaction that did not commit, on top of everything before
+ * it.  Once that transaction commits in full, its fast commits are
+ * obsolete and the area is reused from the start.
+ */
+
+/**
+ * int jbd2_fc_setup() - reserve a fast commit area at the end of the journal
+ * @journal: Journal to act on.
+ * @blocks: Size of the area in blocks.
+ *
+ * The area is taken from the log, which must be empty: call this after
+ * jbd2_journal_load() and before any handle is started.  It is given
+ * back to the log when the journal is destroyed.
+ */
+int jbd2_fc_setup(journal_t *journal, unsigned int blocks)
+{
+	journal_superblock_t *sb = journal->j_superblock;
+	struct buffer_head *bh = journal->j_sb_buffer;
+
+	if (journal->j_format_version < 2 || !blocks ||
+	    blocks > journal->j_maxlen / 4 ||
+	    journal->j_first + JBD2_MIN_JOURNAL_BLOCKS + blocks >
+	    journal->j_maxlen)
+		return -EINVAL;
+
+	write_lock(&journal->j_state_lock);
+	if (journal->j_running_transaction ||
+	    journal->j_committing_transaction ||
+	    journal->j_checkpoint_transactions) {
+		write_unlock(&journal->j_state_lock);
+		return -EBUSY;
+	}
+	journal->j_fc_first = journal->j_maxlen - blocks;
+	journal->j_fc_last = journal->j_maxlen;
+	journal->j_fc_off = 0;
+	journal->j_fc_tid = journal->j_commit_sequence;
+	journal->j_last = journal->j_fc_first;
+	journal->j_head = journal->j_first;
+	journal->j_tail = journal->j_first;
+	journal->j_free = journal->j_last - journal->j_first;
+	journal->j_tail_sequence = journal->j_transaction_sequence;
+
+	/*
+	 * Unlike jbd2_journal_update_superblock(), always write s_start:
+	 * fast commits may come before the first full commit, and recovery
+	 * must not skip them.
+	 */
+	sb->s_sequence = cpu_to_be32(journal->j_tail_sequence);
+	sb->s_start = cpu_to_be32(journal->j_tail);
+	sb->s_num_fc_blks = cpu_to_be32(blocks);
+	sb->s_feature_incompat |=
+		cpu_to_be32(JBD2_FEATURE_INCOMPAT_FAST_COMMIT);
+	journal->j_flags &= ~JBD2_FLUSHED;
+	write_unlock(&journal->j_state_lock);
+
+	mark_buffer_dirty(bh);
+	sync_dirty_buffer(bh);
+	if (buffer_write_io_error(bh)) {
+		clear_buffer_write_io_error(bh);
+		set_buffer_uptodate(bh);
+		return -EIO;
+	}
+	return 0;
+}
+
+/**
+ * int jbd2_fc_begin() - start a fast commit
+ * @journal: Journal to act on.
+ * @tid: Transaction holding the changes to log.
+ *
+ * Returns 0 with fast commits locked out for others if @tid is still
+ * running and nobody asked for it to be committed.  After a journal
+ * flush the superblock says the journal is empty, so that recovery
+ * would not look at a fast commit, and -EAGAIN is returned until the
+ * next full commit has written the superblock again.  The caller then
+ * snapshots what it wants to log, writes it with jbd2_fc_write() and
+ * finishes with jbd2_fc_end().  On any error it has to fall back to a
+ * full commit of @tid.
+ */
+int jbd2_fc_begin(journal_t *journal, tid_t tid)
+{
+	int err = 0;
+
+	if (journal->j_fc_first == journal->j_fc_last)
+		return -EOPNOTSUPP;
+
+	mutex_lock(&journal->j_fc_mutex);
+	read_lock(&journal->j_state_lock);
+	if (is_journal_aborted(journal))
+		err = -EIO;
+	else if (journal->j_flags & JBD2_FLUSHED)
+		err = -EAGAIN;
+	else if (!journal->j_running_transaction ||
+		 journal->j_running_transaction->t_tid != tid ||
+		 tid_geq(journal->j_commit_request, tid))
+		err = -EALREADY;
+	else if (journal->j_fc_off >= journal->j_fc_last - journal->j_fc_first)
+		err = -ENOSPC;
+	read_unlock(&journal->j_state_lock);
+
+	if (err)
+		mutex_unlock(&journal->j_fc_mutex);
+	return err;
+}
+
+void jbd2_fc_end(journal_t *journal)
+{
+	mutex_unlock(&journal->j_fc_mutex);
+}
+
+static void fc_submit(struct buffer_head *bh, int rw)
+{
+	get_bh(bh);
+	clear_buffer_dirty(bh);
+	set_buffer_uptodate(bh);
+	bh->b_end_io = end_buffer_write_sync;
+	submit_bh(rw, bh);
+}
+
+/**
+ * int jbd2_fc_write() - write a fast commit
+ * @journal: Journal to act on.
+ * @tid: Transaction the fast commit belongs to.
+ * @records: Records passed to j_fc_replay on recovery.
+ * @len: Length of @records in bytes.
+ * @images: Blocks to write back to their home location on recovery.
+ * @nr: Number of @images.
+ *
+ * Called between jbd2_fc_begin() and jbd2_fc_end().  The images are
+ * written first, then the fast commit block with a cache flush ahead of
+ * it, so it only reaches the disk after the images and after any data
+ * the caller wrote before.  Returns once that and every transaction
+ * before @tid are on disk.
+ *
+ * -EALREADY means a transaction after @tid has started since
+ * jbd2_fc_begin(): the caller's snapshot may contain its changes, which
+ * must not be replayed on top of @tid.
+ */
+int jbd2_fc_write(journal_t *journal, tid_t tid, const void *records,
+		  unsigned int len, struct jbd2_fc_image *images, int nr)
+{
+	struct buffer_head *bhs[JBD2_FC_MAX_IMAGES + 1];
+	jbd2_fc_header_t *header;
+	jbd2_fc_tag_t *tag;
+	unsigned long long blocknr;
+	unsigned long off = 0;
+	int i, got = 0, err = 0;
+
+	if (nr > JBD2_FC_MAX_IMAGES || sizeof(*header) +
+	    nr * sizeof(*tag) + len > journal->j_blocksize)
+		return -E2BIG;
+
+	write_lock(&journal->j_state_lock);
+	if (journal->j_transaction_sequence != tid + 1)
+		err = -EALREADY;
+	else if (journal->j_fc_off + nr + 1 >
+		 journal->j_fc_last - journal->j_fc_first)
+		err = -ENOSPC;
+	else {
+		off = journal->j_fc_first + journal->j_fc_off;
+		journal->j_fc_off += nr + 1;
+		journal->j_fc_tid = tid;
+	}
+	write_unlock(&journal->j_state_lock);
+	if (err)
+		return err;
+
+	for (got = 0; got <= nr; got++) {
+		err = jbd2_journal_bmap(journal, off + got, &blocknr);
+		if (err)
+			goto out;
+		bhs[got] = __getblk(journal->j_dev, blocknr,
+				    journal->j_blocksize);
+		if (!bhs[got]) {
+			err = -ENOMEM;
+			goto out;
+		}
+	}
+
+	for (i = 1; i <= nr; i++) {
+		lock_buffer(bhs[i]);
+		memcpy(bhs[i]->b_data, images[i - 1].data,
+		       journal->j_blocksize);
+		fc_submit(bhs[i], WRITE_SYNC);
+	}
+
+	lock_buffer(bhs[0]);
+	memset(bhs[0]->b_data, 0, journal->j_blocksize);
+	header = (jbd2_fc_header_t *)bhs[0]->b_data;
+	header->fc_header.h_magic = cpu_to_be32(JBD2_MAGIC_NUMBER);
+	header->fc_header.h_blocktype = cpu_to_be32(JBD2_FC_BLOCK);
+	header->fc_header.h_sequence = cpu_to_be32(tid);
+	header->fc_nr_images = cpu_to_be32(nr);
+	header->fc_len = cpu_to_be32(len);
+	tag = (jbd2_fc_tag_t *)(header + 1);
+	for (i = 0; i < nr; i++) {
+		tag[i].t_blocknr = cpu_to_be64(images[i].blocknr);
+		tag[i].t_chksum = cpu_to_be32(crc32_be(~0, images[i].data,
+						       journal->j_blocksize));
+	}
+	memcpy(tag + nr, records, len);
+	header->fc_chksum = cpu_to_be32(crc32_be(~0, bhs[0]->b_data,
+				sizeof(*header) + nr * sizeof(*tag) + len));
+
+	for (i = 1; i <= nr; i++) {
+		wait_on_buffer(bhs[i]);
+		if (!buffer_uptodate(bhs[i]))
+			err = -EIO;
+	}
+	if (err) {
+		unlock_buffer(bhs[0]);
+		goto out;
+	}
+
+	if (journal->j_flags & JBD2_BARRIER) {
+		if (journal->j_fs_dev != journal->j_dev)
+			blkdev_issue_flush(journal->j_fs_dev, GFP_NOFS, NULL);
+		fc_submit(bhs[0], WRITE_FLUSH_FUA);
+	} else
+		fc_submit(bhs[0], WRITE_SYNC);
+	wait_on_buffer(bhs[0]);
+	if (!buffer_uptodate(bhs[0]))
+		err = -EIO;
+
+out:
+	while (--got >= 0)
+		brelse(bhs[got]);
+	if (err) {
+		/* Recovery would stop at the hole, so no more fast commits */
+		write_lock(&journal->j_state_lock);
+		journal->j_fc_off = journal->j_fc_last - journal->j_fc_first;
+		write_unlock(&journal->j_state_lock);
+		return err;
+	}
+
+	journal->j_fc_commits++;
+	journal->j_fc_blocks += nr + 1;
+	return jbd2_log_wait_commit(journal, tid - 1);
+}
+
 /*
  * Log buffer allocation routines:
  */
@@ -761,6 +1016,37 @@ static void *jbd2_seq_info_next(struct seq_file *seq, void *v, loff_t *pos)
 	return NULL;
 }
 
+static void jbd2_seq_handle_show(struct seq_file *seq, journal_t *journal)
+{
+	static const char * const hist_names[JBD2_START_HIST] = {
+		"<1us", "<10us", "<100us", "<1ms", "<10ms", ">=10ms",
+	};
+	struct jbd2_handle_cpu sum, *hc;
+	int cpu, i;
+
+	memset(&sum, 0, sizeof(sum));
+	for_each_possible_cpu(cpu) {
+		hc = per_cpu_ptr(journal->j_handle_cpu, cpu);
+		sum.hc_starts += hc->hc_starts;
+		sum.hc_fast += hc->hc_fast;
+		sum.hc_wait_ns += hc->hc_wait_ns;
+		sum.hc_max_ns = max(sum.hc_max_ns, hc->hc_max_ns);
+		for (i = 0; i < JBD2_START_HIST; i++)
+			sum.hc_hist[i] += hc->hc_hist[i];
+	}
+	seq_printf(seq, "%lu handles started, %lu from per-cpu credits\n",
+		   sum.hc_starts, sum.hc_fast);
+	if (!sum.hc_starts)
+		return;
+	seq_printf(seq, "  %lluns average handle start, %lluus max\n",
+		   div64_u64(sum.hc_wait_ns, sum.hc_starts),
+		   div_u64(sum.hc_max_ns, 1000));
+	seq_printf(seq, "  handle starts");
+	for (i = 0; i < JBD2_START_HIST; i++)
+		seq_printf(seq, " %s: %lu", hist_names[i], sum.hc_hist[i]);
+	seq_putc(seq, '\n');
+}
+
 static int jbd2_seq_info_show(struct seq_file *seq, void *v)
 {
 	struct jbd2_stats_proc_session *s = seq->private;
@@ -770,6 +1056,12 @@ static int jbd2_seq_info_show(struct seq_file *seq, void *v)
 	seq_printf(seq, "%lu transaction, each up to %u blocks\n",
 			s->stats->ts_tid,
 			s->journal->j_max_transaction_buffers);
+	if (s->journal->j_fc_last > s->journal->j_fc_first)
+		seq_printf(seq, "%lu fast commits, %lu blocks, "
+			   "in an area of %lu blocks\n",
+			   s->journal->j_fc_commits, s->journal->j_fc_blocks,
+			   s->journal->j_fc_last - s->journal->j_fc_first);
+	jbd2_seq_handle_show(seq, s->journal);
 	if (s->stats->ts_tid == 0)
 		return 0;
 	seq_printf(seq, "average: \n  %ums waiting for transaction\n",
@@ -896,6 +1188,7 @@ static journal_t * journal_init_common (void)
 	init_waitqueue_head(&journal->j_wait_updates);
 	mutex_init(&journal->j_barrier);
 	mutex_init(&journal->j_checkpoint_mutex);
+	mutex_init(&journal->j_fc_mutex);
 	spin_lock_init(&journal->j_revoke_lock);
 	spin_lock_init(&journal->j_list_lock);
 	rwlock_init(&journal->j_state_lock);
@@ -914,6 +1207,13 @@ static journal_t * journal_init_common (void)
 		return NULL;
 	}
 
+	journal->j_handle_cpu = alloc_percpu(struct jbd2_handle_cpu);
+	if (!journal->j_handle_cpu) {
+		jbd2_journal_destroy_revoke(journal);
+		kfree(journal);
+		return NULL;
+	}
+
 	spin_lock_init(&journal->j_history_lock);
 
 	return journal;
@@ -988,6 +1288,7 @@ journal_t * jbd2_journal_init_dev(struct block_device *bdev,
 out_err:
 	kfree(journal->j_wbuf);
 	jbd2_stats_proc_exit(journal);
+	free_percpu(journal->j_handle_cpu);
 	kfree(journal);
 	return NULL;
 }
@@ -1062,6 +1363,7 @@ journal_t * jbd2_journal_init_inode (struct inode *inode)
 out_err:
 	kfree(journal->j_wbuf);
 	jbd2_stats_proc_exit(journal);
+	free_percpu(journal->j_handle_cpu);
 	kfree(journal);
 	return NULL;
 }
@@ -1100,11 +1402,11 @@ static int journal_reset(journal_t *journal)
 	}
 
 	journal->j_first = first;
-	journal->j_last = last;
+	journal->j_last = journal->j_fc_first;
 
 	journal->j_head = first;
 	journal->j_tail = first;
-	journal->j_free = last - first;
+	journal->j_free = journal->j_last - first;
 
 	journal->j_tail_sequence = journal->j_transaction_sequence;
 	journal->j_commit_sequence = journal->j_transaction_sequence - 1;
@@ -1288,6 +1590,24 @@ static int load_superblock(journal_t *journal)
 	journal->j_last = be32_to_cpu(sb->s_maxlen);
 	journal->j_errno = be32_to_cpu(sb->s_errno);
 
+	/* The fast commit area, if any, is not part of the log */
+	journal->j_fc_first = journal->j_fc_last = journal->j_last;
+	if (JBD2_HAS_INCOMPAT_FEATURE(journal,
+				      JBD2_FEATURE_INCOMPAT_FAST_COMMIT)) {
+		unsigned long blocks = be32_to_cpu(sb->s_num_fc_blks);
+
+		if (!blocks || journal->j_first + JBD2_MIN_JOURNAL_BLOCKS +
+		    blocks > journal->j_last) {
+			printk(KERN_WARNING
+			       "JBD2: Invalid fast commit area: %lu blocks\n",
+			       blocks);
+			journal_fail_superblock(journal);
+			return -EINVAL;
+		}
+		journal->j_fc_first -= blocks;
+		journal->j_last = journal->j_fc_first;
+	}
+
 	return 0;
 }
 
@@ -1400,6 +1720,10 @@ int jbd2_journal_destroy(journal_t *journal)
 			journal->j_tail = 0;
 			journal->j_tail_sequence =
 				++journal->j_transaction_sequence;
+			/* and give the fast commit area back to the log */
+			journal->j_superblock->s_feature_incompat &=
+				~cpu_to_be32(JBD2_FEATURE_INCOMPAT_FAST_COMMIT);
+			journal->j_superblock->s_num_fc_blks = 0;
 			jbd2_journal_update_superblock(journal, 1);
 		} else {
 			err = -EIO;
@@ -1414,6 +1738,7 @@ int jbd2_journal_destroy(journal_t *journal)
 	if (journal->j_revoke)
 		jbd2_journal_destroy_revoke(journal);
 	kfree(journal->j_wbuf);
+	free_percpu(journal->j_handle_cpu);
 	kfree(journal);
 
 	return err;
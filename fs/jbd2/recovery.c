@@ -42,6 +42,7 @@ static int do_one_pass(journal_t *journal,
 				struct recovery_info *info, enum passtype pass);
 static int scan_revoke_records(journal_t *, struct buffer_head *,
 				tid_t, struct recovery_info *);
+static int fc_replay(journal_t *journal, struct recovery_info *info);
 
 #ifdef __KERNEL__
 
@@ -250,6 +251,8 @@ int jbd2_journal_recover(journal_t *journal)
 		err = do_one_pass(journal, &info, PASS_REVOKE);
 	if (!err)
 		err = do_one_pass(journal, &info, PASS_REPLAY);
+	if (!err && journal->j_fc_first < journal->j_fc_last)
+		err = fc_replay(journal, &info);
 
 	jbd_debug(1, "JBD: recovery, exit status %d, "
 		  "recovered transactions %u to %u\n",
@@ -269,6 +272,111 @@ int jbd2_journal_recover(journal_t *journal)
 	return err;
 }
 
+/*
+ * Replay the fast commits of the first transaction that did not commit.
+ * The area holds fast commits in transaction order from its start;
+ * those of transactions that did commit are skipped, and the first
+ * block that is not a valid fast commit ends it.  A fast commit is
+ * applied only when its block and all its images check out.
+ */
+static int fc_replay(journal_t *journal, struct recovery_info *info)
+{
+	struct buffer_head *bh, *ibh[JBD2_FC_MAX_IMAGES];
+	unsigned long off = journal->j_fc_first;
+	jbd2_fc_header_t *header;
+	jbd2_fc_tag_t *tag;
+	unsigned int nr, len, crc;
+	int i, got, err = 0, replayed = 0;
+
+	while (off < journal->j_fc_last) {
+		err = jread(&bh, journal, off);
+		if (err)
+			break;
+		header = (jbd2_fc_header_t *)bh->b_data;
+		nr = be32_to_cpu(header->fc_nr_images);
+		len = be32_to_cpu(header->fc_len);
+		if (header->fc_header.h_magic != cpu_to_be32(JBD2_MAGIC_NUMBER) ||
+		    header->fc_header.h_blocktype !=
+		    cpu_to_be32(JBD2_FC_BLOCK) || nr > JBD2_FC_MAX_IMAGES ||
+		    sizeof(*header) + nr * sizeof(*tag) + len >
+		    journal->j_blocksize || off + 1 + nr > journal->j_fc_last) {
+			brelse(bh);
+			break;
+		}
+		crc = be32_to_cpu(header->fc_chksum);
+		header->fc_chksum = 0;
+		if (crc32_be(~0, bh->b_data, sizeof(*header) +
+			     nr * sizeof(*tag) + len) != crc) {
+			header->fc_chksum = cpu_to_be32(crc);
+			brelse(bh);
+			break;
+		}
+		header->fc_chksum = cpu_to_be32(crc);
+
+		if (tid_gt(info->end_transaction,
+			   be32_to_cpu(header->fc_header.h_sequence))) {
+			brelse(bh);
+			off += 1 + nr;
+			continue;
+		}
+		if (be32_to_cpu(header->fc_header.h_sequence) !=
+		    info->end_transaction) {
+			brelse(bh);
+			break;
+		}
+
+		tag = (jbd2_fc_tag_t *)(header + 1);
+		for (got = 0; got < nr; got++) {
+			err = jread(&ibh[got], journal, off + 1 + got);
+			if (err)
+				break;
+			if (crc32_be(~0, ibh[got]->b_data, journal->j_blocksize) !=
+			    be32_to_cpu(tag[got].t_chksum)) {
+				brelse(ibh[got]);
+				err = -EBADMSG;
+				break;
+			}
+		}
+		if (!err && journal->j_fc_replay)
+			err = journal->j_fc_replay(journal, tag + nr, len);
+		for (i = 0; i < got; i++) {
+			struct buffer_head *nbh;
+
+			if (!err) {
+				nbh = __getblk(journal->j_fs_dev,
+					       be64_to_cpu(tag[i].t_blocknr),
+					       journal->j_blocksize);
+				if (!nbh) {
+					err = -ENOMEM;
+				} else {
+					lock_buffer(nbh);
+					memcpy(nbh->b_data, ibh[i]->b_data,
+					       journal->j_blocksize);
+					set_buffer_uptodate(nbh);
+					mark_buffer_dirty(nbh);
+					unlock_buffer(nbh);
+					brelse(nbh);
+				}
+			}
+			brelse(ibh[i]);
+		}
+		brelse(bh);
+		if (err == -EBADMSG) {
+			/* torn fast commit: it never completed */
+			err = 0;
+			break;
+		}
+		if (err)
+			break;
+		replayed++;
+		off += 1 + nr;
+	}
+
+	jbd_debug(1, "JBD: replayed %d fast commits of transaction %u\n",
+		  replayed, info->end_transaction);
+	return err;
+}
+
 /**
  * jbd2_journal_skip_recovery - Start journal and wipe exiting records
  * @journal: journal to startup
@@ -28,6 +28,8 @@
 #include <linux/hrtimer.h>
 #include <linux/backing-dev.h>
 #include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/rcupdate.h>
 
 static void __jbd2_journal_temp_unlink_buffer(struct journal_head *jh);
 static void __jbd2_journal_unfile_buffer(struct journal_head *jh);
@@ -107,6 +109,117 @@ static inline void update_t_max_wait(transaction_t *transaction,
 #endif
 }
 
+/*
+ * How many credits to reserve for this CPU on top of what a handle asks
+ * for.  What the CPUs hold stays counted in t_outstanding_credits until
+ * the commit, so all of them together may only hold a small part of a
+ * transaction.
+ */
+static inline int jbd2_credit_batch(journal_t *journal, int nblocks)
+{
+	int batch = journal->j_max_transaction_buffers /
+		(4 * num_online_cpus());
+
+	batch = min(batch, JBD2_CREDIT_BATCH);
+	return batch > nblocks ? batch : 0;
+}
+
+/*
+ * The fast path of start_this_handle(): join the running transaction
+ * with credits this CPU reserved from it earlier, without j_state_lock.
+ *
+ * The handle is counted in t_updates before anything else is looked at.
+ * The commit sets T_LOCKED and jbd2_journal_lock_updates() raises
+ * j_barrier_count before they wait for t_updates to drop to zero, with a
+ * barrier on both sides, so either they wait for this handle or it sees
+ * them and backs out to the slow path.
+ */
+static int start_this_handle_fast(journal_t *journal, handle_t *handle)
+{
+	transaction_t *transaction;
+	struct jbd2_handle_cpu *hc;
+	int nblocks = handle->h_buffer_credits;
+
+	rcu_read_lock();
+	preempt_disable();
+	transaction = ACCESS_ONCE(journal->j_running_transaction);
+	if (!transaction || transaction->t_state != T_RUNNING)
+		goto out;
+
+	atomic_inc(&transaction->t_updates);
+	smp_mb__after_atomic_inc();
+	if (transaction->t_state != T_RUNNING || journal->j_barrier_count ||
+	    journal->j_errno || is_journal_aborted(journal))
+		goto undo;
+
+	hc = this_cpu_ptr(journal->j_handle_cpu);
+	if (hc->hc_tid != transaction->t_tid || hc->hc_credits < nblocks)
+		goto undo;
+	hc->hc_credits -= nblocks;
+	preempt_enable();
+	rcu_read_unlock();
+
+	handle->h_transaction = transaction;
+	atomic_inc(&transaction->t_handle_count);
+	jbd_debug(4, "Handle %p given %d credits from this cpu\n",
+		  handle, nblocks);
+	return 1;
+
+undo:
+	if (atomic_dec_and_test(&transaction->t_updates))
+		wake_up(&journal->j_wait_updates);
+out:
+	preempt_enable();
+	rcu_read_unlock();
+	return 0;
+}
+
+static void jbd2_account_handle_start(journal_t *journal, u64 start, int fast)
+{
+	struct jbd2_handle_cpu *hc;
+	u64 ns = local_clock() - start, limit = 1000;
+	int i;
+
+	/* the handle may have moved to a CPU whose clock is behind */
+	if ((s64)ns < 0)
+		ns = 0;
+	for (i = 0; i < JBD2_START_HIST - 1 && ns >= limit; i++)
+		limit *= 10;
+
+	hc = get_cpu_ptr(journal->j_handle_cpu);
+	hc->hc_starts++;
+	hc->hc_fast += fast;
+	hc->hc_wait_ns += ns;
+	if (ns > hc->hc_max_ns)
+		hc->hc_max_ns = ns;
+	hc->hc_hist[i]++;
+	put_cpu_ptr(journal->j_handle_cpu);
+}
+
+/**
+ * void __jbd2_journal_return_credits() - take back the credits of the CPUs
+ * @journal: journal of @transaction
+ * @transaction: transaction being committed
+ *
+ * Called by the commit with j_state_lock held for writing, once
+ * @transaction is locked and has no updates left, so that no CPU can
+ * take from or add to its credits any more.
+ */
+void __jbd2_journal_return_credits(journal_t *journal,
+				   transaction_t *transaction)
+{
+	struct jbd2_handle_cpu *hc;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		hc = per_cpu_ptr(journal->j_handle_cpu, cpu);
+		if (hc->hc_tid != transaction->t_tid || !hc->hc_credits)
+			continue;
+		atomic_sub(hc->hc_credits, &transaction->t_outstanding_credits);
+		hc->hc_credits = 0;
+	}
+}
+
 /*
  * start_this_handle: Given a handle, deal with any locking or stalling
  * needed to make sure that there is enough journal space for the handle
@@ -118,10 +231,12 @@ static int start_this_handle(journal_t *journal, handle_t *handle,
 			     int gfp_mask)
 {
 	transaction_t	*transaction, *new_transaction = NULL;
+	struct jbd2_handle_cpu *hc;
 	tid_t		tid;
-	int		needed, need_to_start;
+	int		needed, need_to_start, batch;
 	int		nblocks = handle->h_buffer_credits;
 	unsigned long ts = jiffies;
+	u64		start = local_clock();
 
 	if (nblocks > journal->j_max_transaction_buffers) {
 		printk(KERN_ERR "JBD: %s wants too many credits (%d > %d)\n",
@@ -130,6 +245,12 @@ static int start_this_handle(journal_t *journal, handle_t *handle,
 		return -ENOSPC;
 	}
 
+	if (start_this_handle_fast(journal, handle)) {
+		lock_map_acquire(&handle->h_lockdep_map);
+		jbd2_account_handle_start(journal, start, 1);
+		return 0;
+	}
+
 alloc_transaction:
 	if (!journal->j_running_transaction) {
 		new_transaction = kzalloc(sizeof(*new_transaction), gfp_mask);
@@ -206,10 +327,17 @@ repeat:
 	/*
 	 * If there is not enough space left in the log to write all potential
 	 * buffers requested by this operation, we need to stall pending a log
-	 * checkpoint to free some more log space.
+	 * checkpoint to free some more log space.  Reserve a batch for the
+	 * handles that will start on this CPU too, if there is room for it.
 	 */
-	needed = atomic_add_return(nblocks,
+	batch = jbd2_credit_batch(journal, nblocks);
+	needed = atomic_add_return(nblocks + batch,
 				   &transaction->t_outstanding_credits);
+	if (batch && needed > journal->j_max_transaction_buffers) {
+		atomic_sub(batch, &transaction->t_outstanding_credits);
+		needed -= batch;
+		batch = 0;
+	}
 
 	if (needed > journal->j_max_transaction_buffers) {
 		/*
@@ -260,7 +388,7 @@ repeat:
 	 */
 	if (__jbd2_log_space_left(journal) < jbd_space_needed(journal)) {
 		jbd_debug(2, "Handle %p waiting for checkpoint...\n", handle);
-		atomic_sub(nblocks, &transaction->t_outstanding_credits);
+		atomic_sub(nblocks + batch, &transaction->t_outstanding_credits);
 		read_unlock(&journal->j_state_lock);
 		write_lock(&journal->j_state_lock);
 		if (__jbd2_log_space_left(journal) < jbd_space_needed(journal))
@@ -276,6 +404,15 @@ repeat:
 	handle->h_transaction = transaction;
 	atomic_inc(&transaction->t_updates);
 	atomic_inc(&transaction->t_handle_count);
+	if (batch) {
+		/* j_state_lock keeps the commit from taking them back yet */
+		hc = this_cpu_ptr(journal->j_handle_cpu);
+		if (hc->hc_tid != transaction->t_tid) {
+			hc->hc_tid = transaction->t_tid;
+			hc->hc_credits = 0;
+		}
+		hc->hc_credits += batch;
+	}
 	jbd_debug(4, "Handle %p given %d credits (total %d, free %d)\n",
 		  handle, nblocks,
 		  atomic_read(&transaction->t_outstanding_credits),
@@ -284,6 +421,7 @@ repeat:
 
 	lock_map_acquire(&handle->h_lockdep_map);
 	kfree(new_transaction);
+	jbd2_account_handle_start(journal, start, 0);
 	return 0;
 }
 
@@ -507,6 +645,8 @@ void jbd2_journal_lock_updates(journal_t *journal)
 
 	write_lock(&journal->j_state_lock);
 	++journal->j_barrier_count;
+	/* pairs with the barrier in start_this_handle_fast() */
+	smp_mb();
 
 	/* Wait until there are no running updates */
 	while (1) {
@@ -1268,6 +1268,9 @@ static int do_umount(struct vfsmount *mnt, int flags)
 	if (retval)
 		return retval;
 
+	/* Readahead prefetches started at open hold their files */
+	ra_history_flush(sb);
+
 	/*
 	 * Allow userspace to request a mountpoint be expired rather than
 	 * unmounting unconditionally. Unmount only happens if:
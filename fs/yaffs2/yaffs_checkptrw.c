@@ -41,6 +41,11 @@ static int yaffs_checkpt_erase(struct yaffs_dev *dev)
 			"erasing checkpt block %d", i);
 
 			dev->n_erasures++;
+			if (dev->block_erases &&
+			    dev->block_erases[i - dev->internal_start_block] <
+			    0xffff)
+				dev->block_erases[i -
+						  dev->internal_start_block]++;
 
 			if (dev->param.
 			    erase_fn(dev,
@@ -39,6 +39,11 @@
 #define YAFFS_GC_GOOD_ENOUGH 2
 #define YAFFS_GC_PASSIVE_THRESHOLD 4
 
+/* Age in sequence numbers beyond which blocks count as equally old */
+#define YAFFS_GC_MAX_AGE 0x3fff
+/* Erasures above the mean that halve the gc score of a block */
+#define YAFFS_GC_WEAR_SLACK 16
+
 #include "yaffs_ecc.h"
 
 /* Forward declarations */
@@ -296,10 +301,10 @@ static void yaffs_handle_chunk_wr_error(struct yaffs_dev *dev, int nand_chunk,
  *  Simple hash function. Needs to have a reasonable spread
  */
 
-static inline int yaffs_hash_fn(int n)
+static inline int yaffs_hash_fn(struct yaffs_dev *dev, int n)
 {
 	n = abs(n);
-	return n % YAFFS_NOBJECT_BUCKETS;
+	return n & (dev->n_obj_buckets - 1);
 }
 
 /*
@@ -1394,10 +1399,44 @@ static int yaffs_change_obj_name(struct yaffs_obj *obj,
  *   In Linux, the page cache provides read buffering and the short op cache 
  *   provides write buffering.
  *
- *   There are a limited number (~10) of cache chunks per device so that we don't
- *   need a very intelligent search.
+ *   The caches are hashed on object and chunk id so that finding one does not
+ *   get slower with more of them, and kept on a list in the order they were
+ *   last used, free ones first, for picking the one to push out.
+ *   Flushing still looks at all of them: it only happens on sync, close and
+ *   when the caches run out.
  */
 
+static inline struct list_head *yaffs_cache_bucket(struct yaffs_dev *dev,
+						   const struct yaffs_obj *obj,
+						   int chunk_id)
+{
+	u32 h = (u32) obj->obj_id * 0x9e3779b1 + (u32) chunk_id;
+
+	return &dev->cache_hash[(h ^ (h >> 16)) & (dev->cache_hash_size - 1)];
+}
+
+/* Point a cache at a chunk, it becomes the most recently used one */
+static void yaffs_set_cache(struct yaffs_dev *dev, struct yaffs_cache *cache,
+			    struct yaffs_obj *obj, int chunk_id)
+{
+	list_del_init(&cache->hash_link);
+	cache->object = obj;
+	cache->chunk_id = chunk_id;
+	cache->dirty = 0;
+	cache->locked = 0;
+	list_add(&cache->hash_link, yaffs_cache_bucket(dev, obj, chunk_id));
+	list_move_tail(&cache->lru, &dev->cache_lru);
+}
+
+/* Free a cache, it is the first one to be grabbed again */
+static void yaffs_clear_cache(struct yaffs_dev *dev, struct yaffs_cache *cache)
+{
+	list_del_init(&cache->hash_link);
+	cache->object = NULL;
+	cache->dirty = 0;
+	list_move(&cache->lru, &dev->cache_lru);
+}
+
 static int yaffs_obj_cache_dirty(struct yaffs_obj *obj)
 {
 	struct yaffs_dev *dev = obj->my_dev;
@@ -1448,8 +1487,7 @@ static void yaffs_flush_file_cache(struct yaffs_obj *obj)
 						      cache->chunk_id,
 						      cache->data,
 						      cache->n_bytes, 1);
-				cache->dirty = 0;
-				cache->object = NULL;
+				yaffs_clear_cache(dev, cache);
 			}
 
 		} while (cache && chunk_written > 0);
@@ -1493,18 +1531,17 @@ void yaffs_flush_whole_cache(struct yaffs_dev *dev)
 
 /* Grab us a cache chunk for use.
  * First look for an empty one.
- * Then look for the least recently used non-dirty one.
- * Then look for the least recently used dirty one...., flush and look again.
+ * Then look for the least recently used one, if it is not dirty use it.
+ * If it is dirty, flush its object and look again.
  */
 static struct yaffs_cache *yaffs_grab_chunk_worker(struct yaffs_dev *dev)
 {
-	int i;
+	struct yaffs_cache *cache;
 
-	if (dev->param.n_caches > 0) {
-		for (i = 0; i < dev->param.n_caches; i++) {
-			if (!dev->cache[i].object)
-				return &dev->cache[i];
-		}
+	if (dev->param.n_caches > 0 && !list_empty(&dev->cache_lru)) {
+		cache = list_entry(dev->cache_lru.next, struct yaffs_cache, lru);
+		if (!cache->object)
+			return cache;
 	}
 
 	return NULL;
@@ -1513,45 +1550,33 @@ static struct yaffs_cache *yaffs_grab_chunk_worker(struct yaffs_dev *dev)
 static struct yaffs_cache *yaffs_grab_chunk_cache(struct yaffs_dev *dev)
 {
 	struct yaffs_cache *cache;
-	struct yaffs_obj *the_obj;
-	int usage;
-	int i;
-	int pushout;
+	struct yaffs_cache *lru;
+	struct list_head *i;
 
 	if (dev->param.n_caches > 0) {
-		/* Try find a non-dirty one... */
+		/* Try find a free one... */
 
 		cache = yaffs_grab_chunk_worker(dev);
 
 		if (!cache) {
-			/* They were all dirty, find the last recently used object and flush
-			 * its cache, then  find again.
-			 * NB what's here is not very accurate, we actually flush the object
-			 * the last recently used page.
+			/* They are all in use, take the least recently used
+			 * one.  If it is dirty, flush its object and find
+			 * again.
 			 */
 
-			/* With locking we can't assume we can use entry zero */
+			/* With locking we can't assume we can use the first one */
 
-			the_obj = NULL;
-			usage = -1;
-			cache = NULL;
-			pushout = -1;
-
-			for (i = 0; i < dev->param.n_caches; i++) {
-				if (dev->cache[i].object &&
-				    !dev->cache[i].locked &&
-				    (dev->cache[i].last_use < usage
-				     || !cache)) {
-					usage = dev->cache[i].last_use;
-					the_obj = dev->cache[i].object;
-					cache = &dev->cache[i];
-					pushout = i;
+			list_for_each(i, &dev->cache_lru) {
+				lru = list_entry(i, struct yaffs_cache, lru);
+				if (!lru->locked) {
+					cache = lru;
+					break;
 				}
 			}
 
-			if (!cache || cache->dirty) {
+			if (cache && cache->dirty) {
 				/* Flush and try again */
-				yaffs_flush_file_cache(the_obj);
+				yaffs_flush_file_cache(cache->object);
 				cache = yaffs_grab_chunk_worker(dev);
 			}
 
@@ -1562,21 +1587,37 @@ static struct yaffs_cache *yaffs_grab_chunk_cache(struct yaffs_dev *dev)
         }
 }
 
+static struct yaffs_cache *yaffs_lookup_chunk_cache(const struct yaffs_obj *obj,
+						    int chunk_id)
+{
+	struct yaffs_dev *dev = obj->my_dev;
+	struct yaffs_cache *cache;
+	struct list_head *i;
+
+	if (dev->param.n_caches > 0) {
+		list_for_each(i, yaffs_cache_bucket(dev, obj, chunk_id)) {
+			cache = list_entry(i, struct yaffs_cache, hash_link);
+			if (cache->object == obj && cache->chunk_id == chunk_id)
+				return cache;
+		}
+	}
+	return NULL;
+}
+
 /* Find a cached chunk */
 static struct yaffs_cache *yaffs_find_chunk_cache(const struct yaffs_obj *obj,
 						  int chunk_id)
 {
 	struct yaffs_dev *dev = obj->my_dev;
-	int i;
-	if (dev->param.n_caches > 0) {
-		for (i = 0; i < dev->param.n_caches; i++) {
-			if (dev->cache[i].object == obj &&
-			    dev->cache[i].chunk_id == chunk_id) {
-				dev->cache_hits++;
+	struct yaffs_cache *cache;
 
-				return &dev->cache[i];
-			}
+	if (dev->param.n_caches > 0) {
+		cache = yaffs_lookup_chunk_cache(obj, chunk_id);
+		if (cache) {
+			dev->cache_hits++;
+			return cache;
 		}
+		dev->cache_misses++;
 	}
 	return NULL;
 }
@@ -1587,18 +1628,7 @@ static void yaffs_use_cache(struct yaffs_dev *dev, struct yaffs_cache *cache,
 {
 
 	if (dev->param.n_caches > 0) {
-		if (dev->cache_last_use < 0 || dev->cache_last_use > 100000000) {
-			/* Reset the cache usages */
-			int i;
-			for (i = 1; i < dev->param.n_caches; i++)
-				dev->cache[i].last_use = 0;
-
-			dev->cache_last_use = 0;
-		}
-
-		dev->cache_last_use++;
-
-		cache->last_use = dev->cache_last_use;
+		list_move_tail(&cache->lru, &dev->cache_lru);
 
 		if (is_write)
 			cache->dirty = 1;
@@ -1613,10 +1643,10 @@ static void yaffs_invalidate_chunk_cache(struct yaffs_obj *object, int chunk_id)
 {
 	if (object->my_dev->param.n_caches > 0) {
 		struct yaffs_cache *cache =
-		    yaffs_find_chunk_cache(object, chunk_id);
+		    yaffs_lookup_chunk_cache(object, chunk_id);
 
 		if (cache)
-			cache->object = NULL;
+			yaffs_clear_cache(object->my_dev, cache);
 	}
 }
 
@@ -1632,7 +1662,7 @@ static void yaffs_invalidate_whole_cache(struct yaffs_obj *in)
 		/* Invalidate it. */
 		for (i = 0; i < dev->param.n_caches; i++) {
 			if (dev->cache[i].object == in)
-				dev->cache[i].object = NULL;
+				yaffs_clear_cache(dev, &dev->cache[i]);
 		}
 	}
 }
@@ -1645,7 +1675,7 @@ static void yaffs_unhash_obj(struct yaffs_obj *obj)
 	/* If it is still linked into the bucket list, free from the list */
 	if (!list_empty(&obj->hash_link)) {
 		list_del_init(&obj->hash_link);
-		bucket = yaffs_hash_fn(obj->obj_id);
+		bucket = yaffs_hash_fn(dev, obj->obj_id);
 		dev->obj_bucket[bucket].count--;
 	}
 }
@@ -1892,7 +1922,7 @@ static int yaffs_find_nice_bucket(struct yaffs_dev *dev)
 
 	for (i = 0; i < 10 && lowest > 4; i++) {
 		dev->bucket_finder++;
-		dev->bucket_finder %= YAFFS_NOBJECT_BUCKETS;
+		dev->bucket_finder &= dev->n_obj_buckets - 1;
 		if (dev->obj_bucket[dev->bucket_finder].count < lowest) {
 			lowest = dev->obj_bucket[dev->bucket_finder].count;
 			l = dev->bucket_finder;
@@ -1920,7 +1950,7 @@ static int yaffs_new_obj_id(struct yaffs_dev *dev)
 
 	while (!found) {
 		found = 1;
-		n += YAFFS_NOBJECT_BUCKETS;
+		n += dev->n_obj_buckets;
 		if (1 || dev->obj_bucket[bucket].count > 0) {
 			list_for_each(i, &dev->obj_bucket[bucket].list) {
 				/* If there is already one in the list */
@@ -1935,24 +1965,111 @@ static int yaffs_new_obj_id(struct yaffs_dev *dev)
 	return n;
 }
 
+/* With alt NULL the table must come from kmalloc(), see yaffs_grow_obj_hash().
+ * Only the table allocated at mount may fall back to vmalloc().
+ */
+static struct yaffs_obj_bucket *yaffs_alloc_obj_buckets(u32 n_buckets,
+							int *alt)
+{
+	struct yaffs_obj_bucket *buckets;
+	u32 i;
+
+	buckets = kmalloc(n_buckets * sizeof(*buckets),
+			  alt ? GFP_NOFS : GFP_NOFS | __GFP_NOWARN);
+	if (alt)
+		*alt = 0;
+	if (!buckets && alt) {
+		buckets = vmalloc(n_buckets * sizeof(*buckets));
+		*alt = 1;
+	}
+	if (!buckets)
+		return NULL;
+
+	for (i = 0; i < n_buckets; i++) {
+		INIT_LIST_HEAD(&buckets[i].list);
+		buckets[i].count = 0;
+	}
+	return buckets;
+}
+
+static void yaffs_free_obj_buckets(struct yaffs_obj_bucket *buckets, int alt)
+{
+	if (alt)
+		vfree(buckets);
+	else
+		kfree(buckets);
+}
+
+/* Double the object hash, moving every object over to the new table.
+ * Failing to get the memory is not an error, the chains just get longer.
+ * This runs under the gross lock when an object gets created: vmalloc()
+ * allocates with GFP_KERNEL and could end up evicting one of our inodes,
+ * which takes the gross lock again, so the new table has to come from
+ * kmalloc(GFP_NOFS).
+ */
+static void yaffs_grow_obj_hash(struct yaffs_dev *dev)
+{
+	struct yaffs_obj_bucket *old = dev->obj_bucket;
+	u32 n_old = dev->n_obj_buckets;
+	int old_alt = dev->obj_bucket_alt;
+	struct yaffs_obj_bucket *buckets;
+	struct list_head *lh;
+	struct list_head *n;
+	struct yaffs_obj *obj;
+	int bucket;
+	u32 i;
+
+	buckets = yaffs_alloc_obj_buckets(n_old * 2, NULL);
+	if (!buckets)
+		return;
+
+	dev->obj_bucket = buckets;
+	dev->n_obj_buckets = n_old * 2;
+	dev->obj_bucket_alt = 0;
+	dev->bucket_finder = 0;
+
+	for (i = 0; i < n_old; i++) {
+		list_for_each_safe(lh, n, &old[i].list) {
+			obj = list_entry(lh, struct yaffs_obj, hash_link);
+			bucket = yaffs_hash_fn(dev, obj->obj_id);
+			list_move(lh, &buckets[bucket].list);
+			buckets[bucket].count++;
+		}
+	}
+	yaffs_free_obj_buckets(old, old_alt);
+	dev->obj_rehashes++;
+
+	yaffs_trace(YAFFS_TRACE_OS,
+		"yaffs: object hash grown to %u buckets for %d objects",
+		dev->n_obj_buckets, dev->n_obj);
+}
+
 static void yaffs_hash_obj(struct yaffs_obj *in)
 {
-	int bucket = yaffs_hash_fn(in->obj_id);
 	struct yaffs_dev *dev = in->my_dev;
+	int bucket;
 
+	/* Keep the chains around two objects long */
+	if (dev->n_obj > 2 * dev->n_obj_buckets &&
+	    dev->n_obj_buckets < YAFFS_MAX_NOBJECT_BUCKETS)
+		yaffs_grow_obj_hash(dev);
+
+	bucket = yaffs_hash_fn(dev, in->obj_id);
 	list_add(&in->hash_link, &dev->obj_bucket[bucket].list);
 	dev->obj_bucket[bucket].count++;
 }
 
 struct yaffs_obj *yaffs_find_by_number(struct yaffs_dev *dev, u32 number)
 {
-	int bucket = yaffs_hash_fn(number);
+	int bucket = yaffs_hash_fn(dev, number);
 	struct list_head *i;
 	struct yaffs_obj *in;
 
+	dev->obj_lookups++;
 	list_for_each(i, &dev->obj_bucket[bucket].list) {
 		/* Look if it is in the list */
 		if (i) {
+			dev->obj_probes++;
 			in = list_entry(i, struct yaffs_obj, hash_link);
 			if (in->obj_id == number) {
 
@@ -2056,7 +2173,8 @@ static void yaffs_init_tnodes_and_objs(struct yaffs_dev *dev)
 
 	yaffs_init_raw_tnodes_and_objs(dev);
 
-	for (i = 0; i < YAFFS_NOBJECT_BUCKETS; i++) {
+	/* The table keeps the size it grew to, a rescan fills it again */
+	for (i = 0; dev->obj_bucket && i < dev->n_obj_buckets; i++) {
 		INIT_LIST_HEAD(&dev->obj_bucket[i].list);
 		dev->obj_bucket[i].count = 0;
 	}
@@ -2332,10 +2450,21 @@ static int yaffs_init_blocks(struct yaffs_dev *dev)
                 }
 	}
 
+	/* Only used to steer gc, so do without if there is no memory */
+	dev->block_erases = kmalloc(n_blocks * sizeof(u16), GFP_NOFS);
+	if (!dev->block_erases) {
+		dev->block_erases = vmalloc(n_blocks * sizeof(u16));
+		dev->block_erases_alt = 1;
+	} else {
+		dev->block_erases_alt = 0;
+	}
+
 	if (dev->block_info && dev->chunk_bits) {
 		memset(dev->block_info, 0,
 		       n_blocks * sizeof(struct yaffs_block_info));
 		memset(dev->chunk_bits, 0, dev->chunk_bit_stride * n_blocks);
+		if (dev->block_erases)
+			memset(dev->block_erases, 0, n_blocks * sizeof(u16));
 		return YAFFS_OK;
 	}
 
@@ -2359,6 +2488,13 @@ static void yaffs_deinit_blocks(struct yaffs_dev *dev)
 		kfree(dev->chunk_bits);
 	dev->chunk_bits_alt = 0;
 	dev->chunk_bits = NULL;
+
+	if (dev->block_erases_alt && dev->block_erases)
+		vfree(dev->block_erases);
+	else if (dev->block_erases)
+		kfree(dev->block_erases);
+	dev->block_erases_alt = 0;
+	dev->block_erases = NULL;
 }
 
 void yaffs_block_became_dirty(struct yaffs_dev *dev, int block_no)
@@ -2715,9 +2851,48 @@ static int yaffs_gc_block(struct yaffs_dev *dev, int block, int whole_block)
 	return ret_val;
 }
 
+/*
+ * yaffs_gc_score() rates a block for leisurely garbage collection by its
+ * cost-benefit, as log structured file systems do: the space collecting
+ * it frees, times how long its data has gone unchanged, over the cost of
+ * copying the chunks still in use.  Old blocks hold data that is not
+ * going to be deleted soon, so a half full old block is worth collecting
+ * before a more dirty new one, whose remaining chunks may well die on
+ * their own.  Blocks erased well above the average since mount score
+ * less, which spreads the wear.
+ */
+static unsigned yaffs_gc_score(struct yaffs_dev *dev, int block,
+			       struct yaffs_block_info *bi, int pages_used)
+{
+	unsigned n_chunks = dev->param.chunks_per_block;
+	unsigned n_blocks =
+	    dev->internal_end_block - dev->internal_start_block + 1;
+	unsigned age, score, mean, erases;
+
+	if (!dev->param.is_yaffs2)
+		return n_chunks - pages_used;
+
+	/* Blocks are allocated in sequence number order */
+	age = dev->seq_number - bi->seq_number;
+	if (age > YAFFS_GC_MAX_AGE)
+		age = YAFFS_GC_MAX_AGE;
+	score = ((n_chunks - pages_used) * (age + 1) << 6) /
+	    (n_chunks + pages_used);
+
+	if (dev->block_erases) {
+		erases = dev->block_erases[block - dev->internal_start_block];
+		mean = dev->n_erasures / n_blocks;
+		if (erases > mean + YAFFS_GC_WEAR_SLACK)
+			score /= 1 + (erases - mean) / YAFFS_GC_WEAR_SLACK;
+	}
+	return score;
+}
+
 /*
  * FindBlockForgarbageCollection is used to select the dirtiest block (or close enough)
- * for garbage collection.
+ * for garbage collection.  Aggressive gc takes the dirtiest block, which
+ * gets the writer waiting for it going soonest, the others the block with
+ * the best yaffs_gc_score().
  */
 
 static unsigned yaffs_find_gc_block(struct yaffs_dev *dev,
@@ -2730,6 +2905,8 @@ static unsigned yaffs_find_gc_block(struct yaffs_dev *dev,
 	int prioritised_exist = 0;
 	struct yaffs_block_info *bi;
 	int threshold;
+	int max_threshold;
+	unsigned score;
 
 	/* First let's see if we need to grab a prioritised block */
 	if (dev->has_pending_prioritised_gc && !aggressive) {
@@ -2775,10 +2952,11 @@ static unsigned yaffs_find_gc_block(struct yaffs_dev *dev,
 		    dev->internal_end_block - dev->internal_start_block + 1;
 		if (aggressive) {
 			threshold = dev->param.chunks_per_block;
+			max_threshold = threshold;
 			iterations = n_blocks;
+			/* Scores of passive scans don't compare, start over */
+			dev->gc_dirtiest = 0;
 		} else {
-			int max_threshold;
-
 			if (background)
 				max_threshold = dev->param.chunks_per_block / 2;
 			else
@@ -2812,13 +2990,24 @@ static unsigned yaffs_find_gc_block(struct yaffs_dev *dev,
 
 			pages_used = bi->pages_in_use - bi->soft_del_pages;
 
-			if (bi->block_state == YAFFS_BLOCK_STATE_FULL &&
-			    pages_used < dev->param.chunks_per_block &&
-			    (dev->gc_dirtiest < 1
-			     || pages_used < dev->gc_pages_in_use)
-			    && yaffs_block_ok_for_gc(dev, bi)) {
+			if (bi->block_state != YAFFS_BLOCK_STATE_FULL ||
+			    pages_used >= dev->param.chunks_per_block ||
+			    pages_used > max_threshold ||
+			    !yaffs_block_ok_for_gc(dev, bi))
+				continue;
+
+			if (aggressive)
+				score = dev->param.chunks_per_block -
+				    pages_used;
+			else
+				score = yaffs_gc_score(dev,
+						       dev->gc_block_finder,
+						       bi, pages_used);
+			if (dev->gc_dirtiest < 1 ||
+			    score > dev->gc_best_score) {
 				dev->gc_dirtiest = dev->gc_block_finder;
 				dev->gc_pages_in_use = pages_used;
+				dev->gc_best_score = score;
 			}
 		}
 
@@ -2874,6 +3063,24 @@ static unsigned yaffs_find_gc_block(struct yaffs_dev *dev,
 	return selected;
 }
 
+/* Account the time a writer spent collecting garbage before it could write */
+static void yaffs_gc_stall(struct yaffs_dev *dev, s64 us)
+{
+	static const s64 limits[YAFFS_GC_STALL_BUCKETS - 1] = {
+		1000, 10000, 100000
+	};
+	int i;
+
+	for (i = 0; i < YAFFS_GC_STALL_BUCKETS - 1; i++)
+		if (us < limits[i])
+			break;
+	dev->gc_stall_hist[i]++;
+	dev->gc_stalls++;
+	dev->gc_stall_us += us;
+	if (us > dev->gc_stall_max_us)
+		dev->gc_stall_max_us = us;
+}
+
 /* New garbage collector
  * If we're very low on erased blocks then we do aggressive garbage collection
  * otherwise we do "leasurely" garbage collection.
@@ -2891,6 +3098,7 @@ static int yaffs_check_gc(struct yaffs_dev *dev, int background)
 	int min_erased;
 	int erased_chunks;
 	int checkpt_block_adjust;
+	s64 start = 0;
 
 	if (dev->param.gc_control && (dev->param.gc_control(dev) & 1) == 0)
 		return YAFFS_OK;
@@ -2958,6 +3166,8 @@ static int yaffs_check_gc(struct yaffs_dev *dev, int background)
 				"yaffs: GC n_erased_blocks %d aggressive %d",
 				dev->n_erased_blocks, aggressive);
 
+			if (!background && !start)
+				start = Y_CLOCK_US();
 			gc_ok = yaffs_gc_block(dev, dev->gc_block, aggressive);
 		}
 
@@ -2971,6 +3181,9 @@ static int yaffs_check_gc(struct yaffs_dev *dev, int background)
 	} while ((dev->n_erased_blocks < dev->param.n_reserved_blocks) &&
 		 (dev->gc_block > 0) && (max_tries < 2));
 
+	if (start)
+		yaffs_gc_stall(dev, Y_CLOCK_US() - start);
+
 	return aggressive ? gc_ok : YAFFS_OK;
 }
 
@@ -3581,10 +3794,7 @@ int yaffs_file_rd(struct yaffs_obj *in, u8 * buffer, loff_t offset, int n_bytes)
 				if (!cache) {
 					cache =
 					    yaffs_grab_chunk_cache(in->my_dev);
-					cache->object = in;
-					cache->chunk_id = chunk;
-					cache->dirty = 0;
-					cache->locked = 0;
+					yaffs_set_cache(dev, cache, in, chunk);
 					yaffs_rd_data_obj(in, chunk,
 							  cache->data);
 					cache->n_bytes = 0;
@@ -3707,10 +3917,7 @@ int yaffs_do_file_wr(struct yaffs_obj *in, const u8 * buffer, loff_t offset,
 				if (!cache
 				    && yaffs_check_alloc_available(dev, 1)) {
 					cache = yaffs_grab_chunk_cache(dev);
-					cache->object = in;
-					cache->chunk_id = chunk;
-					cache->dirty = 0;
-					cache->locked = 0;
+					yaffs_set_cache(dev, cache, in, chunk);
 					yaffs_rd_data_obj(in, chunk,
 							  cache->data);
 				} else if (cache &&
@@ -4383,7 +4590,7 @@ static void yaffs_fix_hanging_objs(struct yaffs_dev *dev)
 	 * Make sure it is rooted.
 	 */
 
-	for (i = 0; i < YAFFS_NOBJECT_BUCKETS; i++) {
+	for (i = 0; i < dev->n_obj_buckets; i++) {
 		list_for_each_safe(lh, n, &dev->obj_bucket[i].list) {
 			if (lh) {
 				obj =
@@ -4764,6 +4971,8 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 	int init_failed = 0;
 	unsigned x;
 	int bits;
+	u64 mount_start = Y_CLOCK_US();
+	u64 t;
 
 	yaffs_trace(YAFFS_TRACE_TRACING, "yaffs: yaffs_guts_initialise()" );
 
@@ -4916,6 +5125,7 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 	dev->passive_gc_count = 0;
 	dev->oldest_dirty_gc_count = 0;
 	dev->bg_gcs = 0;
+	dev->bg_checkpts = 0;
 	dev->gc_block_finder = 0;
 	dev->buffered_block = -1;
 	dev->doing_buffered_block_rewrite = 0;
@@ -4939,17 +5149,20 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 		init_failed = 1;
 
 	dev->cache = NULL;
+	dev->cache_hash = NULL;
+	INIT_LIST_HEAD(&dev->cache_lru);
 	dev->gc_cleanup_list = NULL;
+	dev->obj_bucket = NULL;
 
 	if (!init_failed && dev->param.n_caches > 0) {
 		int i;
 		void *buf;
-		int cache_bytes =
-		    dev->param.n_caches * sizeof(struct yaffs_cache);
+		int cache_bytes;
 
 		if (dev->param.n_caches > YAFFS_MAX_SHORT_OP_CACHES)
 			dev->param.n_caches = YAFFS_MAX_SHORT_OP_CACHES;
 
+		cache_bytes = dev->param.n_caches * sizeof(struct yaffs_cache);
 		dev->cache = kmalloc(cache_bytes, GFP_NOFS);
 
 		buf = (u8 *) dev->cache;
@@ -4959,18 +5172,45 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 
 		for (i = 0; i < dev->param.n_caches && buf; i++) {
 			dev->cache[i].object = NULL;
-			dev->cache[i].last_use = 0;
+			INIT_LIST_HEAD(&dev->cache[i].hash_link);
+			list_add_tail(&dev->cache[i].lru, &dev->cache_lru);
 			dev->cache[i].dirty = 0;
 			dev->cache[i].data = buf =
 			    kmalloc(dev->param.total_bytes_per_chunk, GFP_NOFS);
 		}
+
+		/* Two buckets per cache */
+		dev->cache_hash_size = 1;
+		while (dev->cache_hash_size < 2 * dev->param.n_caches)
+			dev->cache_hash_size <<= 1;
+		if (buf)
+			buf = dev->cache_hash =
+			    kmalloc(dev->cache_hash_size *
+				    sizeof(struct list_head), GFP_NOFS);
+		for (i = 0; buf && i < dev->cache_hash_size; i++)
+			INIT_LIST_HEAD(&dev->cache_hash[i]);
+
 		if (!buf)
 			init_failed = 1;
-
-		dev->cache_last_use = 0;
 	}
 
 	dev->cache_hits = 0;
+	dev->cache_misses = 0;
+	dev->obj_lookups = 0;
+	dev->obj_probes = 0;
+	dev->obj_rehashes = 0;
+
+	if (!init_failed) {
+		int alt;
+
+		dev->n_obj_buckets = YAFFS_NOBJECT_BUCKETS;
+		dev->obj_bucket =
+		    yaffs_alloc_obj_buckets(dev->n_obj_buckets, &alt);
+		dev->obj_bucket_alt = alt;
+		dev->bucket_finder = 0;
+		if (!dev->obj_bucket)
+			init_failed = 1;
+	}
 
 	if (!init_failed) {
 		dev->gc_cleanup_list =
@@ -4991,10 +5231,19 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 	if (!init_failed && !yaffs_create_initial_dir(dev))
 		init_failed = 1;
 
+	dev->mount_from_checkpt = 0;
+	dev->mount_checkpt_us = 0;
+	dev->mount_scan_us = 0;
+	dev->mount_scan_blocks = 0;
+	dev->mount_scan_threads = 0;
+
 	if (!init_failed) {
 		/* Now scan the flash. */
 		if (dev->param.is_yaffs2) {
-			if (yaffs2_checkpt_restore(dev)) {
+			t = Y_CLOCK_US();
+			dev->mount_from_checkpt = yaffs2_checkpt_restore(dev);
+			dev->mount_checkpt_us = Y_CLOCK_US() - t;
+			if (dev->mount_from_checkpt) {
 				yaffs_check_obj_details_loaded(dev->root_dir);
 				yaffs_trace(YAFFS_TRACE_CHECKPOINT | YAFFS_TRACE_MOUNT,
 					"yaffs: restored from checkpoint"
@@ -5025,12 +5274,17 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 				    && !yaffs_create_initial_dir(dev))
 					init_failed = 1;
 
+				t = Y_CLOCK_US();
 				if (!init_failed && !yaffs2_scan_backwards(dev))
 					init_failed = 1;
+				dev->mount_scan_us = Y_CLOCK_US() - t;
 			}
-		} else if (!yaffs1_scan(dev)) {
-			init_failed = 1;
-                }
+		} else {
+			t = Y_CLOCK_US();
+			if (!yaffs1_scan(dev))
+				init_failed = 1;
+			dev->mount_scan_us = Y_CLOCK_US() - t;
+		}
 
 		yaffs_strip_deleted_objs(dev);
 		yaffs_fix_hanging_objs(dev);
@@ -5047,12 +5301,25 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 		return YAFFS_FAIL;
 	}
 
+	dev->mount_page_reads = dev->n_page_reads;
+	dev->mount_us = Y_CLOCK_US() - mount_start;
+	yaffs_trace(YAFFS_TRACE_MOUNT,
+		"yaffs: mounted %s in %u us: checkpoint %u us, scan %u us of %u blocks with %u threads, %u page reads",
+		dev->mount_from_checkpt ? "from checkpoint" : "by scanning",
+		dev->mount_us, dev->mount_checkpt_us, dev->mount_scan_us,
+		dev->mount_scan_blocks, dev->mount_scan_threads,
+		dev->mount_page_reads);
+
 	/* Zero out stats */
 	dev->n_page_reads = 0;
 	dev->n_page_writes = 0;
 	dev->n_erasures = 0;
 	dev->n_gc_copies = 0;
 	dev->n_retired_writes = 0;
+	if (dev->block_erases)
+		memset(dev->block_erases, 0,
+		       (dev->internal_end_block - dev->internal_start_block +
+			1) * sizeof(u16));
 
 	dev->n_retired_blocks = 0;
 
@@ -5086,6 +5353,14 @@ void yaffs_deinitialise(struct yaffs_dev *dev)
 
 			kfree(dev->cache);
 			dev->cache = NULL;
+			kfree(dev->cache_hash);
+			dev->cache_hash = NULL;
+		}
+
+		if (dev->obj_bucket) {
+			yaffs_free_obj_buckets(dev->obj_bucket,
+					       dev->obj_bucket_alt);
+			dev->obj_bucket = NULL;
 		}
 
 		kfree(dev->gc_cleanup_list);
@@ -55,7 +55,13 @@
 #define YAFFS_ALLOCATION_NTNODES	100
 #define YAFFS_ALLOCATION_NLINKS		100
 
+/* The object hash starts with YAFFS_NOBJECT_BUCKETS buckets and doubles as
+ * objects get created.  New object ids are allocated bucket by bucket, so
+ * the table is kept small enough for each bucket to have plenty of ids left
+ * in the object space.
+ */
 #define YAFFS_NOBJECT_BUCKETS		256
+#define YAFFS_MAX_NOBJECT_BUCKETS	4096
 
 #define YAFFS_OBJECT_SPACE		0x40000
 #define YAFFS_MAX_OBJECT_ID		(YAFFS_OBJECT_SPACE -1)
@@ -83,7 +89,7 @@
 #define YAFFS_OBJECTID_CHECKPOINT_DATA	0x20
 #define YAFFS_SEQUENCE_CHECKPOINT_DATA  0x21
 
-#define YAFFS_MAX_SHORT_OP_CACHES	20
+#define YAFFS_MAX_SHORT_OP_CACHES	256
 
 #define YAFFS_N_TEMP_BUFFERS		6
 
@@ -93,6 +99,9 @@
  */
 #define YAFFS_WR_ATTEMPTS		(5*64)
 
+/* GC stalls are counted below 1ms, 10ms, 100ms and above */
+#define YAFFS_GC_STALL_BUCKETS		4
+
 /* Sequence numbers are used in YAFFS2 to determine block allocation order.
  * The range is limited slightly to help distinguish bad numbers from good.
  * This also allows us to perhaps in the future use special numbers for
@@ -110,7 +119,8 @@
 struct yaffs_cache {
 	struct yaffs_obj *object;
 	int chunk_id;
-	int last_use;
+	struct list_head hash_link;	/* in dev->cache_hash while object is set */
+	struct list_head lru;		/* in dev->cache_lru, free ones first */
 	int dirty;
 	int n_bytes;		/* Only valid if the cache is dirty */
 	int locked;		/* Can't push out or flush while locked. */
@@ -524,6 +534,8 @@ struct yaffs_param {
 
 	int enable_xattr;	/* Enable xattribs */
 
+	int n_scan_threads;	/* Threads reading tags ahead of a scan, 0 for none */
+
 	/* NAND access functions (Must be set before calling YAFFS) */
 
 	int (*write_chunk_fn) (struct yaffs_dev * dev,
@@ -543,6 +555,11 @@ struct yaffs_param {
 	int (*read_chunk_tags_fn) (struct yaffs_dev * dev,
 				   int nand_chunk, u8 * data,
 				   struct yaffs_ext_tags * tags);
+	/* Reads tags only and does not touch the device, so that several
+	 * threads can call it at once.  Optional, used to scan faster.
+	 */
+	int (*read_tags_fn) (struct yaffs_dev * dev, int nand_chunk,
+			     struct yaffs_ext_tags * tags);
 	int (*bad_block_fn) (struct yaffs_dev * dev, int block_no);
 	int (*query_block_fn) (struct yaffs_dev * dev, int block_no,
 			       enum yaffs_block_state * state,
@@ -637,6 +654,9 @@ struct yaffs_dev {
 	u8 *chunk_bits;		/* bitmap of chunks in use */
 	unsigned block_info_alt:1;	/* was allocated using alternative strategy */
 	unsigned chunk_bits_alt:1;	/* was allocated using alternative strategy */
+	unsigned block_erases_alt:1;	/* was allocated using alternative strategy */
+	unsigned obj_bucket_alt:1;	/* was allocated using alternative strategy */
+	u16 *block_erases;	/* erasures of each block since mount */
 	int chunk_bit_stride;	/* Number of bytes of chunk_bits per block.
 				 * Must be consistent with chunks_per_block.
 				 */
@@ -653,7 +673,8 @@ struct yaffs_dev {
 
 	int n_hardlinks;
 
-	struct yaffs_obj_bucket obj_bucket[YAFFS_NOBJECT_BUCKETS];
+	struct yaffs_obj_bucket *obj_bucket;
+	u32 n_obj_buckets;	/* a power of two */
 	u32 bucket_finder;
 
 	int n_free_chunks;
@@ -667,6 +688,7 @@ struct yaffs_dev {
 	unsigned gc_block_finder;
 	unsigned gc_dirtiest;
 	unsigned gc_pages_in_use;
+	unsigned gc_best_score;	/* yaffs_gc_score() of gc_dirtiest */
 	unsigned gc_not_done;
 	unsigned gc_block;
 	unsigned gc_chunk;
@@ -685,7 +707,9 @@ struct yaffs_dev {
 	int doing_buffered_block_rewrite;
 
 	struct yaffs_cache *cache;
-	int cache_last_use;
+	struct list_head *cache_hash;	/* caches hashed on object and chunk */
+	u32 cache_hash_size;	/* a power of two */
+	struct list_head cache_lru;	/* least recently used first */
 
 	/* Stuff for background deletion and unlinked files. */
 	struct yaffs_obj *unlinked_dir;	/* Directory where unlinked and deleted files live. */
@@ -724,6 +748,7 @@ struct yaffs_dev {
 	u32 oldest_dirty_gc_count;
 	u32 n_gc_blocks;
 	u32 bg_gcs;
+	u32 bg_checkpts;	/* checkpoints written by the background thread */
 	u32 n_retired_writes;
 	u32 n_retired_blocks;
 	u32 n_ecc_fixed;
@@ -734,6 +759,25 @@ struct yaffs_dev {
 	u32 n_unmarked_deletions;
 	u32 refresh_count;
 	u32 cache_hits;
+	u32 cache_misses;
+	u32 obj_lookups;	/* yaffs_find_by_number() calls */
+	u32 obj_probes;		/* objects looked at by them */
+	u32 obj_rehashes;
+
+	/* Writers that had to wait for a block to be garbage collected */
+	u32 gc_stalls;
+	u32 gc_stall_max_us;
+	u64 gc_stall_us;
+	u32 gc_stall_hist[YAFFS_GC_STALL_BUCKETS];
+
+	/* How the last mount went */
+	int mount_from_checkpt;
+	u32 mount_us;
+	u32 mount_checkpt_us;	/* reading the checkpoint, used or not */
+	u32 mount_scan_us;
+	u32 mount_scan_blocks;	/* blocks with chunks to scan */
+	u32 mount_scan_threads;	/* threads reading tags ahead of the scan */
+	u32 mount_page_reads;
 
 };
 
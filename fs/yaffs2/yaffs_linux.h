@@ -24,6 +24,8 @@ struct yaffs_linux_context {
 	struct super_block *super;
 	struct task_struct *bg_thread;	/* Background thread for this device */
 	int bg_running;
+	u32 bg_writes;		/* Non-gc page writes when last looked at */
+	unsigned long bg_active;	/* jiffies when they last changed */
 	struct mutex gross_lock;	/* Gross locking mutex*/
 	u8 *spare_buffer;	/* For mtdif2 use. Don't know the size of the buffer
 				 * at compile time so we have to allocate it.
@@ -110,6 +110,10 @@ int yaffs_erase_block(struct yaffs_dev *dev, int flash_block)
 {
 	int result;
 
+	if (dev->block_erases &&
+	    dev->block_erases[flash_block - dev->internal_start_block] < 0xffff)
+		dev->block_erases[flash_block - dev->internal_start_block]++;
+
 	flash_block -= dev->block_offset;
 
 	dev->n_erasures++;
@@ -85,6 +85,7 @@ static uint32_t YCALCBLOCKS(uint64_t partition_size, uint32_t block_size)
 #include "yaffs_trace.h"
 #include "yaffs_guts.h"
 #include "yaffs_attribs.h"
+#include "yaffs_yaffs2.h"
 
 #include "yaffs_linux.h"
 
@@ -97,6 +98,9 @@ unsigned int yaffs_wr_attempts = YAFFS_WR_ATTEMPTS;
 unsigned int yaffs_auto_checkpoint = 1;
 unsigned int yaffs_gc_control = 1;
 unsigned int yaffs_bg_enable = 1;
+unsigned int yaffs_bg_idle_ms = 500;
+unsigned int yaffs_bg_checkpt_secs = 60;
+int yaffs_scan_threads = -1;
 
 /* Module Parameters */
 module_param(yaffs_trace_mask, uint, 0644);
@@ -104,6 +108,9 @@ module_param(yaffs_wr_attempts, uint, 0644);
 module_param(yaffs_auto_checkpoint, uint, 0644);
 module_param(yaffs_gc_control, uint, 0644);
 module_param(yaffs_bg_enable, uint, 0644);
+module_param(yaffs_bg_idle_ms, uint, 0644);
+module_param(yaffs_bg_checkpt_secs, uint, 0644);
+module_param(yaffs_scan_threads, int, 0644);
 
 
 #define yaffs_inode_to_obj_lv(iptr) ((iptr)->i_private)
@@ -1615,6 +1622,68 @@ void yaffs_background_waker(unsigned long data)
 	wake_up_process((struct task_struct *)data);
 }
 
+/*
+ * The device is idle once nothing but gc has written to it for
+ * yaffs_bg_idle_ms.  Called with the gross lock held.
+ */
+static int yaffs_bg_idle(struct yaffs_dev *dev, unsigned long now)
+{
+	struct yaffs_linux_context *context = yaffs_dev_to_lc(dev);
+	u32 writes = dev->n_page_writes - dev->n_gc_copies;
+
+	if (writes != context->bg_writes) {
+		context->bg_writes = writes;
+		context->bg_active = now;
+	}
+	return time_after_eq(now, context->bg_active +
+			     msecs_to_jiffies(yaffs_bg_idle_ms));
+}
+
+/*
+ * A checkpoint lets the next mount skip the scan, but the first write after
+ * it throws it away.  Unmount and sync write one, and so does the
+ * background thread once the device has gone idle, at most every
+ * yaffs_bg_checkpt_secs, so that a mount after power is lost does not have
+ * to scan either.  Like sync, that is only done if yaffs_auto_checkpoint
+ * asks for it, and a one-shot request is taken at the next idle moment.
+ * Called with the gross lock held.
+ */
+static int yaffs_bg_checkpoint_due(struct yaffs_dev *dev, unsigned long now,
+				   unsigned long next_checkpt)
+{
+	unsigned int oneshot_checkpoint = (yaffs_auto_checkpoint & 4);
+
+	if (!yaffs_bg_enable || dev->is_checkpointed ||
+	    !yaffs2_checkpt_required(dev))
+		return 0;
+	if (!oneshot_checkpoint &&
+	    (!yaffs_bg_checkpt_secs || !(yaffs_auto_checkpoint & 3) ||
+	     time_before(now, next_checkpt)))
+		return 0;
+	return yaffs_bg_idle(dev, now) && !yaffs_bg_gc_urgency(dev);
+}
+
+/*
+ * Not done with yaffs_flush_super(): the gross lock does not keep inodes
+ * from coming and going on sb->s_inodes.  s_umount keeps the super block
+ * around, and if an unmount holds it the unmount writes the checkpoint.
+ */
+static void yaffs_bg_checkpoint(struct yaffs_dev *dev)
+{
+	struct super_block *sb = yaffs_dev_to_lc(dev)->super;
+
+	if (!down_read_trylock(&sb->s_umount))
+		return;
+	yaffs_update_dirty_dirs(dev);
+	yaffs_flush_whole_cache(dev);
+	yaffs_checkpoint_save(dev);
+	up_read(&sb->s_umount);
+
+	yaffs_auto_checkpoint &= ~4;
+	if (dev->is_checkpointed)
+		dev->bg_checkpts++;
+}
+
 static int yaffs_bg_thread_fn(void *data)
 {
 	struct yaffs_dev *dev = (struct yaffs_dev *)data;
@@ -1622,8 +1691,10 @@ static int yaffs_bg_thread_fn(void *data)
 	unsigned long now = jiffies;
 	unsigned long next_dir_update = now;
 	unsigned long next_gc = now;
+	unsigned long next_checkpt = now;
 	unsigned long expires;
 	unsigned int urgency;
+	int idle;
 
 	int gc_result;
 	struct timer_list timer;
@@ -1652,10 +1723,21 @@ static int yaffs_bg_thread_fn(void *data)
 
 		if (time_after(now, next_gc) && yaffs_bg_enable) {
 			if (!dev->is_checkpointed) {
+				/*
+				 * Collect while nobody is writing, so that
+				 * writers find erased blocks instead of having
+				 * to collect them.  Only when they are about
+				 * to, compete with them for the lock.
+				 */
 				urgency = yaffs_bg_gc_urgency(dev);
-				gc_result = yaffs_bg_gc(dev, urgency);
+				idle = yaffs_bg_idle(dev, now);
+				if (idle || urgency > 1)
+					gc_result = yaffs_bg_gc(dev, urgency);
 				if (urgency > 1)
 					next_gc = now + HZ / 20 + 1;
+				else if (!idle)
+					next_gc = now +
+					    msecs_to_jiffies(yaffs_bg_idle_ms) + 1;
 				else if (urgency > 0)
 					next_gc = now + HZ / 10 + 1;
 				else
@@ -1668,6 +1750,11 @@ static int yaffs_bg_thread_fn(void *data)
 				next_gc = next_dir_update;
                         }
 		}
+
+		if (yaffs_bg_checkpoint_due(dev, now, next_checkpt)) {
+			yaffs_bg_checkpoint(dev);
+			next_checkpt = now + yaffs_bg_checkpt_secs * HZ;
+		}
 		yaffs_gross_unlock(dev);
 		expires = next_dir_update;
 		if (time_before(next_gc, expires))
@@ -1698,6 +1785,8 @@ static int yaffs_bg_start(struct yaffs_dev *dev)
 		return -1;
 
 	context->bg_running = 1;
+	context->bg_writes = dev->n_page_writes - dev->n_gc_copies;
+	context->bg_active = jiffies;
 
 	context->bg_thread = kthread_run(yaffs_bg_thread_fn,
 					 (void *)dev, "yaffs-bg-%d",
@@ -1758,6 +1847,7 @@ struct yaffs_options {
 	int skip_checkpoint_read;
 	int skip_checkpoint_write;
 	int no_cache;
+	int n_caches;		/* 0 for the default */
 	int tags_ecc_on;
 	int tags_ecc_overridden;
 	int lazy_loading_enabled;
@@ -1813,6 +1903,16 @@ static int yaffs_parse_options(struct yaffs_options *options,
 			options->empty_lost_and_found_overridden = 1;
 		} else if (!strcmp(cur_opt, "no-cache")) {
 			options->no_cache = 1;
+		} else if (!strncmp(cur_opt, "cache-chunks=", 13)) {
+			options->n_caches =
+			    simple_strtoul(cur_opt + 13, NULL, 0);
+			if (options->n_caches < 1 ||
+			    options->n_caches > YAFFS_MAX_SHORT_OP_CACHES) {
+				printk(KERN_INFO
+				       "yaffs: cache-chunks must be 1 to %d\n",
+				       YAFFS_MAX_SHORT_OP_CACHES);
+				error = 1;
+			}
 		} else if (!strcmp(cur_opt, "no-checkpoint-read")) {
 			options->skip_checkpoint_read = 1;
 		} else if (!strcmp(cur_opt, "no-checkpoint-write")) {
@@ -2215,7 +2315,12 @@ static struct super_block *yaffs_internal_read_super(int yaffs_version,
 	param->chunks_per_block = YAFFS_CHUNKS_PER_BLOCK;
 	param->total_bytes_per_chunk = YAFFS_BYTES_PER_CHUNK;
 	param->n_reserved_blocks = 5;
-	param->n_caches = (options.no_cache) ? 0 : 10;
+	if (options.no_cache)
+		param->n_caches = 0;
+	else if (options.n_caches)
+		param->n_caches = options.n_caches;
+	else
+		param->n_caches = 10;
 	param->inband_tags = options.inband_tags;
 
 #ifdef CONFIG_YAFFS_DISABLE_LAZY_LOAD
@@ -2260,6 +2365,7 @@ static struct super_block *yaffs_internal_read_super(int yaffs_version,
 	if (yaffs_version == 2) {
 		param->write_chunk_tags_fn = nandmtd2_write_chunk_tags;
 		param->read_chunk_tags_fn = nandmtd2_read_chunk_tags;
+		param->read_tags_fn = nandmtd2_read_tags;
 		param->bad_block_fn = nandmtd2_mark_block_bad;
 		param->query_block_fn = nandmtd2_query_block;
 		yaffs_dev_to_lc(dev)->spare_buffer = 
@@ -2297,6 +2403,11 @@ static struct super_block *yaffs_internal_read_super(int yaffs_version,
 	param->skip_checkpt_rd = options.skip_checkpoint_read;
 	param->skip_checkpt_wr = options.skip_checkpoint_write;
 
+	if (yaffs_scan_threads < 0)
+		param->n_scan_threads = num_online_cpus();
+	else
+		param->n_scan_threads = yaffs_scan_threads;
+
 	mutex_lock(&yaffs_context_lock);
 	/* Get a mount id */
 	found = 0;
@@ -2442,6 +2553,8 @@ static char *yaffs_dump_dev_part0(char *buf, struct yaffs_dev *dev)
 			param->n_reserved_blocks);
 	buf += sprintf(buf, "always_check_erased... %d\n",
 			param->always_check_erased);
+	buf += sprintf(buf, "n_scan_threads........ %d\n",
+			param->n_scan_threads);
 
 	return buf;
 }
@@ -2458,6 +2571,22 @@ static char *yaffs_dump_dev_part1(char *buf, struct yaffs_dev *dev)
 	buf +=
 	    sprintf(buf, "blocks_in_checkpt..... %d\n", dev->blocks_in_checkpt);
 	buf += sprintf(buf, "\n");
+	buf +=
+	    sprintf(buf, "mount_from_checkpt.... %d\n",
+		    dev->mount_from_checkpt);
+	buf += sprintf(buf, "mount_us.............. %u\n", dev->mount_us);
+	buf +=
+	    sprintf(buf, "mount_checkpt_us...... %u\n", dev->mount_checkpt_us);
+	buf += sprintf(buf, "mount_scan_us......... %u\n", dev->mount_scan_us);
+	buf +=
+	    sprintf(buf, "mount_scan_blocks..... %u\n",
+		    dev->mount_scan_blocks);
+	buf +=
+	    sprintf(buf, "mount_scan_threads.... %u\n",
+		    dev->mount_scan_threads);
+	buf +=
+	    sprintf(buf, "mount_page_reads...... %u\n", dev->mount_page_reads);
+	buf += sprintf(buf, "\n");
 	buf += sprintf(buf, "n_tnodes.............. %d\n", dev->n_tnodes);
 	buf += sprintf(buf, "n_obj................. %d\n", dev->n_obj);
 	buf += sprintf(buf, "n_free_chunks......... %d\n", dev->n_free_chunks);
@@ -2474,6 +2603,17 @@ static char *yaffs_dump_dev_part1(char *buf, struct yaffs_dev *dev)
 		    dev->oldest_dirty_gc_count);
 	buf += sprintf(buf, "n_gc_blocks........... %u\n", dev->n_gc_blocks);
 	buf += sprintf(buf, "bg_gcs................ %u\n", dev->bg_gcs);
+	buf += sprintf(buf, "bg_checkpts........... %u\n", dev->bg_checkpts);
+	buf += sprintf(buf, "gc_stalls............. %u\n", dev->gc_stalls);
+	buf +=
+	    sprintf(buf, "gc_stall_us........... %llu\n",
+		    (unsigned long long)dev->gc_stall_us);
+	buf +=
+	    sprintf(buf, "gc_stall_max_us....... %u\n", dev->gc_stall_max_us);
+	buf +=
+	    sprintf(buf, "gc_stall_hist......... %u %u %u %u (<1 <10 <100 >=100 ms)\n",
+		    dev->gc_stall_hist[0], dev->gc_stall_hist[1],
+		    dev->gc_stall_hist[2], dev->gc_stall_hist[3]);
 	buf +=
 	    sprintf(buf, "n_retired_writes...... %u\n", dev->n_retired_writes);
 	buf +=
@@ -2486,6 +2626,11 @@ static char *yaffs_dump_dev_part1(char *buf, struct yaffs_dev *dev)
 	    sprintf(buf, "n_tags_ecc_unfixed.... %u\n",
 		    dev->n_tags_ecc_unfixed);
 	buf += sprintf(buf, "cache_hits............ %u\n", dev->cache_hits);
+	buf += sprintf(buf, "cache_misses.......... %u\n", dev->cache_misses);
+	buf += sprintf(buf, "obj_buckets........... %u\n", dev->n_obj_buckets);
+	buf += sprintf(buf, "obj_rehashes.......... %u\n", dev->obj_rehashes);
+	buf += sprintf(buf, "obj_lookups........... %u\n", dev->obj_lookups);
+	buf += sprintf(buf, "obj_probes............ %u\n", dev->obj_probes);
 	buf +=
 	    sprintf(buf, "n_deleted_files....... %u\n", dev->n_deleted_files);
 	buf +=
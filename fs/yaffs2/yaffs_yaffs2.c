@@ -566,7 +566,7 @@ static int yaffs2_wr_checkpt_objs(struct yaffs_dev *dev)
 	 * dumping them to the checkpointing stream.
 	 */
 
-	for (i = 0; ok && i < YAFFS_NOBJECT_BUCKETS; i++) {
+	for (i = 0; ok && i < dev->n_obj_buckets; i++) {
 		list_for_each(lh, &dev->obj_bucket[i].list) {
 			if (lh) {
 				obj =
@@ -954,6 +954,145 @@ static int yaffs2_ybicmp(const void *a, const void *b)
 		return aseq - bseq;
 }
 
+/*
+ * Reading ahead during the scan.
+ *
+ * The blocks have to be processed one at a time, newest first, but reading
+ * their tags does not depend on that.  If the driver has a read_tags_fn,
+ * a pool of n_scan_threads threads reads the tags of the next few blocks
+ * into slots while the scan works on the ones already read.  Slot i holds
+ * the blocks whose place in the block index is i modulo the slot count.
+ */
+#define YAFFS_SCAN_AHEAD_MAX	16
+
+struct yaffs_scan_slot {
+	struct work_struct work;
+	struct completion done;
+	struct yaffs_dev *dev;
+	int block;
+	struct yaffs_ext_tags *tags;	/* one per chunk of the block */
+};
+
+struct yaffs_scan_ahead {
+	struct workqueue_struct *wq;
+	struct yaffs_block_index *block_index;
+	int n_slots;
+	struct yaffs_scan_slot slots[YAFFS_SCAN_AHEAD_MAX];
+};
+
+static void yaffs2_scan_ahead_worker(struct work_struct *work)
+{
+	struct yaffs_scan_slot *slot =
+	    container_of(work, struct yaffs_scan_slot, work);
+	struct yaffs_dev *dev = slot->dev;
+	int first = slot->block * dev->param.chunks_per_block -
+	    dev->chunk_offset;
+	int c;
+
+	for (c = 0; c < dev->param.chunks_per_block; c++)
+		dev->param.read_tags_fn(dev, first + c, &slot->tags[c]);
+
+	complete(&slot->done);
+}
+
+static void yaffs2_scan_ahead_queue(struct yaffs_scan_ahead *sa,
+				    int block_iter)
+{
+	struct yaffs_scan_slot *slot = &sa->slots[block_iter % sa->n_slots];
+
+	slot->block = sa->block_index[block_iter].block;
+	INIT_COMPLETION(slot->done);
+	queue_work(sa->wq, &slot->work);
+}
+
+static void yaffs2_scan_ahead_stop(struct yaffs_scan_ahead *sa)
+{
+	int i;
+
+	/* Waits for whatever was still queued */
+	destroy_workqueue(sa->wq);
+	for (i = 0; i < sa->n_slots; i++)
+		kfree(sa->slots[i].tags);
+	kfree(sa);
+}
+
+/* Returns NULL if the tags are to be read by the scan itself */
+static struct yaffs_scan_ahead *yaffs2_scan_ahead_start(struct yaffs_dev *dev,
+							struct yaffs_block_index
+							*block_index,
+							int n_to_scan)
+{
+	struct yaffs_scan_ahead *sa;
+	int n_threads = dev->param.n_scan_threads;
+	int i;
+
+	if (n_threads < 1 || !dev->param.read_tags_fn ||
+	    dev->param.inband_tags || n_to_scan < 2)
+		return NULL;
+
+	sa = kmalloc(sizeof(*sa), GFP_NOFS);
+	if (!sa)
+		return NULL;
+	memset(sa, 0, sizeof(*sa));
+	sa->block_index = block_index;
+
+	/* Two blocks in flight per thread keeps them all busy */
+	sa->n_slots = 2 * n_threads;
+	if (sa->n_slots > YAFFS_SCAN_AHEAD_MAX)
+		sa->n_slots = YAFFS_SCAN_AHEAD_MAX;
+	if (sa->n_slots > n_to_scan)
+		sa->n_slots = n_to_scan;
+
+	for (i = 0; i < sa->n_slots; i++) {
+		INIT_WORK(&sa->slots[i].work, yaffs2_scan_ahead_worker);
+		init_completion(&sa->slots[i].done);
+		sa->slots[i].dev = dev;
+		sa->slots[i].tags =
+		    kmalloc(dev->param.chunks_per_block *
+			    sizeof(struct yaffs_ext_tags), GFP_NOFS);
+		if (!sa->slots[i].tags)
+			break;
+	}
+
+	if (i == sa->n_slots)
+		sa->wq = alloc_workqueue("yaffs-scan", WQ_UNBOUND, n_threads);
+
+	if (!sa->wq) {
+		for (i = 0; i < sa->n_slots; i++)
+			kfree(sa->slots[i].tags);
+		kfree(sa);
+		return NULL;
+	}
+
+	/* The scan goes from the end of the index to its start */
+	for (i = 0; i < sa->n_slots; i++)
+		yaffs2_scan_ahead_queue(sa, n_to_scan - 1 - i);
+
+	dev->mount_scan_threads = n_threads;
+	return sa;
+}
+
+/* The tags of a chunk that was read ahead, counted as yaffs_rd_chunk_tags_nand()
+ * would have
+ */
+static void yaffs2_scan_ahead_tags(struct yaffs_dev *dev,
+				   struct yaffs_scan_slot *slot, int c,
+				   struct yaffs_ext_tags *tags)
+{
+	*tags = slot->tags[c];
+	dev->n_page_reads++;
+
+	if (tags->ecc_result == YAFFS_ECC_RESULT_FIXED)
+		dev->n_ecc_fixed++;
+	else if (tags->ecc_result == YAFFS_ECC_RESULT_UNFIXED)
+		dev->n_ecc_unfixed++;
+
+	if (tags->ecc_result > YAFFS_ECC_RESULT_NO_ERROR)
+		yaffs_handle_chunk_error(dev,
+					 yaffs_get_block_info(dev,
+							      slot->block));
+}
+
 int yaffs2_scan_backwards(struct yaffs_dev *dev)
 {
 	struct yaffs_ext_tags tags;
@@ -986,6 +1125,8 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 
 	struct yaffs_block_index *block_index = NULL;
 	int alt_block_index = 0;
+	struct yaffs_scan_ahead *sa;
+	struct yaffs_scan_slot *slot = NULL;
 
 	yaffs_trace(YAFFS_TRACE_SCAN,
 		"yaffs2_scan_backwards starts  intstartblk %d intendblk %d...",
@@ -1086,6 +1227,10 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 	end_iter = n_to_scan - 1;
 	yaffs_trace(YAFFS_TRACE_SCAN_DEBUG, "%d blocks to scan", n_to_scan);
 
+	dev->mount_scan_blocks = n_to_scan;
+	dev->mount_scan_threads = 0;
+	sa = yaffs2_scan_ahead_start(dev, block_index, n_to_scan);
+
 	/* For each block.... backwards */
 	for (block_iter = end_iter; !alloc_failed && block_iter >= start_iter;
 	     block_iter--) {
@@ -1098,6 +1243,16 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 
 		bi = yaffs_get_block_info(dev, blk);
 
+		if (sa) {
+			/* The slot of the previous block is free again */
+			if (block_iter < end_iter &&
+			    block_iter + 1 - sa->n_slots >= start_iter)
+				yaffs2_scan_ahead_queue(sa, block_iter + 1 -
+							sa->n_slots);
+			slot = &sa->slots[block_iter % sa->n_slots];
+			wait_for_completion(&slot->done);
+		}
+
 		state = bi->block_state;
 
 		deleted = 0;
@@ -1114,8 +1269,11 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 
 			chunk = blk * dev->param.chunks_per_block + c;
 
-			result = yaffs_rd_chunk_tags_nand(dev, chunk, NULL,
-							  &tags);
+			if (sa)
+				yaffs2_scan_ahead_tags(dev, slot, c, &tags);
+			else
+				result = yaffs_rd_chunk_tags_nand(dev, chunk,
+								  NULL, &tags);
 
 			/* Let's have a good look at this chunk... */
 
@@ -1573,6 +1731,9 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 
 	}
 
+	if (sa)
+		yaffs2_scan_ahead_stop(sa);
+
 	yaffs_skip_rest_of_block(dev);
 
 	if (alt_block_index)
@@ -30,6 +30,9 @@
 #include <linux/stat.h>
 #include <linux/sort.h>
 #include <linux/bitops.h>
+#include <linux/hrtimer.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
 
 #define YCHAR char
 #define YUCHAR unsigned char
@@ -44,6 +47,7 @@
 
 #define Y_CURRENT_TIME CURRENT_TIME.tv_sec
 #define Y_TIME_CONVERT(x) (x).tv_sec
+#define Y_CLOCK_US() ktime_to_us(ktime_get())
 
 #define compile_time_assertion(assertion) \
 	({ int x = __builtin_choose_expr(assertion, 0, (void)0); (void) x; })
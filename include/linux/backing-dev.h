@@ -86,6 +86,15 @@ struct backing_dev_info {
 
 	struct timer_list laptop_mode_wb_timer;
 
+#ifdef CONFIG_READAHEAD_HISTORY
+	unsigned long ra_window;	/* measured max readahead, in pages */
+	unsigned long ra_sample_time;	/* jiffies of the last sample */
+	unsigned long ra_sample_ios;	/* disk read stats at that time */
+	unsigned long ra_sample_sectors;
+	unsigned long ra_sample_ticks;
+	unsigned long ra_sample_busy;
+#endif
+
 #ifdef CONFIG_DEBUG_FS
 	struct dentry *debug_dir;
 	struct dentry *debug_stats;
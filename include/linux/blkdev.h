@@ -25,6 +25,7 @@
 struct scsi_ioctl_command;
 
 struct request_queue;
+struct blk_stage_ctx;
 struct elevator_queue;
 struct request_pm_state;
 struct blk_trace;
@@ -383,6 +384,16 @@ struct request_queue
 	/* Throttle data */
 	struct throtl_data *td;
 #endif
+
+#ifdef CONFIG_BLK_PERCPU_STAGING
+	/*
+	 * Per-cpu staging of requests ahead of the elevator, off
+	 * unless stage_batch is set
+	 */
+	struct blk_stage_ctx __percpu *stage_ctx;
+	unsigned int		stage_batch;
+	struct work_struct	stage_work;
+#endif
 };
 
 #define QUEUE_FLAG_QUEUED	1	/* uses generic tag queueing */
@@ -846,6 +857,14 @@ extern void blk_queue_rq_timed_out(struct request_queue *, rq_timed_out_fn *);
 extern void blk_queue_rq_timeout(struct request_queue *, unsigned int);
 extern void blk_queue_flush(struct request_queue *q, unsigned int flush);
 extern void blk_queue_flush_queueable(struct request_queue *q, bool queueable);
+#ifdef CONFIG_BLK_PERCPU_STAGING
+extern void blk_queue_stage_batch(struct request_queue *q, unsigned int batch);
+#else
+static inline void blk_queue_stage_batch(struct request_queue *q,
+					 unsigned int batch)
+{
+}
+#endif
 extern struct backing_dev_info *blk_get_backing_dev_info(struct block_device *bdev);
 
 extern int blk_rq_map_sg(struct request_queue *, struct request *, struct scatterlist *);
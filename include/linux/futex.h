@@ -177,6 +177,9 @@ union futex_key {
 extern void exit_robust_list(struct task_struct *curr);
 extern void exit_pi_state_list(struct task_struct *curr);
 extern int futex_cmpxchg_enabled;
+extern int futex_set_private_hash(unsigned long slots);
+extern int futex_get_private_hash(void);
+extern void futex_mm_drop(struct mm_struct *mm);
 #else
 static inline void exit_robust_list(struct task_struct *curr)
 {
@@ -184,6 +187,9 @@ static inline void exit_robust_list(struct task_struct *curr)
 static inline void exit_pi_state_list(struct task_struct *curr)
 {
 }
+static inline void futex_mm_drop(struct mm_struct *mm)
+{
+}
 #endif
 #endif /* __KERNEL__ */
 
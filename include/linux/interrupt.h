@@ -105,6 +105,7 @@ typedef irqreturn_t (*irq_handler_t)(int, void *);
  * @thread:	thread pointer for threaded interrupts
  * @thread_flags:	flags related to @thread
  * @thread_mask:	bitmask for keeping track of @thread activity
+ * @wake_time:	time the primary handler woke @thread
  */
 struct irqaction {
 	irq_handler_t handler;
@@ -118,6 +119,9 @@ struct irqaction {
 	unsigned long thread_mask;
 	const char *name;
 	struct proc_dir_entry *dir;
+#ifdef CONFIG_IRQ_LATENCY_HIST
+	u64 wake_time;
+#endif
 } ____cacheline_internodealigned_in_smp;
 
 extern irqreturn_t no_action(int cpl, void *dev_id);
@@ -286,6 +290,10 @@ static inline int irq_set_affinity_hint(unsigned int irq,
 }
 #endif /* CONFIG_SMP && CONFIG_GENERIC_HARDIRQS */
 
+#ifdef CONFIG_GENERIC_HARDIRQS
+extern int irq_set_thread_priority(unsigned int irq, int prio);
+#endif
+
 #ifdef CONFIG_GENERIC_HARDIRQS
 /*
  * Special lockdep variants of irq disabling/enabling.
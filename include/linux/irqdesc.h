@@ -9,6 +9,7 @@
  */
 
 struct irq_affinity_notify;
+struct irq_latency;
 struct proc_dir_entry;
 struct timer_rand_state;
 /**
@@ -30,9 +31,12 @@ struct timer_rand_state;
  * @affinity_hint:	hint to user space for preferred irq affinity
  * @affinity_notify:	context for notification of affinity changes
  * @pending_mask:	pending rebalanced interrupts
+ * @follow_mask:	affinity to restore when the irq stops following its thread
  * @threads_oneshot:	bitfield to handle shared oneshot threads
  * @threads_active:	number of irqaction threads currently running
  * @wait_for_threads:	wait queue for sync_irq to wait for threaded handlers
+ * @thread_prio:	SCHED_FIFO priority of the irqaction threads
+ * @latency:		handler time and thread wakeup latency histograms
  * @dir:		/proc/irq/ procfs entry
  * @name:		flow handler name for /proc/interrupts output
  */
@@ -59,10 +63,15 @@ struct irq_desc {
 #ifdef CONFIG_GENERIC_PENDING_IRQ
 	cpumask_var_t		pending_mask;
 #endif
+	cpumask_var_t		follow_mask;
 #endif
 	unsigned long		threads_oneshot;
 	atomic_t		threads_active;
 	wait_queue_head_t       wait_for_threads;
+	int			thread_prio;
+#ifdef CONFIG_IRQ_LATENCY_HIST
+	struct irq_latency	*latency;
+#endif
 #ifdef CONFIG_PROC_FS
 	struct proc_dir_entry	*dir;
 #endif
@@ -130,6 +130,7 @@ typedef struct journal_s	journal_t;	/* Journal control structure */
 #define JBD2_SUPERBLOCK_V1	3
 #define JBD2_SUPERBLOCK_V2	4
 #define JBD2_REVOKE_BLOCK	5
+#define JBD2_FC_BLOCK		6
 
 /*
  * Standard header for all descriptor blocks:
@@ -199,6 +200,27 @@ typedef struct jbd2_journal_revoke_header_s
 #define JBD2_FLAG_DELETED	4	/* block deleted by this transaction */
 #define JBD2_FLAG_LAST_TAG	8	/* last tag in this descriptor block */
 
+/*
+ * The fast commit block: describes one fast commit in the fast commit
+ * area at the end of the journal.  It is followed by the tags of the
+ * block images logged with it and then by the records of the client
+ * filesystem; the images themselves follow the block.
+ */
+typedef struct jbd2_fc_header_s
+{
+	journal_header_t fc_header;
+	__be32		fc_nr_images;	/* Nr of block images after this block */
+	__be32		fc_len;		/* Bytes of records after the tags */
+	__be32		fc_chksum;	/* crc32 of header, tags and records */
+} jbd2_fc_header_t;
+
+typedef struct jbd2_fc_tag_s
+{
+	__be64		t_blocknr;	/* Where the image goes on replay */
+	__be32		t_chksum;	/* crc32 of the image */
+	__be32		t_padding;
+} jbd2_fc_tag_t;
+
 
 /*
  * The journal superblock.  All fields are in big-endian byte order.
@@ -241,7 +263,8 @@ typedef struct journal_superblock_s
 	__be32	s_max_trans_data;	/* Limit of data blocks per trans. */
 
 /* 0x0050 */
-	__u32	s_padding[44];
+	__be32	s_num_fc_blks;		/* Blocks of fast commit area */
+	__u32	s_padding[43];
 
 /* 0x0100 */
 	__u8	s_users[16*48];		/* ids of all fs'es sharing the log */
@@ -263,13 +286,15 @@ typedef struct journal_superblock_s
 #define JBD2_FEATURE_INCOMPAT_REVOKE		0x00000001
 #define JBD2_FEATURE_INCOMPAT_64BIT		0x00000002
 #define JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT	0x00000004
+#define JBD2_FEATURE_INCOMPAT_FAST_COMMIT	0x00000040
 
 /* Features known to this kernel version: */
 #define JBD2_KNOWN_COMPAT_FEATURES	JBD2_FEATURE_COMPAT_CHECKSUM
 #define JBD2_KNOWN_ROCOMPAT_FEATURES	0
 #define JBD2_KNOWN_INCOMPAT_FEATURES	(JBD2_FEATURE_INCOMPAT_REVOKE | \
 					JBD2_FEATURE_INCOMPAT_64BIT | \
-					JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT)
+					JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT | \
+					JBD2_FEATURE_INCOMPAT_FAST_COMMIT)
 
 #ifdef __KERNEL__
 
@@ -668,6 +693,12 @@ struct transaction_s
 	 * structures associated with the transaction
 	 */
 	struct list_head	t_private_list;
+
+	/*
+	 * Handles may look at the running transaction without j_state_lock,
+	 * so it is freed after an RCU grace period
+	 */
+	struct rcu_head		t_rcu;
 };
 
 struct transaction_run_stats_s {
@@ -687,6 +718,32 @@ struct transaction_stats_s {
 	struct transaction_run_stats_s run;
 };
 
+/*
+ * Handle start latency histogram: below 1us, 10us, 100us, 1ms, 10ms
+ * and above
+ */
+#define JBD2_START_HIST		6
+
+/*
+ * Per-CPU part of the handle start path.  Credits are reserved from the
+ * running transaction in batches, so that most handles can start without
+ * touching t_outstanding_credits or j_state_lock.  hc_tid and hc_credits
+ * are changed by their CPU with preemption disabled and, once the
+ * transaction is locked, by the commit under j_state_lock.
+ */
+struct jbd2_handle_cpu {
+	tid_t			hc_tid;		/* transaction of hc_credits */
+	int			hc_credits;
+	unsigned long		hc_starts;	/* handles started */
+	unsigned long		hc_fast;	/* of which from hc_credits */
+	u64			hc_wait_ns;	/* time spent starting them */
+	u64			hc_max_ns;
+	unsigned long		hc_hist[JBD2_START_HIST];
+};
+
+/* Most credits a CPU reserves ahead of the handles that will use them */
+#define JBD2_CREDIT_BATCH	64
+
 static inline unsigned long
 jbd2_time_diff(unsigned long start, unsigned long end)
 {
@@ -765,6 +822,15 @@ jbd2_time_diff(unsigned long start, unsigned long end)
  * @j_history_lock: Protect the transactions statistics history
  * @j_proc_entry: procfs entry for the jbd statistics directory
  * @j_stats: Overall statistics
+ * @j_fc_first: The block number of the first block of the fast commit area
+ * @j_fc_last: The block number one beyond the fast commit area
+ * @j_fc_off: Blocks of the fast commit area in use
+ * @j_fc_tid: Transaction of the last fast commit written
+ * @j_fc_mutex: Serialises fast commits
+ * @j_fc_replay: Applies the records of a fast commit during recovery
+ * @j_fc_commits: Number of fast commits written
+ * @j_fc_blocks: Number of blocks written by fast commits
+ * @j_handle_cpu: Per-CPU credit reservations and handle start statistics
  * @j_private: An opaque pointer to fs-private information.
  */
 
@@ -997,6 +1063,33 @@ struct journal_s
 	/* Failed journal commit ID */
 	unsigned int		j_failed_commit;
 
+	/*
+	 * Fast commit area: the last s_num_fc_blks blocks of the journal,
+	 * outside of the log.  Unused unless j_fc_first < j_fc_last.
+	 */
+	unsigned long		j_fc_first;
+	unsigned long		j_fc_last;
+
+	/*
+	 * Blocks in use in the fast commit area, and the transaction of the
+	 * last fast commit written there [j_state_lock]
+	 */
+	unsigned long		j_fc_off;
+	tid_t			j_fc_tid;
+
+	struct mutex		j_fc_mutex;
+
+	/* Called by recovery for the records of each fast commit to replay */
+	int			(*j_fc_replay)(journal_t *, const void *,
+					       unsigned int);
+
+	/* Fast commit statistics [j_fc_mutex] */
+	unsigned long		j_fc_commits;
+	unsigned long		j_fc_blocks;
+
+	/* Per-CPU credits and handle start statistics */
+	struct jbd2_handle_cpu __percpu *j_handle_cpu;
+
 	/*
 	 * An opaque pointer to fs-private information.  ext3 puts its
 	 * superblock pointer here
@@ -1231,8 +1324,23 @@ int jbd2_log_wait_commit(journal_t *journal, tid_t tid);
 int jbd2_log_do_checkpoint(journal_t *journal);
 int jbd2_trans_will_send_data_barrier(journal_t *journal, tid_t tid);
 
+/* Fast commits */
+struct jbd2_fc_image {
+	unsigned long long	blocknr;
+	void			*data;
+};
+
+#define JBD2_FC_MAX_IMAGES	8
+
+extern int	jbd2_fc_setup(journal_t *, unsigned int);
+extern int	jbd2_fc_begin(journal_t *, tid_t);
+extern int	jbd2_fc_write(journal_t *, tid_t, const void *, unsigned int,
+			      struct jbd2_fc_image *, int);
+extern void	jbd2_fc_end(journal_t *);
+
 void __jbd2_log_wait_for_space(journal_t *journal);
 extern void __jbd2_journal_drop_transaction(journal_t *, transaction_t *);
+extern void __jbd2_journal_return_credits(journal_t *, transaction_t *);
 extern int jbd2_cleanup_journal_tail(journal_t *);
 
 /* Debugging code only: */
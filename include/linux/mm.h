@@ -21,6 +21,7 @@ struct anon_vma;
 struct file_ra_state;
 struct user_struct;
 struct writeback_control;
+struct super_block;
 
 #ifndef CONFIG_DISCONTIGMEM          /* Don't use mapnrs, do it properly */
 extern unsigned long max_mapnr;
@@ -1157,15 +1158,44 @@ struct shrink_control {
  * Note that 'shrink' will be passed nr_to_scan == 0 when the VM is
  * querying the cache size, so a fastpath for that case is appropriate.
  */
+#define SHRINKER_LATENCY_BUCKETS 6	/* <10us, <100us, ... >=100ms */
+
+struct shrinker_stats {
+	atomic_long_t calls;		/* shrink batches run */
+	atomic_long_t scanned;		/* objects handed to ->shrink */
+	atomic_long_t freed;		/* objects gone afterwards */
+	atomic_long_t deferred;		/* batches left to kswapd */
+	atomic_long_t over_budget;	/* passes cut short by the budget */
+	atomic64_t time_ns;		/* total time spent in ->shrink */
+	atomic64_t max_ns;		/* slowest single batch */
+	atomic_long_t latency[SHRINKER_LATENCY_BUCKETS];
+};
+
 struct shrinker {
 	int (*shrink)(struct shrinker *, struct shrink_control *sc);
 	int seeks;	/* seeks to recreate an obj */
+	unsigned int flags;	/* SHRINKER_* below */
+	unsigned int budget_us;	/* direct reclaim time budget, 0: default */
 
 	/* These are for internal use */
 	struct list_head list;
 	long nr;	/* objs pending delete */
+	struct shrinker_stats stats;
 };
 #define DEFAULT_SEEKS 2 /* A good number if you don't know better. */
+
+/*
+ * The shrinker is expensive to run: direct reclaimers only account its
+ * share of the work, which kswapd then carries out asynchronously.
+ */
+#define SHRINKER_ASYNC	0x1
+/*
+ * The shrinker frees memory by killing tasks (the low memory killer).
+ * A direct reclaimer carries out the work SHRINKER_ASYNC shrinkers left
+ * to kswapd before it gets to run it.
+ */
+#define SHRINKER_LAST_RESORT	0x2
+
 extern void register_shrinker(struct shrinker *);
 extern void unregister_shrinker(struct shrinker *);
 
@@ -1493,6 +1523,19 @@ unsigned long ra_submit(struct file_ra_state *ra,
 			struct address_space *mapping,
 			struct file *filp);
 
+#ifdef CONFIG_READAHEAD_HISTORY
+extern int sysctl_readahead_history;
+void ra_history_prefetch(struct file *file);
+void ra_history_flush(struct super_block *sb);
+#else
+static inline void ra_history_prefetch(struct file *file)
+{
+}
+static inline void ra_history_flush(struct super_block *sb)
+{
+}
+#endif
+
 /* Generic expand stack which grows the stack according to GROWS{UP,DOWN} */
 extern int expand_stack(struct vm_area_struct *vma, unsigned long address);
 
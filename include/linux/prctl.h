@@ -102,4 +102,12 @@
 
 #define PR_MCE_KILL_GET 34
 
+/*
+ * Give the process its own hash table for private futexes, arg2 is
+ * the number of buckets. Only allowed while single threaded.
+ * Vendor-private numbers, well away from the upstream range.
+ */
+#define PR_SET_FUTEX_HASH	0x59460001
+#define PR_GET_FUTEX_HASH	0x59460002
+
 #endif /* _LINUX_PRCTL_H */
@@ -141,6 +141,8 @@ extern unsigned long nr_uninterruptible(void);
 extern unsigned long nr_iowait(void);
 extern unsigned long nr_iowait_cpu(int cpu);
 extern unsigned long this_cpu_load(void);
+extern unsigned long sched_cpu_util(int cpu);
+extern unsigned long sched_nr_running_avg(void);
 
 
 extern void calc_global_load(unsigned long ticks);
@@ -274,6 +276,7 @@ extern cpumask_var_t nohz_cpu_mask;
 #if defined(CONFIG_SMP) && defined(CONFIG_NO_HZ)
 extern void select_nohz_load_balancer(int stop_tick);
 extern int get_nohz_timer_target(void);
+extern int get_nohz_coalesce_target(void);
 #else
 static inline void select_nohz_load_balancer(int stop_tick) { }
 #endif
@@ -1130,6 +1133,17 @@ struct load_weight {
 	unsigned long weight, inv_weight;
 };
 
+/*
+ * Decayed runnable average, in 1024us periods where the contribution of a
+ * period is halved every 32 periods.  The sums represent an infinite
+ * geometric series and so are bounded by 1024/(1-y), which fits in a u32.
+ */
+struct sched_avg {
+	u32 runnable_avg_sum, runnable_avg_period;
+	u64 last_runnable_update;
+	unsigned long load_avg_contrib;
+};
+
 #ifdef CONFIG_SCHEDSTATS
 struct sched_statistics {
 	u64			wait_start;
@@ -1179,6 +1193,8 @@ struct sched_entity {
 
 	u64			nr_migrations;
 
+	struct sched_avg	avg;
+
 #ifdef CONFIG_SCHEDSTATS
 	struct sched_statistics statistics;
 #endif
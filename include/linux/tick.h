@@ -26,6 +26,14 @@ enum tick_nohz_mode {
 	NOHZ_MODE_HIGHRES,
 };
 
+/* What ended a nohz idle period */
+enum tick_wakeup_source {
+	TICK_WAKEUP_TICK,	/* the tick, for the timer wheel */
+	TICK_WAKEUP_HRTIMER,	/* any other hrtimer */
+	TICK_WAKEUP_OTHER,	/* device interrupts and IPIs */
+	NR_TICK_WAKEUP,
+};
+
 /**
  * struct tick_sched - sched tick emulation and no idle tick control/stats
  * @sched_timer:	hrtimer to schedule the periodic tick in high
@@ -45,6 +53,13 @@ enum tick_nohz_mode {
  * @iowait_sleeptime:	Sum of the time slept in idle with sched tick stopped, with IO outstanding
  * @sleep_length:	Duration of the current idle sleep
  * @do_timer_lst:	CPU was the last one doing do_timer before going idle
+ * @wakeup_state:	Whether the current interrupt ended a nohz idle period
+ *			and whether its source has been accounted yet
+ * @wakeups:		Number of nohz idle periods ended by each source
+ * @wakeup_timers:	Number of timers expired by those interrupts
+ * @timers_aligned:	Number of hrtimers moved within their slack onto the
+ *			coalescing grid
+ * @timers_migrated:	Number of timers moved to a cpu that stays awake
  */
 struct tick_sched {
 	struct hrtimer			sched_timer;
@@ -67,6 +82,11 @@ struct tick_sched {
 	unsigned long			next_jiffies;
 	ktime_t				idle_expires;
 	int				do_timer_last;
+	int				wakeup_state;
+	unsigned long			wakeups[NR_TICK_WAKEUP];
+	unsigned long			wakeup_timers;
+	unsigned long			timers_aligned;
+	unsigned long			timers_migrated;
 };
 
 extern void __init tick_init(void);
@@ -126,6 +146,10 @@ extern void tick_nohz_restart_sched_tick(void);
 extern ktime_t tick_nohz_get_sleep_length(void);
 extern u64 get_cpu_idle_time_us(int cpu, u64 *last_update_time);
 extern u64 get_cpu_iowait_time_us(int cpu, u64 *last_update_time);
+extern unsigned int sysctl_timer_coalesce;
+extern void tick_nohz_count_timer(struct hrtimer *timer);
+extern void tick_nohz_wakeup_end(void);
+extern void tick_nohz_timer_coalesced(int migrated);
 # else
 static inline void tick_nohz_stop_sched_tick(int inidle) { }
 static inline void tick_nohz_restart_sched_tick(void) { }
@@ -137,6 +161,9 @@ static inline ktime_t tick_nohz_get_sleep_length(void)
 }
 static inline u64 get_cpu_idle_time_us(int cpu, u64 *unused) { return -1; }
 static inline u64 get_cpu_iowait_time_us(int cpu, u64 *unused) { return -1; }
+static inline void tick_nohz_count_timer(struct hrtimer *timer) { }
+static inline void tick_nohz_wakeup_end(void) { }
+static inline void tick_nohz_timer_coalesced(int migrated) { }
 # endif /* !NO_HZ */
 
 #endif
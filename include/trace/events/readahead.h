@@ -0,0 +1,71 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM readahead
+
+#if !defined(_TRACE_READAHEAD_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_READAHEAD_H
+
+#include <linux/types.h>
+#include <linux/tracepoint.h>
+#include <linux/fs.h>
+
+TRACE_EVENT(mm_readahead_miss,
+
+	TP_PROTO(struct address_space *mapping, pgoff_t offset,
+		 unsigned long req_size, pgoff_t start, unsigned long size),
+
+	TP_ARGS(mapping, offset, req_size, start, size),
+
+	TP_STRUCT__entry(
+		__field(	dev_t,		dev		)
+		__field(	unsigned long,	ino		)
+		__field(	pgoff_t,	offset		)
+		__field(	unsigned long,	req_size	)
+		__field(	pgoff_t,	start		)
+		__field(	unsigned long,	size		)
+	),
+
+	TP_fast_assign(
+		__entry->dev		= mapping->host->i_sb->s_dev;
+		__entry->ino		= mapping->host->i_ino;
+		__entry->offset		= offset;
+		__entry->req_size	= req_size;
+		__entry->start		= start;
+		__entry->size		= size;
+	),
+
+	TP_printk("dev=%d,%d ino=%lu offset=%lu req_size=%lu ra=%lu+%lu",
+		MAJOR(__entry->dev), MINOR(__entry->dev), __entry->ino,
+		__entry->offset, __entry->req_size,
+		__entry->start, __entry->size)
+);
+
+TRACE_EVENT(mm_readahead_prefetch,
+
+	TP_PROTO(struct address_space *mapping, pgoff_t start,
+		 unsigned long size),
+
+	TP_ARGS(mapping, start, size),
+
+	TP_STRUCT__entry(
+		__field(	dev_t,		dev	)
+		__field(	unsigned long,	ino	)
+		__field(	pgoff_t,	start	)
+		__field(	unsigned long,	size	)
+	),
+
+	TP_fast_assign(
+		__entry->dev	= mapping->host->i_sb->s_dev;
+		__entry->ino	= mapping->host->i_ino;
+		__entry->start	= start;
+		__entry->size	= size;
+	),
+
+	TP_printk("dev=%d,%d ino=%lu ra=%lu+%lu",
+		MAJOR(__entry->dev), MINOR(__entry->dev), __entry->ino,
+		__entry->start, __entry->size)
+);
+
+#endif /* _TRACE_READAHEAD_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
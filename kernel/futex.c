@@ -59,6 +59,8 @@
 #include <linux/magic.h>
 #include <linux/pid.h>
 #include <linux/nsproxy.h>
+#include <linux/bootmem.h>
+#include <linux/log2.h>
 
 #include <asm/futex.h>
 
@@ -66,7 +68,8 @@
 
 int __read_mostly futex_cmpxchg_enabled;
 
-#define FUTEX_HASHBITS (CONFIG_BASE_SMALL ? 4 : 8)
+/* Upper bound on the slots of a per-process private hash */
+#define FUTEX_PRIVATE_HASH_MAX	1024
 
 /*
  * Futex flags used to encode options to functions and preserve them across
@@ -147,7 +150,22 @@ struct futex_hash_bucket {
 	struct plist_head chain;
 };
 
-static struct futex_hash_bucket futex_queues[1<<FUTEX_HASHBITS];
+/*
+ * The global table is sized at boot, 256 buckets per possible cpu.
+ */
+static struct futex_hash_bucket *futex_queues __read_mostly;
+static unsigned long futex_hashsize __read_mostly;
+
+/*
+ * Optional per-process table for PTHREAD_PROCESS_PRIVATE futexes, so
+ * a busy process doesn't contend on the buckets of everybody else.
+ * It is installed through prctl(PR_SET_FUTEX_HASH) while the process
+ * is still single threaded, and lives as long as the mm.
+ */
+struct futex_private_hash {
+	unsigned int			mask;
+	struct futex_hash_bucket	queues[0];
+};
 
 /*
  * We hash on the keys returned from get_futex_key (see below).
@@ -157,7 +175,77 @@ static struct futex_hash_bucket *hash_futex(union futex_key *key)
 	u32 hash = jhash2((u32*)&key->both.word,
 			  (sizeof(key->both.word)+sizeof(key->both.ptr))/4,
 			  key->both.offset);
-	return &futex_queues[hash & ((1 << FUTEX_HASHBITS)-1)];
+
+	if (!(key->both.offset & (FUT_OFF_INODE | FUT_OFF_MMSHARED))) {
+		struct futex_private_hash *fph;
+
+		fph = ACCESS_ONCE(key->private.mm->futex_hash);
+		if (fph)
+			return &fph->queues[hash & fph->mask];
+	}
+	return &futex_queues[hash & (futex_hashsize - 1)];
+}
+
+static void futex_hash_init(struct futex_hash_bucket *hb, unsigned long nr)
+{
+	unsigned long i;
+
+	for (i = 0; i < nr; i++) {
+		plist_head_init(&hb[i].chain);
+		spin_lock_init(&hb[i].lock);
+	}
+}
+
+/**
+ * futex_set_private_hash() - give the current process its own futex hash
+ * @slots:	number of hash buckets, rounded up to a power of two
+ *
+ * Waiters queued in the global table would no longer be found once the
+ * private table is in place, so this is only allowed as long as no
+ * other task shares the mm, and only once.
+ *
+ * Returns 0 on success, -EBUSY if the mm is shared or already has a
+ * table, -EINVAL for a bad @slots, -ENOMEM if the table can't be
+ * allocated.
+ */
+int futex_set_private_hash(unsigned long slots)
+{
+	struct mm_struct *mm = current->mm;
+	struct futex_private_hash *fph;
+
+	if (slots < 2 || slots > FUTEX_PRIVATE_HASH_MAX)
+		return -EINVAL;
+	if (!mm || atomic_read(&mm->mm_users) != 1 ||
+	    !thread_group_empty(current))
+		return -EBUSY;
+	if (mm->futex_hash)
+		return -EBUSY;
+
+	slots = roundup_pow_of_two(slots);
+	fph = kmalloc(sizeof(*fph) + slots * sizeof(fph->queues[0]),
+		      GFP_KERNEL);
+	if (!fph)
+		return -ENOMEM;
+
+	fph->mask = slots - 1;
+	futex_hash_init(fph->queues, slots);
+	mm->futex_hash = fph;
+	return 0;
+}
+
+/* Returns the number of slots of the private hash, 0 if there is none */
+int futex_get_private_hash(void)
+{
+	struct mm_struct *mm = current->mm;
+
+	if (!mm || !mm->futex_hash)
+		return 0;
+	return mm->futex_hash->mask + 1;
+}
+
+void futex_mm_drop(struct mm_struct *mm)
+{
+	kfree(mm->futex_hash);
 }
 
 /*
@@ -2710,8 +2798,8 @@ SYSCALL_DEFINE6(futex, u32 __user *, uaddr, int, op, u32, val,
 
 static int __init futex_init(void)
 {
+	unsigned int futex_shift;
 	u32 curval;
-	int i;
 
 	/*
 	 * This will fail and we want it. Some arch implementations do
@@ -2726,10 +2814,18 @@ static int __init futex_init(void)
 	if (cmpxchg_futex_value_locked(&curval, NULL, 0, 0) == -EFAULT)
 		futex_cmpxchg_enabled = 1;
 
-	for (i = 0; i < ARRAY_SIZE(futex_queues); i++) {
-		plist_head_init(&futex_queues[i].chain);
-		spin_lock_init(&futex_queues[i].lock);
-	}
+#if CONFIG_BASE_SMALL
+	futex_hashsize = 16;
+#else
+	futex_hashsize = roundup_pow_of_two(256 * num_possible_cpus());
+#endif
+
+	futex_queues = alloc_large_system_hash("futex", sizeof(*futex_queues),
+					       futex_hashsize, 0, 0,
+					       &futex_shift, NULL,
+					       futex_hashsize);
+	futex_hashsize = 1UL << futex_shift;
+	futex_hash_init(futex_queues, futex_hashsize);
 
 	return 0;
 }
@@ -42,6 +42,7 @@
 #include <linux/tick.h>
 #include <linux/seq_file.h>
 #include <linux/err.h>
+#include <linux/log2.h>
 #include <linux/debugobjects.h>
 #include <linux/sched.h>
 #include <linux/timer.h>
@@ -154,13 +155,25 @@ struct hrtimer_clock_base *lock_hrtimer_base(const struct hrtimer *timer,
 
 
 /*
- * Get the preferred target CPU for NOHZ
+ * Get the preferred target CPU for NOHZ.  *@coalesced is set when a timer
+ * with slack goes to a busy cpu for coalescing rather than to whatever
+ * cpu get_nohz_timer_target() would have picked.
  */
-static int hrtimer_get_target(int this_cpu, int pinned)
+static int hrtimer_get_target(int this_cpu, int pinned, unsigned long delta_ns,
+			      int *coalesced)
 {
 #ifdef CONFIG_NO_HZ
-	if (!pinned && get_sysctl_timer_migration() && idle_cpu(this_cpu))
+	if (!pinned && get_sysctl_timer_migration() && idle_cpu(this_cpu)) {
+		if (sysctl_timer_coalesce && delta_ns) {
+			int cpu = get_nohz_coalesce_target();
+
+			if (cpu >= 0) {
+				*coalesced = 1;
+				return cpu;
+			}
+		}
 		return get_nohz_timer_target();
+	}
 #endif
 	return this_cpu;
 }
@@ -193,12 +206,13 @@ hrtimer_check_target(struct hrtimer *timer, struct hrtimer_clock_base *new_base)
  */
 static inline struct hrtimer_clock_base *
 switch_hrtimer_base(struct hrtimer *timer, struct hrtimer_clock_base *base,
-		    int pinned)
+		    int pinned, unsigned long delta_ns)
 {
 	struct hrtimer_clock_base *new_base;
 	struct hrtimer_cpu_base *new_cpu_base;
 	int this_cpu = smp_processor_id();
-	int cpu = hrtimer_get_target(this_cpu, pinned);
+	int coalesced = 0;
+	int cpu = hrtimer_get_target(this_cpu, pinned, delta_ns, &coalesced);
 	int basenum = base->index;
 
 again:
@@ -231,6 +245,8 @@ again:
 			goto again;
 		}
 		timer->base = new_base;
+		if (coalesced && cpu != this_cpu)
+			tick_nohz_timer_coalesced(1);
 	}
 	return new_base;
 }
@@ -247,7 +263,7 @@ lock_hrtimer_base(const struct hrtimer *timer, unsigned long *flags)
 	return base;
 }
 
-# define switch_hrtimer_base(t, b, p)	(b)
+# define switch_hrtimer_base(t, b, p, d)	(b)
 
 #endif	/* !CONFIG_SMP */
 
@@ -943,6 +959,31 @@ remove_hrtimer(struct hrtimer *timer, struct hrtimer_clock_base *base)
 	return 0;
 }
 
+/*
+ * Move the hard expiry of a timer with slack down onto a grid of the
+ * largest power of two nanoseconds that fits in the slack, capped at a
+ * tick.  Timers on all cpus whose slack overlaps then share a hard
+ * expiry and are expired by the same interrupt.  The result never
+ * precedes @tim.
+ */
+static unsigned long hrtimer_coalesce_slack(ktime_t tim, unsigned long delta_ns)
+{
+#ifdef CONFIG_NO_HZ
+	u64 hard, grid;
+
+	if (!sysctl_timer_coalesce || delta_ns < 2)
+		return delta_ns;
+
+	grid = rounddown_pow_of_two(min_t(unsigned long, delta_ns, TICK_NSEC));
+	hard = ktime_to_ns(tim) + delta_ns;
+	if (hard & (grid - 1)) {
+		delta_ns -= hard & (grid - 1);
+		tick_nohz_timer_coalesced(0);
+	}
+#endif
+	return delta_ns;
+}
+
 int __hrtimer_start_range_ns(struct hrtimer *timer, ktime_t tim,
 		unsigned long delta_ns, const enum hrtimer_mode mode,
 		int wakeup)
@@ -957,7 +998,8 @@ int __hrtimer_start_range_ns(struct hrtimer *timer, ktime_t tim,
 	ret = remove_hrtimer(timer, base);
 
 	/* Switch the timer base, if necessary: */
-	new_base = switch_hrtimer_base(timer, base, mode & HRTIMER_MODE_PINNED);
+	new_base = switch_hrtimer_base(timer, base, mode & HRTIMER_MODE_PINNED,
+				       delta_ns);
 
 	if (mode & HRTIMER_MODE_REL) {
 		tim = ktime_add_safe(tim, new_base->get_time());
@@ -973,6 +1015,7 @@ int __hrtimer_start_range_ns(struct hrtimer *timer, ktime_t tim,
 #endif
 	}
 
+	delta_ns = hrtimer_coalesce_slack(tim, delta_ns);
 	hrtimer_set_expires_range_ns(timer, tim, delta_ns);
 
 	timer_stats_hrtimer_set_start_info(timer);
@@ -1206,6 +1249,7 @@ static void __run_hrtimer(struct hrtimer *timer, ktime_t *now)
 	debug_deactivate(timer);
 	__remove_hrtimer(timer, base, HRTIMER_STATE_CALLBACK, 0);
 	timer_stats_account_hrtimer(timer);
+	tick_nohz_count_timer(timer);
 	fn = timer->function;
 
 	/*
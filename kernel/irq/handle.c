@@ -15,6 +15,8 @@
 #include <linux/sched.h>
 #include <linux/interrupt.h>
 #include <linux/kernel_stat.h>
+#include <linux/slab.h>
+#include <linux/math64.h>
 
 #include <trace/events/irq.h>
 
@@ -110,9 +112,52 @@ static void irq_wake_thread(struct irq_desc *desc, struct irqaction *action)
 	 * threads_oneshot untouched and runs the thread another time.
 	 */
 	desc->threads_oneshot |= action->thread_mask;
+	irq_lat_wake(desc, action);
 	wake_up_process(action->thread);
 }
 
+#ifdef CONFIG_IRQ_LATENCY_HIST
+void irq_lat_account(struct irq_lat_hist *hist, u64 delta_ns)
+{
+	unsigned long us = div_u64(delta_ns, NSEC_PER_USEC);
+	int idx = 0;
+
+	if (us)
+		idx = min_t(int, fls_long(us), IRQ_LAT_BUCKETS - 1);
+	hist->count[idx]++;
+	hist->sum_ns += delta_ns;
+	if (delta_ns > hist->max_ns)
+		hist->max_ns = delta_ns;
+}
+
+/*
+ * Called from process context when a handler gets installed. Lines
+ * which never get a handler don't pay for the histograms, nor do per
+ * cpu lines, whose handlers would race on the buckets.
+ */
+void irq_alloc_latency(struct irq_desc *desc, struct irqaction *new)
+{
+	struct irq_latency *lat;
+	unsigned long flags;
+
+	if (desc->latency || irq_settings_is_per_cpu(desc) ||
+	    (new->flags & IRQF_PERCPU))
+		return;
+
+	lat = kzalloc(sizeof(*lat), GFP_KERNEL);
+	if (!lat)
+		return;
+
+	raw_spin_lock_irqsave(&desc->lock, flags);
+	if (!desc->latency) {
+		desc->latency = lat;
+		lat = NULL;
+	}
+	raw_spin_unlock_irqrestore(&desc->lock, flags);
+	kfree(lat);
+}
+#endif
+
 irqreturn_t
 handle_irq_event_percpu(struct irq_desc *desc, struct irqaction *action)
 {
@@ -121,10 +166,12 @@ handle_irq_event_percpu(struct irq_desc *desc, struct irqaction *action)
 
 	do {
 		irqreturn_t res;
+		u64 start = irq_lat_start(desc);
 
 		trace_irq_handler_entry(irq, action);
 		res = action->handler(irq, action->dev_id);
 		trace_irq_handler_exit(irq, action, res);
+		irq_lat_end(desc, hardirq, start);
 
 		if (WARN_ONCE(!irqs_disabled(),"irq %u handler %pF enabled interrupts\n",
 			      irq, action->handler))
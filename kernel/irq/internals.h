@@ -6,6 +6,7 @@
  * of this file for your non core code.
  */
 #include <linux/irqdesc.h>
+#include <linux/sched.h>
 
 #ifdef CONFIG_SPARSE_IRQ
 # define IRQ_BITMAP_BITS	(NR_IRQS + 8196)
@@ -15,6 +16,9 @@
 
 #define istate core_internal_state__do_not_mess_with_it
 
+/* SCHED_FIFO priority irq threads start out with */
+#define IRQ_THREAD_DEFAULT_PRIO	(MAX_USER_RT_PRIO/2)
+
 extern int noirqdebug;
 
 /*
@@ -45,6 +49,7 @@ enum {
  * IRQS_WAITING			- irq is waiting
  * IRQS_PENDING			- irq is pending and replayed later
  * IRQS_SUSPENDED		- irq is suspended
+ * IRQS_AFFINITY_FOLLOW		- irq affinity follows the cpu of its thread
  */
 enum {
 	IRQS_AUTODETECT		= 0x00000001,
@@ -55,6 +60,7 @@ enum {
 	IRQS_WAITING		= 0x00000080,
 	IRQS_PENDING		= 0x00000200,
 	IRQS_SUSPENDED		= 0x00000800,
+	IRQS_AFFINITY_FOLLOW	= 0x00001000,
 };
 
 #include "debug.h"
@@ -101,6 +107,77 @@ extern int irq_select_affinity_usr(unsigned int irq, struct cpumask *mask);
 
 extern void irq_set_thread_affinity(struct irq_desc *desc);
 
+#ifdef CONFIG_IRQ_LATENCY_HIST
+/*
+ * Latency histograms, one bucket per power of two microseconds:
+ * bucket 0 counts everything below 1us, bucket n counts [2^(n-1),
+ * 2^n) us and the last bucket everything above.
+ */
+#define IRQ_LAT_BUCKETS		16
+
+struct irq_lat_hist {
+	unsigned int		count[IRQ_LAT_BUCKETS];
+	u64			sum_ns;
+	u64			max_ns;
+};
+
+struct irq_latency {
+	struct irq_lat_hist	hardirq;	/* primary handlers */
+	struct irq_lat_hist	wakeup;		/* thread wakeup to run */
+	struct irq_lat_hist	thread;		/* threaded handlers */
+};
+
+extern void irq_lat_account(struct irq_lat_hist *hist, u64 delta_ns);
+extern void irq_alloc_latency(struct irq_desc *desc, struct irqaction *new);
+
+static inline u64 irq_lat_start(struct irq_desc *desc)
+{
+	return desc->latency ? local_clock() : 0;
+}
+
+/*
+ * The hard interrupt side is serialized by IRQD_IRQ_INPROGRESS, per
+ * cpu interrupts run concurrently on all cpus and get no histograms.
+ * The thread side is not serialized between the threads of a shared
+ * line, so an update might get lost there once in a while.
+ */
+#define irq_lat_end(desc, hist, start)					\
+do {									\
+	if ((start) && (desc)->latency)					\
+		irq_lat_account(&(desc)->latency->hist,			\
+				local_clock() - (start));		\
+} while (0)
+
+static inline void irq_lat_wake(struct irq_desc *desc, struct irqaction *action)
+{
+	if (desc->latency)
+		action->wake_time = local_clock();
+}
+
+static inline u64 irq_lat_thread_start(struct irq_desc *desc,
+				       struct irqaction *action)
+{
+	u64 now, wake = action->wake_time;
+
+	if (!desc->latency)
+		return 0;
+	now = local_clock();
+	if (wake && now > wake)
+		irq_lat_account(&desc->latency->wakeup, now - wake);
+	action->wake_time = 0;
+	return now;
+}
+#else
+static inline u64 irq_lat_start(struct irq_desc *desc) { return 0; }
+#define irq_lat_end(desc, hist, start)	do { (void)(start); } while (0)
+static inline void irq_lat_wake(struct irq_desc *desc,
+				struct irqaction *action) { }
+static inline u64 irq_lat_thread_start(struct irq_desc *desc,
+				       struct irqaction *action) { return 0; }
+static inline void irq_alloc_latency(struct irq_desc *desc,
+				     struct irqaction *new) { }
+#endif
+
 /* Inline functions for support of irq chips on slow busses */
 static inline void chip_bus_lock(struct irq_desc *desc)
 {
@@ -46,6 +46,13 @@ static int alloc_masks(struct irq_desc *desc, gfp_t gfp, int node)
 		return -ENOMEM;
 	}
 #endif
+	if (!zalloc_cpumask_var_node(&desc->follow_mask, gfp, node)) {
+#ifdef CONFIG_GENERIC_PENDING_IRQ
+		free_cpumask_var(desc->pending_mask);
+#endif
+		free_cpumask_var(desc->irq_data.affinity);
+		return -ENOMEM;
+	}
 	return 0;
 }
 
@@ -85,6 +92,7 @@ static void desc_set_defaults(unsigned int irq, struct irq_desc *desc, int node)
 	desc->depth = 1;
 	desc->irq_count = 0;
 	desc->irqs_unhandled = 0;
+	desc->thread_prio = IRQ_THREAD_DEFAULT_PRIO;
 	desc->name = NULL;
 	for_each_possible_cpu(cpu)
 		*per_cpu_ptr(desc->kstat_irqs, cpu) = 0;
@@ -119,6 +127,7 @@ static void delete_irq_desc(unsigned int irq)
 #ifdef CONFIG_SMP
 static void free_masks(struct irq_desc *desc)
 {
+	free_cpumask_var(desc->follow_mask);
 #ifdef CONFIG_GENERIC_PENDING_IRQ
 	free_cpumask_var(desc->pending_mask);
 #endif
@@ -170,6 +179,9 @@ static void free_desc(unsigned int irq)
 
 	free_masks(desc);
 	free_percpu(desc->kstat_irqs);
+#ifdef CONFIG_IRQ_LATENCY_HIST
+	kfree(desc->latency);
+#endif
 	kfree(desc);
 }
 
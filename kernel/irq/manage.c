@@ -712,15 +712,45 @@ irq_thread_check_affinity(struct irq_desc *desc, struct irqaction *action)
 	}
 
 	raw_spin_lock_irq(&desc->lock);
-	cpumask_copy(mask, desc->irq_data.affinity);
+	/*
+	 * When the irq follows its thread, the scheduler picks the cpu
+	 * and irq_thread_follow_cpu() moves the interrupt after it.
+	 */
+	if (desc->istate & IRQS_AFFINITY_FOLLOW)
+		cpumask_copy(mask, cpu_possible_mask);
+	else
+		cpumask_copy(mask, desc->irq_data.affinity);
 	raw_spin_unlock_irq(&desc->lock);
 
 	set_cpus_allowed_ptr(current, mask);
 	free_cpumask_var(mask);
 }
+
+/*
+ * Route the interrupt to the cpu the thread handling it runs on, so
+ * the primary handler wakes the thread locally and both share the
+ * cache. Only done for lines with a single handler, shared lines
+ * would just bounce between the cpus of their threads.
+ */
+static void
+irq_thread_follow_cpu(struct irq_desc *desc, struct irqaction *action)
+{
+	int cpu = raw_smp_processor_id();
+
+	if (!(desc->istate & IRQS_AFFINITY_FOLLOW) ||
+	    desc->action != action || action->next)
+		return;
+
+	if (cpumask_equal(desc->irq_data.affinity, cpumask_of(cpu)))
+		return;
+
+	irq_set_affinity(action->irq, cpumask_of(cpu));
+}
 #else
 static inline void
 irq_thread_check_affinity(struct irq_desc *desc, struct irqaction *action) { }
+static inline void
+irq_thread_follow_cpu(struct irq_desc *desc, struct irqaction *action) { }
 #endif
 
 /*
@@ -761,11 +791,11 @@ static irqreturn_t irq_thread_fn(struct irq_desc *desc,
  */
 static int irq_thread(void *data)
 {
-	static const struct sched_param param = {
-		.sched_priority = MAX_USER_RT_PRIO/2,
-	};
 	struct irqaction *action = data;
 	struct irq_desc *desc = irq_to_desc(action->irq);
+	struct sched_param param = {
+		.sched_priority = desc->thread_prio,
+	};
 	irqreturn_t (*handler_fn)(struct irq_desc *desc,
 			struct irqaction *action);
 	int wake;
@@ -780,6 +810,7 @@ static int irq_thread(void *data)
 	current->irqaction = action;
 
 	while (!irq_wait_for_interrupt(action)) {
+		u64 start = irq_lat_thread_start(desc, action);
 
 		irq_thread_check_affinity(desc, action);
 
@@ -801,8 +832,10 @@ static int irq_thread(void *data)
 
 			raw_spin_unlock_irq(&desc->lock);
 			action_ret = handler_fn(desc, action);
+			irq_lat_end(desc, thread, start);
 			if (!noirqdebug)
 				note_interrupt(action->irq, desc, action_ret);
+			irq_thread_follow_cpu(desc, action);
 		}
 
 		wake = atomic_dec_and_test(&desc->threads_active);
@@ -822,6 +855,58 @@ static int irq_thread(void *data)
 	return 0;
 }
 
+/**
+ *	irq_set_thread_priority - set the priority of the threads of an irq
+ *	@irq:	Interrupt line
+ *	@prio:	SCHED_FIFO priority, 1 .. MAX_USER_RT_PRIO-1
+ *
+ *	Applies to the threads already running on the line as well as
+ *	to the threads of handlers installed later on.
+ */
+int irq_set_thread_priority(unsigned int irq, int prio)
+{
+	struct sched_param param = { .sched_priority = prio };
+	struct irq_desc *desc = irq_to_desc(irq);
+	struct irqaction *action;
+	struct task_struct *t;
+	unsigned long flags;
+	int n, i = 0;
+
+	if (!desc)
+		return -EINVAL;
+	if (prio < 1 || prio > MAX_USER_RT_PRIO - 1)
+		return -EINVAL;
+
+	/*
+	 * sched_setscheduler() can't be called under desc->lock, so pin
+	 * the threads one at a time. A reference keeps the task around
+	 * should __free_irq() stop it meanwhile.
+	 */
+	do {
+		raw_spin_lock_irqsave(&desc->lock, flags);
+		desc->thread_prio = prio;
+		t = NULL;
+		n = 0;
+		for (action = desc->action; action; action = action->next) {
+			if (action->thread && n++ == i) {
+				t = action->thread;
+				get_task_struct(t);
+				break;
+			}
+		}
+		raw_spin_unlock_irqrestore(&desc->lock, flags);
+
+		if (t) {
+			sched_setscheduler_nocheck(t, SCHED_FIFO, &param);
+			put_task_struct(t);
+		}
+		i++;
+	} while (t);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(irq_set_thread_priority);
+
 /*
  * Called from do_exit()
  */
@@ -943,6 +1028,8 @@ __setup_irq(unsigned int irq, struct irq_desc *desc, struct irqaction *new)
 		new->thread = t;
 	}
 
+	irq_alloc_latency(desc, new);
+
 	if (!alloc_cpumask_var(&mask, GFP_KERNEL)) {
 		ret = -ENOMEM;
 		goto out_thread;
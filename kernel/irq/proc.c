@@ -12,6 +12,7 @@
 #include <linux/seq_file.h>
 #include <linux/interrupt.h>
 #include <linux/kernel_stat.h>
+#include <linux/math64.h>
 
 #include "internals.h"
 
@@ -244,6 +245,187 @@ static const struct file_operations irq_node_proc_fops = {
 };
 #endif
 
+#ifdef CONFIG_SMP
+static int irq_follow_proc_show(struct seq_file *m, void *v)
+{
+	struct irq_desc *desc = irq_to_desc((long) m->private);
+
+	seq_printf(m, "%d\n", !!(desc->istate & IRQS_AFFINITY_FOLLOW));
+	return 0;
+}
+
+static ssize_t irq_follow_proc_write(struct file *file,
+		const char __user *buffer, size_t count, loff_t *pos)
+{
+	unsigned int irq = (int)(long)PDE(file->f_path.dentry->d_inode)->data;
+	struct irq_desc *desc = irq_to_desc(irq);
+	unsigned long flags;
+	unsigned int val;
+	bool restore;
+	int err;
+
+	if (!irq_can_set_affinity(irq) || no_irq_affinity)
+		return -EIO;
+
+	err = kstrtouint_from_user(buffer, count, 0, &val);
+	if (err)
+		return err;
+	if (val > 1)
+		return -EINVAL;
+
+	raw_spin_lock_irqsave(&desc->lock, flags);
+	restore = !val && (desc->istate & IRQS_AFFINITY_FOLLOW);
+	if (val && !(desc->istate & IRQS_AFFINITY_FOLLOW)) {
+		/* Following overwrites the affinity, keep it for later */
+		cpumask_copy(desc->follow_mask, desc->irq_data.affinity);
+		desc->istate |= IRQS_AFFINITY_FOLLOW;
+	} else if (!val) {
+		desc->istate &= ~IRQS_AFFINITY_FOLLOW;
+	}
+	/* Let the threads pick up their new cpus allowed */
+	irq_set_thread_affinity(desc);
+	raw_spin_unlock_irqrestore(&desc->lock, flags);
+
+	/*
+	 * Put the irq back where it was before it followed the thread,
+	 * which moves the threads there as well.
+	 */
+	if (restore) {
+		err = irq_set_affinity(irq, desc->follow_mask);
+		if (err)
+			return err;
+	}
+
+	return count;
+}
+
+static int irq_follow_proc_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, irq_follow_proc_show, PDE(inode)->data);
+}
+
+static const struct file_operations irq_follow_proc_fops = {
+	.open		= irq_follow_proc_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+	.write		= irq_follow_proc_write,
+};
+#endif
+
+static int irq_thread_prio_proc_show(struct seq_file *m, void *v)
+{
+	struct irq_desc *desc = irq_to_desc((long) m->private);
+
+	seq_printf(m, "%d\n", desc->thread_prio);
+	return 0;
+}
+
+static ssize_t irq_thread_prio_proc_write(struct file *file,
+		const char __user *buffer, size_t count, loff_t *pos)
+{
+	unsigned int irq = (int)(long)PDE(file->f_path.dentry->d_inode)->data;
+	int prio, err;
+
+	err = kstrtoint_from_user(buffer, count, 0, &prio);
+	if (err)
+		return err;
+
+	err = irq_set_thread_priority(irq, prio);
+	return err ? err : count;
+}
+
+static int irq_thread_prio_proc_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, irq_thread_prio_proc_show, PDE(inode)->data);
+}
+
+static const struct file_operations irq_thread_prio_proc_fops = {
+	.open		= irq_thread_prio_proc_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+	.write		= irq_thread_prio_proc_write,
+};
+
+#ifdef CONFIG_IRQ_LATENCY_HIST
+static void irq_lat_show_hist(struct seq_file *m, const char *name,
+			      struct irq_lat_hist *hist)
+{
+	unsigned int nr = 0;
+	u64 avg = 0;
+	int i;
+
+	for (i = 0; i < IRQ_LAT_BUCKETS; i++)
+		nr += hist->count[i];
+	if (nr)
+		avg = div_u64(hist->sum_ns, nr);
+
+	seq_printf(m, "%s: count %u avg %llu us max %llu us\n", name, nr,
+		   (unsigned long long)div_u64(avg, NSEC_PER_USEC),
+		   (unsigned long long)div_u64(hist->max_ns, NSEC_PER_USEC));
+	if (!nr)
+		return;
+
+	for (i = 0; i < IRQ_LAT_BUCKETS; i++) {
+		if (!hist->count[i])
+			continue;
+		if (!i)
+			seq_printf(m, "  %8s      < 1 us: %u\n", "",
+				   hist->count[i]);
+		else if (i == IRQ_LAT_BUCKETS - 1)
+			seq_printf(m, "  %8s     >= %lu us: %u\n", "",
+				   1UL << (i - 1), hist->count[i]);
+		else
+			seq_printf(m, "  %8lu - %-6lu us: %u\n", 1UL << (i - 1),
+				   (1UL << i) - 1, hist->count[i]);
+	}
+}
+
+static int irq_latency_proc_show(struct seq_file *m, void *v)
+{
+	struct irq_desc *desc = irq_to_desc((long) m->private);
+	struct irq_latency *lat = desc->latency;
+
+	if (!lat)
+		return 0;
+
+	irq_lat_show_hist(m, "hardirq", &lat->hardirq);
+	irq_lat_show_hist(m, "wakeup", &lat->wakeup);
+	irq_lat_show_hist(m, "thread", &lat->thread);
+	return 0;
+}
+
+/* Any write clears the histograms */
+static ssize_t irq_latency_proc_write(struct file *file,
+		const char __user *buffer, size_t count, loff_t *pos)
+{
+	unsigned int irq = (int)(long)PDE(file->f_path.dentry->d_inode)->data;
+	struct irq_desc *desc = irq_to_desc(irq);
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&desc->lock, flags);
+	if (desc->latency)
+		memset(desc->latency, 0, sizeof(*desc->latency));
+	raw_spin_unlock_irqrestore(&desc->lock, flags);
+
+	return count;
+}
+
+static int irq_latency_proc_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, irq_latency_proc_show, PDE(inode)->data);
+}
+
+static const struct file_operations irq_latency_proc_fops = {
+	.open		= irq_latency_proc_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+	.write		= irq_latency_proc_write,
+};
+#endif
+
 static int irq_spurious_proc_show(struct seq_file *m, void *v)
 {
 	struct irq_desc *desc = irq_to_desc((long) m->private);
@@ -337,10 +519,24 @@ void register_irq_proc(unsigned int irq, struct irq_desc *desc)
 
 	proc_create_data("node", 0444, desc->dir,
 			 &irq_node_proc_fops, (void *)(long)irq);
+
+	/* create /proc/irq/<irq>/affinity_follows_thread */
+	proc_create_data("affinity_follows_thread", 0600, desc->dir,
+			 &irq_follow_proc_fops, (void *)(long)irq);
 #endif
 
 	proc_create_data("spurious", 0444, desc->dir,
 			 &irq_spurious_proc_fops, (void *)(long)irq);
+
+	/* create /proc/irq/<irq>/thread_priority */
+	proc_create_data("thread_priority", 0600, desc->dir,
+			 &irq_thread_prio_proc_fops, (void *)(long)irq);
+
+#ifdef CONFIG_IRQ_LATENCY_HIST
+	/* create /proc/irq/<irq>/latency */
+	proc_create_data("latency", 0600, desc->dir,
+			 &irq_latency_proc_fops, (void *)(long)irq);
+#endif
 }
 
 void unregister_irq_proc(unsigned int irq, struct irq_desc *desc)
@@ -354,8 +550,13 @@ void unregister_irq_proc(unsigned int irq, struct irq_desc *desc)
 	remove_proc_entry("affinity_hint", desc->dir);
 	remove_proc_entry("smp_affinity_list", desc->dir);
 	remove_proc_entry("node", desc->dir);
+	remove_proc_entry("affinity_follows_thread", desc->dir);
 #endif
 	remove_proc_entry("spurious", desc->dir);
+	remove_proc_entry("thread_priority", desc->dir);
+#ifdef CONFIG_IRQ_LATENCY_HIST
+	remove_proc_entry("latency", desc->dir);
+#endif
 
 	memset(name, 0, MAX_NAMELEN);
 	sprintf(name, "%u", irq);
@@ -298,6 +298,20 @@ struct rcu_data {
 	unsigned long n_rp_need_fqs;
 	unsigned long n_rp_need_nothing;
 
+#ifdef CONFIG_RCU_NOCB_CPU
+	/* 6) callback offloading, see rcu_nocb_kthread(). */
+	struct rcu_head *nocb_head;	/* CBs waiting for kthread. */
+	struct rcu_head **nocb_tail;
+	atomic_long_t nocb_q_count;	/* # CBs waiting for kthread. */
+	atomic_long_t nocb_q_count_lazy; /*  of which kfree_rcu() ones. */
+	bool nocb_defer_wakeup;		/* Wake kthread from the tick. */
+	wait_queue_head_t nocb_wq;	/* For the kthread to sleep on. */
+	struct task_struct *nocb_kthread;
+	struct rcu_state *nocb_rsp;	/* Flavor, for the kthread. */
+	unsigned long n_nocb_invoked;	/* # CBs invoked by the kthread. */
+	unsigned long n_nocb_lazy;	/* # of those that were lazy. */
+#endif /* #ifdef CONFIG_RCU_NOCB_CPU */
+
 	int cpu;
 };
 
@@ -466,5 +480,15 @@ static void rcu_yield(void (*f)(unsigned long), unsigned long arg);
 #endif /* #ifdef CONFIG_RCU_BOOST */
 static void rcu_cpu_kthread_setrt(int cpu, int to_rt);
 static void __cpuinit rcu_prepare_kthreads(int cpu);
+static bool rcu_is_nocb_cpu(int cpu);
+static bool rcu_nocb_enqueue(struct rcu_data *rdp, struct rcu_head *rhp,
+			     bool irqs_disabled);
+static void rcu_nocb_barrier(struct rcu_state *rsp,
+			     void (*func)(struct rcu_head *head));
+static int rcu_nocb_needs_cpu(int cpu);
+static void rcu_nocb_do_deferred_wakeup(int cpu);
+static void __init rcu_init_nocb(void);
+static void __init rcu_boot_init_nocb_percpu_data(struct rcu_data *rdp,
+						  struct rcu_state *rsp);
 
 #endif /* #ifndef RCU_TREE_NONCORE */
@@ -639,7 +639,7 @@ static void rcu_preempt_do_callbacks(void)
  */
 void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *rcu))
 {
-	__call_rcu(head, func, &rcu_preempt_state);
+	__call_rcu(head, func, &rcu_preempt_state, true);
 }
 EXPORT_SYMBOL_GPL(call_rcu);
 
@@ -1949,6 +1949,10 @@ int rcu_needs_cpu(int cpu)
 	if (per_cpu(rcu_dyntick_holdoff, cpu) == jiffies)
 		return rcu_needs_cpu_quick_check(cpu);
 
+	/* A deferred wakeup of an rcuo kthread is done by the next tick. */
+	if (rcu_nocb_needs_cpu(cpu))
+		return 1;
+
 	/* Don't bother unless we are the last non-dyntick-idle CPU. */
 	for_each_online_cpu(thatcpu) {
 		if (thatcpu == cpu)
@@ -2008,3 +2012,318 @@ static void rcu_needs_cpu_flush(void)
 }
 
 #endif /* #else #if !defined(CONFIG_RCU_FAST_NO_HZ) */
+
+#ifdef CONFIG_RCU_NOCB_CPU
+
+/*
+ * Offloaded ("no-CBs") CPUs.  call_rcu() on one of these CPUs does not
+ * touch the CPU's own callback lists: the callback goes onto a lockless
+ * queue that a per-CPU, per-flavor rcuo kthread drains.  The kthread
+ * waits for a grace period on behalf of the whole batch and then
+ * invokes it in process context.  The kthreads are not bound to their
+ * CPU, so they can be moved to a housekeeping CPU, and an offloaded CPU
+ * with no callbacks of its own can stay in dyntick-idle.
+ *
+ * Callbacks that only kfree() (kfree_rcu()) are lazy: nobody waits for
+ * them, so the kthread lets them accumulate for up to
+ * rcu_nocb_lazy_delay jiffies before starting on a batch made only of
+ * lazy callbacks.
+ */
+static DECLARE_BITMAP(rcu_nocb_bits, CONFIG_NR_CPUS);
+#define rcu_nocb_mask to_cpumask(rcu_nocb_bits)
+
+static int rcu_nocb_lazy_delay = HZ;
+module_param(rcu_nocb_lazy_delay, int, 0644);
+
+static int __init rcu_nocb_setup(char *str)
+{
+	cpulist_parse(str, rcu_nocb_mask);
+	return 1;
+}
+__setup("rcu_nocbs=", rcu_nocb_setup);
+
+static bool rcu_is_nocb_cpu(int cpu)
+{
+	return cpumask_test_cpu(cpu, rcu_nocb_mask);
+}
+
+/*
+ * Add a callback to the tail of the CPU's offload queue.  Any number
+ * of CPUs may enqueue concurrently, so the tail is claimed with xchg()
+ * and the kthread copes with a ->next that is not filled in yet.
+ */
+static void __rcu_nocb_enqueue(struct rcu_data *rdp, struct rcu_head *rhp,
+			       bool lazy, bool irqs_disabled)
+{
+	struct rcu_head **old_rhpp;
+	long len;
+
+	old_rhpp = xchg(&rdp->nocb_tail, &rhp->next);
+	ACCESS_ONCE(*old_rhpp) = rhp;
+	if (lazy)
+		atomic_long_inc(&rdp->nocb_q_count_lazy);
+	len = atomic_long_inc_return(&rdp->nocb_q_count);
+
+	/*
+	 * Wake the kthread for the first callback of a batch, so that it
+	 * can arm the lazy timeout, and for anything non-lazy.  A wakeup
+	 * with interrupts disabled could be under the runqueue locks, so
+	 * leave that one to the next tick.
+	 */
+	if (!ACCESS_ONCE(rdp->nocb_kthread) ||
+	    (lazy && old_rhpp != &rdp->nocb_head && len <= qhimark))
+		return;
+	/*
+	 * Order the enqueue before the waitqueue check.  Pairs with the
+	 * barrier in prepare_to_wait() of the kthread, which then either
+	 * sees the callback or is seen on the waitqueue.
+	 */
+	smp_mb();
+	if (!waitqueue_active(&rdp->nocb_wq))
+		return;
+	if (irqs_disabled)
+		rdp->nocb_defer_wakeup = true;
+	else
+		wake_up(&rdp->nocb_wq);
+}
+
+/*
+ * Called from __call_rcu() with interrupts disabled.  Returns false if
+ * the callback is to be queued the usual way.
+ */
+static bool rcu_nocb_enqueue(struct rcu_data *rdp, struct rcu_head *rhp,
+			     bool irqs_disabled)
+{
+	if (!rcu_is_nocb_cpu(rdp->cpu))
+		return false;
+	__rcu_nocb_enqueue(rdp, rhp,
+			   __is_kfree_rcu_offset((unsigned long)rhp->func),
+			   irqs_disabled);
+	return true;
+}
+
+/*
+ * rcu_barrier() cannot count on an IPI to queue its callback on an
+ * offloaded CPU, as the CPU might be offline with its kthread still
+ * busy.  Queue directly instead, behind everything already pending.
+ */
+static void rcu_nocb_barrier(struct rcu_state *rsp,
+			     void (*func)(struct rcu_head *head))
+{
+	struct rcu_head *head;
+	int cpu;
+
+	for_each_cpu(cpu, rcu_nocb_mask) {
+		if (!cpu_possible(cpu))
+			continue;
+		head = &per_cpu(rcu_barrier_head, cpu);
+		debug_rcu_head_queue(head);
+		head->func = func;
+		head->next = NULL;
+		atomic_inc(&rcu_barrier_cpu_count);
+		smp_mb(); /* Count before the callback can be invoked. */
+		__rcu_nocb_enqueue(per_cpu_ptr(rsp->rda, cpu), head,
+				   false, false);
+	}
+}
+
+static int rcu_nocb_needs_cpu(int cpu)
+{
+	return per_cpu(rcu_sched_data, cpu).nocb_defer_wakeup ||
+	       per_cpu(rcu_bh_data, cpu).nocb_defer_wakeup ||
+#ifdef CONFIG_TREE_PREEMPT_RCU
+	       per_cpu(rcu_preempt_data, cpu).nocb_defer_wakeup ||
+#endif /* #ifdef CONFIG_TREE_PREEMPT_RCU */
+	       0;
+}
+
+static void __rcu_nocb_do_deferred_wakeup(struct rcu_data *rdp)
+{
+	if (!rdp->nocb_defer_wakeup)
+		return;
+	rdp->nocb_defer_wakeup = false;
+	wake_up(&rdp->nocb_wq);
+}
+
+/* Called from the scheduling-clock interrupt. */
+static void rcu_nocb_do_deferred_wakeup(int cpu)
+{
+	__rcu_nocb_do_deferred_wakeup(&per_cpu(rcu_sched_data, cpu));
+	__rcu_nocb_do_deferred_wakeup(&per_cpu(rcu_bh_data, cpu));
+#ifdef CONFIG_TREE_PREEMPT_RCU
+	__rcu_nocb_do_deferred_wakeup(&per_cpu(rcu_preempt_data, cpu));
+#endif /* #ifdef CONFIG_TREE_PREEMPT_RCU */
+}
+
+static bool rcu_nocb_has_nonlazy(struct rcu_data *rdp)
+{
+	long len = atomic_long_read(&rdp->nocb_q_count);
+
+	return len > atomic_long_read(&rdp->nocb_q_count_lazy) ||
+	       len > qhimark;
+}
+
+/*
+ * Wait for a grace period of the kthread's flavor.  The callback goes
+ * onto the normal lists of whatever CPU we run on, bypassing the
+ * offload queues.
+ */
+static void rcu_nocb_wait_gp(struct rcu_data *rdp)
+{
+	struct rcu_synchronize rcu;
+
+	init_rcu_head_on_stack(&rcu.head);
+	init_completion(&rcu.completion);
+	__call_rcu(&rcu.head, wakeme_after_rcu, rdp->nocb_rsp, false);
+	wait_for_completion(&rcu.completion);
+	destroy_rcu_head_on_stack(&rcu.head);
+}
+
+static int rcu_nocb_kthread(void *arg)
+{
+	struct rcu_data *rdp = arg;
+	struct rcu_head *list, *next, **tail;
+	long c, cl;
+
+	for (;;) {
+		wait_event_interruptible(rdp->nocb_wq,
+					 ACCESS_ONCE(rdp->nocb_head));
+		/* Give lazy callbacks time to pile up. */
+		if (!rcu_nocb_has_nonlazy(rdp))
+			wait_event_interruptible_timeout(rdp->nocb_wq,
+						rcu_nocb_has_nonlazy(rdp),
+						rcu_nocb_lazy_delay);
+
+		list = ACCESS_ONCE(rdp->nocb_head);
+		if (!list)
+			continue;
+		ACCESS_ONCE(rdp->nocb_head) = NULL;
+		tail = xchg(&rdp->nocb_tail, &rdp->nocb_head);
+		c = atomic_long_xchg(&rdp->nocb_q_count, 0);
+		cl = atomic_long_xchg(&rdp->nocb_q_count_lazy, 0);
+
+		rcu_nocb_wait_gp(rdp);
+
+		while (list) {
+			next = list->next;
+			/* Wait for enqueuers to finish linking, if needed. */
+			while (next == NULL && &list->next != tail) {
+				schedule_timeout_interruptible(1);
+				next = ACCESS_ONCE(list->next);
+			}
+			debug_rcu_head_unqueue(list);
+			local_bh_disable();
+			__rcu_reclaim(list);
+			local_bh_enable();
+			list = next;
+			cond_resched();
+		}
+		rdp->n_nocb_invoked += c;
+		rdp->n_nocb_lazy += cl;
+	}
+	return 0;
+}
+
+static void __init rcu_spawn_nocb_kthreads_rsp(struct rcu_state *rsp)
+{
+	struct rcu_data *rdp;
+	struct task_struct *t;
+	cpumask_var_t cm;
+	bool housekeeping = false;
+	int cpu;
+
+	/* Keep the kthreads off the offloaded CPUs, if there is a choice. */
+	if (zalloc_cpumask_var(&cm, GFP_KERNEL)) {
+		cpumask_andnot(cm, cpu_possible_mask, rcu_nocb_mask);
+		housekeeping = !cpumask_empty(cm);
+	}
+
+	for_each_cpu(cpu, rcu_nocb_mask) {
+		if (!cpu_possible(cpu))
+			continue;
+		rdp = per_cpu_ptr(rsp->rda, cpu);
+		t = kthread_create(rcu_nocb_kthread, rdp, "rcuo%c/%d",
+				   rsp->name[4], cpu);
+		/*
+		 * Callbacks have been queued for the kthread since boot,
+		 * nothing else would ever invoke them.
+		 */
+		if (IS_ERR(t))
+			panic("rcu: no kthread for offloaded CPU %d\n", cpu);
+		if (housekeeping)
+			set_cpus_allowed_ptr(t, cm);
+		ACCESS_ONCE(rdp->nocb_kthread) = t;
+		wake_up_process(t);
+	}
+	free_cpumask_var(cm);
+}
+
+static int __init rcu_spawn_nocb_kthreads(void)
+{
+	char buf[64];
+
+	if (cpumask_empty(rcu_nocb_mask))
+		return 0;
+	cpulist_scnprintf(buf, sizeof(buf), rcu_nocb_mask);
+	printk(KERN_INFO "\tOffload RCU callbacks from CPUs: %s.\n", buf);
+	rcu_spawn_nocb_kthreads_rsp(&rcu_sched_state);
+	rcu_spawn_nocb_kthreads_rsp(&rcu_bh_state);
+#ifdef CONFIG_TREE_PREEMPT_RCU
+	rcu_spawn_nocb_kthreads_rsp(&rcu_preempt_state);
+#endif /* #ifdef CONFIG_TREE_PREEMPT_RCU */
+	return 0;
+}
+early_initcall(rcu_spawn_nocb_kthreads);
+
+static void __init rcu_init_nocb(void)
+{
+#ifdef CONFIG_RCU_NOCB_CPU_ALL
+	cpumask_setall(rcu_nocb_mask);
+#endif /* #ifdef CONFIG_RCU_NOCB_CPU_ALL */
+}
+
+static void __init rcu_boot_init_nocb_percpu_data(struct rcu_data *rdp,
+						  struct rcu_state *rsp)
+{
+	rdp->nocb_tail = &rdp->nocb_head;
+	init_waitqueue_head(&rdp->nocb_wq);
+	rdp->nocb_rsp = rsp;
+}
+
+#else /* #ifdef CONFIG_RCU_NOCB_CPU */
+
+static bool rcu_is_nocb_cpu(int cpu)
+{
+	return false;
+}
+
+static bool rcu_nocb_enqueue(struct rcu_data *rdp, struct rcu_head *rhp,
+			     bool irqs_disabled)
+{
+	return false;
+}
+
+static void rcu_nocb_barrier(struct rcu_state *rsp,
+			     void (*func)(struct rcu_head *head))
+{
+}
+
+static int rcu_nocb_needs_cpu(int cpu)
+{
+	return 0;
+}
+
+static void rcu_nocb_do_deferred_wakeup(int cpu)
+{
+}
+
+static void __init rcu_init_nocb(void)
+{
+}
+
+static void __init rcu_boot_init_nocb_percpu_data(struct rcu_data *rdp,
+						  struct rcu_state *rsp)
+{
+}
+
+#endif /* #else #ifdef CONFIG_RCU_NOCB_CPU */
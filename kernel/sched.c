@@ -311,6 +311,9 @@ struct cfs_rq {
 	struct load_weight load;
 	unsigned long nr_running;
 
+	/* Sum of the load_avg_contrib of the queued entities */
+	unsigned long runnable_load_avg;
+
 	u64 exec_clock;
 	u64 min_vruntime;
 #ifndef CONFIG_64BIT
@@ -466,12 +469,19 @@ struct rq {
 #ifdef CONFIG_NO_HZ
 	u64 nohz_stamp;
 	unsigned char nohz_balance_kick;
+	/* busy cpu for coalesced timers, looked up at most once a jiffy */
+	int coalesce_target;
+	unsigned long coalesce_stamp;
 #endif
 	int skip_clock_update;
 
 	/* capture load from *all* tasks on this cpu: */
 	struct load_weight load;
 	unsigned long nr_load_updates;
+	/* decayed fraction of time this cpu had tasks to run */
+	struct sched_avg avg;
+	/* decayed nr_running of all classes, runnable_avg_sum is nr x time */
+	struct sched_avg nr_avg;
 	u64 nr_switches;
 
 	struct cfs_rq cfs;
@@ -568,6 +578,15 @@ struct rq {
 
 static DEFINE_PER_CPU_SHARED_ALIGNED(struct rq, runqueues);
 
+#ifdef CONFIG_SMP
+/* Small task packing decisions, see select_packing_cpu() */
+struct sched_packing_stats {
+	unsigned long small_wakeups;	/* wakeups of tasks below the threshold */
+	unsigned long packed_prev;	/* kept on their busy previous cpu */
+	unsigned long packed_other;	/* moved next to work on another cpu */
+	unsigned long no_room;		/* left to the regular placement */
+};
+#endif
 
 static void check_preempt_curr(struct rq *rq, struct task_struct *p, int flags);
 
@@ -1225,6 +1244,44 @@ unlock:
 	rcu_read_unlock();
 	return cpu;
 }
+
+/*
+ * A timer with slack armed from an idle cpu is better off on a cpu that
+ * has more work queued and will stay awake anyway, rather than on any
+ * cpu that merely is not idle right now.  The sched domains are walked
+ * at most once a jiffy per cpu, and the cached target is used until then
+ * as long as it is still busy.  Returns -1 when there is no busy cpu.
+ */
+int get_nohz_coalesce_target(void)
+{
+	int cpu = smp_processor_id();
+	struct rq *rq = cpu_rq(cpu);
+	int target = rq->coalesce_target;
+	int i;
+	struct sched_domain *sd;
+
+	if (rq->coalesce_stamp != jiffies) {
+		target = -1;
+		rcu_read_lock();
+		for_each_domain(cpu, sd) {
+			for_each_cpu(i, sched_domain_span(sd)) {
+				if (i != cpu && cpu_rq(i)->nr_running > 1) {
+					target = i;
+					goto unlock;
+				}
+			}
+		}
+unlock:
+		rcu_read_unlock();
+		rq->coalesce_target = target;
+		rq->coalesce_stamp = jiffies;
+	}
+
+	if (target < 0 || target == cpu || cpu_rq(target)->nr_running <= 1)
+		return -1;
+	return target;
+}
+
 /*
  * When add_timer_on() enqueues a timer into the timer wheel of an
  * idle CPU then this timer might expire before the next timer event
@@ -1510,10 +1567,34 @@ static int tg_nop(struct task_group *tg, void *data)
 #endif
 
 #ifdef CONFIG_SMP
+/*
+ * The load the balancer sees of a cfs_rq and of an entity queued on it:
+ * with LOAD_AVG_BALANCE the decayed runnable load, otherwise the weight.
+ */
+static inline unsigned long cfs_rq_balance_load(struct cfs_rq *cfs_rq)
+{
+	if (sched_feat(LOAD_AVG_BALANCE))
+		return cfs_rq->runnable_load_avg;
+	return cfs_rq->load.weight;
+}
+
+static inline unsigned long se_balance_load(struct sched_entity *se)
+{
+	if (sched_feat(LOAD_AVG_BALANCE))
+		return se->avg.load_avg_contrib;
+	return se->load.weight;
+}
+
+/* The load a task takes along when it is migrated */
+static inline unsigned long task_balance_load(struct task_struct *p)
+{
+	return se_balance_load(&p->se);
+}
+
 /* Used instead of source_load when we know the type == 0 */
 static unsigned long weighted_cpuload(const int cpu)
 {
-	return cpu_rq(cpu)->load.weight;
+	return cfs_rq_balance_load(&cpu_rq(cpu)->cfs);
 }
 
 /*
@@ -1562,7 +1643,7 @@ static unsigned long cpu_avg_load_per_task(int cpu)
 	unsigned long nr_running = ACCESS_ONCE(rq->nr_running);
 
 	if (nr_running)
-		rq->avg_load_per_task = rq->load.weight / nr_running;
+		rq->avg_load_per_task = weighted_cpuload(cpu) / nr_running;
 	else
 		rq->avg_load_per_task = 0;
 
@@ -1582,11 +1663,11 @@ static int tg_load_down(struct task_group *tg, void *data)
 	long cpu = (long)data;
 
 	if (!tg->parent) {
-		load = cpu_rq(cpu)->load.weight;
+		load = weighted_cpuload(cpu);
 	} else {
 		load = tg->parent->cfs_rq[cpu]->h_load;
-		load *= tg->se[cpu]->load.weight;
-		load /= tg->parent->cfs_rq[cpu]->load.weight + 1;
+		load *= se_balance_load(tg->se[cpu]);
+		load /= cfs_rq_balance_load(tg->parent->cfs_rq[cpu]) + 1;
 	}
 
 	tg->cfs_rq[cpu]->h_load = load;
@@ -1780,13 +1861,256 @@ static const struct sched_class rt_sched_class;
 
 #include "sched_stats.h"
 
+/*
+ * Per-entity load tracking.
+ *
+ * Time is divided into periods of 1024us.  Each entity, and each cpu,
+ * tracks the sum of the time it was runnable in the current and in all
+ * past periods, with the contribution of a period decayed by y^n after n
+ * periods, where y^32 = 1/2.  The ratio of that sum to the equally decayed
+ * sum of all elapsed time is its recent runnable fraction.
+ */
+#define LOAD_AVG_PERIOD 32
+#define LOAD_AVG_MAX 47742	/* maximum possible load avg */
+#define LOAD_AVG_MAX_N 345	/* number of full periods to produce LOAD_MAX_AVG */
+
+/* Precomputed fixed inverse multiplies for multiplication by y^n */
+static const u32 runnable_avg_yN_inv[] = {
+	0xffffffff, 0xfa83b2db, 0xf5257d15, 0xefe4b99b, 0xeac0c6e7, 0xe5b906e7,
+	0xe0ccdeec, 0xdbfbb797, 0xd744fcca, 0xd2a81d91, 0xce248c15, 0xc9b9bd86,
+	0xc5672a11, 0xc12c4cca, 0xbd08a39f, 0xb8fbaf47, 0xb504f333, 0xb123f581,
+	0xad583eea, 0xa9a15ab4, 0xa5fed6a9, 0xa2704303, 0x9ef53260, 0x9b8d39b9,
+	0x9837f051, 0x94f4efa8, 0x91c3d373, 0x8ea4398b, 0x8b95c1e3, 0x88980e80,
+	0x85aac367, 0x82cd8698,
+};
+
+/*
+ * Precomputed \Sum y^k { 1<=k<=n }.  These are floor(true_value) to prevent
+ * over-estimates when re-combining.
+ */
+static const u32 runnable_avg_yN_sum[] = {
+	    0, 1002, 1982, 2941, 3880, 4798, 5697, 6576, 7437, 8279, 9103,
+	 9909,10698,11470,12226,12965,13689,14397,15090,15768,16431,17080,
+	17715,18337,18945,19540,20123,20693,21251,21797,22331,22854,23365,
+};
+
+/* Approximate val * y^n, where y^32 ~= 0.5 (~1 scheduling period) */
+static __always_inline u64 decay_load(u64 val, u64 n)
+{
+	unsigned int local_n;
+
+	if (!n)
+		return val;
+	else if (unlikely(n > LOAD_AVG_PERIOD * 63))
+		return 0;
+
+	/* after bounds checking we can collapse to 32-bit */
+	local_n = n;
+
+	/*
+	 * As y^PERIOD = 1/2, we can combine
+	 *    y^n = 1/2^(n/PERIOD) * y^(n%PERIOD)
+	 * with a look-up table which covers y^n (n<PERIOD)
+	 */
+	if (unlikely(local_n >= LOAD_AVG_PERIOD)) {
+		val >>= local_n / LOAD_AVG_PERIOD;
+		local_n %= LOAD_AVG_PERIOD;
+	}
+
+	val *= runnable_avg_yN_inv[local_n];
+	return val >> 32;
+}
+
+/*
+ * For updates fully spanning n periods, the contribution to runnable
+ * average will be: \Sum 1024*y^n
+ */
+static u32 __compute_runnable_contrib(u64 n)
+{
+	u32 contrib = 0;
+
+	if (likely(n <= LOAD_AVG_PERIOD))
+		return runnable_avg_yN_sum[n];
+	else if (unlikely(n >= LOAD_AVG_MAX_N))
+		return LOAD_AVG_MAX;
+
+	/* Compute \Sum k^n combining precomputed values for k^i, \Sum k^j */
+	do {
+		contrib /= 2; /* y^LOAD_AVG_PERIOD = 1/2 */
+		contrib += runnable_avg_yN_sum[LOAD_AVG_PERIOD];
+
+		n -= LOAD_AVG_PERIOD;
+	} while (n > LOAD_AVG_PERIOD);
+
+	contrib = decay_load(contrib, n);
+	return contrib + runnable_avg_yN_sum[n];
+}
+
+/*
+ * Account the time since the last update to @sa, as runnable or not.
+ * @runnable weighs the time accrued: entities pass 0 or 1, while the rq's
+ * nr_avg passes its nr_running so that the sum counts tasks.
+ * Returns non-zero when a period boundary was crossed, i.e. when the
+ * average changed enough to be worth propagating.
+ */
+static __always_inline int __update_entity_runnable_avg(u64 now,
+							struct sched_avg *sa,
+							int runnable)
+{
+	u64 delta, periods;
+	u32 runnable_contrib;
+	int delta_w, decayed = 0;
+
+	/* First update for this entity: just start the clock */
+	if (unlikely(!sa->last_runnable_update)) {
+		sa->last_runnable_update = now;
+		return 0;
+	}
+
+	delta = now - sa->last_runnable_update;
+	/*
+	 * This should only happen when time goes backwards, which it
+	 * unfortunately does across cpus, when a task is migrated.
+	 */
+	if ((s64)delta < 0) {
+		sa->last_runnable_update = now;
+		return 0;
+	}
+
+	/* Use 1024ns as the unit of measurement since it's a reasonable
+	 * approximation of 1us and fast to compute. */
+	delta >>= 10;
+	if (!delta)
+		return 0;
+	sa->last_runnable_update += delta << 10;
+
+	/* delta_w is the amount already accumulated against our next period */
+	delta_w = sa->runnable_avg_period % 1024;
+	if (delta + delta_w >= 1024) {
+		/* period roll-over */
+		decayed = 1;
+
+		/*
+		 * Now that we know we're crossing a period boundary, figure
+		 * out how much from delta we need to complete the current
+		 * period and accrue it.
+		 */
+		delta_w = 1024 - delta_w;
+		if (runnable)
+			sa->runnable_avg_sum += runnable * delta_w;
+		sa->runnable_avg_period += delta_w;
+
+		delta -= delta_w;
+
+		/* Figure out how many additional periods this update spans */
+		periods = div_u64(delta, 1024);
+		delta -= periods * 1024;
+
+		sa->runnable_avg_sum = decay_load(sa->runnable_avg_sum,
+						  periods + 1);
+		sa->runnable_avg_period = decay_load(sa->runnable_avg_period,
+						     periods + 1);
+
+		/* Efficiently calculate \sum (1..n_period) 1024*y^i */
+		runnable_contrib = __compute_runnable_contrib(periods);
+		if (runnable)
+			sa->runnable_avg_sum += runnable * runnable_contrib;
+		sa->runnable_avg_period += runnable_contrib;
+	}
+
+	/* Remainder of delta accrued against u_0` */
+	if (runnable)
+		sa->runnable_avg_sum += runnable * delta;
+	sa->runnable_avg_period += delta;
+
+	return decayed;
+}
+
+/*
+ * The cpu is runnable whenever it has anything but the idle task to run.
+ * nr_avg accrues nr_running itself, whatever the class of the tasks.
+ */
+static inline void update_rq_runnable_avg(struct rq *rq)
+{
+	__update_entity_runnable_avg(rq->clock_task, &rq->avg,
+				     rq->nr_running != 0);
+	__update_entity_runnable_avg(rq->clock_task, &rq->nr_avg,
+				     rq->nr_running);
+}
+
+/**
+ * sched_cpu_util - recent utilization of a cpu
+ * @cpu: the cpu in question
+ *
+ * Returns the decayed fraction of time @cpu had runnable tasks, scaled to
+ * SCHED_POWER_SCALE.  Meant for cpufreq governors and hotplug policies, so
+ * that they act on the same signal as the scheduler.
+ */
+unsigned long sched_cpu_util(int cpu)
+{
+	struct rq *rq = cpu_rq(cpu);
+	unsigned long flags;
+	u32 sum, period;
+
+	raw_spin_lock_irqsave(&rq->lock, flags);
+	update_rq_clock(rq);
+	update_rq_runnable_avg(rq);
+	sum = rq->avg.runnable_avg_sum;
+	period = rq->avg.runnable_avg_period;
+	raw_spin_unlock_irqrestore(&rq->lock, flags);
+
+	return div_u64((u64)sum << SCHED_POWER_SHIFT, period + 1);
+}
+EXPORT_SYMBOL_GPL(sched_cpu_util);
+
+/**
+ * sched_nr_running_avg - recent average number of runnable tasks, x100
+ *
+ * Sums the decayed nr_running of every online cpu, rt tasks included and
+ * regardless of their weight, times 100.  A drop-in for the nr_running
+ * averages that cpufreq governors and hotplug policies used to sample
+ * for themselves.  Takes no rq locks, so it may be a little off while a
+ * cpu updates its average.
+ */
+unsigned long sched_nr_running_avg(void)
+{
+	struct sched_avg sa;
+	unsigned long sum = 0;
+	int cpu;
+
+	for_each_online_cpu(cpu) {
+		struct rq *rq = cpu_rq(cpu);
+
+		sa.runnable_avg_sum = ACCESS_ONCE(rq->nr_avg.runnable_avg_sum);
+		sa.runnable_avg_period =
+			ACCESS_ONCE(rq->nr_avg.runnable_avg_period);
+		sa.last_runnable_update =
+			ACCESS_ONCE(rq->nr_avg.last_runnable_update);
+
+		/*
+		 * Nothing updates the average of an idle cpu, decay a copy
+		 * of it by the time it has been idle.
+		 */
+		if (!ACCESS_ONCE(rq->nr_running))
+			__update_entity_runnable_avg(cpu_clock(cpu), &sa, 0);
+
+		sum += div_u64((u64)sa.runnable_avg_sum * 100,
+			       sa.runnable_avg_period + 1);
+	}
+
+	return sum;
+}
+EXPORT_SYMBOL_GPL(sched_nr_running_avg);
+
 static void inc_nr_running(struct rq *rq)
 {
+	update_rq_runnable_avg(rq);
 	rq->nr_running++;
 }
 
 static void dec_nr_running(struct rq *rq)
 {
+	update_rq_runnable_avg(rq);
 	rq->nr_running--;
 }
 
@@ -2809,6 +3133,15 @@ static void __sched_fork(struct task_struct *p)
 	p->se.vruntime			= 0;
 	INIT_LIST_HEAD(&p->se.group_node);
 
+	/*
+	 * Start new tasks out as fully runnable for one period, so that
+	 * they carry their weight until they have some history of their own.
+	 */
+	p->se.avg.runnable_avg_sum	= 1024;
+	p->se.avg.runnable_avg_period	= 1024;
+	p->se.avg.last_runnable_update	= 0;
+	p->se.avg.load_avg_contrib	= p->se.load.weight;
+
 #ifdef CONFIG_SCHEDSTATS
 	memset(&p->se.statistics, 0, sizeof(p->se.statistics));
 #endif
@@ -3583,7 +3916,7 @@ decay_load_missed(unsigned long load, unsigned long missed_updates, int idx)
  */
 static void update_cpu_load(struct rq *this_rq)
 {
-	unsigned long this_load = this_rq->load.weight;
+	unsigned long this_load = weighted_cpuload(cpu_of(this_rq));
 	unsigned long curr_jiffies = jiffies;
 	unsigned long pending_updates;
 	int i, scale;
@@ -4073,6 +4406,7 @@ void scheduler_tick(void)
 
 	raw_spin_lock(&rq->lock);
 	update_rq_clock(rq);
+	update_rq_runnable_avg(rq);
 	update_cpu_load_active(rq);
 	curr->sched_class->task_tick(rq, curr, 0);
 	raw_spin_unlock(&rq->lock);
@@ -7785,6 +8119,86 @@ int __init sched_create_sysfs_power_savings_entries(struct sysdev_class *cls)
 }
 #endif /* CONFIG_SCHED_MC || CONFIG_SCHED_SMT */
 
+#ifdef CONFIG_SMP
+static ssize_t sched_packing_val_show(unsigned int *val, char *page)
+{
+	return sprintf(page, "%u\n", *val);
+}
+
+static ssize_t sched_packing_val_store(unsigned int *val, unsigned int max,
+				       const char *buf, size_t count)
+{
+	unsigned int level;
+
+	if (sscanf(buf, "%u", &level) != 1 || level > max)
+		return -EINVAL;
+
+	*val = level;
+	return count;
+}
+
+#define SCHED_PACKING_ATTR(_name, _var, _max)				\
+static ssize_t _name##_show(struct sysdev_class *class,			\
+			    struct sysdev_class_attribute *attr,	\
+			    char *page)					\
+{									\
+	return sched_packing_val_show(&_var, page);			\
+}									\
+static ssize_t _name##_store(struct sysdev_class *class,		\
+			     struct sysdev_class_attribute *attr,	\
+			     const char *buf, size_t count)		\
+{									\
+	return sched_packing_val_store(&_var, _max, buf, count);	\
+}									\
+static SYSDEV_CLASS_ATTR(_name, 0644, _name##_show, _name##_store)
+
+SCHED_PACKING_ATTR(sched_packing, sysctl_sched_packing_enabled, 1);
+SCHED_PACKING_ATTR(sched_packing_task_pct, sysctl_sched_packing_task_pct, 100);
+SCHED_PACKING_ATTR(sched_packing_cpu_pct, sysctl_sched_packing_cpu_pct, 100);
+
+static ssize_t sched_packing_stats_show(struct sysdev_class *class,
+					struct sysdev_class_attribute *attr,
+					char *page)
+{
+	struct sched_packing_stats sum = { 0, };
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct sched_packing_stats *stats;
+
+		stats = &per_cpu(sched_packing_stats, cpu);
+		sum.small_wakeups += stats->small_wakeups;
+		sum.packed_prev += stats->packed_prev;
+		sum.packed_other += stats->packed_other;
+		sum.no_room += stats->no_room;
+	}
+
+	return sprintf(page, "small_wakeups %lu\npacked_prev %lu\n"
+		       "packed_other %lu\nno_room %lu\n",
+		       sum.small_wakeups, sum.packed_prev,
+		       sum.packed_other, sum.no_room);
+}
+static SYSDEV_CLASS_ATTR(sched_packing_stats, 0444,
+			 sched_packing_stats_show, NULL);
+
+static struct attribute *sched_packing_attrs[] = {
+	&attr_sched_packing.attr,
+	&attr_sched_packing_task_pct.attr,
+	&attr_sched_packing_cpu_pct.attr,
+	&attr_sched_packing_stats.attr,
+	NULL
+};
+
+static struct attribute_group sched_packing_attr_group = {
+	.attrs = sched_packing_attrs,
+};
+
+int __init sched_create_sysfs_packing_entries(struct sysdev_class *cls)
+{
+	return sysfs_create_group(&cls->kset.kobj, &sched_packing_attr_group);
+}
+#endif /* CONFIG_SMP */
+
 /*
  * Update cpusets according to cpu_active mask.  If cpusets are
  * disabled, cpuset_update_active_cpus() becomes a simple wrapper
@@ -8112,6 +8526,7 @@ void __init sched_init(void)
 		rq_attach_root(rq, &def_root_domain);
 #ifdef CONFIG_NO_HZ
 		rq->nohz_balance_kick = 0;
+		rq->coalesce_target = -1;
 		init_sched_softirq_csd(&per_cpu(remote_sched_softirq_cb, i));
 #endif
 #endif
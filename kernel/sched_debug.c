@@ -202,6 +202,8 @@ void print_cfs_rq(struct seq_file *m, int cpu, struct cfs_rq *cfs_rq)
 			cfs_rq->nr_spread_over);
 	SEQ_printf(m, "  .%-30s: %ld\n", "nr_running", cfs_rq->nr_running);
 	SEQ_printf(m, "  .%-30s: %ld\n", "load", cfs_rq->load.weight);
+	SEQ_printf(m, "  .%-30s: %lu\n", "runnable_load_avg",
+			cfs_rq->runnable_load_avg);
 #ifdef CONFIG_FAIR_GROUP_SCHED
 #ifdef CONFIG_SMP
 	SEQ_printf(m, "  .%-30s: %Ld.%06ld\n", "load_avg",
@@ -268,6 +270,8 @@ static void print_cpu(struct seq_file *m, int cpu)
 		   rq->load.weight);
 	P(nr_switches);
 	P(nr_load_updates);
+	P(avg.runnable_avg_sum);
+	P(avg.runnable_avg_period);
 	P(nr_uninterruptible);
 	PN(next_balance);
 	P(curr->pid);
@@ -482,6 +486,9 @@ void proc_sched_show_task(struct task_struct *p, struct seq_file *m)
 		   "nr_involuntary_switches", (long long)p->nivcsw);
 
 	P(se.load.weight);
+	P(se.avg.runnable_avg_sum);
+	P(se.avg.runnable_avg_period);
+	P(se.avg.load_avg_contrib);
 	P(policy);
 	P(prio);
 #undef PN
@@ -969,6 +969,52 @@ place_entity(struct cfs_rq *cfs_rq, struct sched_entity *se, int initial)
 	se->vruntime = vruntime;
 }
 
+/*
+ * Compute the current contribution to the cfs_rq's runnable_load_avg by
+ * se: its weight scaled by its recent runnable fraction.  Returns the delta.
+ */
+static long __update_entity_load_avg_contrib(struct sched_entity *se)
+{
+	long old_contrib = se->avg.load_avg_contrib;
+
+	se->avg.load_avg_contrib = div_u64((u64)se->avg.runnable_avg_sum *
+					   se->load.weight,
+					   se->avg.runnable_avg_period + 1);
+	return se->avg.load_avg_contrib - old_contrib;
+}
+
+/* Update se's runnable average, and its cfs_rq's sum if it is queued */
+static inline void update_entity_load_avg(struct sched_entity *se)
+{
+	struct cfs_rq *cfs_rq = cfs_rq_of(se);
+	long contrib_delta;
+
+	if (!__update_entity_runnable_avg(rq_of(cfs_rq)->clock_task, &se->avg,
+					  se->on_rq))
+		return;
+
+	contrib_delta = __update_entity_load_avg_contrib(se);
+	if (se->on_rq)
+		cfs_rq->runnable_load_avg += contrib_delta;
+}
+
+static inline void enqueue_entity_load_avg(struct cfs_rq *cfs_rq,
+					   struct sched_entity *se)
+{
+	/* Account the time se spent blocked before it adds its share */
+	__update_entity_runnable_avg(rq_of(cfs_rq)->clock_task, &se->avg, 0);
+	__update_entity_load_avg_contrib(se);
+	cfs_rq->runnable_load_avg += se->avg.load_avg_contrib;
+}
+
+static inline void dequeue_entity_load_avg(struct cfs_rq *cfs_rq,
+					   struct sched_entity *se)
+{
+	update_entity_load_avg(se);
+	cfs_rq->runnable_load_avg -= min(cfs_rq->runnable_load_avg,
+					 se->avg.load_avg_contrib);
+}
+
 static void
 enqueue_entity(struct cfs_rq *cfs_rq, struct sched_entity *se, int flags)
 {
@@ -984,6 +1030,7 @@ enqueue_entity(struct cfs_rq *cfs_rq, struct sched_entity *se, int flags)
 	 */
 	update_curr(cfs_rq);
 	update_cfs_load(cfs_rq, 0);
+	enqueue_entity_load_avg(cfs_rq, se);
 	account_entity_enqueue(cfs_rq, se);
 	update_cfs_shares(cfs_rq);
 
@@ -1054,6 +1101,7 @@ dequeue_entity(struct cfs_rq *cfs_rq, struct sched_entity *se, int flags)
 	 * Update run-time statistics of the 'current'.
 	 */
 	update_curr(cfs_rq);
+	dequeue_entity_load_avg(cfs_rq, se);
 
 	update_stats_dequeue(cfs_rq, se);
 	if (flags & DEQUEUE_SLEEP) {
@@ -1230,6 +1278,11 @@ entity_tick(struct cfs_rq *cfs_rq, struct sched_entity *curr, int queued)
 	 */
 	update_curr(cfs_rq);
 
+	/*
+	 * Ensure that runnable average is periodically updated.
+	 */
+	update_entity_load_avg(curr);
+
 	/*
 	 * Update share accounting for long-running entities.
 	 */
@@ -1484,14 +1537,14 @@ static int wake_affine(struct sched_domain *sd, struct task_struct *p, int sync)
 	rcu_read_lock();
 	if (sync) {
 		tg = task_group(current);
-		weight = current->se.load.weight;
+		weight = task_balance_load(current);
 
 		this_load += effective_load(tg, this_cpu, -weight, -weight);
 		load += effective_load(tg, prev_cpu, 0, -weight);
 	}
 
 	tg = task_group(p);
-	weight = p->se.load.weight;
+	weight = task_balance_load(p);
 
 	/*
 	 * In low-load situations, where prev_cpu is idle and this_cpu is idle
@@ -1675,6 +1728,110 @@ static int select_idle_sibling(struct task_struct *p, int target)
 	return target;
 }
 
+/*
+ * Small task packing.
+ *
+ * Waking an idle cpu for a task that only runs for a fraction of a
+ * millisecond now and then costs more power than it buys: the cpu has to
+ * leave (or be hotplugged out of) its low power state, and the task
+ * would have fit next to whatever is already running elsewhere.  When
+ * enabled, wakeups of tasks whose tracked utilization is below
+ * sched_packing_task_pct are placed on a cpu that is already busy and
+ * still has room below sched_packing_cpu_pct.  Heavier tasks keep using
+ * the regular, idle-seeking placement.
+ */
+unsigned int sysctl_sched_packing_enabled;
+unsigned int sysctl_sched_packing_task_pct = 10;
+unsigned int sysctl_sched_packing_cpu_pct = 80;
+
+DEFINE_PER_CPU(struct sched_packing_stats, sched_packing_stats);
+
+static inline unsigned long task_util(struct task_struct *p)
+{
+	struct sched_avg *sa = &p->se.avg;
+
+	return div_u64((u64)sa->runnable_avg_sum << SCHED_POWER_SHIFT,
+		       sa->runnable_avg_period + 1);
+}
+
+/*
+ * The rq average is only brought up to date on enqueue, dequeue and tick,
+ * but a busy cpu ticks, so the unlocked value is recent enough here.
+ */
+static inline unsigned long rq_util(struct rq *rq)
+{
+	u32 sum = ACCESS_ONCE(rq->avg.runnable_avg_sum);
+	u32 period = ACCESS_ONCE(rq->avg.runnable_avg_period);
+
+	return div_u64((u64)sum << SCHED_POWER_SHIFT, period + 1);
+}
+
+/*
+ * Returns the util left on @cpu if it is a valid packing target for a
+ * task of utilization @util, or -1.
+ */
+static long packing_room(struct task_struct *p, int cpu, unsigned long util)
+{
+	unsigned long limit = sysctl_sched_packing_cpu_pct *
+				SCHED_POWER_SCALE / 100;
+	struct rq *rq = cpu_rq(cpu);
+	unsigned long cpu_util;
+
+	if (!cpumask_test_cpu(cpu, &p->cpus_allowed) || !cpu_active(cpu))
+		return -1;
+	/* Only pack next to work that already keeps the cpu awake */
+	if (idle_cpu(cpu))
+		return -1;
+	/* Don't queue behind realtime tasks */
+	if (rq->rt.rt_nr_running)
+		return -1;
+
+	cpu_util = rq_util(rq);
+	if (cpu_util + util > limit)
+		return -1;
+
+	return limit - cpu_util - util;
+}
+
+/*
+ * Pick the busy cpu a small task should be packed on: its previous cpu
+ * if that still has room, since its cache is warm there, otherwise the
+ * busiest cpu that fits, so that the least loaded cpus are the ones that
+ * get to go idle.  Returns -1 if the task is not small or nothing fits.
+ */
+static int select_packing_cpu(struct task_struct *p, int prev_cpu)
+{
+	struct sched_packing_stats *stats = &__get_cpu_var(sched_packing_stats);
+	unsigned long util = task_util(p);
+	long room, best_room = LONG_MAX;
+	int i, best_cpu = -1;
+
+	if (util * 100 > sysctl_sched_packing_task_pct * SCHED_POWER_SCALE)
+		return -1;
+
+	stats->small_wakeups++;
+
+	if (packing_room(p, prev_cpu, util) >= 0) {
+		stats->packed_prev++;
+		return prev_cpu;
+	}
+
+	for_each_online_cpu(i) {
+		room = packing_room(p, i, util);
+		if (room >= 0 && room < best_room) {
+			best_room = room;
+			best_cpu = i;
+		}
+	}
+
+	if (best_cpu >= 0)
+		stats->packed_other++;
+	else
+		stats->no_room++;
+
+	return best_cpu;
+}
+
 /*
  * sched_balance_self: balance the current task (running on cpu) in domains
  * that have the 'flag' flag set. In practice, this is SD_BALANCE_FORK and
@@ -1697,6 +1854,13 @@ select_task_rq_fair(struct task_struct *p, int sd_flag, int wake_flags)
 	int want_sd = 1;
 	int sync = wake_flags & WF_SYNC;
 
+	if ((sd_flag & SD_BALANCE_WAKE) && sysctl_sched_packing_enabled) {
+		new_cpu = select_packing_cpu(p, prev_cpu);
+		if (new_cpu >= 0)
+			return new_cpu;
+		new_cpu = cpu;
+	}
+
 	if (sd_flag & SD_BALANCE_WAKE) {
 		if (cpumask_test_cpu(cpu, &p->cpus_allowed))
 			want_affine = 1;
@@ -2156,14 +2320,14 @@ balance_tasks(struct rq *this_rq, int this_cpu, struct rq *busiest,
 		if (loops++ > sysctl_sched_nr_migrate)
 			break;
 
-		if ((p->se.load.weight >> 1) > rem_load_move ||
+		if ((task_balance_load(p) >> 1) > rem_load_move ||
 		    !can_migrate_task(p, busiest, this_cpu, sd, idle,
 				      all_pinned))
 			continue;
 
 		pull_task(busiest, p, this_rq, this_cpu);
 		pulled++;
-		rem_load_move -= p->se.load.weight;
+		rem_load_move -= task_balance_load(p);
 
 #ifdef CONFIG_PREEMPT
 		/*
@@ -2252,7 +2416,7 @@ load_balance_fair(struct rq *this_rq, int this_cpu, struct rq *busiest,
 	list_for_each_entry_rcu(tg, &task_groups, list) {
 		struct cfs_rq *busiest_cfs_rq = tg->cfs_rq[busiest_cpu];
 		unsigned long busiest_h_load = busiest_cfs_rq->h_load;
-		unsigned long busiest_weight = busiest_cfs_rq->load.weight;
+		unsigned long busiest_weight;
 		u64 rem_load, moved_load;
 
 		/*
@@ -2261,6 +2425,7 @@ load_balance_fair(struct rq *this_rq, int this_cpu, struct rq *busiest,
 		if (!busiest_cfs_rq->task_weight)
 			continue;
 
+		busiest_weight = cfs_rq_balance_load(busiest_cfs_rq);
 		rem_load = (u64)rem_load_move * busiest_weight;
 		rem_load = div_u64(rem_load, busiest_h_load + 1);
 
@@ -53,6 +53,14 @@ SCHED_FEAT(HRTICK, 0)
 SCHED_FEAT(DOUBLE_TICK, 0)
 SCHED_FEAT(LB_BIAS, 1)
 
+/*
+ * Balance on the decayed per-entity runnable load averages rather than
+ * on the instantaneous weight of the runqueues.  The cpu_load[] history,
+ * the per-task average and the hierarchical group loads all follow, so
+ * that the imbalance and the load moved are in the same units.
+ */
+SCHED_FEAT(LOAD_AVG_BALANCE, 1)
+
 /*
  * Spin-wait on mutex acquisition when the mutex owner is running on
  * another cpu -- assumes that when the owner is running, it will soon
@@ -0,0 +1,167 @@
+/*
+ * kernel/sched_load_avg_test.c
+ *
+ * Accuracy test for the per-entity load tracking.  On load, it runs a
+ * kthread bound to one cpu that alternates between spinning and
+ * sleeping with a known duty cycle, samples the tracked utilization of
+ * the task and of the cpu along the way, and prints how far the mean of
+ * the samples is from the duty cycle that was actually achieved.
+ *
+ * Run it on an otherwise idle cpu: the cpu utilization includes every
+ * other task that ran there.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/sched.h>
+#include <linux/delay.h>
+#include <linux/math64.h>
+
+static int cpu;
+module_param(cpu, int, 0444);
+MODULE_PARM_DESC(cpu, "Cpu to run the periodic workload on");
+
+static int period_ms = 40;
+module_param(period_ms, int, 0444);
+MODULE_PARM_DESC(period_ms, "Length of one busy plus idle cycle");
+
+static int runtime_ms = 2000;
+module_param(runtime_ms, int, 0444);
+MODULE_PARM_DESC(runtime_ms, "How long to run each duty cycle");
+
+static const int duty_pct[] = { 10, 25, 50, 75, 90 };
+
+struct load_avg_result {
+	int duty;
+	u64 busy_ns, total_ns;
+	u64 task_util, cpu_util;	/* sums of SCHED_POWER_SCALE samples */
+	unsigned int nr_samples;
+};
+
+static struct load_avg_result results[ARRAY_SIZE(duty_pct)];
+static DECLARE_COMPLETION(test_done);
+
+static unsigned long task_util(struct task_struct *p)
+{
+	struct sched_avg *sa = &p->se.avg;
+
+	return div_u64((u64)sa->runnable_avg_sum << SCHED_POWER_SHIFT,
+		       sa->runnable_avg_period + 1);
+}
+
+static void load_avg_sample(struct load_avg_result *res)
+{
+	res->task_util += task_util(current);
+	res->cpu_util += sched_cpu_util(cpu);
+	res->nr_samples++;
+}
+
+static void load_avg_run(struct load_avg_result *res)
+{
+	u64 busy_ns = (u64)period_ms * NSEC_PER_MSEC * res->duty / 100;
+	unsigned int idle_ms = period_ms - period_ms * res->duty / 100;
+	u64 start, end, warmup, now;
+
+	start = local_clock();
+	/* Let the averages converge, eight half-lives is plenty */
+	warmup = start + 8 * 32 * NSEC_PER_MSEC;
+	end = warmup + (u64)runtime_ms * NSEC_PER_MSEC;
+
+	do {
+		u64 t0 = local_clock(), t1;
+
+		if (t0 >= warmup)
+			load_avg_sample(res);
+		do {
+			cpu_relax();
+			t1 = local_clock();
+		} while (t1 - t0 < busy_ns);
+		if (t1 >= warmup) {
+			load_avg_sample(res);
+			res->busy_ns += t1 - max(t0, warmup);
+		}
+		if (idle_ms)
+			msleep(idle_ms);
+		now = local_clock();
+	} while (now < end);
+
+	res->total_ns = now - warmup;
+}
+
+static int load_avg_thread(void *unused)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(duty_pct); i++) {
+		results[i].duty = duty_pct[i];
+		load_avg_run(&results[i]);
+	}
+	complete(&test_done);
+	return 0;
+}
+
+static int pct10(u64 util)
+{
+	return (int)div_u64(util * 1000, SCHED_POWER_SCALE);
+}
+
+static void load_avg_report(struct load_avg_result *res)
+{
+	int actual, task, rq, task_err, rq_err;
+
+	if (!res->nr_samples || !res->total_ns)
+		return;
+
+	actual = (int)div64_u64(res->busy_ns * 1000, res->total_ns);
+	task = pct10(div_u64(res->task_util, res->nr_samples));
+	rq = pct10(div_u64(res->cpu_util, res->nr_samples));
+	task_err = abs(task - actual);
+	rq_err = abs(rq - actual);
+
+	printk(KERN_INFO "sched_load_avg_test: duty %2d%%: actual %3d.%d%% "
+	       "task %3d.%d%% (%c%d.%d) cpu %3d.%d%% (%c%d.%d)\n",
+	       res->duty, actual / 10, actual % 10,
+	       task / 10, task % 10, task < actual ? '-' : '+',
+	       task_err / 10, task_err % 10,
+	       rq / 10, rq % 10, rq < actual ? '-' : '+',
+	       rq_err / 10, rq_err % 10);
+}
+
+static int __init sched_load_avg_test_init(void)
+{
+	struct task_struct *tsk;
+	int i;
+
+	if (cpu < 0 || cpu >= nr_cpu_ids || !cpu_online(cpu))
+		return -EINVAL;
+	if (period_ms < 2 || runtime_ms < period_ms)
+		return -EINVAL;
+
+	tsk = kthread_create(load_avg_thread, NULL, "load_avg_test");
+	if (IS_ERR(tsk))
+		return PTR_ERR(tsk);
+	kthread_bind(tsk, cpu);
+	wake_up_process(tsk);
+	wait_for_completion(&test_done);
+
+	printk(KERN_INFO "sched_load_avg_test: cpu %d, period %d ms, "
+	       "%d ms per duty cycle\n", cpu, period_ms, runtime_ms);
+	for (i = 0; i < ARRAY_SIZE(results); i++)
+		load_avg_report(&results[i]);
+
+	/* Nothing to keep around, refuse to stay loaded */
+	return -EAGAIN;
+}
+module_init(sched_load_avg_test_init);
+
+MODULE_DESCRIPTION("Per-entity load tracking accuracy test");
+MODULE_LICENSE("GPL");
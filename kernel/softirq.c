@@ -349,6 +349,8 @@ void irq_exit(void)
 
 	rcu_irq_exit();
 #ifdef CONFIG_NO_HZ
+	if (!in_interrupt())
+		tick_nohz_wakeup_end();
 	/* Make sure that timer wheel updates are propagated */
 	if (idle_cpu(smp_processor_id()) && !in_interrupt() && !need_resched())
 		tick_nohz_stop_sched_tick(0);
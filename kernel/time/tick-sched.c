@@ -123,6 +123,78 @@ static int __init setup_tick_nohz(char *str)
 
 __setup("nohz=", setup_tick_nohz);
 
+/*
+ * Coalesce timers that have slack: align their expiry so that timers
+ * armed on different cpus fire together, and arm them on a cpu that
+ * stays awake anyway rather than on one that is about to go idle.
+ */
+unsigned int sysctl_timer_coalesce;
+
+/*
+ * Idle wakeup accounting.  The interrupt that ends a nohz idle period
+ * is attributed to the first timer it expires, or to "other" if it
+ * expires none, and every timer it expires is counted, so the number
+ * of timers per wakeup shows how well they are being coalesced.
+ */
+#define TICK_WAKEUP_PENDING	1
+#define TICK_WAKEUP_ACCOUNTED	2
+
+static void tick_nohz_account_wakeup(struct tick_sched *ts,
+				     enum tick_wakeup_source src)
+{
+	if (ts->wakeup_state == TICK_WAKEUP_PENDING) {
+		ts->wakeups[src]++;
+		ts->wakeup_state = TICK_WAKEUP_ACCOUNTED;
+	}
+}
+
+/**
+ * tick_nohz_count_timer - account a timer expiry for idle wakeup stats
+ * @timer:	the hrtimer being expired, or NULL for a timer wheel timer
+ *
+ * Called with interrupts disabled.
+ */
+void tick_nohz_count_timer(struct hrtimer *timer)
+{
+	struct tick_sched *ts = &__get_cpu_var(tick_cpu_sched);
+
+	if (!ts->wakeup_state)
+		return;
+
+	tick_nohz_account_wakeup(ts, !timer || timer == &ts->sched_timer ?
+				 TICK_WAKEUP_TICK : TICK_WAKEUP_HRTIMER);
+	ts->wakeup_timers++;
+}
+
+/*
+ * Called from irq_exit() once the outermost interrupt, and the softirqs
+ * it raised, are done.
+ */
+void tick_nohz_wakeup_end(void)
+{
+	struct tick_sched *ts = &__get_cpu_var(tick_cpu_sched);
+
+	if (!ts->wakeup_state)
+		return;
+
+	tick_nohz_account_wakeup(ts, TICK_WAKEUP_OTHER);
+	ts->wakeup_state = 0;
+}
+
+/*
+ * Called with interrupts disabled when a timer was aligned within its
+ * slack or, if @migrated, armed on another cpu for coalescing.
+ */
+void tick_nohz_timer_coalesced(int migrated)
+{
+	struct tick_sched *ts = &__get_cpu_var(tick_cpu_sched);
+
+	if (migrated)
+		ts->timers_migrated++;
+	else
+		ts->timers_aligned++;
+}
+
 /**
  * tick_nohz_update_jiffies - update jiffies when idle was interrupted
  *
@@ -597,6 +669,7 @@ static void tick_nohz_handler(struct clock_event_device *dev)
 		ts->idle_jiffies++;
 	}
 
+	tick_nohz_account_wakeup(ts, TICK_WAKEUP_TICK);
 	update_process_times(user_mode(regs));
 	profile_tick(CPU_PROFILING);
 
@@ -682,6 +755,7 @@ static inline void tick_check_nohz(int cpu)
 
 	if (!ts->idle_active && !ts->tick_stopped)
 		return;
+	ts->wakeup_state = TICK_WAKEUP_PENDING;
 	now = ktime_get();
 	if (ts->idle_active)
 		tick_nohz_stop_idle(cpu, now);
@@ -289,6 +289,46 @@ static const struct file_operations timer_list_fops = {
 	.release	= single_release,
 };
 
+#ifdef CONFIG_NO_HZ
+/*
+ * Per cpu count of what ended nohz idle periods, how many timers were
+ * expired by those wakeups, and how many timers were coalesced.
+ */
+static int timer_wakeups_show(struct seq_file *m, void *v)
+{
+	int cpu;
+
+	seq_printf(m, "Timer Wakeups Version: v0.1\n");
+	seq_printf(m, "cpu %10s %10s %10s %10s %10s %10s\n", "tick",
+		   "hrtimer", "other", "timers", "aligned", "migrated");
+
+	for_each_possible_cpu(cpu) {
+		struct tick_sched *ts = tick_get_tick_sched(cpu);
+
+		seq_printf(m, "%3d %10lu %10lu %10lu %10lu %10lu %10lu\n", cpu,
+			   ts->wakeups[TICK_WAKEUP_TICK],
+			   ts->wakeups[TICK_WAKEUP_HRTIMER],
+			   ts->wakeups[TICK_WAKEUP_OTHER],
+			   ts->wakeup_timers, ts->timers_aligned,
+			   ts->timers_migrated);
+	}
+
+	return 0;
+}
+
+static int timer_wakeups_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, timer_wakeups_show, NULL);
+}
+
+static const struct file_operations timer_wakeups_fops = {
+	.open		= timer_wakeups_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+#endif
+
 static int __init init_timer_list_procfs(void)
 {
 	struct proc_dir_entry *pe;
@@ -296,6 +336,11 @@ static int __init init_timer_list_procfs(void)
 	pe = proc_create("timer_list", 0444, NULL, &timer_list_fops);
 	if (!pe)
 		return -ENOMEM;
+#ifdef CONFIG_NO_HZ
+	pe = proc_create("timer_wakeups", 0444, NULL, &timer_wakeups_fops);
+	if (!pe)
+		return -ENOMEM;
+#endif
 	return 0;
 }
 __initcall(init_timer_list_procfs);
@@ -659,7 +659,7 @@ __mod_timer(struct timer_list *timer, unsigned long expires,
 {
 	struct tvec_base *base, *new_base;
 	unsigned long flags;
-	int ret = 0 , cpu;
+	int ret = 0 , cpu, coalesce_cpu = -1;
 
 	timer_stats_timer_set_start_info(timer);
 	BUG_ON(!timer->function);
@@ -682,8 +682,12 @@ __mod_timer(struct timer_list *timer, unsigned long expires,
 	cpu = smp_processor_id();
 
 #if defined(CONFIG_NO_HZ) && defined(CONFIG_SMP)
-	if (!pinned && get_sysctl_timer_migration() && idle_cpu(cpu))
-		cpu = get_nohz_timer_target();
+	if (!pinned && get_sysctl_timer_migration() && idle_cpu(cpu)) {
+		if (sysctl_timer_coalesce &&
+		    (tbase_get_deferrable(timer->base) || timer->slack > 0))
+			coalesce_cpu = get_nohz_coalesce_target();
+		cpu = coalesce_cpu >= 0 ? coalesce_cpu : get_nohz_timer_target();
+	}
 #endif
 	new_base = per_cpu(tvec_bases, cpu);
 
@@ -702,6 +706,8 @@ __mod_timer(struct timer_list *timer, unsigned long expires,
 			base = new_base;
 			spin_lock(&base->lock);
 			timer_set_base(timer, base);
+			if (cpu == coalesce_cpu)
+				tick_nohz_timer_coalesced(1);
 		}
 	}
 
@@ -1118,6 +1124,7 @@ static inline void __run_timers(struct tvec_base *base)
 			data = timer->data;
 
 			timer_stats_account_timer(timer);
+			tick_nohz_count_timer(NULL);
 
 			base->running_timer = timer;
 			detach_timer(timer, 1);
@@ -41,6 +41,9 @@
 #include <linux/debug_locks.h>
 #include <linux/lockdep.h>
 #include <linux/idr.h>
+#include <linux/log2.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include "workqueue_sched.h"
 
@@ -61,6 +64,7 @@ enum {
 	WORKER_REBIND		= 1 << 5,	/* mom is home, come back */
 	WORKER_CPU_INTENSIVE	= 1 << 6,	/* cpu intensive */
 	WORKER_UNBOUND		= 1 << 7,	/* worker is unbound */
+	WORKER_RT		= 1 << 8,	/* running at SCHED_FIFO */
 
 	WORKER_NOT_RUNNING	= WORKER_PREP | WORKER_ROGUE | WORKER_REBIND |
 				  WORKER_CPU_INTENSIVE | WORKER_UNBOUND,
@@ -91,6 +95,15 @@ enum {
 	 * all cpus.  Give -20.
 	 */
 	RESCUER_NICE_LEVEL	= -20,
+
+	/*
+	 * Workers processing WQ_HIGHPRI_RT works run just below the
+	 * default priority of threaded interrupt handlers.
+	 */
+	WORKER_RT_PRIO		= MAX_USER_RT_PRIO / 2 - 1,
+
+	/* queue to execution latency buckets, power of two usecs */
+	WQ_LAT_BUCKETS		= 21,
 };
 
 /*
@@ -184,6 +197,11 @@ struct cpu_workqueue_struct {
 	int			nr_active;	/* L: nr of active works */
 	int			max_active;	/* L: max active works */
 	struct list_head	delayed_works;	/* L: delayed works */
+#ifdef CONFIG_WQ_LATENCY_HIST
+	unsigned long		lat_hist[WQ_LAT_BUCKETS]; /* L: latencies */
+	u64			lat_sum_us;	/* L: sum of latencies */
+	unsigned long		lat_max_us;	/* L: worst latency */
+#endif
 };
 
 /*
@@ -252,11 +270,13 @@ struct workqueue_struct *system_long_wq __read_mostly;
 struct workqueue_struct *system_nrt_wq __read_mostly;
 struct workqueue_struct *system_unbound_wq __read_mostly;
 struct workqueue_struct *system_freezable_wq __read_mostly;
+struct workqueue_struct *system_rt_wq __read_mostly;
 EXPORT_SYMBOL_GPL(system_wq);
 EXPORT_SYMBOL_GPL(system_long_wq);
 EXPORT_SYMBOL_GPL(system_nrt_wq);
 EXPORT_SYMBOL_GPL(system_unbound_wq);
 EXPORT_SYMBOL_GPL(system_freezable_wq);
+EXPORT_SYMBOL_GPL(system_rt_wq);
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/workqueue.h>
@@ -656,6 +676,40 @@ static void wake_up_worker(struct global_cwq *gcwq)
 		wake_up_process(worker->task);
 }
 
+/**
+ * wake_up_rt_worker - wake up an idle worker for a WQ_HIGHPRI_RT work
+ * @gcwq: gcwq to wake worker for
+ *
+ * Idle workers which are still at SCHED_FIFO from a previous
+ * WQ_HIGHPRI_RT work sit at the tail of the idle list.  Prefer one of
+ * those, it preempts whatever is running right away instead of
+ * waiting for the fair class to let it run and boost itself.
+ *
+ * CONTEXT:
+ * spin_lock_irq(gcwq->lock).
+ */
+static void wake_up_rt_worker(struct global_cwq *gcwq)
+{
+	struct worker *worker;
+
+	if (unlikely(list_empty(&gcwq->idle_list)))
+		return;
+
+	worker = list_entry(gcwq->idle_list.prev, struct worker, entry);
+	if (!(worker->flags & WORKER_RT))
+		worker = first_worker(gcwq);
+	wake_up_process(worker->task);
+}
+
+/* Wake up an idle worker suitable for @cwq's works */
+static void wake_up_cwq_worker(struct cpu_workqueue_struct *cwq)
+{
+	if (cwq->wq->flags & WQ_HIGHPRI_RT)
+		wake_up_rt_worker(cwq->gcwq);
+	else
+		wake_up_worker(cwq->gcwq);
+}
+
 /**
  * wq_worker_waking_up - a worker is waking up
  * @task: task waking up
@@ -876,7 +930,8 @@ static struct worker *find_worker_executing_work(struct global_cwq *gcwq,
  * A work for @cwq is about to be queued on @gcwq, determine insertion
  * position for the work.  If @cwq is for HIGHPRI wq, the work is
  * queued at the head of the queue but in FIFO order with respect to
- * other HIGHPRI works; otherwise, at the end of the queue.  This
+ * other HIGHPRI works; otherwise, at the end of the queue.  HIGHPRI_RT
+ * works go in front of the other HIGHPRI works the same way.  This
  * function also sets GCWQ_HIGHPRI_PENDING flag to hint @gcwq that
  * there are HIGHPRI works pending.
  *
@@ -889,6 +944,7 @@ static struct worker *find_worker_executing_work(struct global_cwq *gcwq,
 static inline struct list_head *gcwq_determine_ins_pos(struct global_cwq *gcwq,
 					       struct cpu_workqueue_struct *cwq)
 {
+	unsigned int prio = cwq->wq->flags & (WQ_HIGHPRI | WQ_HIGHPRI_RT);
 	struct work_struct *twork;
 
 	if (likely(!(cwq->wq->flags & WQ_HIGHPRI)))
@@ -897,7 +953,7 @@ static inline struct list_head *gcwq_determine_ins_pos(struct global_cwq *gcwq,
 	list_for_each_entry(twork, &gcwq->worklist, entry) {
 		struct cpu_workqueue_struct *tcwq = get_work_cwq(twork);
 
-		if (!(tcwq->wq->flags & WQ_HIGHPRI))
+		if ((tcwq->wq->flags & prio) != prio)
 			break;
 	}
 
@@ -926,6 +982,9 @@ static void insert_work(struct cpu_workqueue_struct *cwq,
 
 	/* we own @work, set data and link */
 	set_work_cwq(work, cwq, extra_flags);
+#ifdef CONFIG_WQ_LATENCY_HIST
+	work->queued_at = local_clock();
+#endif
 
 	/*
 	 * Ensure that we get the right work->data if we see the
@@ -943,7 +1002,7 @@ static void insert_work(struct cpu_workqueue_struct *cwq,
 	smp_mb();
 
 	if (__need_more_worker(gcwq))
-		wake_up_worker(gcwq);
+		wake_up_cwq_worker(cwq);
 }
 
 /*
@@ -1202,8 +1261,15 @@ static void worker_enter_idle(struct worker *worker)
 	gcwq->nr_idle++;
 	worker->last_active = jiffies;
 
-	/* idle_list is LIFO */
-	list_add(&worker->entry, &gcwq->idle_list);
+	/*
+	 * idle_list is LIFO, except that SCHED_FIFO workers are kept at
+	 * the tail for wake_up_rt_worker() so that regular works don't
+	 * keep knocking them back down.  idle_worker_to_reap() skips them.
+	 */
+	if (worker->flags & WORKER_RT)
+		list_add_tail(&worker->entry, &gcwq->idle_list);
+	else
+		list_add(&worker->entry, &gcwq->idle_list);
 
 	if (likely(!(worker->flags & WORKER_ROGUE))) {
 		if (too_many_workers(gcwq) && !timer_pending(&gcwq->idle_timer))
@@ -1458,6 +1524,22 @@ static void destroy_worker(struct worker *worker)
 	ida_remove(&gcwq->worker_ida, id);
 }
 
+/*
+ * The idle worker to reap next.  Regular workers sit at the head of
+ * idle_list in LIFO order, so the last of them has been idle longest.
+ * SCHED_FIFO workers at the tail are kept for WQ_HIGHPRI_RT works and
+ * only reaped once no regular worker is idle, oldest first.
+ */
+static struct worker *idle_worker_to_reap(struct global_cwq *gcwq)
+{
+	struct worker *worker;
+
+	list_for_each_entry_reverse(worker, &gcwq->idle_list, entry)
+		if (!(worker->flags & WORKER_RT))
+			return worker;
+	return list_first_entry(&gcwq->idle_list, struct worker, entry);
+}
+
 static void idle_worker_timeout(unsigned long __gcwq)
 {
 	struct global_cwq *gcwq = (void *)__gcwq;
@@ -1468,8 +1550,7 @@ static void idle_worker_timeout(unsigned long __gcwq)
 		struct worker *worker;
 		unsigned long expires;
 
-		/* idle_list is kept in LIFO order, check the last one */
-		worker = list_entry(gcwq->idle_list.prev, struct worker, entry);
+		worker = idle_worker_to_reap(gcwq);
 		expires = worker->last_active + IDLE_WORKER_TIMEOUT;
 
 		if (time_before(jiffies, expires))
@@ -1612,7 +1693,7 @@ static bool maybe_destroy_workers(struct global_cwq *gcwq)
 		struct worker *worker;
 		unsigned long expires;
 
-		worker = list_entry(gcwq->idle_list.prev, struct worker, entry);
+		worker = idle_worker_to_reap(gcwq);
 		expires = worker->last_active + IDLE_WORKER_TIMEOUT;
 
 		if (time_before(jiffies, expires)) {
@@ -1779,6 +1860,48 @@ static void cwq_dec_nr_in_flight(struct cpu_workqueue_struct *cwq, int color,
 		complete(&cwq->wq->first_flusher->done);
 }
 
+#ifdef CONFIG_WQ_LATENCY_HIST
+/*
+ * Account how long @work waited between being queued and starting
+ * execution.  Called with gcwq->lock held.
+ */
+static void cwq_account_latency(struct cpu_workqueue_struct *cwq,
+				struct work_struct *work)
+{
+	u64 now = local_clock();
+	unsigned long us = 0;
+	int bucket = 0;
+
+	if (now > work->queued_at)
+		us = min_t(u64, div_u64(now - work->queued_at, NSEC_PER_USEC),
+			   ULONG_MAX);
+	if (us >= 2)
+		bucket = min(ilog2(us), WQ_LAT_BUCKETS - 1);
+
+	cwq->lat_hist[bucket]++;
+	cwq->lat_sum_us += us;
+	if (us > cwq->lat_max_us)
+		cwq->lat_max_us = us;
+}
+#else
+static inline void cwq_account_latency(struct cpu_workqueue_struct *cwq,
+				       struct work_struct *work) { }
+#endif
+
+/*
+ * Switch @worker, which must be current, between SCHED_FIFO for
+ * WQ_HIGHPRI_RT works and SCHED_NORMAL for everything else.
+ */
+static void worker_set_sched_rt(struct worker *worker, bool rt)
+{
+	struct sched_param param = {
+		.sched_priority = rt ? WORKER_RT_PRIO : 0,
+	};
+
+	sched_setscheduler_nocheck(worker->task,
+				   rt ? SCHED_FIFO : SCHED_NORMAL, &param);
+}
+
 /**
  * process_one_work - process single work
  * @worker: self
@@ -1801,6 +1924,8 @@ __acquires(&gcwq->lock)
 	struct global_cwq *gcwq = cwq->gcwq;
 	struct hlist_head *bwh = busy_worker_head(gcwq, work);
 	bool cpu_intensive = cwq->wq->flags & WQ_CPU_INTENSIVE;
+	bool rt = cwq->wq->flags & WQ_HIGHPRI_RT;
+	bool switch_rt;
 	work_func_t f = work->func;
 	int work_color;
 	struct worker *collision;
@@ -1847,7 +1972,7 @@ __acquires(&gcwq->lock)
 
 		if (!list_empty(&gcwq->worklist) &&
 		    get_work_cwq(nwork)->wq->flags & WQ_HIGHPRI)
-			wake_up_worker(gcwq);
+			wake_up_cwq_worker(get_work_cwq(nwork));
 		else
 			gcwq->flags &= ~GCWQ_HIGHPRI_PENDING;
 	}
@@ -1859,8 +1984,26 @@ __acquires(&gcwq->lock)
 	if (unlikely(cpu_intensive))
 		worker_set_flags(worker, WORKER_CPU_INTENSIVE, true);
 
+	/*
+	 * WQ_HIGHPRI_RT works run at SCHED_FIFO.  The worker keeps its
+	 * policy until it picks up a work which wants the other one, so
+	 * a burst of RT works only pays for the switch once.
+	 */
+	switch_rt = rt != !!(worker->flags & WORKER_RT);
+	if (unlikely(switch_rt)) {
+		if (rt)
+			worker_set_flags(worker, WORKER_RT, false);
+		else
+			worker_clr_flags(worker, WORKER_RT);
+	}
+
+	cwq_account_latency(cwq, work);
+
 	spin_unlock_irq(&gcwq->lock);
 
+	if (unlikely(switch_rt))
+		worker_set_sched_rt(worker, rt);
+
 	work_clear_pending(work);
 	lock_map_acquire_read(&cwq->wq->lockdep_map);
 	lock_map_acquire(&lockdep_map);
@@ -2918,9 +3061,9 @@ struct workqueue_struct *__alloc_workqueue_key(const char *name,
 
 	/*
 	 * Unbound workqueues aren't concurrency managed and should be
-	 * dispatched to workers immediately.
+	 * dispatched to workers immediately.  So should RT ones.
 	 */
-	if (flags & WQ_UNBOUND)
+	if (flags & (WQ_UNBOUND | WQ_HIGHPRI_RT))
 		flags |= WQ_HIGHPRI;
 
 	max_active = max_active ?: WQ_DFL_ACTIVE;
@@ -3742,6 +3885,108 @@ out_unlock:
 }
 #endif /* CONFIG_FREEZER */
 
+#ifdef CONFIG_WQ_LATENCY_HIST
+/*
+ * debugfs: workqueue/latency shows, for every workqueue, how long its
+ * works waited between being queued and starting to execute, summed
+ * over all cpus.  Bucket N counts waits of [2^N, 2^(N+1)) usecs, except
+ * that bucket 0 starts at 0 and the last one is open ended.  Writing
+ * to the file clears the histograms.
+ */
+static int wq_latency_show(struct seq_file *m, void *v)
+{
+	struct workqueue_struct *wq;
+	int i;
+
+	seq_printf(m, "%-24s %10s %8s %8s", "workqueue", "count",
+		   "avg_us", "max_us");
+	for (i = 0; i < WQ_LAT_BUCKETS; i++)
+		seq_printf(m, " %7lu", 1UL << (i + 1));
+	seq_putc(m, '\n');
+
+	spin_lock(&workqueue_lock);
+	list_for_each_entry(wq, &workqueues, list) {
+		unsigned long hist[WQ_LAT_BUCKETS] = { 0, };
+		unsigned long count = 0, max = 0;
+		u64 sum = 0;
+		unsigned int cpu;
+
+		for_each_cwq_cpu(cpu, wq) {
+			struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
+
+			for (i = 0; i < WQ_LAT_BUCKETS; i++) {
+				hist[i] += cwq->lat_hist[i];
+				count += cwq->lat_hist[i];
+			}
+			sum += cwq->lat_sum_us;
+			max = max(max, cwq->lat_max_us);
+		}
+
+		seq_printf(m, "%-24s %10lu %8llu %8lu", wq->name, count,
+			   count ? div_u64(sum, count) : 0ULL, max);
+		for (i = 0; i < WQ_LAT_BUCKETS; i++)
+			seq_printf(m, " %7lu", hist[i]);
+		seq_putc(m, '\n');
+	}
+	spin_unlock(&workqueue_lock);
+
+	return 0;
+}
+
+static int wq_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, wq_latency_show, NULL);
+}
+
+static ssize_t wq_latency_write(struct file *file, const char __user *buf,
+				size_t count, loff_t *ppos)
+{
+	struct workqueue_struct *wq;
+	unsigned int cpu;
+
+	spin_lock(&workqueue_lock);
+	list_for_each_entry(wq, &workqueues, list) {
+		for_each_cwq_cpu(cpu, wq) {
+			struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
+			struct global_cwq *gcwq = get_gcwq(cpu);
+
+			spin_lock_irq(&gcwq->lock);
+			memset(cwq->lat_hist, 0, sizeof(cwq->lat_hist));
+			cwq->lat_sum_us = 0;
+			cwq->lat_max_us = 0;
+			spin_unlock_irq(&gcwq->lock);
+		}
+	}
+	spin_unlock(&workqueue_lock);
+
+	return count;
+}
+
+static const struct file_operations wq_latency_fops = {
+	.open		= wq_latency_open,
+	.read		= seq_read,
+	.write		= wq_latency_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init wq_latency_debugfs_init(void)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir("workqueue", NULL);
+	if (!dir)
+		return -ENOMEM;
+	if (!debugfs_create_file("latency", 0644, dir, NULL,
+				 &wq_latency_fops)) {
+		debugfs_remove(dir);
+		return -ENOMEM;
+	}
+	return 0;
+}
+late_initcall(wq_latency_debugfs_init);
+#endif /* CONFIG_WQ_LATENCY_HIST */
+
 static int __init init_workqueues(void)
 {
 	unsigned int cpu;
@@ -3796,8 +4041,9 @@ static int __init init_workqueues(void)
 					    WQ_UNBOUND_MAX_ACTIVE);
 	system_freezable_wq = alloc_workqueue("events_freezable",
 					      WQ_FREEZABLE, 0);
+	system_rt_wq = alloc_workqueue("events_rt", WQ_HIGHPRI_RT, 0);
 	BUG_ON(!system_wq || !system_long_wq || !system_nrt_wq ||
-	       !system_unbound_wq || !system_freezable_wq);
+	       !system_unbound_wq || !system_freezable_wq || !system_rt_wq);
 	return 0;
 }
 early_initcall(init_workqueues);
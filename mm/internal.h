@@ -295,6 +295,43 @@ static inline void mminit_validate_memmodel_limits(unsigned long *start_pfn,
 }
 #endif /* CONFIG_SPARSEMEM */
 
+extern void readahead_miss(struct address_space *mapping, pgoff_t offset,
+			   unsigned long req_size, pgoff_t start,
+			   unsigned long size);
+
+#ifdef CONFIG_READAHEAD_HISTORY
+extern void ra_history_record(struct address_space *mapping, pgoff_t start,
+			      unsigned long nr);
+extern void ra_history_note_stream(struct address_space *mapping,
+				   unsigned long size);
+extern unsigned long ra_history_init_size(struct address_space *mapping,
+					  unsigned long size, unsigned long max);
+extern unsigned long ra_history_max_pages(struct address_space *mapping,
+					  unsigned long ra_pages);
+#else
+static inline void ra_history_record(struct address_space *mapping,
+				     pgoff_t start, unsigned long nr)
+{
+}
+
+static inline void ra_history_note_stream(struct address_space *mapping,
+					  unsigned long size)
+{
+}
+
+static inline unsigned long ra_history_init_size(struct address_space *mapping,
+					unsigned long size, unsigned long max)
+{
+	return size;
+}
+
+static inline unsigned long ra_history_max_pages(struct address_space *mapping,
+						 unsigned long ra_pages)
+{
+	return ra_pages;
+}
+#endif /* CONFIG_READAHEAD_HISTORY */
+
 #define ZONE_RECLAIM_NOSCAN	-2
 #define ZONE_RECLAIM_FULL	-1
 #define ZONE_RECLAIM_SOME	0
@@ -36,6 +36,8 @@
 #include <linux/hash.h>
 #include <linux/freezer.h>
 #include <linux/oom.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
 
 #include <asm/tlbflush.h>
 #include "internal.h"
@@ -86,12 +88,16 @@
  * @mm_list: link into the mm_slots list, rooted in ksm_mm_head
  * @rmap_list: head for this mm_slot's singly-linked list of rmap_items
  * @mm: the mm that this information is valid for
+ * @seqnr: ksm_scan.seqnr when this mm was registered
+ * @anon_rss: anonymous rss of the mm at the start of the last full scan
  */
 struct mm_slot {
 	struct hlist_node link;
 	struct list_head mm_list;
 	struct rmap_item *rmap_list;
 	struct mm_struct *mm;
+	unsigned long seqnr;
+	unsigned long anon_rss;
 };
 
 /**
@@ -115,11 +121,15 @@ struct ksm_scan {
  * @node: rb node of this ksm page in the stable tree
  * @hlist: hlist head of rmap_items using this ksm page
  * @kpfn: page frame number of this ksm page
+ * @hash: link into stable_hash, keyed by @checksum
+ * @checksum: checksum of the (write-protected) ksm page
  */
 struct stable_node {
 	struct rb_node node;
 	struct hlist_head hlist;
 	unsigned long kpfn;
+	struct hlist_node hash;
+	u32 checksum;
 };
 
 /**
@@ -156,6 +166,25 @@ struct rmap_item {
 static struct rb_root root_stable_tree = RB_ROOT;
 static struct rb_root root_unstable_tree = RB_ROOT;
 
+/*
+ * Checksums of all the ksm pages in the stable tree.  A page whose checksum
+ * is not in here cannot be identical to any of them, so when the hash index
+ * is in use it skips the stable tree walk, and its memcmps, altogether.
+ */
+#define STABLE_HASH_SHIFT 10
+static struct hlist_head stable_hash[1 << STABLE_HASH_SHIFT];
+
+/*
+ * Saturating counts of the checksums seen in the current and in the
+ * previous full scan, indexed by hashed checksum.  A page is only looked up
+ * in (and added to) the unstable tree when its checksum has been seen more
+ * than once in either scan: a unique page then costs one counter bump
+ * instead of a tree walk.  Collisions merely cost the walk we used to do.
+ */
+static u8 *unstable_filter;
+static u8 *unstable_filter_prev;
+static unsigned int unstable_filter_shift;
+
 #define MM_SLOTS_HASH_SHIFT 10
 #define MM_SLOTS_HASH_HEADS (1 << MM_SLOTS_HASH_SHIFT)
 static struct hlist_head mm_slots_hash[MM_SLOTS_HASH_HEADS];
@@ -189,6 +218,27 @@ static unsigned int ksm_thread_pages_to_scan = 100;
 /* Milliseconds ksmd should sleep between batches */
 static unsigned int ksm_thread_sleep_millisecs = 20;
 
+/* Milliseconds of cpu per second ksmd may use, instead of pages_to_scan */
+static unsigned int ksm_thread_cpu_budget_ms;
+
+/* Pages ksmd scans between checks of its cpu budget */
+#define KSM_BUDGET_BATCH	16
+
+/* Skip tree walks for pages whose checksum was not seen before */
+static unsigned int ksm_use_hash_index;
+
+/* Scan newly forked and settled mms first in each full scan */
+static unsigned int ksm_scan_priority;
+
+/* The number of stable or unstable tree walks the hash index saved */
+static unsigned long ksm_walks_skipped;
+
+/* Wall and ksmd cpu time taken by the last full scan, in milliseconds */
+static unsigned long ksm_last_scan_ms;
+static unsigned long ksm_last_scan_cpu_ms;
+static unsigned long ksm_scan_start;
+static unsigned long long ksm_scan_start_cpu;
+
 #define KSM_RUN_STOP	0
 #define KSM_RUN_MERGE	1
 #define KSM_RUN_UNMERGE	2
@@ -458,6 +508,7 @@ static void remove_node_from_stable_tree(struct stable_node *stable_node)
 		cond_resched();
 	}
 
+	hlist_del(&stable_node->hash);
 	rb_erase(&stable_node->node, &root_stable_tree);
 	free_stable_node(stable_node);
 }
@@ -696,6 +747,74 @@ static inline int pages_identical(struct page *page1, struct page *page2)
 	return !memcmp_pages(page1, page2);
 }
 
+static struct hlist_head *stable_hash_head(u32 checksum)
+{
+	return &stable_hash[hash_32(checksum, STABLE_HASH_SHIFT)];
+}
+
+/*
+ * stable_hash_lookup - is there a ksm page in the stable tree whose
+ * contents have this checksum?
+ */
+static bool stable_hash_lookup(u32 checksum)
+{
+	struct stable_node *stable_node;
+	struct hlist_node *node;
+
+	hlist_for_each_entry(stable_node, node, stable_hash_head(checksum), hash)
+		if (stable_node->checksum == checksum)
+			return true;
+	return false;
+}
+
+/*
+ * unstable_filter_add - count the checksum of a page in the current scan,
+ * and tell whether the unstable tree is worth searching for it.
+ */
+static bool unstable_filter_add(u32 checksum)
+{
+	unsigned int index = hash_32(checksum, unstable_filter_shift);
+
+	if (unstable_filter[index] < 2)
+		unstable_filter[index]++;
+	return unstable_filter[index] >= 2 || unstable_filter_prev[index] >= 2;
+}
+
+/* Called with ksm_thread_mutex held, at the start of each full scan */
+static void unstable_filter_rotate(void)
+{
+	u8 *filter = unstable_filter_prev;
+
+	if (!filter)
+		return;
+	unstable_filter_prev = unstable_filter;
+	unstable_filter = filter;
+	memset(filter, 0, 1UL << unstable_filter_shift);
+}
+
+/* Called with ksm_thread_mutex held */
+static int unstable_filter_alloc(void)
+{
+	unsigned long size;
+
+	if (unstable_filter)
+		return 0;
+
+	/* One counter per four pages of memory is plenty to filter with */
+	size = roundup_pow_of_two(max(totalram_pages / 4, 4096UL));
+	size = min(size, 1UL << 20);
+	unstable_filter = vzalloc(size);
+	unstable_filter_prev = vzalloc(size);
+	if (!unstable_filter || !unstable_filter_prev) {
+		vfree(unstable_filter);
+		vfree(unstable_filter_prev);
+		unstable_filter = unstable_filter_prev = NULL;
+		return -ENOMEM;
+	}
+	unstable_filter_shift = ilog2(size);
+	return 0;
+}
+
 static int write_protect_page(struct vm_area_struct *vma, struct page *page,
 			      pte_t *orig_pte)
 {
@@ -1070,6 +1189,9 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
 	INIT_HLIST_HEAD(&stable_node->hlist);
 
 	stable_node->kpfn = page_to_pfn(kpage);
+	stable_node->checksum = calc_checksum(kpage);
+	hlist_add_head(&stable_node->hash,
+		       stable_hash_head(stable_node->checksum));
 	set_page_stable_node(kpage, stable_node);
 
 	return stable_node;
@@ -1174,13 +1296,22 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	struct page *tree_page = NULL;
 	struct stable_node *stable_node;
 	struct page *kpage;
-	unsigned int checksum;
+	unsigned int uninitialized_var(checksum);
 	int err;
 
 	remove_rmap_item_from_tree(rmap_item);
 
 	/* We first start with searching the page inside the stable tree */
-	kpage = stable_tree_search(page);
+	if (ksm_use_hash_index) {
+		checksum = calc_checksum(page);
+		if (page_stable_node(page) || stable_hash_lookup(checksum))
+			kpage = stable_tree_search(page);
+		else {
+			kpage = NULL;
+			ksm_walks_skipped++;
+		}
+	} else
+		kpage = stable_tree_search(page);
 	if (kpage) {
 		err = try_to_merge_with_ksm_page(rmap_item, page, kpage);
 		if (!err) {
@@ -1202,12 +1333,22 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	 * don't want to insert it in the unstable tree, and we don't want
 	 * to waste our time searching for something identical to it there.
 	 */
-	checksum = calc_checksum(page);
+	if (!ksm_use_hash_index)
+		checksum = calc_checksum(page);
 	if (rmap_item->oldchecksum != checksum) {
 		rmap_item->oldchecksum = checksum;
 		return;
 	}
 
+	/*
+	 * Nothing else with this checksum in this scan or in the last one:
+	 * the page is unique for now, and would just sit in the tree.
+	 */
+	if (ksm_use_hash_index && !unstable_filter_add(checksum)) {
+		ksm_walks_skipped++;
+		return;
+	}
+
 	tree_rmap_item =
 		unstable_tree_search_insert(rmap_item, page, &tree_page);
 	if (tree_rmap_item) {
@@ -1272,6 +1413,40 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 	return rmap_item;
 }
 
+/*
+ * ksm_prioritize_mm_slots - reorder the mm_slots at the start of a full scan
+ *
+ * Zygote-forked processes are where the duplicate pages are, and they are
+ * best caught early, so mms registered during the last scan go first.  Then
+ * come the mms whose anonymous rss did not change since the last scan: their
+ * pages have settled down, so their checksums are likely to be stable enough
+ * to get them into the trees.  Busy mms go last.
+ *
+ * Called with ksm_mmlist_lock held, while the cursor is on ksm_mm_head.
+ */
+static void ksm_prioritize_mm_slots(void)
+{
+	struct mm_slot *slot, *next;
+	LIST_HEAD(forked);
+	LIST_HEAD(settled);
+	LIST_HEAD(busy);
+
+	list_for_each_entry_safe(slot, next, &ksm_mm_head.mm_list, mm_list) {
+		unsigned long anon_rss = get_mm_counter(slot->mm, MM_ANONPAGES);
+
+		if (slot->seqnr + 1 >= ksm_scan.seqnr)
+			list_move_tail(&slot->mm_list, &forked);
+		else if (anon_rss == slot->anon_rss)
+			list_move_tail(&slot->mm_list, &settled);
+		else
+			list_move_tail(&slot->mm_list, &busy);
+		slot->anon_rss = anon_rss;
+	}
+	list_splice_tail(&forked, &ksm_mm_head.mm_list);
+	list_splice_tail(&settled, &ksm_mm_head.mm_list);
+	list_splice_tail(&busy, &ksm_mm_head.mm_list);
+}
+
 static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 {
 	struct mm_struct *mm;
@@ -1297,8 +1472,13 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 		lru_add_drain_all();
 
 		root_unstable_tree = RB_ROOT;
+		unstable_filter_rotate();
+		ksm_scan_start = jiffies;
+		ksm_scan_start_cpu = task_sched_runtime(current);
 
 		spin_lock(&ksm_mmlist_lock);
+		if (ksm_scan_priority)
+			ksm_prioritize_mm_slots();
 		slot = list_entry(slot->mm_list.next, struct mm_slot, mm_list);
 		ksm_scan.mm_slot = slot;
 		spin_unlock(&ksm_mmlist_lock);
@@ -1400,27 +1580,57 @@ next_mm:
 		goto next_mm;
 
 	ksm_scan.seqnr++;
+	ksm_last_scan_ms = jiffies_to_msecs(jiffies - ksm_scan_start);
+	ksm_last_scan_cpu_ms = div_u64(task_sched_runtime(current) -
+				       ksm_scan_start_cpu, NSEC_PER_MSEC);
 	return NULL;
 }
 
 /**
  * ksm_do_scan  - the ksm scanner main worker function.
  * @scan_npages - number of pages we want to scan before we return.
+ *
+ * Returns false if it stopped early, at the end of a full scan or because
+ * ksmd is being frozen.
  */
-static void ksm_do_scan(unsigned int scan_npages)
+static bool ksm_do_scan(unsigned int scan_npages)
 {
 	struct rmap_item *rmap_item;
 	struct page *uninitialized_var(page);
 
-	while (scan_npages-- && likely(!freezing(current))) {
+	while (scan_npages--) {
+		if (unlikely(freezing(current)))
+			return false;
 		cond_resched();
 		rmap_item = scan_get_next_rmap_item(&page);
 		if (!rmap_item)
-			return;
+			return false;
 		if (!PageKsm(page) || !in_stable_tree(rmap_item))
 			cmp_and_merge_page(page, rmap_item);
 		put_page(page);
 	}
+	return true;
+}
+
+/*
+ * ksm_do_scan_budget - scan for as long as the cpu budget allows
+ *
+ * ksmd runs for a slice of cpu time and then sleeps for sleep_millisecs, in
+ * a duty cycle that gives it cpu_budget_ms of every second.  Time spent
+ * preempted does not count against the slice.
+ */
+static void ksm_do_scan_budget(void)
+{
+	unsigned int budget = min(ksm_thread_cpu_budget_ms, 999U);
+	unsigned long long start = task_sched_runtime(current);
+	u64 slice;
+
+	slice = div_u64((u64)budget * ksm_thread_sleep_millisecs * NSEC_PER_MSEC,
+			1000 - budget);
+	while (ksm_do_scan(KSM_BUDGET_BATCH)) {
+		if (task_sched_runtime(current) - start >= slice)
+			break;
+	}
 }
 
 static int ksmd_should_run(void)
@@ -1435,8 +1645,12 @@ static int ksm_scan_thread(void *nothing)
 
 	while (!kthread_should_stop()) {
 		mutex_lock(&ksm_thread_mutex);
-		if (ksmd_should_run())
-			ksm_do_scan(ksm_thread_pages_to_scan);
+		if (ksmd_should_run()) {
+			if (ksm_thread_cpu_budget_ms)
+				ksm_do_scan_budget();
+			else
+				ksm_do_scan(ksm_thread_pages_to_scan);
+		}
 		mutex_unlock(&ksm_thread_mutex);
 
 		try_to_freeze();
@@ -1507,6 +1721,8 @@ int __ksm_enter(struct mm_struct *mm)
 	/* Check ksm_run too?  Would need tighter locking */
 	needs_wakeup = list_empty(&ksm_mm_head.mm_list);
 
+	mm_slot->seqnr = ksm_scan.seqnr;
+
 	spin_lock(&ksm_mmlist_lock);
 	insert_to_mm_slots_hash(mm, mm_slot);
 	/*
@@ -1872,6 +2088,80 @@ static ssize_t pages_to_scan_store(struct kobject *kobj,
 }
 KSM_ATTR(pages_to_scan);
 
+static ssize_t cpu_budget_ms_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_thread_cpu_budget_ms);
+}
+
+static ssize_t cpu_budget_ms_store(struct kobject *kobj,
+				   struct kobj_attribute *attr,
+				   const char *buf, size_t count)
+{
+	unsigned long msecs;
+	int err;
+
+	err = strict_strtoul(buf, 10, &msecs);
+	if (err || msecs >= MSEC_PER_SEC)
+		return -EINVAL;
+
+	ksm_thread_cpu_budget_ms = msecs;
+
+	return count;
+}
+KSM_ATTR(cpu_budget_ms);
+
+static ssize_t use_hash_index_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_use_hash_index);
+}
+
+static ssize_t use_hash_index_store(struct kobject *kobj,
+				    struct kobj_attribute *attr,
+				    const char *buf, size_t count)
+{
+	unsigned long enable;
+	int err;
+
+	err = strict_strtoul(buf, 10, &enable);
+	if (err || enable > 1)
+		return -EINVAL;
+
+	mutex_lock(&ksm_thread_mutex);
+	if (enable)
+		err = unstable_filter_alloc();
+	if (!err)
+		ksm_use_hash_index = enable;
+	mutex_unlock(&ksm_thread_mutex);
+
+	return err ? err : count;
+}
+KSM_ATTR(use_hash_index);
+
+static ssize_t scan_priority_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_scan_priority);
+}
+
+static ssize_t scan_priority_store(struct kobject *kobj,
+				   struct kobj_attribute *attr,
+				   const char *buf, size_t count)
+{
+	unsigned long enable;
+	int err;
+
+	err = strict_strtoul(buf, 10, &enable);
+	if (err || enable > 1)
+		return -EINVAL;
+
+	ksm_scan_priority = enable;
+
+	return count;
+}
+KSM_ATTR(scan_priority);
+
 static ssize_t run_show(struct kobject *kobj, struct kobj_attribute *attr,
 			char *buf)
 {
@@ -1966,15 +2256,42 @@ static ssize_t full_scans_show(struct kobject *kobj,
 }
 KSM_ATTR_RO(full_scans);
 
+static ssize_t walks_skipped_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_walks_skipped);
+}
+KSM_ATTR_RO(walks_skipped);
+
+static ssize_t last_scan_ms_show(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_last_scan_ms);
+}
+KSM_ATTR_RO(last_scan_ms);
+
+static ssize_t last_scan_cpu_ms_show(struct kobject *kobj,
+				     struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_last_scan_cpu_ms);
+}
+KSM_ATTR_RO(last_scan_cpu_ms);
+
 static struct attribute *ksm_attrs[] = {
 	&sleep_millisecs_attr.attr,
 	&pages_to_scan_attr.attr,
+	&cpu_budget_ms_attr.attr,
+	&use_hash_index_attr.attr,
+	&scan_priority_attr.attr,
 	&run_attr.attr,
 	&pages_shared_attr.attr,
 	&pages_sharing_attr.attr,
 	&pages_unshared_attr.attr,
 	&pages_volatile_attr.attr,
 	&full_scans_attr.attr,
+	&walks_skipped_attr.attr,
+	&last_scan_ms_attr.attr,
+	&last_scan_cpu_ms_attr.attr,
 	NULL,
 };
 
@@ -0,0 +1,156 @@
+/*
+ * mm/page_alloc-bench.c
+ *
+ * Page allocator microbenchmark.  On load, it times alloc_pages() and
+ * __free_pages() pairs for every order up to max_order, first with one
+ * thread and then with one thread per online cpu added at a time, and
+ * prints the cost per pair and the overall throughput.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/gfp.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/wait.h>
+#include <linux/ktime.h>
+#include <linux/cpumask.h>
+#include <linux/cpu.h>
+#include <linux/sched.h>
+
+static int max_order = PCP_MAX_ORDER + 1;
+module_param(max_order, int, 0444);
+MODULE_PARM_DESC(max_order, "Highest order to benchmark");
+
+static int nr_loops = 10000;
+module_param(nr_loops, int, 0444);
+MODULE_PARM_DESC(nr_loops, "Allocation rounds per thread");
+
+static int nr_held = 16;
+module_param(nr_held, int, 0444);
+MODULE_PARM_DESC(nr_held, "Blocks allocated before they are freed, per round");
+
+#define BENCH_MAX_HELD	64
+
+struct bench_thread {
+	struct completion done;
+	int order;
+	unsigned long failed;
+	s64 elapsed_ns;
+};
+
+static DECLARE_WAIT_QUEUE_HEAD(bench_wait);
+static bool bench_go;
+
+static int bench_thread_fn(void *data)
+{
+	struct bench_thread *bt = data;
+	struct page *pages[BENCH_MAX_HELD];
+	ktime_t start;
+	int loop, i;
+
+	wait_event(bench_wait, bench_go);
+
+	start = ktime_get();
+	for (loop = 0; loop < nr_loops; loop++) {
+		for (i = 0; i < nr_held; i++) {
+			pages[i] = alloc_pages(GFP_KERNEL | __GFP_NOWARN,
+					       bt->order);
+			if (!pages[i])
+				bt->failed++;
+		}
+		for (i = 0; i < nr_held; i++)
+			if (pages[i])
+				__free_pages(pages[i], bt->order);
+		cond_resched();
+	}
+	bt->elapsed_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	complete(&bt->done);
+	return 0;
+}
+
+static void bench_run(int order, int nr_threads)
+{
+	struct bench_thread *threads;
+	unsigned long failed = 0;
+	s64 slowest = 0;
+	u64 nr_ops;
+	int cpu, i = 0;
+
+	threads = kcalloc(nr_threads, sizeof(*threads), GFP_KERNEL);
+	if (!threads)
+		return;
+
+	bench_go = false;
+	for_each_online_cpu(cpu) {
+		struct task_struct *p;
+
+		if (i == nr_threads)
+			break;
+		init_completion(&threads[i].done);
+		threads[i].order = order;
+		p = kthread_create(bench_thread_fn, &threads[i],
+				   "page_alloc_bench/%d", cpu);
+		if (IS_ERR(p))
+			break;
+		kthread_bind(p, cpu);
+		wake_up_process(p);
+		i++;
+	}
+	nr_threads = i;
+
+	bench_go = true;
+	wake_up_all(&bench_wait);
+
+	for (i = 0; i < nr_threads; i++) {
+		wait_for_completion(&threads[i].done);
+		slowest = max(slowest, threads[i].elapsed_ns);
+		failed += threads[i].failed;
+	}
+
+	nr_ops = (u64)nr_threads * nr_loops * nr_held;
+	if (nr_threads && slowest > 0)
+		printk(KERN_INFO "page_alloc_bench: order %d threads %d: "
+		       "%llu ns per alloc+free, %llu pairs/s, %lu failed\n",
+		       order, nr_threads,
+		       div64_u64((u64)slowest * nr_threads, nr_ops),
+		       div64_u64(nr_ops * NSEC_PER_SEC, slowest), failed);
+	kfree(threads);
+}
+
+static int __init page_alloc_bench_init(void)
+{
+	int order, nr_threads;
+
+	if (max_order < 0 || max_order >= MAX_ORDER ||
+	    nr_held < 1 || nr_held > BENCH_MAX_HELD || nr_loops < 1)
+		return -EINVAL;
+
+	/* The threads are bound to their cpus, keep them all online */
+	get_online_cpus();
+	for (order = 0; order <= max_order; order++)
+		for (nr_threads = 1; nr_threads <= num_online_cpus();
+		     nr_threads++)
+			bench_run(order, nr_threads);
+	put_online_cpus();
+
+	return 0;
+}
+
+static void __exit page_alloc_bench_exit(void)
+{
+}
+
+module_init(page_alloc_bench_init);
+module_exit(page_alloc_bench_exit);
+
+MODULE_LICENSE("GPL");
@@ -651,6 +651,69 @@ static void free_pcppages_bulk(struct zone *zone, int count,
 	spin_unlock(&zone->lock);
 }
 
+/*
+ * Blocks of order 1 to PCP_MAX_ORDER live on their own pcp-lists.  They
+ * take a share of the order-0 high watermark that halves with each order,
+ * so that percpu_pagelist_fraction tunes all of them together.
+ */
+static inline int pcp_order_high(struct per_cpu_pages *pcp, int order)
+{
+	return pcp->high >> (order + 2);
+}
+
+static inline int pcp_order_batch(struct per_cpu_pages *pcp, int order)
+{
+	return max(1, pcp->batch >> (order + 1));
+}
+
+/*
+ * Free @count blocks of @order from the pcp-lists, fullest lists first.
+ * Returns the number of blocks actually freed.
+ */
+static int free_pcp_order_bulk(struct zone *zone, int order, int count,
+			       struct per_cpu_pages *pcp)
+{
+	struct list_head *lists = pcp->order_lists[order - 1];
+	int migratetype = 0;
+	int freed = 0;
+
+	spin_lock(&zone->lock);
+	zone->all_unreclaimable = 0;
+	zone->pages_scanned = 0;
+
+	while (freed < count && pcp->order_count[order - 1]) {
+		struct list_head *list;
+		struct page *page;
+
+		do {
+			if (++migratetype == MIGRATE_PCPTYPES)
+				migratetype = 0;
+			list = &lists[migratetype];
+		} while (list_empty(list));
+
+		page = list_entry(list->prev, struct page, lru);
+		list_del(&page->lru);
+		pcp->order_count[order - 1]--;
+		__free_one_page(page, zone, order, page_private(page));
+		trace_mm_page_pcpu_drain(page, order, page_private(page));
+		freed++;
+	}
+	__mod_zone_page_state(zone, NR_FREE_PAGES, freed << order);
+	spin_unlock(&zone->lock);
+	return freed;
+}
+
+/* Free all the order 1 to PCP_MAX_ORDER blocks on the pcp-lists */
+static void free_pcp_orders(struct zone *zone, struct per_cpu_pages *pcp)
+{
+	int order;
+
+	for (order = 1; order <= PCP_MAX_ORDER; order++)
+		if (pcp->order_count[order - 1])
+			free_pcp_order_bulk(zone, order,
+					    pcp->order_count[order - 1], pcp);
+}
+
 static void free_one_page(struct zone *zone, struct page *page, int order,
 				int migratetype)
 {
@@ -689,20 +752,50 @@ static bool free_pages_prepare(struct page *page, unsigned int order)
 	return true;
 }
 
+/*
+ * Put a block of order 1 to PCP_MAX_ORDER on this cpu's pcp-lists, handing
+ * a batch back to the buddy allocator when there are too many.  Called with
+ * interrupts disabled.
+ */
+static void free_pcp_order(struct zone *zone, struct page *page,
+			   unsigned int order, int migratetype)
+{
+	struct per_cpu_pages *pcp;
+
+	if (unlikely(PageCompound(page)))
+		if (unlikely(destroy_compound_page(page, order)))
+			return;
+
+	/* Same as for order-0: RESERVE blocks go back as RESERVE */
+	set_page_private(page, migratetype);
+	if (migratetype >= MIGRATE_PCPTYPES)
+		migratetype = MIGRATE_MOVABLE;
+
+	pcp = &this_cpu_ptr(zone->pageset)->pcp;
+	list_add(&page->lru, &pcp->order_lists[order - 1][migratetype]);
+	if (++pcp->order_count[order - 1] > pcp_order_high(pcp, order))
+		free_pcp_order_bulk(zone, order, pcp_order_batch(pcp, order),
+				    pcp);
+}
+
 static void __free_pages_ok(struct page *page, unsigned int order)
 {
 	unsigned long flags;
+	int migratetype;
 	int wasMlocked = __TestClearPageMlocked(page);
 
 	if (!free_pages_prepare(page, order))
 		return;
 
+	migratetype = get_pageblock_migratetype(page);
 	local_irq_save(flags);
 	if (unlikely(wasMlocked))
 		free_page_mlock(page);
 	__count_vm_events(PGFREE, 1 << order);
-	free_one_page(page_zone(page), page, order,
-					get_pageblock_migratetype(page));
+	if (order <= PCP_MAX_ORDER && migratetype != MIGRATE_ISOLATE)
+		free_pcp_order(page_zone(page), page, order, migratetype);
+	else
+		free_one_page(page_zone(page), page, order, migratetype);
 	local_irq_restore(flags);
 }
 
@@ -1088,6 +1181,7 @@ void drain_zone_pages(struct zone *zone, struct per_cpu_pages *pcp)
 		to_drain = pcp->count;
 	free_pcppages_bulk(zone, to_drain, pcp);
 	pcp->count -= to_drain;
+	free_pcp_orders(zone, pcp);
 	local_irq_restore(flags);
 }
 #endif
@@ -1116,6 +1210,7 @@ static void drain_pages(unsigned int cpu)
 			free_pcppages_bulk(zone, pcp->count, pcp);
 			pcp->count = 0;
 		}
+		free_pcp_orders(zone, pcp);
 		local_irq_restore(flags);
 	}
 }
@@ -1334,6 +1429,30 @@ again:
 
 		list_del(&page->lru);
 		pcp->count--;
+	} else if (order <= PCP_MAX_ORDER) {
+		struct per_cpu_pages *pcp;
+		struct list_head *list;
+
+		WARN_ON_ONCE((gfp_flags & __GFP_NOFAIL) && order > 1);
+
+		local_irq_save(flags);
+		pcp = &this_cpu_ptr(zone->pageset)->pcp;
+		list = &pcp->order_lists[order - 1][migratetype];
+		if (list_empty(list)) {
+			pcp->order_count[order - 1] += rmqueue_bulk(zone, order,
+					pcp_order_batch(pcp, order), list,
+					migratetype, cold);
+			if (unlikely(list_empty(list)))
+				goto failed;
+		}
+
+		if (cold)
+			page = list_entry(list->prev, struct page, lru);
+		else
+			page = list_entry(list->next, struct page, lru);
+
+		list_del(&page->lru);
+		pcp->order_count[order - 1]--;
 	} else {
 		if (unlikely(gfp_flags & __GFP_NOFAIL)) {
 			/*
@@ -3603,7 +3722,7 @@ static int zone_batchsize(struct zone *zone)
 static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 {
 	struct per_cpu_pages *pcp;
-	int migratetype;
+	int migratetype, order;
 
 	memset(p, 0, sizeof(*p));
 
@@ -3611,8 +3730,11 @@ static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 	pcp->count = 0;
 	pcp->high = 6 * batch;
 	pcp->batch = max(1UL, 1 * batch);
-	for (migratetype = 0; migratetype < MIGRATE_PCPTYPES; migratetype++)
+	for (migratetype = 0; migratetype < MIGRATE_PCPTYPES; migratetype++) {
 		INIT_LIST_HEAD(&pcp->lists[migratetype]);
+		for (order = 0; order < PCP_MAX_ORDER; order++)
+			INIT_LIST_HEAD(&pcp->order_lists[order][migratetype]);
+	}
 }
 
 /*
@@ -3720,6 +3842,7 @@ static int __zone_pcp_update(void *data)
 
 		local_irq_save(flags);
 		free_pcppages_bulk(zone, pcp->count, pcp);
+		free_pcp_orders(zone, pcp);
 		setup_pageset(pset, batch);
 		local_irq_restore(flags);
 	}
@@ -5322,7 +5445,8 @@ int lowmem_reserve_ratio_sysctl_handler(ctl_table *table, int write,
 /*
  * percpu_pagelist_fraction - changes the pcp->high for each zone on each
  * cpu.  It is the fraction of total pages in each zone that a hot per cpu pagelist
- * can have before it gets flushed back to buddy allocator.
+ * can have before it gets flushed back to buddy allocator.  The lists of
+ * order 1 to PCP_MAX_ORDER blocks follow, as their limits derive from it.
  */
 
 int percpu_pagelist_fraction_sysctl_handler(ctl_table *table, int write,
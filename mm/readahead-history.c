@@ -0,0 +1,466 @@
+/*
+ * mm/readahead-history.c - readahead patterns remembered across opens.
+ *
+ * The on-demand readahead state lives in struct file, so every open of
+ * a file starts learning its access pattern from scratch.  Applications
+ * that are launched over and over map the very same ranges of the very
+ * same files (APKs, dex and odex files, shared libraries) each time.
+ *
+ * This keeps a small, bounded table of recently used files.  For each
+ * it remembers the ranges that were read synchronously on page cache
+ * misses and the largest window of a sequential stream.  On the next
+ * open the hot ranges are prefetched asynchronously, and a stream
+ * starts out with the window it ended up with the last time.
+ *
+ * The maximum readahead window is also sized from the measured
+ * throughput and read latency of the underlying block device, rather
+ * than only from the static bdi->ra_pages.
+ */
+
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/hash.h>
+#include <linux/list.h>
+#include <linux/file.h>
+#include <linux/genhd.h>
+#include <linux/pagemap.h>
+#include <linux/workqueue.h>
+#include <linux/backing-dev.h>
+#include <linux/init.h>
+
+#include <trace/events/readahead.h>
+
+#define RA_HISTORY_HASH_BITS	8
+#define RA_HISTORY_MAX		512	/* files remembered */
+#define RA_HISTORY_RANGES	8	/* hot ranges per file */
+#define RA_HISTORY_GAP		16	/* merge ranges closer than this */
+#define RA_HISTORY_RANGE_MAX	512	/* pages in a single range */
+#define RA_HISTORY_PREFETCH_MAX	1024	/* pages prefetched per open */
+
+int sysctl_readahead_history __read_mostly = 1;
+
+struct ra_range {
+	pgoff_t start;
+	unsigned long nr;
+	unsigned int hits;
+};
+
+struct ra_history {
+	struct hlist_node hash;
+	struct list_head lru;
+	dev_t dev;
+	unsigned long ino;
+	u32 generation;
+	unsigned long stream_pages;	/* largest sequential window */
+	unsigned long prefetched;	/* jiffies of the last prefetch */
+	struct ra_range range[RA_HISTORY_RANGES];
+};
+
+struct ra_prefetch {
+	struct work_struct work;
+	struct list_head list;		/* on ra_prefetch_list while queued */
+	struct super_block *sb;
+	struct file *file;
+	unsigned int nr_ranges;
+	struct ra_range range[RA_HISTORY_RANGES];
+};
+
+static DEFINE_SPINLOCK(ra_history_lock);
+static struct hlist_head ra_history_hash[1 << RA_HISTORY_HASH_BITS];
+static LIST_HEAD(ra_history_lru);
+static unsigned int ra_history_count;
+static struct kmem_cache *ra_history_cachep;
+static struct workqueue_struct *ra_prefetch_wq;
+static LIST_HEAD(ra_prefetch_list);
+
+static inline bool ra_history_wanted(struct inode *inode)
+{
+	return sysctl_readahead_history && ra_history_cachep &&
+		S_ISREG(inode->i_mode);
+}
+
+static struct hlist_head *ra_history_bucket(struct inode *inode)
+{
+	unsigned long key = inode->i_ino ^ inode->i_sb->s_dev;
+
+	return &ra_history_hash[hash_long(key, RA_HISTORY_HASH_BITS)];
+}
+
+/* Called with ra_history_lock held */
+static struct ra_history *ra_history_lookup(struct inode *inode)
+{
+	struct hlist_node *node;
+	struct ra_history *h;
+
+	hlist_for_each_entry(h, node, ra_history_bucket(inode), hash) {
+		if (h->ino == inode->i_ino && h->dev == inode->i_sb->s_dev &&
+		    h->generation == inode->i_generation) {
+			list_move(&h->lru, &ra_history_lru);
+			return h;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Called with ra_history_lock held.  Uses @new if the table has room,
+ * otherwise recycles the least recently used entry.
+ */
+static struct ra_history *ra_history_insert(struct inode *inode,
+					    struct ra_history **new)
+{
+	struct ra_history *h;
+
+	if (*new && ra_history_count < RA_HISTORY_MAX) {
+		h = *new;
+		*new = NULL;
+		ra_history_count++;
+	} else if (!list_empty(&ra_history_lru)) {
+		h = list_entry(ra_history_lru.prev, struct ra_history, lru);
+		hlist_del(&h->hash);
+		list_del(&h->lru);
+	} else
+		return NULL;
+
+	memset(h, 0, sizeof(*h));
+	h->dev = inode->i_sb->s_dev;
+	h->ino = inode->i_ino;
+	h->generation = inode->i_generation;
+	hlist_add_head(&h->hash, ra_history_bucket(inode));
+	list_add(&h->lru, &ra_history_lru);
+	return h;
+}
+
+static void ra_history_add_range(struct ra_history *h, pgoff_t start,
+				 unsigned long nr)
+{
+	struct ra_range *victim = NULL;
+	int i;
+
+	for (i = 0; i < RA_HISTORY_RANGES; i++) {
+		struct ra_range *r = &h->range[i];
+		pgoff_t lo, hi;
+
+		if (!r->nr) {
+			if (!victim || victim->nr)
+				victim = r;
+			continue;
+		}
+		if (start > r->start + r->nr + RA_HISTORY_GAP ||
+		    start + nr + RA_HISTORY_GAP < r->start) {
+			if (!victim || (victim->nr && r->hits < victim->hits))
+				victim = r;
+			continue;
+		}
+		lo = min(start, r->start);
+		hi = max(start + nr, r->start + r->nr);
+		if (hi - lo > RA_HISTORY_RANGE_MAX)
+			continue;
+		r->start = lo;
+		r->nr = hi - lo;
+		if (++r->hits == UINT_MAX) {
+			/* Age everybody so that old favourites can go */
+			for (i = 0; i < RA_HISTORY_RANGES; i++)
+				h->range[i].hits >>= 1;
+		}
+		return;
+	}
+
+	if (victim) {
+		victim->start = start;
+		victim->nr = nr;
+		victim->hits = 1;
+	}
+}
+
+/**
+ * ra_history_record - remember a range read on a page cache miss
+ * @mapping: the file's address_space
+ * @start: first page of the range
+ * @nr: number of pages in the range
+ */
+void ra_history_record(struct address_space *mapping, pgoff_t start,
+		       unsigned long nr)
+{
+	struct inode *inode = mapping->host;
+	struct ra_history *h, *new = NULL;
+
+	if (!nr || !ra_history_wanted(inode))
+		return;
+	nr = min_t(unsigned long, nr, RA_HISTORY_RANGE_MAX);
+
+	spin_lock(&ra_history_lock);
+	h = ra_history_lookup(inode);
+	if (!h && ra_history_count < RA_HISTORY_MAX) {
+		/* The first miss on this file: get it an entry */
+		spin_unlock(&ra_history_lock);
+		new = kmem_cache_alloc(ra_history_cachep,
+				       GFP_NOFS | __GFP_NOWARN);
+		spin_lock(&ra_history_lock);
+		h = ra_history_lookup(inode);
+	}
+	if (!h)
+		h = ra_history_insert(inode, &new);
+	if (h)
+		ra_history_add_range(h, start, nr);
+	spin_unlock(&ra_history_lock);
+
+	if (new)
+		kmem_cache_free(ra_history_cachep, new);
+}
+
+/**
+ * ra_history_note_stream - remember the window a sequential stream reached
+ * @mapping: the file's address_space
+ * @size: current readahead window, in pages
+ */
+void ra_history_note_stream(struct address_space *mapping, unsigned long size)
+{
+	struct inode *inode = mapping->host;
+	struct ra_history *h;
+
+	if (!ra_history_wanted(inode))
+		return;
+
+	spin_lock(&ra_history_lock);
+	h = ra_history_lookup(inode);
+	if (h && size > h->stream_pages)
+		h->stream_pages = size;
+	spin_unlock(&ra_history_lock);
+}
+
+/**
+ * ra_history_init_size - initial window for a stream starting at offset 0
+ * @mapping: the file's address_space
+ * @size: the window the on-demand logic came up with
+ * @max: the maximum window
+ *
+ * A file that was streamed before does not need to ramp up its window
+ * again from the request size.
+ */
+unsigned long ra_history_init_size(struct address_space *mapping,
+				   unsigned long size, unsigned long max)
+{
+	struct inode *inode = mapping->host;
+	struct ra_history *h;
+
+	if (!ra_history_wanted(inode))
+		return size;
+
+	spin_lock(&ra_history_lock);
+	h = ra_history_lookup(inode);
+	if (h && h->stream_pages > size)
+		size = min(h->stream_pages, max);
+	spin_unlock(&ra_history_lock);
+
+	return size;
+}
+
+/*
+ * Sample the read statistics of @disk, at most once a second per bdi.
+ *
+ * Throughput while the device is busy, times the average read latency,
+ * is the amount of data that moves while one request is in flight.  The
+ * window keeps two of those in flight, so that the next one is already
+ * queued by the time a streaming reader catches up with the first.
+ */
+static void ra_sample_device(struct backing_dev_info *bdi,
+			     struct gendisk *disk)
+{
+	struct hd_struct *part = &disk->part0;
+	unsigned long ios = part_stat_read(part, ios[READ]);
+	unsigned long sectors = part_stat_read(part, sectors[READ]);
+	unsigned long ticks = part_stat_read(part, ticks[READ]);
+	unsigned long busy = part_stat_read(part, io_ticks);
+	unsigned long d_ios = ios - bdi->ra_sample_ios;
+	unsigned long d_pages = (sectors - bdi->ra_sample_sectors) >>
+					(PAGE_CACHE_SHIFT - 9);
+	unsigned long d_ticks = ticks - bdi->ra_sample_ticks;
+	unsigned long d_busy = busy - bdi->ra_sample_busy;
+
+	bdi->ra_sample_ios = ios;
+	bdi->ra_sample_sectors = sectors;
+	bdi->ra_sample_ticks = ticks;
+	bdi->ra_sample_busy = busy;
+
+	/* Not enough reads in this period to tell anything */
+	if (d_ios < 16 || !d_busy || !d_ticks)
+		return;
+
+	bdi->ra_window = max_t(unsigned long, 1,
+			div64_u64((u64)d_pages * d_ticks * 2,
+				  (u64)d_busy * d_ios));
+}
+
+/**
+ * ra_history_max_pages - device-sized maximum readahead window
+ * @mapping: the file's address_space
+ * @ra_pages: the file's configured maximum window
+ *
+ * Returns the window measured for the backing device, kept between half
+ * of @ra_pages and @ra_pages itself, so that read_ahead_kb stays a limit.
+ */
+unsigned long ra_history_max_pages(struct address_space *mapping,
+				   unsigned long ra_pages)
+{
+	struct backing_dev_info *bdi = mapping->backing_dev_info;
+	struct block_device *bdev = mapping->host->i_sb->s_bdev;
+	unsigned long stamp = bdi->ra_sample_time;
+	unsigned long window;
+
+	if (!sysctl_readahead_history || !bdev || !bdev->bd_disk)
+		return ra_pages;
+
+	/* Whoever moves the sample time on gets to take the sample */
+	if (jiffies - stamp >= HZ &&
+	    cmpxchg(&bdi->ra_sample_time, stamp, jiffies) == stamp)
+		ra_sample_device(bdi, bdev->bd_disk);
+
+	window = ACCESS_ONCE(bdi->ra_window);
+	if (!window)
+		return ra_pages;
+	return clamp(window, ra_pages / 2, ra_pages);
+}
+
+static void ra_prefetch_work(struct work_struct *work)
+{
+	struct ra_prefetch *p = container_of(work, struct ra_prefetch, work);
+	struct address_space *mapping = p->file->f_mapping;
+	unsigned long budget = RA_HISTORY_PREFETCH_MAX;
+	unsigned int i;
+
+	for (i = 0; i < p->nr_ranges && budget; i++) {
+		unsigned long nr = min(p->range[i].nr, budget);
+
+		trace_mm_readahead_prefetch(mapping, p->range[i].start, nr);
+		force_page_cache_readahead(mapping, p->file,
+					   p->range[i].start, nr);
+		budget -= nr;
+	}
+	fput(p->file);
+
+	/* Unless ra_history_flush() took it off the list and frees it */
+	spin_lock(&ra_history_lock);
+	if (list_empty(&p->list))
+		p = NULL;
+	else
+		list_del(&p->list);
+	spin_unlock(&ra_history_lock);
+	kfree(p);
+}
+
+/**
+ * ra_history_prefetch - prefetch the hot ranges of a file being opened
+ * @file: the newly opened file
+ *
+ * The prefetch holds a reference to @file until it is done, so umount
+ * cancels it with ra_history_flush().
+ */
+void ra_history_prefetch(struct file *file)
+{
+	struct address_space *mapping = file->f_mapping;
+	struct inode *inode = mapping->host;
+	struct ra_range range[RA_HISTORY_RANGES];
+	unsigned int nr_ranges = 0;
+	struct ra_history *h;
+	struct ra_prefetch *p;
+	struct page *page;
+	int i, j;
+
+	if ((file->f_mode & (FMODE_READ | FMODE_WRITE)) != FMODE_READ ||
+	    (file->f_flags & O_DIRECT) || !file->f_ra.ra_pages ||
+	    !ra_history_wanted(inode))
+		return;
+	if (!mapping->a_ops ||
+	    (!mapping->a_ops->readpage && !mapping->a_ops->readpages))
+		return;
+
+	spin_lock(&ra_history_lock);
+	h = ra_history_lookup(inode);
+	/* Don't hammer the device for a file that is opened in a loop */
+	if (h && jiffies - h->prefetched > HZ) {
+		h->prefetched = jiffies;
+		/* Hottest ranges first, in case the budget runs out */
+		for (i = 0; i < RA_HISTORY_RANGES; i++) {
+			struct ra_range r = h->range[i];
+
+			if (!r.nr)
+				continue;
+			for (j = nr_ranges; j > 0 &&
+			     range[j - 1].hits < r.hits; j--)
+				range[j] = range[j - 1];
+			range[j] = r;
+			nr_ranges++;
+		}
+	}
+	spin_unlock(&ra_history_lock);
+
+	if (!nr_ranges)
+		return;
+
+	/* Still warm from the last time: nothing to do */
+	page = find_get_page(mapping, range[0].start);
+	if (page) {
+		page_cache_release(page);
+		return;
+	}
+
+	p = kmalloc(sizeof(*p), GFP_KERNEL);
+	if (!p)
+		return;
+	memcpy(p->range, range, nr_ranges * sizeof(range[0]));
+	p->nr_ranges = nr_ranges;
+	get_file(file);
+	p->file = file;
+	p->sb = inode->i_sb;
+	INIT_WORK(&p->work, ra_prefetch_work);
+	spin_lock(&ra_history_lock);
+	list_add_tail(&p->list, &ra_prefetch_list);
+	spin_unlock(&ra_history_lock);
+	queue_work(ra_prefetch_wq, &p->work);
+}
+
+/**
+ * ra_history_flush - cancel the prefetches of a super block
+ * @sb: the super block being unmounted
+ *
+ * Called by umount, which would otherwise find the mount busy with the
+ * files they hold.  Prefetches that have not started are dropped, those
+ * running are waited for.
+ */
+void ra_history_flush(struct super_block *sb)
+{
+	struct ra_prefetch *p;
+
+again:
+	spin_lock(&ra_history_lock);
+	list_for_each_entry(p, &ra_prefetch_list, list) {
+		if (p->sb != sb)
+			continue;
+		list_del_init(&p->list);
+		spin_unlock(&ra_history_lock);
+
+		/* Not pending any more means it ran and put the file */
+		if (cancel_work_sync(&p->work))
+			fput(p->file);
+		kfree(p);
+		goto again;
+	}
+	spin_unlock(&ra_history_lock);
+}
+
+static int __init ra_history_init(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(ra_history_hash); i++)
+		INIT_HLIST_HEAD(&ra_history_hash[i]);
+	ra_prefetch_wq = alloc_workqueue("ra_prefetch", WQ_UNBOUND, 0);
+	if (!ra_prefetch_wq)
+		return -ENOMEM;
+	ra_history_cachep = KMEM_CACHE(ra_history, SLAB_PANIC);
+	return 0;
+}
+module_init(ra_history_init);
@@ -18,6 +18,11 @@
 #include <linux/pagevec.h>
 #include <linux/pagemap.h>
 
+#include "internal.h"
+
+#define CREATE_TRACE_POINTS
+#include <trace/events/readahead.h>
+
 /*
  * Initialise a struct file's readahead state.  Assumes that the caller has
  * memset *ra to zero.
@@ -177,7 +182,7 @@ __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 		rcu_read_lock();
 		page = radix_tree_lookup(&mapping->page_tree, page_offset);
 		rcu_read_unlock();
-		if (page)
+		if (page && !radix_tree_exceptional_entry(page))
 			continue;
 
 		page = page_cache_alloc_readahead(mapping);
@@ -245,6 +250,17 @@ unsigned long max_sane_readahead(unsigned long nr)
 		+ node_page_state(numa_node_id(), NR_FREE_PAGES)) / 2);
 }
 
+/*
+ * Note a page cache miss at @offset, for a read of @req_size pages, that
+ * is being served by a synchronous read of [@start, @start + @size).
+ */
+void readahead_miss(struct address_space *mapping, pgoff_t offset,
+		    unsigned long req_size, pgoff_t start, unsigned long size)
+{
+	trace_mm_readahead_miss(mapping, offset, req_size, start, size);
+	ra_history_record(mapping, start, size);
+}
+
 /*
  * Submit IO for the read-ahead request in file_ra_state.
  */
@@ -349,7 +365,7 @@ static pgoff_t count_history_pages(struct address_space *mapping,
 	pgoff_t head;
 
 	rcu_read_lock();
-	head = radix_tree_prev_hole(&mapping->page_tree, offset - 1, max);
+	head = page_cache_prev_hole(mapping, offset - 1, max);
 	rcu_read_unlock();
 
 	return offset - 1 - head;
@@ -398,7 +414,9 @@ ondemand_readahead(struct address_space *mapping,
 		   bool hit_readahead_marker, pgoff_t offset,
 		   unsigned long req_size)
 {
-	unsigned long max = max_sane_readahead(ra->ra_pages);
+	unsigned long max;
+
+	max = max_sane_readahead(ra_history_max_pages(mapping, ra->ra_pages));
 
 	/*
 	 * start of file
@@ -415,6 +433,7 @@ ondemand_readahead(struct address_space *mapping,
 		ra->start += ra->size;
 		ra->size = get_next_ra_size(ra, max);
 		ra->async_size = ra->size;
+		ra_history_note_stream(mapping, ra->size);
 		goto readit;
 	}
 
@@ -428,7 +447,7 @@ ondemand_readahead(struct address_space *mapping,
 		pgoff_t start;
 
 		rcu_read_lock();
-		start = radix_tree_next_hole(&mapping->page_tree, offset+1,max);
+		start = page_cache_next_hole(mapping, offset+1, max);
 		rcu_read_unlock();
 
 		if (!start || start - offset > max)
@@ -465,11 +484,15 @@ ondemand_readahead(struct address_space *mapping,
 	 * standalone, small random read
 	 * Read as is, and do not pollute the readahead state.
 	 */
+	readahead_miss(mapping, offset, req_size, offset, req_size);
 	return __do_page_cache_readahead(mapping, filp, offset, req_size, 0);
 
 initial_readahead:
 	ra->start = offset;
 	ra->size = get_init_ra_size(req_size, max);
+	/* A file streamed before can start out at its old window */
+	if (!offset)
+		ra->size = ra_history_init_size(mapping, ra->size, max);
 	ra->async_size = ra->size > req_size ? ra->size - req_size : ra->size;
 
 readit:
@@ -483,6 +506,8 @@ readit:
 		ra->size += ra->async_size;
 	}
 
+	if (!hit_readahead_marker)
+		readahead_miss(mapping, offset, req_size, ra->start, ra->size);
 	return ra_submit(ra, mapping, filp);
 }
 
@@ -510,6 +535,7 @@ void page_cache_sync_readahead(struct address_space *mapping,
 
 	/* be dumb */
 	if (filp && (filp->f_mode & FMODE_RANDOM)) {
+		readahead_miss(mapping, offset, req_size, offset, req_size);
 		force_page_cache_readahead(mapping, filp, offset, req_size);
 		return;
 	}
@@ -183,6 +183,56 @@ int invalidate_inode_page(struct page *page)
 	return invalidate_complete_page(mapping, page);
 }
 
+/*
+ * Drop the shadow entries of evicted pages in [start, end].  Pages
+ * themselves are left alone, the caller has already removed them.
+ */
+static void truncate_shadow_entries(struct address_space *mapping,
+				    pgoff_t start, pgoff_t end)
+{
+	unsigned long indices[PAGEVEC_SIZE];
+	unsigned long shadows[PAGEVEC_SIZE];
+	void **slots[PAGEVEC_SIZE];
+	bool done = false;
+
+	while (!done) {
+		unsigned int nr_found, nr_shadows = 0;
+		unsigned int i;
+
+		spin_lock_irq(&mapping->tree_lock);
+		if (!mapping->nrshadows) {
+			spin_unlock_irq(&mapping->tree_lock);
+			break;
+		}
+		nr_found = radix_tree_gang_lookup_slot(&mapping->page_tree,
+				slots, indices, start, PAGEVEC_SIZE);
+		/*
+		 * Deleting entries can free nodes holding the other slots,
+		 * so collect the shadow indices before touching the tree.
+		 */
+		for (i = 0; i < nr_found && indices[i] <= end; i++) {
+			void *entry = radix_tree_deref_slot_protected(slots[i],
+							&mapping->tree_lock);
+
+			if (radix_tree_exceptional_entry(entry))
+				shadows[nr_shadows++] = indices[i];
+		}
+		/* Stop at the end of the tree or of the range */
+		if (i < PAGEVEC_SIZE)
+			done = true;
+		else {
+			start = indices[i - 1] + 1;
+			done = !start;
+		}
+		for (i = 0; i < nr_shadows; i++)
+			radix_tree_delete(&mapping->page_tree, shadows[i]);
+		if (nr_shadows)
+			workingset_shadows_changed(mapping, -(long)nr_shadows);
+		spin_unlock_irq(&mapping->tree_lock);
+		cond_resched();
+	}
+}
+
 /**
  * truncate_inode_pages - truncate range of pages specified by start & end byte offsets
  * @mapping: mapping to truncate
@@ -217,12 +267,15 @@ void truncate_inode_pages_range(struct address_space *mapping,
 	int i;
 
 	cleancache_flush_inode(mapping);
-	if (mapping->nrpages == 0)
+	if (mapping->nrpages == 0 && mapping->nrshadows == 0)
 		return;
 
 	BUG_ON((lend & (PAGE_CACHE_SIZE - 1)) != (PAGE_CACHE_SIZE - 1));
 	end = (lend >> PAGE_CACHE_SHIFT);
 
+	if (mapping->nrpages == 0)
+		goto shadows;
+
 	pagevec_init(&pvec, 0);
 	next = start;
 	while (next <= end &&
@@ -294,6 +347,13 @@ void truncate_inode_pages_range(struct address_space *mapping,
 		pagevec_release(&pvec);
 		mem_cgroup_uncharge_end();
 	}
+shadows:
+	/*
+	 * Reclaim may have replaced pages in the range by shadow entries
+	 * while we were busy; those go only after the pages are gone.
+	 */
+	if (mapping->nrshadows)
+		truncate_shadow_entries(mapping, start, end);
 	cleancache_flush_inode(mapping);
 }
 EXPORT_SYMBOL(truncate_inode_pages_range);
@@ -404,7 +464,7 @@ invalidate_complete_page2(struct address_space *mapping, struct page *page)
 
 	clear_page_mlock(page);
 	BUG_ON(page_has_private(page));
-	__delete_from_page_cache(page);
+	__delete_from_page_cache(page, NULL);
 	spin_unlock_irq(&mapping->tree_lock);
 	mem_cgroup_uncharge_cache_page(page);
 
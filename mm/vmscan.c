@@ -43,6 +43,8 @@
 #include <linux/sysctl.h>
 #include <linux/oom.h>
 #include <linux/prefetch.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
@@ -185,6 +187,7 @@ static unsigned long zone_nr_lru_pages(struct zone *zone,
 void register_shrinker(struct shrinker *shrinker)
 {
 	shrinker->nr = 0;
+	memset(&shrinker->stats, 0, sizeof(shrinker->stats));
 	down_write(&shrinker_rwsem);
 	list_add_tail(&shrinker->list, &shrinker_list);
 	up_write(&shrinker_rwsem);
@@ -210,7 +213,127 @@ static inline int do_shrinker_shrink(struct shrinker *shrinker,
 	return (*shrinker->shrink)(shrinker, sc);
 }
 
+/*
+ * Default time budget, in microseconds, a direct reclaimer spends in a
+ * single shrinker per shrink_slab() pass.  Whatever is left over when it
+ * runs out is deferred to the next pass, typically kswapd's.  0 disables
+ * the budget.
+ */
+static unsigned int shrinker_budget_us = 4000;
+
+/*
+ * Direct reclaim: an allocating task reclaiming on its own behalf, as
+ * opposed to kswapd or an explicit drop_caches.
+ */
+static inline bool shrink_in_direct_reclaim(void)
+{
+	return (current->flags & PF_MEMALLOC) && !current_is_kswapd();
+}
+
+static void shrinker_account(struct shrinker *shrinker, unsigned long scanned,
+			     unsigned long freed, u64 delta_ns)
+{
+	struct shrinker_stats *stats = &shrinker->stats;
+	u64 limit = 10 * NSEC_PER_USEC;
+	long long old, prev;
+	int bucket = 0;
+
+	while (bucket < SHRINKER_LATENCY_BUCKETS - 1 && delta_ns >= limit) {
+		limit *= 10;
+		bucket++;
+	}
+	atomic_long_inc(&stats->latency[bucket]);
+	atomic_long_inc(&stats->calls);
+	atomic_long_add(scanned, &stats->scanned);
+	atomic_long_add(freed, &stats->freed);
+	atomic64_add(delta_ns, &stats->time_ns);
+
+	old = atomic64_read(&stats->max_ns);
+	while (delta_ns > (u64)old) {
+		prev = atomic64_cmpxchg(&stats->max_ns, old, delta_ns);
+		if (prev == old)
+			break;
+		old = prev;
+	}
+}
+
 #define SHRINK_BATCH 128
+
+static u64 shrinker_deadline(struct shrinker *shrinker)
+{
+	unsigned int budget_us = shrinker->budget_us ?: shrinker_budget_us;
+
+	if (!budget_us)
+		return ~0ULL;
+	return ktime_to_ns(ktime_get()) + (u64)budget_us * NSEC_PER_USEC;
+}
+
+/*
+ * Hand *total_scan objects to the shrinker in batches, until fewer than a
+ * batch are left, it gives up, or a direct reclaimer's deadline passes.
+ * What was not scanned is left in *total_scan.  Returns the number of
+ * objects freed.
+ */
+static unsigned long shrinker_run_batches(struct shrinker *shrinker,
+					  struct shrink_control *shrink,
+					  unsigned long *total_scan,
+					  bool direct, u64 deadline)
+{
+	unsigned long freed = 0;
+
+	while (*total_scan >= SHRINK_BATCH) {
+		long this_scan = SHRINK_BATCH;
+		int shrink_ret;
+		int nr_before;
+		u64 start, now;
+
+		nr_before = do_shrinker_shrink(shrinker, shrink, 0);
+		start = ktime_to_ns(ktime_get());
+		shrink_ret = do_shrinker_shrink(shrinker, shrink, this_scan);
+		now = ktime_to_ns(ktime_get());
+		if (shrink_ret == -1)
+			break;
+		if (shrink_ret < nr_before)
+			freed += nr_before - shrink_ret;
+		shrinker_account(shrinker, this_scan,
+				 max(nr_before - shrink_ret, 0), now - start);
+		count_vm_events(SLABS_SCANNED, this_scan);
+		*total_scan -= this_scan;
+
+		/* Leave the rest to the next pass */
+		if (direct && *total_scan >= SHRINK_BATCH && now >= deadline) {
+			atomic_long_inc(&shrinker->stats.over_budget);
+			break;
+		}
+
+		cond_resched();
+	}
+	return freed;
+}
+
+/*
+ * Before a direct reclaimer resorts to killing tasks, have the
+ * SHRINKER_ASYNC shrinkers free what they were asked to so far, rather
+ * than leaving it to kswapd: that memory is cheaper to give up than a
+ * task.  Called with shrinker_rwsem held.
+ */
+static unsigned long shrink_slab_deferred(struct shrink_control *shrink)
+{
+	struct shrinker *shrinker;
+	unsigned long total_scan, freed = 0;
+
+	list_for_each_entry(shrinker, &shrinker_list, list) {
+		if (!(shrinker->flags & SHRINKER_ASYNC) ||
+		    shrinker->nr < SHRINK_BATCH)
+			continue;
+		total_scan = shrinker->nr;
+		shrinker->nr = 0;
+		freed += shrinker_run_batches(shrinker, shrink, &total_scan,
+					      true, shrinker_deadline(shrinker));
+		shrinker->nr += total_scan;
+	}
+	return freed;
+}
 /*
  * Call the shrink functions to age shrinkable caches
  *
@@ -236,6 +359,7 @@ unsigned long shrink_slab(struct shrink_control *shrink,
 {
 	struct shrinker *shrinker;
 	unsigned long ret = 0;
+	bool direct = shrink_in_direct_reclaim();
 
 	if (nr_pages_scanned == 0)
 		nr_pages_scanned = SWAP_CLUSTER_MAX;
@@ -250,6 +374,7 @@ unsigned long shrink_slab(struct shrink_control *shrink,
 		unsigned long long delta;
 		unsigned long total_scan;
 		unsigned long max_pass;
+		u64 deadline = ~0ULL;
 
 		max_pass = do_shrinker_shrink(shrinker, shrink, 0);
 		delta = (4 * nr_pages_scanned) / shrinker->seeks;
@@ -274,24 +399,27 @@ unsigned long shrink_slab(struct shrink_control *shrink,
 		total_scan = shrinker->nr;
 		shrinker->nr = 0;
 
-		while (total_scan >= SHRINK_BATCH) {
-			long this_scan = SHRINK_BATCH;
-			int shrink_ret;
-			int nr_before;
-
-			nr_before = do_shrinker_shrink(shrinker, shrink, 0);
-			shrink_ret = do_shrinker_shrink(shrinker, shrink,
-							this_scan);
-			if (shrink_ret == -1)
-				break;
-			if (shrink_ret < nr_before)
-				ret += nr_before - shrink_ret;
-			count_vm_events(SLABS_SCANNED, this_scan);
-			total_scan -= this_scan;
+		/*
+		 * Expensive shrinkers don't hold up direct reclaimers: their
+		 * work is only accounted here, and carried out by kswapd,
+		 * which is awake whenever somebody is in direct reclaim.
+		 */
+		if (direct && (shrinker->flags & SHRINKER_ASYNC)) {
+			if (total_scan >= SHRINK_BATCH)
+				atomic_long_inc(&shrinker->stats.deferred);
+			shrinker->nr += total_scan;
+			continue;
+		}
 
-			cond_resched();
+		if (direct) {
+			/* ...unless the alternative is killing a task */
+			if (shrinker->flags & SHRINKER_LAST_RESORT)
+				ret += shrink_slab_deferred(shrink);
+			deadline = shrinker_deadline(shrinker);
 		}
 
+		ret += shrinker_run_batches(shrinker, shrink, &total_scan,
+					    direct, deadline);
 		shrinker->nr += total_scan;
 	}
 	up_read(&shrinker_rwsem);
@@ -300,6 +428,84 @@ out:
 	return ret;
 }
 
+#ifdef CONFIG_DEBUG_FS
+static int shrinker_stats_show(struct seq_file *m, void *v)
+{
+	static const char *const buckets[SHRINKER_LATENCY_BUCKETS] = {
+		"<10us", "<100us", "<1ms", "<10ms", "<100ms", ">=100ms",
+	};
+	struct shrinker *shrinker;
+	int i;
+
+	seq_printf(m, "%-40s %5s %9s %9s %11s %11s %8s %8s %10s %10s",
+		   "shrinker", "async", "pending", "calls", "scanned",
+		   "freed", "deferred", "overrun", "avg_us", "max_us");
+	for (i = 0; i < SHRINKER_LATENCY_BUCKETS; i++)
+		seq_printf(m, " %9s", buckets[i]);
+	seq_putc(m, '\n');
+
+	down_read(&shrinker_rwsem);
+	list_for_each_entry(shrinker, &shrinker_list, list) {
+		struct shrinker_stats *stats = &shrinker->stats;
+		unsigned long calls = atomic_long_read(&stats->calls);
+		u64 avg_ns = atomic64_read(&stats->time_ns);
+
+		if (calls)
+			do_div(avg_ns, calls);
+		seq_printf(m, "%-40pF %5d %9ld %9lu %11lu %11lu %8lu %8lu "
+			   "%10llu %10llu",
+			   shrinker->shrink,
+			   !!(shrinker->flags & SHRINKER_ASYNC),
+			   shrinker->nr, calls,
+			   atomic_long_read(&stats->scanned),
+			   atomic_long_read(&stats->freed),
+			   atomic_long_read(&stats->deferred),
+			   atomic_long_read(&stats->over_budget),
+			   div_u64(avg_ns, NSEC_PER_USEC),
+			   div_u64(atomic64_read(&stats->max_ns),
+				   NSEC_PER_USEC));
+		for (i = 0; i < SHRINKER_LATENCY_BUCKETS; i++)
+			seq_printf(m, " %9lu",
+				   atomic_long_read(&stats->latency[i]));
+		seq_putc(m, '\n');
+	}
+	up_read(&shrinker_rwsem);
+
+	return 0;
+}
+
+static int shrinker_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, shrinker_stats_show, NULL);
+}
+
+static const struct file_operations shrinker_stats_fops = {
+	.open		= shrinker_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init shrinker_debug_init(void)
+{
+	struct dentry *root;
+
+	root = debugfs_create_dir("shrinker", NULL);
+	if (!root)
+		return -ENOMEM;
+
+	if (!debugfs_create_file("stats", 0444, root, NULL,
+				 &shrinker_stats_fops))
+		return -ENOMEM;
+
+	if (!debugfs_create_u32("budget_us", 0644, root, &shrinker_budget_us))
+		return -ENOMEM;
+
+	return 0;
+}
+late_initcall(shrinker_debug_init);
+#endif /* CONFIG_DEBUG_FS */
+
 static void set_reclaim_mode(int priority, struct scan_control *sc,
 				   bool sync)
 {
@@ -481,7 +687,8 @@ static pageout_t pageout(struct page *page, struct address_space *mapping,
  * Same as remove_mapping, but if the page is removed from the mapping, it
  * gets returned with a refcount of 0.
  */
-static int __remove_mapping(struct address_space *mapping, struct page *page)
+static int __remove_mapping(struct address_space *mapping, struct page *page,
+			    bool reclaimed)
 {
 	BUG_ON(!PageLocked(page));
 	BUG_ON(mapping != page_mapping(page));
@@ -527,10 +734,20 @@ static int __remove_mapping(struct address_space *mapping, struct page *page)
 		swapcache_free(swap, page);
 	} else {
 		void (*freepage)(struct page *);
+		void *shadow = NULL;
 
 		freepage = mapping->a_ops->freepage;
 
-		__delete_from_page_cache(page);
+		/*
+		 * Remember a shadow entry for reclaimed file cache in
+		 * order to detect refaults, thus thrashing, later on.
+		 * Only inode mappings are torn down through
+		 * end_writeback(), which releases leftover shadows.
+		 */
+		if (reclaimed && page_is_file_cache(page) && mapping->host &&
+		    mapping == &mapping->host->i_data)
+			shadow = workingset_eviction(mapping, page);
+		__delete_from_page_cache(page, shadow);
 		spin_unlock_irq(&mapping->tree_lock);
 		mem_cgroup_uncharge_cache_page(page);
 
@@ -553,7 +770,7 @@ cannot_free:
  */
 int remove_mapping(struct address_space *mapping, struct page *page)
 {
-	if (__remove_mapping(mapping, page)) {
+	if (__remove_mapping(mapping, page, false)) {
 		/*
 		 * Unfreezing the refcount with 1 rather than 2 effectively
 		 * drops the pagecache ref for us without requiring another
@@ -901,7 +1118,7 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			}
 		}
 
-		if (!mapping || !__remove_mapping(mapping, page))
+		if (!mapping || !__remove_mapping(mapping, page, true))
 			goto keep_locked;
 
 		/*
@@ -0,0 +1,281 @@
+/*
+ *  linux/mm/workingset.c
+ *
+ *  Workingset detection
+ *
+ *  When a file page is reclaimed from the inactive list, a "shadow"
+ *  entry is left behind in its slot of the page cache radix tree.  The
+ *  shadow records the zone the page lived in and a snapshot of that
+ *  zone's eviction clock (zone->inactive_age), which ticks on every
+ *  inactive list eviction and on every activation.
+ *
+ *  When the page is faulted back in, the difference between the
+ *  current clock and the snapshot is the refault distance: the number
+ *  of inactive list slots the page would have needed beyond what it got
+ *  in order to stay resident.  If that distance is smaller than the
+ *  active file list, the page could have stayed in memory had the
+ *  inactive list been given the room the active list currently has, so
+ *  it is activated right away instead of being thrashed through the
+ *  inactive list once more.  Streaming IO, which never refaults within
+ *  that distance, keeps being aged out of the inactive list as before.
+ *
+ *  Shadow entries are bounded by a shrinker that drops the ones that
+ *  have grown too old to ever cause an activation.
+ */
+
+#include <linux/mm.h>
+#include <linux/mmzone.h>
+#include <linux/swap.h>
+#include <linux/fs.h>
+#include <linux/pagemap.h>
+#include <linux/pagevec.h>
+#include <linux/radix-tree.h>
+#include <linux/spinlock.h>
+#include <linux/vmstat.h>
+#include <linux/init.h>
+
+/*
+ * Eviction timestamps need to fit into the shadow entry next to the
+ * radix tree exceptional bits, the node and the zone index.
+ */
+#define EVICTION_SHIFT	(RADIX_TREE_EXCEPTIONAL_SHIFT + \
+			 NODES_SHIFT + ZONES_SHIFT)
+#define EVICTION_MASK	(~0UL >> EVICTION_SHIFT)
+
+/*
+ * Mappings that currently hold shadow entries, oldest first, so the
+ * shrinker can find stale shadows without walking every inode.
+ * Lock order: mapping->tree_lock -> shadow_lock.
+ */
+static DEFINE_SPINLOCK(shadow_lock);
+static LIST_HEAD(shadow_mappings);
+static atomic_long_t nr_shadow_entries = ATOMIC_LONG_INIT(0);
+
+static void *pack_shadow(unsigned long eviction, struct zone *zone)
+{
+	eviction = (eviction << NODES_SHIFT) | zone_to_nid(zone);
+	eviction = (eviction << ZONES_SHIFT) | zone_idx(zone);
+	eviction = (eviction << RADIX_TREE_EXCEPTIONAL_SHIFT);
+
+	return (void *)(eviction | RADIX_TREE_EXCEPTIONAL_ENTRY);
+}
+
+static void unpack_shadow(void *shadow, struct zone **zone,
+			  unsigned long *distance)
+{
+	unsigned long entry = (unsigned long)shadow;
+	unsigned long eviction;
+	unsigned long refault;
+	int zid, nid;
+
+	entry >>= RADIX_TREE_EXCEPTIONAL_SHIFT;
+	zid = entry & ((1UL << ZONES_SHIFT) - 1);
+	entry >>= ZONES_SHIFT;
+	nid = entry & ((1UL << NODES_SHIFT) - 1);
+	entry >>= NODES_SHIFT;
+	eviction = entry;
+
+	*zone = NODE_DATA(nid)->node_zones + zid;
+
+	refault = atomic_long_read(&(*zone)->inactive_age);
+	/*
+	 * The unsigned subtraction here gives an accurate distance
+	 * across inactive_age overflows in most cases.
+	 */
+	*distance = (refault - eviction) & EVICTION_MASK;
+}
+
+/*
+ * Is the shadow too old to ever activate the page on refault?
+ */
+static bool shadow_is_stale(void *shadow)
+{
+	unsigned long distance;
+	struct zone *zone;
+
+	unpack_shadow(shadow, &zone, &distance);
+	return distance > zone_page_state(zone, NR_ACTIVE_FILE);
+}
+
+/**
+ * workingset_eviction - note the eviction of a page from memory
+ * @mapping: address space the page was backing
+ * @page: the page being evicted
+ *
+ * Returns a shadow entry to be stored in @mapping->page_tree in place
+ * of the evicted @page so that a later refault can be detected.
+ */
+void *workingset_eviction(struct address_space *mapping, struct page *page)
+{
+	struct zone *zone = page_zone(page);
+	unsigned long eviction;
+
+	eviction = atomic_long_inc_return(&zone->inactive_age);
+	return pack_shadow(eviction, zone);
+}
+
+/**
+ * workingset_refault - evaluate the refault of a previously evicted page
+ * @shadow: shadow entry of the evicted page
+ *
+ * Calculates and evaluates the refault distance of the previously
+ * evicted page in the context of the zone it was allocated in.
+ *
+ * Returns %true if the page should be activated, %false otherwise.
+ */
+bool workingset_refault(void *shadow)
+{
+	unsigned long refault_distance;
+	struct zone *zone;
+
+	unpack_shadow(shadow, &zone, &refault_distance);
+	inc_zone_state(zone, WORKINGSET_REFAULT);
+
+	if (refault_distance <= zone_page_state(zone, NR_ACTIVE_FILE)) {
+		inc_zone_state(zone, WORKINGSET_ACTIVATE);
+		return true;
+	}
+	return false;
+}
+
+/**
+ * workingset_activation - note a page activation
+ * @page: page that is being activated
+ */
+void workingset_activation(struct page *page)
+{
+	atomic_long_inc(&page_zone(page)->inactive_age);
+}
+
+/*
+ * Shadow entry accounting.  The caller holds @mapping->tree_lock and
+ * has just added (@nr > 0) or removed (@nr < 0) shadow entries.
+ */
+static void __workingset_shadows_changed(struct address_space *mapping,
+					 long nr)
+{
+	unsigned long old = mapping->nrshadows;
+
+	mapping->nrshadows += nr;
+	atomic_long_add(nr, &nr_shadow_entries);
+	if (!old && mapping->nrshadows)
+		list_add_tail(&mapping->shadow_list, &shadow_mappings);
+	else if (old && !mapping->nrshadows)
+		list_del_init(&mapping->shadow_list);
+}
+
+void workingset_shadows_changed(struct address_space *mapping, long nr)
+{
+	unsigned long old = mapping->nrshadows;
+
+	/* Only the first and the last shadow move the mapping on the list */
+	if (!old || old + nr == 0) {
+		spin_lock(&shadow_lock);
+		__workingset_shadows_changed(mapping, nr);
+		spin_unlock(&shadow_lock);
+	} else {
+		mapping->nrshadows += nr;
+		atomic_long_add(nr, &nr_shadow_entries);
+	}
+}
+
+/*
+ * Drop stale shadow entries from the start of @mapping, looking at no
+ * more than @nr_to_scan of them.  Called with both the shadow_lock and
+ * @mapping->tree_lock held.  Returns the number of entries scanned.
+ */
+static unsigned long prune_mapping_shadows(struct address_space *mapping,
+					   unsigned long nr_to_scan)
+{
+	unsigned long indices[PAGEVEC_SIZE];
+	unsigned long stale[PAGEVEC_SIZE];
+	void **slots[PAGEVEC_SIZE];
+	unsigned long index = 0;
+	unsigned long scanned = 0;
+	long nr_pruned = 0;
+
+	while (scanned < nr_to_scan) {
+		unsigned int nr_found, nr_stale = 0;
+		unsigned int i;
+
+		nr_found = radix_tree_gang_lookup_slot(&mapping->page_tree,
+				slots, indices, index, PAGEVEC_SIZE);
+		if (!nr_found)
+			break;
+		/*
+		 * Deleting entries can free nodes holding the other slots,
+		 * so collect the stale indices before touching the tree.
+		 */
+		for (i = 0; i < nr_found; i++) {
+			void *entry = radix_tree_deref_slot_protected(slots[i],
+							&mapping->tree_lock);
+
+			if (radix_tree_exceptional_entry(entry) &&
+			    shadow_is_stale(entry))
+				stale[nr_stale++] = indices[i];
+		}
+		index = indices[nr_found - 1] + 1;
+		scanned += nr_found;
+		for (i = 0; i < nr_stale; i++)
+			radix_tree_delete(&mapping->page_tree, stale[i]);
+		nr_pruned += nr_stale;
+		if (nr_found < PAGEVEC_SIZE || !index)
+			break;
+	}
+	if (nr_pruned)
+		__workingset_shadows_changed(mapping, -nr_pruned);
+	return scanned;
+}
+
+static int shrink_shadows(struct shrinker *shrink, struct shrink_control *sc)
+{
+	unsigned long nr_to_scan = sc->nr_to_scan;
+	long nr_shadows, budget;
+
+	if (nr_to_scan) {
+		struct address_space *mapping;
+		int busy = 0;
+
+		spin_lock_irq(&shadow_lock);
+		while (nr_to_scan && !list_empty(&shadow_mappings)) {
+			unsigned long scanned;
+
+			mapping = list_first_entry(&shadow_mappings,
+					struct address_space, shadow_list);
+			list_move_tail(&mapping->shadow_list, &shadow_mappings);
+			/* Lock order is inverted, so we can only trylock */
+			if (!spin_trylock(&mapping->tree_lock)) {
+				if (++busy > 4)
+					break;
+				continue;
+			}
+			scanned = prune_mapping_shadows(mapping, nr_to_scan);
+			spin_unlock(&mapping->tree_lock);
+			nr_to_scan -= min(scanned, nr_to_scan);
+		}
+		spin_unlock_irq(&shadow_lock);
+	}
+
+	/*
+	 * A shadow can only cause an activation if its refault distance
+	 * is within the active file list, so there is no point in keeping
+	 * many more of them around than there are active file pages.
+	 */
+	nr_shadows = atomic_long_read(&nr_shadow_entries);
+	budget = global_page_state(NR_ACTIVE_FILE);
+	if (nr_shadows <= budget)
+		return 0;
+	return min_t(long, nr_shadows - budget, INT_MAX);
+}
+
+static struct shrinker workingset_shadow_shrinker = {
+	.shrink = shrink_shadows,
+	.seeks = DEFAULT_SEEKS,
+};
+
+static int __init workingset_init(void)
+{
+	register_shrinker(&workingset_shadow_shrinker);
+	return 0;
+}
+module_init(workingset_init);
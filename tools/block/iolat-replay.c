@@ -0,0 +1,391 @@
+/* $(CROSS_COMPILE)cc -Wall -Wextra -O2 -lpthread -o iolat-replay iolat-replay.c */
+
+/*
+ * iolat-replay: read latency under write load
+ *
+ * Issues reads against a block device or file, either replayed from a
+ * trace with their original timing or generated at a fixed rate, while
+ * writer threads keep a write load going on a scratch file.  When the
+ * run is over, the read latency distribution is printed as percentiles,
+ * which is what an I/O scheduler has to keep low while the writes are
+ * going on.
+ *
+ * The trace is plain text, one request per line:
+ *
+ *	<usecs since start> <R|W> <byte offset> <bytes>
+ *
+ * W lines are written back to the read target, so only use them on a
+ * scratch device.  blkparse output converts with something like
+ *
+ *	blkparse -i trace -f "%T %t %a %d %S %N\n" | awk '$3 == "Q" \
+ *		{ printf "%d %s %d %d\n", $1 * 1000000 + $2 / 1000, \
+ *		  substr($4, 1, 1), $5 * 512, $6 }'
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#define ALIGN_BYTES	4096
+
+struct trace_op {
+	uint64_t usec;
+	uint64_t offset;
+	uint32_t len;
+	int write;
+};
+
+static const char *read_path, *write_path, *trace_path;
+static int duration = 30;
+static int read_bs = 4096;
+static int read_rate;			/* reads per second, 0: back to back */
+static int nr_writers = 1;
+static int write_bs = 512 * 1024;
+static int write_burst = 64;		/* writes between syncs */
+static int write_mode;			/* 0 buffered, 1 O_DIRECT, 2 fsync */
+static uint64_t write_size = 256ULL << 20;
+
+static volatile int stop, measuring;
+
+static uint32_t *lat;			/* read latencies, usecs */
+static size_t nr_lat, max_lat;
+static uint64_t nr_writes;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleep_until(uint64_t usec)
+{
+	uint64_t now = now_usec();
+	struct timespec ts;
+
+	if (usec <= now)
+		return;
+	usec -= now;
+	ts.tv_sec = usec / 1000000;
+	ts.tv_nsec = (usec % 1000000) * 1000;
+	nanosleep(&ts, NULL);
+}
+
+static void *alloc_buf(size_t len)
+{
+	void *buf;
+
+	if (posix_memalign(&buf, ALIGN_BYTES, len)) {
+		perror("posix_memalign");
+		exit(1);
+	}
+	memset(buf, 0x5a, len);
+	return buf;
+}
+
+static void record_latency(uint64_t usec)
+{
+	if (nr_lat == max_lat) {
+		max_lat = max_lat ? max_lat * 2 : 65536;
+		lat = realloc(lat, max_lat * sizeof(*lat));
+		if (!lat) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	lat[nr_lat++] = usec > UINT32_MAX ? UINT32_MAX : usec;
+}
+
+static uint64_t target_size(int fd)
+{
+	struct stat st;
+	uint64_t size;
+
+	if (fstat(fd, &st)) {
+		perror("fstat");
+		exit(1);
+	}
+	if (S_ISBLK(st.st_mode)) {
+		if (ioctl(fd, BLKGETSIZE64, &size)) {
+			perror("BLKGETSIZE64");
+			exit(1);
+		}
+		return size;
+	}
+	return st.st_size;
+}
+
+static struct trace_op *load_trace(const char *path, size_t *nr)
+{
+	struct trace_op *ops = NULL;
+	size_t n = 0, max = 0;
+	char line[256], rw;
+	unsigned long long usec, offset;
+	unsigned int len;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%llu %c %llu %u", &usec, &rw, &offset,
+			   &len) != 4)
+			continue;
+		if (n == max) {
+			max = max ? max * 2 : 4096;
+			ops = realloc(ops, max * sizeof(*ops));
+			if (!ops) {
+				perror("realloc");
+				exit(1);
+			}
+		}
+		/* O_DIRECT wants aligned requests */
+		ops[n].usec = usec;
+		ops[n].offset = offset & ~(uint64_t)(ALIGN_BYTES - 1);
+		ops[n].len = (len + ALIGN_BYTES - 1) & ~(ALIGN_BYTES - 1);
+		ops[n].write = rw == 'W' || rw == 'w';
+		n++;
+	}
+	fclose(f);
+	*nr = n;
+	return ops;
+}
+
+static void *writer_fn(void *arg)
+{
+	int id = (long)arg, fd, flags = O_WRONLY | O_CREAT;
+	uint64_t slice = write_size / nr_writers, off = 0, n = 0, burst = 0;
+	char *buf = alloc_buf(write_bs);
+
+	if (write_mode == 1)
+		flags |= O_DIRECT;
+	fd = open(write_path, flags, 0644);
+	if (fd < 0) {
+		perror(write_path);
+		exit(1);
+	}
+
+	while (!stop) {
+		if (pwrite(fd, buf, write_bs, id * slice + off) != write_bs) {
+			perror("pwrite");
+			exit(1);
+		}
+		off += write_bs;
+		if (off + write_bs > slice)
+			off = 0;
+		if (measuring)
+			n++;
+		if (++burst % write_burst == 0 && write_mode == 2)
+			fsync(fd);
+	}
+	close(fd);
+
+	pthread_mutex_lock(&stats_lock);
+	nr_writes += n;
+	pthread_mutex_unlock(&stats_lock);
+	free(buf);
+	return NULL;
+}
+
+static void do_read(int fd, char *buf, uint64_t offset, uint32_t len)
+{
+	uint64_t start = now_usec();
+
+	if (pread(fd, buf, len, offset) < 0) {
+		perror("pread");
+		exit(1);
+	}
+	record_latency(now_usec() - start);
+}
+
+static void replay_trace(int fd, struct trace_op *ops, size_t nr)
+{
+	uint64_t start = now_usec(), end = start + duration * 1000000ULL;
+	uint32_t max_len = 0;
+	char *buf;
+	size_t i;
+
+	for (i = 0; i < nr; i++)
+		if (ops[i].len > max_len)
+			max_len = ops[i].len;
+	buf = alloc_buf(max_len);
+
+	for (i = 0; i < nr && !stop; i++) {
+		sleep_until(start + ops[i].usec);
+		if (now_usec() >= end)
+			break;
+		if (ops[i].write) {
+			if (pwrite(fd, buf, ops[i].len, ops[i].offset) < 0) {
+				perror("pwrite");
+				exit(1);
+			}
+		} else
+			do_read(fd, buf, ops[i].offset, ops[i].len);
+	}
+	free(buf);
+}
+
+static void generate_reads(int fd)
+{
+	uint64_t blocks = target_size(fd) / read_bs;
+	uint64_t start = now_usec(), end = start + duration * 1000000ULL;
+	uint64_t next = start, offset;
+	char *buf = alloc_buf(read_bs);
+
+	if (!blocks) {
+		fprintf(stderr, "%s is too small\n", read_path);
+		exit(1);
+	}
+	srandom(start);
+
+	while (now_usec() < end) {
+		offset = ((uint64_t)random() << 31 | random()) % blocks;
+		do_read(fd, buf, offset * read_bs, read_bs);
+		if (read_rate) {
+			next += 1000000 / read_rate;
+			sleep_until(next);
+		}
+	}
+	free(buf);
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void report(double secs)
+{
+	static const double pct[] = { 50, 90, 99, 99.9, 99.99 };
+	uint64_t sum = 0;
+	size_t i;
+
+	if (!nr_lat) {
+		printf("no reads completed\n");
+		return;
+	}
+	qsort(lat, nr_lat, sizeof(*lat), cmp_u32);
+	for (i = 0; i < nr_lat; i++)
+		sum += lat[i];
+
+	printf("reads: %zu (%.0f/s), writes: %llu x %d bytes (%.1f MB/s)\n",
+	       nr_lat, nr_lat / secs, (unsigned long long)nr_writes, write_bs,
+	       nr_writes * (double)write_bs / secs / (1 << 20));
+	printf("read latency (usec): min %u avg %llu max %u\n", lat[0],
+	       (unsigned long long)(sum / nr_lat), lat[nr_lat - 1]);
+	for (i = 0; i < sizeof(pct) / sizeof(pct[0]); i++)
+		printf("  %6.2fth: %u\n", pct[i],
+		       lat[(size_t)(nr_lat * pct[i] / 100)]);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] <read target>\n"
+		"  -t trace   replay reads (and writes) from trace\n"
+		"  -d secs    run time (%d)\n"
+		"  -b bytes   read size without a trace (%d)\n"
+		"  -r rate    reads per second without a trace, 0 back to back (%d)\n"
+		"  -f file    scratch file for the write load, none if not given\n"
+		"  -w nr      writer threads (%d)\n"
+		"  -W bytes   write size (%d)\n"
+		"  -z MB      scratch file size (%llu)\n"
+		"  -m mode    0 buffered, 1 O_DIRECT, 2 buffered with fsync (%d)\n"
+		"  -n nr      writes between fsyncs with -m 2 (%d)\n",
+		prog, duration, read_bs, read_rate, nr_writers, write_bs,
+		(unsigned long long)(write_size >> 20), write_mode,
+		write_burst);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct trace_op *ops = NULL;
+	pthread_t *writers = NULL;
+	size_t nr_ops = 0;
+	uint64_t start;
+	int c, fd, flags;
+	long i;
+
+	while ((c = getopt(argc, argv, "t:d:b:r:f:w:W:z:m:n:")) != -1) {
+		switch (c) {
+		case 't': trace_path = optarg; break;
+		case 'd': duration = atoi(optarg); break;
+		case 'b': read_bs = atoi(optarg); break;
+		case 'r': read_rate = atoi(optarg); break;
+		case 'f': write_path = optarg; break;
+		case 'w': nr_writers = atoi(optarg); break;
+		case 'W': write_bs = atoi(optarg); break;
+		case 'z': write_size = strtoull(optarg, NULL, 0) << 20; break;
+		case 'm': write_mode = atoi(optarg); break;
+		case 'n': write_burst = atoi(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || duration <= 0 || read_bs <= 0 ||
+	    read_bs % 512 || write_bs <= 0 || nr_writers < 0 ||
+	    write_burst <= 0 || write_mode < 0 || write_mode > 2)
+		usage(argv[0]);
+	read_path = argv[optind];
+	if (write_path && write_size / (nr_writers ? nr_writers : 1) <
+	    (uint64_t)write_bs)
+		usage(argv[0]);
+
+	if (trace_path)
+		ops = load_trace(trace_path, &nr_ops);
+
+	flags = O_DIRECT | (ops ? O_RDWR : O_RDONLY);
+	fd = open(read_path, flags);
+	if (fd < 0) {
+		perror(read_path);
+		return 1;
+	}
+
+	if (write_path && nr_writers) {
+		writers = calloc(nr_writers, sizeof(*writers));
+		for (i = 0; i < nr_writers; i++)
+			pthread_create(&writers[i], NULL, writer_fn, (void *)i);
+		/* let the writeback get going before measuring */
+		sleep(1);
+	}
+
+	measuring = 1;
+	start = now_usec();
+	if (ops)
+		replay_trace(fd, ops, nr_ops);
+	else
+		generate_reads(fd);
+	stop = 1;
+
+	for (i = 0; writers && i < nr_writers; i++)
+		pthread_join(writers[i], NULL);
+
+	report((now_usec() - start) / 1000000.0);
+
+	close(fd);
+	free(writers);
+	free(ops);
+	free(lat);
+	return 0;
+}
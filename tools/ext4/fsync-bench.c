@@ -0,0 +1,315 @@
+/* $(CROSS_COMPILE)cc -Wall -Wextra -O2 -lpthread -o fsync-bench fsync-bench.c */
+
+/*
+ * fsync-bench: fsync latency of the write patterns of sqlite
+ *
+ * Each thread works on a database file of its own in the directory given
+ * and runs -n transactions of -p pages of -s bytes each, in one of the
+ * ways sqlite commits them:
+ *
+ *	wal		append the pages and a commit record to a write ahead
+ *			log, fdatasync it (journal_mode=WAL, synchronous=FULL)
+ *	delete		write the old pages to a rollback journal, fsync it,
+ *			overwrite them in the database, fsync it and delete
+ *			the journal (journal_mode=DELETE, the default)
+ *	truncate	the same, but truncate the journal instead of deleting
+ *			it (journal_mode=TRUNCATE)
+ *	overwrite	overwrite the pages in the database and fdatasync it
+ *			(journal_mode=OFF)
+ *
+ * The pages written are chosen at random among -P pages, which is the
+ * size of the database.  Prints transactions per second and the latency
+ * of a transaction, all of its writes and syncs included.  Run it with
+ * and without fast commits to compare them, e.g.
+ *
+ *	mount -o remount,fast_commit /data
+ *	fsync-bench -t 4 -m wal /data/local/tmp
+ *	cat /proc/fs/ext4/<dev>/fc_info
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+enum {
+	M_WAL,
+	M_DELETE,
+	M_TRUNCATE,
+	M_OVERWRITE,
+	NR_MODES,
+};
+
+static const char * const mode_names[NR_MODES] = {
+	"wal", "delete", "truncate", "overwrite",
+};
+
+struct job {
+	pthread_t thread;
+	int id;
+	uint64_t *lat;			/* usec per transaction */
+};
+
+static const char *dir;
+static int mode = M_WAL;
+static int nr_jobs = 1;
+static int nr_trans = 1000;
+static size_t page_size = 4096;
+static int trans_pages = 2;
+static int db_pages = 1024;
+
+static uint64_t now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static void *alloc_buf(size_t len)
+{
+	void *buf;
+
+	if (posix_memalign(&buf, 4096, len))
+		die("posix_memalign");
+	memset(buf, 0x5a, len);
+	return buf;
+}
+
+static void pwrite_all(int fd, const void *buf, size_t len, off_t off)
+{
+	if (pwrite(fd, buf, len, off) != (ssize_t)len)
+		die("pwrite");
+}
+
+static int open_db(struct job *j, char *buf)
+{
+	char path[PATH_MAX];
+	int fd, i;
+
+	snprintf(path, sizeof(path), "%s/fsync-bench.%d.db", dir, j->id);
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		die(path);
+	for (i = 0; i < db_pages; i++)
+		pwrite_all(fd, buf, page_size, (off_t)i * page_size);
+	if (fsync(fd))
+		die("fsync");
+	return fd;
+}
+
+/* One transaction, returns the new end of the wal */
+static off_t transaction(struct job *j, int db, int wal, off_t wal_end,
+			 char *buf, unsigned int *seed)
+{
+	char path[PATH_MAX];
+	int i, fd, page;
+
+	switch (mode) {
+	case M_WAL:
+		for (i = 0; i < trans_pages; i++) {
+			buf[0] = rand_r(seed);
+			pwrite_all(wal, buf, page_size, wal_end);
+			wal_end += page_size;
+		}
+		/* the commit record, a frame header in sqlite */
+		pwrite_all(wal, buf, 24, wal_end);
+		wal_end += 24;
+		if (fdatasync(wal))
+			die("fdatasync");
+		break;
+	case M_DELETE:
+	case M_TRUNCATE:
+		snprintf(path, sizeof(path), "%s/fsync-bench.%d.db-journal",
+			 dir, j->id);
+		fd = open(path, O_WRONLY | O_CREAT, 0644);
+		if (fd < 0)
+			die(path);
+		/* the journal header, then the original pages */
+		pwrite_all(fd, buf, 512, 0);
+		for (i = 0; i < trans_pages; i++)
+			pwrite_all(fd, buf, page_size,
+				   512 + (off_t)i * (page_size + 8));
+		if (fsync(fd))
+			die("fsync");
+		for (i = 0; i < trans_pages; i++) {
+			page = rand_r(seed) % db_pages;
+			pwrite_all(db, buf, page_size, (off_t)page * page_size);
+		}
+		if (fsync(db))
+			die("fsync");
+		if (mode == M_DELETE) {
+			close(fd);
+			if (unlink(path))
+				die(path);
+		} else {
+			if (ftruncate(fd, 0))
+				die("ftruncate");
+			if (fsync(fd))
+				die("fsync");
+			close(fd);
+		}
+		break;
+	case M_OVERWRITE:
+		for (i = 0; i < trans_pages; i++) {
+			page = rand_r(seed) % db_pages;
+			pwrite_all(db, buf, page_size, (off_t)page * page_size);
+		}
+		if (fdatasync(db))
+			die("fdatasync");
+		break;
+	}
+	return wal_end;
+}
+
+static void *job_fn(void *arg)
+{
+	struct job *j = arg;
+	char *buf = alloc_buf(page_size);
+	char path[PATH_MAX];
+	unsigned int seed = j->id + 1;
+	off_t wal_end = 0;
+	uint64_t start;
+	int db, wal = -1, i;
+
+	db = open_db(j, buf);
+	if (mode == M_WAL) {
+		snprintf(path, sizeof(path), "%s/fsync-bench.%d.db-wal", dir,
+			 j->id);
+		wal = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (wal < 0)
+			die(path);
+		/* the wal header, written when the database is opened */
+		pwrite_all(wal, buf, 32, 0);
+		if (fsync(wal))
+			die("fsync");
+		wal_end = 32;
+	}
+
+	for (i = 0; i < nr_trans; i++) {
+		start = now_usec();
+		wal_end = transaction(j, db, wal, wal_end, buf, &seed);
+		j->lat[i] = now_usec() - start;
+	}
+
+	close(db);
+	snprintf(path, sizeof(path), "%s/fsync-bench.%d.db", dir, j->id);
+	unlink(path);
+	if (wal >= 0) {
+		close(wal);
+		snprintf(path, sizeof(path), "%s/fsync-bench.%d.db-wal", dir,
+			 j->id);
+		unlink(path);
+	}
+	snprintf(path, sizeof(path), "%s/fsync-bench.%d.db-journal", dir,
+		 j->id);
+	unlink(path);
+	free(buf);
+	return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] <dir>\n"
+		"  -m mode    wal, delete, truncate or overwrite (%s)\n"
+		"  -t nr      threads, each with a database of its own (%d)\n"
+		"  -n nr      transactions per thread (%d)\n"
+		"  -s bytes   page size (%zu)\n"
+		"  -p nr      pages written per transaction (%d)\n"
+		"  -P nr      pages in the database (%d)\n",
+		prog, mode_names[mode], nr_jobs, nr_trans, page_size,
+		trans_pages, db_pages);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct job *jobs;
+	uint64_t *lat, start, elapsed, sum = 0;
+	size_t nr, i;
+	int c, m;
+
+	while ((c = getopt(argc, argv, "m:t:n:s:p:P:")) != -1) {
+		switch (c) {
+		case 'm':
+			for (m = 0; m < NR_MODES; m++)
+				if (!strcmp(optarg, mode_names[m]))
+					break;
+			if (m == NR_MODES)
+				usage(argv[0]);
+			mode = m;
+			break;
+		case 't': nr_jobs = atoi(optarg); break;
+		case 'n': nr_trans = atoi(optarg); break;
+		case 's': page_size = strtoul(optarg, NULL, 0); break;
+		case 'p': trans_pages = atoi(optarg); break;
+		case 'P': db_pages = atoi(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || nr_jobs < 1 || nr_trans < 1 ||
+	    page_size < 512 || trans_pages < 1 || db_pages < trans_pages)
+		usage(argv[0]);
+	dir = argv[optind];
+
+	nr = (size_t)nr_jobs * nr_trans;
+	jobs = calloc(nr_jobs, sizeof(*jobs));
+	lat = calloc(nr, sizeof(*lat));
+	if (!jobs || !lat)
+		die("calloc");
+
+	start = now_usec();
+	for (c = 0; c < nr_jobs; c++) {
+		jobs[c].id = c;
+		jobs[c].lat = lat + (size_t)c * nr_trans;
+		if (pthread_create(&jobs[c].thread, NULL, job_fn, &jobs[c]))
+			die("pthread_create");
+	}
+	for (c = 0; c < nr_jobs; c++)
+		pthread_join(jobs[c].thread, NULL);
+	elapsed = now_usec() - start;
+
+	qsort(lat, nr, sizeof(*lat), cmp_u64);
+	for (i = 0; i < nr; i++)
+		sum += lat[i];
+
+	printf("%-10s %8s %10s %10s %10s %10s %10s\n", "mode", "threads",
+	       "trans/s", "avg us", "p50 us", "p99 us", "max us");
+	printf("%-10s %8d %10.1f %10llu %10llu %10llu %10llu\n",
+	       mode_names[mode], nr_jobs, nr / (elapsed / 1000000.0),
+	       (unsigned long long)(sum / nr),
+	       (unsigned long long)lat[nr / 2],
+	       (unsigned long long)lat[nr * 99 / 100],
+	       (unsigned long long)lat[nr - 1]);
+
+	free(lat);
+	free(jobs);
+	return 0;
+}
@@ -0,0 +1,326 @@
+/* $(CROSS_COMPILE)cc -Wall -Wextra -O2 -lpthread -o fuse-bench fuse-bench.c */
+
+/*
+ * fuse-bench: file throughput of a FUSE mount against its backing fs
+ *
+ * Runs the same tests in each directory given and prints one line per
+ * directory, the later ones also relative to the first.  Give the
+ * backing directory first and the FUSE mount mirroring it second, e.g.
+ * with fuse-loopback:
+ *
+ *	fuse-loopback -t 4 -c -p 256 -s /data/media /mnt/loop &
+ *	fuse-bench -j 4 /data/media /mnt/loop
+ *
+ * The tests, each with -j threads working on files of their own:
+ *
+ *	seq write	write a file of -S MB in -b sized writes, then fsync
+ *	seq read	read it back through a freshly opened file
+ *	create		create small files of -z bytes
+ *	stat		stat them
+ *	read		open and read them
+ *	unlink		remove them
+ *
+ * By default the reads are served from the page cache of the backing fs,
+ * which shows what the FUSE transport costs on top of it.  With -d the
+ * caches are dropped before each read test (needs root), which compares
+ * both against the storage.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+enum {
+	T_SEQ_WRITE,
+	T_SEQ_READ,
+	T_CREATE,
+	T_STAT,
+	T_READ,
+	T_UNLINK,
+	NR_TESTS,
+};
+
+static const char * const test_names[NR_TESTS] = {
+	"seq write", "seq read", "create", "stat", "read", "unlink",
+};
+
+/* seq tests report MB/s, the small file ones operations per second */
+static const int test_is_mb[NR_TESTS] = { 1, 1, 0, 0, 0, 0 };
+
+struct job {
+	pthread_t thread;
+	const char *dir;
+	int id;
+	int test;
+	double amount;			/* MB or operations done */
+};
+
+static int nr_jobs = 1;
+static uint64_t seq_size = 256ULL << 20;
+static size_t block_size = 1 << 20;
+static int nr_files = 2000;
+static size_t file_size = 4096;
+static int drop_caches;
+
+static uint64_t now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static void *alloc_buf(size_t len)
+{
+	void *buf;
+
+	if (posix_memalign(&buf, 4096, len))
+		die("posix_memalign");
+	memset(buf, 0x5a, len);
+	return buf;
+}
+
+static void do_drop_caches(void)
+{
+	int fd;
+
+	sync();
+	fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+	if (fd < 0 || write(fd, "3", 1) != 1)
+		die("drop_caches");
+	close(fd);
+}
+
+static void seq_write(struct job *j, char *buf)
+{
+	char path[PATH_MAX];
+	uint64_t done;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/fuse-bench.%d", j->dir, j->id);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		die(path);
+	for (done = 0; done < seq_size; done += block_size)
+		if (write(fd, buf, block_size) != (ssize_t)block_size)
+			die("write");
+	if (fsync(fd))
+		die("fsync");
+	close(fd);
+	j->amount = done / (double)(1 << 20);
+}
+
+static void seq_read(struct job *j, char *buf)
+{
+	char path[PATH_MAX];
+	uint64_t done = 0;
+	ssize_t res;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/fuse-bench.%d", j->dir, j->id);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		die(path);
+	while ((res = read(fd, buf, block_size)) > 0)
+		done += res;
+	if (res < 0)
+		die("read");
+	close(fd);
+	unlink(path);
+	j->amount = done / (double)(1 << 20);
+}
+
+static void small_files(struct job *j, char *buf)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	int i, fd;
+
+	for (i = 0; i < nr_files; i++) {
+		snprintf(path, sizeof(path), "%s/fuse-bench.d%d/%d", j->dir,
+			 j->id, i);
+		switch (j->test) {
+		case T_CREATE:
+			fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			if (fd < 0)
+				die(path);
+			if (write(fd, buf, file_size) != (ssize_t)file_size)
+				die("write");
+			close(fd);
+			break;
+		case T_STAT:
+			if (stat(path, &st))
+				die(path);
+			break;
+		case T_READ:
+			fd = open(path, O_RDONLY);
+			if (fd < 0)
+				die(path);
+			if (read(fd, buf, file_size) < 0)
+				die("read");
+			close(fd);
+			break;
+		case T_UNLINK:
+			if (unlink(path))
+				die(path);
+			break;
+		}
+	}
+	j->amount = nr_files;
+}
+
+static void *job_fn(void *arg)
+{
+	struct job *j = arg;
+	char *buf = alloc_buf(block_size > file_size ? block_size : file_size);
+
+	switch (j->test) {
+	case T_SEQ_WRITE:
+		seq_write(j, buf);
+		break;
+	case T_SEQ_READ:
+		seq_read(j, buf);
+		break;
+	default:
+		small_files(j, buf);
+		break;
+	}
+	free(buf);
+	return NULL;
+}
+
+/* Run one test on all jobs, returns MB/s or ops/s over all of them */
+static double run_test(const char *dir, int test)
+{
+	struct job *jobs = calloc(nr_jobs, sizeof(*jobs));
+	double amount = 0;
+	uint64_t start;
+	int i;
+
+	if (!jobs)
+		die("calloc");
+	if (drop_caches && (test == T_SEQ_READ || test == T_STAT ||
+			    test == T_READ))
+		do_drop_caches();
+
+	start = now_usec();
+	for (i = 0; i < nr_jobs; i++) {
+		jobs[i].dir = dir;
+		jobs[i].id = i;
+		jobs[i].test = test;
+		if (pthread_create(&jobs[i].thread, NULL, job_fn, &jobs[i]))
+			die("pthread_create");
+	}
+	for (i = 0; i < nr_jobs; i++) {
+		pthread_join(jobs[i].thread, NULL);
+		amount += jobs[i].amount;
+	}
+	amount /= (now_usec() - start) / 1000000.0;
+	free(jobs);
+	return amount;
+}
+
+static void run_dir(const char *dir, double *res)
+{
+	char path[PATH_MAX];
+	int i, t;
+
+	for (i = 0; i < nr_jobs; i++) {
+		snprintf(path, sizeof(path), "%s/fuse-bench.d%d", dir, i);
+		if (mkdir(path, 0755) && errno != EEXIST)
+			die(path);
+	}
+	for (t = 0; t < NR_TESTS; t++)
+		res[t] = run_test(dir, t);
+	for (i = 0; i < nr_jobs; i++) {
+		snprintf(path, sizeof(path), "%s/fuse-bench.d%d", dir, i);
+		rmdir(path);
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] <dir> [<dir>...]\n"
+		"  -j nr      threads, each with files of its own (%d)\n"
+		"  -S MB      sequential file size per thread (%llu)\n"
+		"  -b bytes   sequential I/O size (%zu)\n"
+		"  -n nr      small files per thread (%d)\n"
+		"  -z bytes   small file size (%zu)\n"
+		"  -d         drop caches before the read tests (root only)\n",
+		prog, nr_jobs, (unsigned long long)(seq_size >> 20),
+		block_size, nr_files, file_size);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	double (*res)[NR_TESTS];
+	int c, d, t, nr_dirs;
+
+	while ((c = getopt(argc, argv, "j:S:b:n:z:d")) != -1) {
+		switch (c) {
+		case 'j': nr_jobs = atoi(optarg); break;
+		case 'S': seq_size = strtoull(optarg, NULL, 0) << 20; break;
+		case 'b': block_size = strtoul(optarg, NULL, 0); break;
+		case 'n': nr_files = atoi(optarg); break;
+		case 'z': file_size = strtoul(optarg, NULL, 0); break;
+		case 'd': drop_caches = 1; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind == argc || nr_jobs < 1 || !block_size ||
+	    seq_size < block_size || nr_files < 1 || !file_size)
+		usage(argv[0]);
+	nr_dirs = argc - optind;
+
+	res = calloc(nr_dirs, sizeof(*res));
+	if (!res)
+		die("calloc");
+
+	printf("%-24s", "");
+	for (t = 0; t < NR_TESTS; t++)
+		printf(" %12s", test_names[t]);
+	printf("\n%-24s", "");
+	for (t = 0; t < NR_TESTS; t++)
+		printf(" %12s", test_is_mb[t] ? "MB/s" : "ops/s");
+	printf("\n");
+
+	for (d = 0; d < nr_dirs; d++) {
+		const char *dir = argv[optind + d];
+
+		run_dir(dir, res[d]);
+		printf("%-24s", dir);
+		for (t = 0; t < NR_TESTS; t++)
+			printf(" %12.1f", res[d][t]);
+		printf("\n");
+		if (!d)
+			continue;
+		printf("%-24s", "");
+		for (t = 0; t < NR_TESTS; t++)
+			printf(" %11.0f%%", 100 * res[d][t] / res[0][t]);
+		printf("\n");
+	}
+	free(res);
+	return 0;
+}
@@ -0,0 +1,992 @@
+/* $(CROSS_COMPILE)cc -Wall -Wextra -O2 -lpthread -o fuse-loopback fuse-loopback.c */
+
+/*
+ * fuse-loopback: mirror a directory through FUSE
+ *
+ * A passthrough filesystem speaking the kernel protocol directly, without
+ * libfuse, so that it can use what the transport offers: a cloned device
+ * file per daemon thread (FUSE_DEV_IOC_CLONE), requests of up to 1MB
+ * (FUSE_MAX_PAGES), splice for moving file data through the device
+ * without copying it, and passthrough of file I/O to the lower files
+ * (FUSE_PASSTHROUGH), which keeps file data off the device entirely,
+ * and the writeback cache (FUSE_WRITEBACK_CACHE), which collects small
+ * writes in the page cache and sends them out in large requests.
+ * It is meant as the FUSE side of fuse-bench and as a reference for
+ * daemons such as the sdcard one, not as a complete filesystem: only
+ * regular files and directories are handled, and rename, links, xattrs
+ * and locks are not supported.
+ *
+ *	fuse-loopback -t 4 -c -p 256 -s /data/media /mnt/loop &
+ *	fuse-bench /data/media /mnt/loop
+ *	umount /mnt/loop
+ *
+ * With -P the bench compares the passthrough I/O path with the backing fs,
+ * with -w the cached write path.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/uio.h>
+
+#include "../../include/linux/fuse.h"
+
+#ifndef F_SETPIPE_SZ
+#define F_SETPIPE_SZ	1031
+#endif
+
+#define PAGE_BYTES	4096
+#define HASH_SIZE	4096
+#define ATTR_TIMEOUT	1
+
+struct node {
+	struct node *next;		/* hash chain */
+	uint64_t nlookup;
+	char path[];			/* relative to the lower dir */
+};
+
+struct dir_handle {
+	DIR *dp;
+	off_t offset;
+	struct dirent *entry;
+};
+
+struct worker {
+	pthread_t thread;
+	int id;
+	int fd;				/* device file */
+	int pipe[2];			/* splice mode only */
+	char *buf;			/* request */
+	char *out;			/* reply data */
+};
+
+static const char *lower_path, *mnt_path;
+static int lower_fd;
+static int nr_threads = 4;
+static int clone_devs;
+static int use_splice;
+static int use_passthrough;		/* asked for, then negotiated */
+static int use_writeback;		/* asked for, then negotiated */
+static int pin_threads;
+static unsigned int max_pages = 32;	/* asked for */
+static unsigned int req_pages = 32;	/* negotiated */
+static size_t buf_size;
+
+static struct node root_node = { .nlookup = 1, };
+static struct node *node_hash[HASH_SIZE];
+static pthread_mutex_t node_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int hash_path(const char *path)
+{
+	unsigned int h = 5381;
+
+	while (*path)
+		h = h * 33 + (unsigned char)*path++;
+	return h % HASH_SIZE;
+}
+
+static struct node *get_node(uint64_t nodeid)
+{
+	if (nodeid == FUSE_ROOT_ID)
+		return &root_node;
+	return (struct node *)(uintptr_t)nodeid;
+}
+
+static uint64_t node_id(struct node *node)
+{
+	if (node == &root_node)
+		return FUSE_ROOT_ID;
+	return (uintptr_t)node;
+}
+
+/* Path of a node, or of the entry name in directory node */
+static void node_path(char *buf, size_t len, uint64_t nodeid,
+		      const char *name)
+{
+	struct node *node = get_node(nodeid);
+
+	if (!name)
+		snprintf(buf, len, "%s", node == &root_node ? "." : node->path);
+	else if (node == &root_node)
+		snprintf(buf, len, "%s", name);
+	else
+		snprintf(buf, len, "%s/%s", node->path, name);
+}
+
+/* Find or add the node of a path and take a lookup reference */
+static struct node *lookup_node(const char *path)
+{
+	unsigned int h = hash_path(path);
+	struct node *node;
+
+	pthread_mutex_lock(&node_lock);
+	for (node = node_hash[h]; node; node = node->next)
+		if (!strcmp(node->path, path))
+			break;
+	if (!node) {
+		node = malloc(sizeof(*node) + strlen(path) + 1);
+		if (!node) {
+			pthread_mutex_unlock(&node_lock);
+			return NULL;
+		}
+		strcpy(node->path, path);
+		node->nlookup = 0;
+		node->next = node_hash[h];
+		node_hash[h] = node;
+	}
+	node->nlookup++;
+	pthread_mutex_unlock(&node_lock);
+	return node;
+}
+
+static void forget_node(uint64_t nodeid, uint64_t nlookup)
+{
+	struct node *node = get_node(nodeid), **pp;
+
+	if (node == &root_node)
+		return;
+
+	pthread_mutex_lock(&node_lock);
+	node->nlookup -= nlookup;
+	if (!node->nlookup) {
+		for (pp = &node_hash[hash_path(node->path)]; *pp;
+		     pp = &(*pp)->next)
+			if (*pp == node) {
+				*pp = node->next;
+				break;
+			}
+		free(node);
+	}
+	pthread_mutex_unlock(&node_lock);
+}
+
+static void fill_attr(struct fuse_attr *attr, const struct stat *st)
+{
+	memset(attr, 0, sizeof(*attr));
+	attr->ino = st->st_ino;
+	attr->size = st->st_size;
+	attr->blocks = st->st_blocks;
+	attr->atime = st->st_atim.tv_sec;
+	attr->mtime = st->st_mtim.tv_sec;
+	attr->ctime = st->st_ctim.tv_sec;
+	attr->atimensec = st->st_atim.tv_nsec;
+	attr->mtimensec = st->st_mtim.tv_nsec;
+	attr->ctimensec = st->st_ctim.tv_nsec;
+	attr->mode = st->st_mode;
+	attr->nlink = st->st_nlink;
+	attr->uid = st->st_uid;
+	attr->gid = st->st_gid;
+	attr->rdev = st->st_rdev;
+	attr->blksize = st->st_blksize;
+}
+
+static void send_reply(struct worker *w, const struct fuse_in_header *ih,
+		       int err, const void *arg, size_t len)
+{
+	struct fuse_out_header oh;
+	struct iovec iov[2];
+	int cnt = 1;
+
+	oh.unique = ih->unique;
+	oh.error = err;
+	oh.len = sizeof(oh);
+	iov[0].iov_base = &oh;
+	iov[0].iov_len = sizeof(oh);
+	if (!err && len) {
+		iov[1].iov_base = (void *)arg;
+		iov[1].iov_len = len;
+		oh.len += len;
+		cnt = 2;
+	}
+	/* ENOENT: the request was interrupted meanwhile */
+	if (writev(w->fd, iov, cnt) < 0 && errno != ENOENT)
+		perror("fuse reply");
+}
+
+static void reply_err(struct worker *w, const struct fuse_in_header *ih,
+		      int err)
+{
+	send_reply(w, ih, err, NULL, 0);
+}
+
+static int make_entry(struct fuse_entry_out *out, const char *path)
+{
+	struct stat st;
+	struct node *node;
+
+	if (fstatat(lower_fd, path, &st, AT_SYMLINK_NOFOLLOW))
+		return -errno;
+	node = lookup_node(path);
+	if (!node)
+		return -ENOMEM;
+
+	memset(out, 0, sizeof(*out));
+	out->nodeid = node_id(node);
+	out->entry_valid = ATTR_TIMEOUT;
+	out->attr_valid = ATTR_TIMEOUT;
+	fill_attr(&out->attr, &st);
+	return 0;
+}
+
+static void do_lookup(struct worker *w, struct fuse_in_header *ih,
+		      const char *name)
+{
+	struct fuse_entry_out out;
+	char path[PATH_MAX];
+	int err;
+
+	node_path(path, sizeof(path), ih->nodeid, name);
+	err = make_entry(&out, path);
+	send_reply(w, ih, err, &out, sizeof(out));
+}
+
+static void do_getattr(struct worker *w, struct fuse_in_header *ih,
+		       struct fuse_getattr_in *in)
+{
+	struct fuse_attr_out out;
+	char path[PATH_MAX];
+	struct stat st;
+	int res;
+
+	if (in->getattr_flags & FUSE_GETATTR_FH) {
+		res = fstat(in->fh, &st);
+	} else {
+		node_path(path, sizeof(path), ih->nodeid, NULL);
+		res = fstatat(lower_fd, path, &st, AT_SYMLINK_NOFOLLOW);
+	}
+	if (res) {
+		reply_err(w, ih, -errno);
+		return;
+	}
+	memset(&out, 0, sizeof(out));
+	out.attr_valid = ATTR_TIMEOUT;
+	fill_attr(&out.attr, &st);
+	send_reply(w, ih, 0, &out, sizeof(out));
+}
+
+static void do_setattr(struct worker *w, struct fuse_in_header *ih,
+		       struct fuse_setattr_in *in)
+{
+	struct fuse_getattr_in getattr = { 0 };
+	char path[PATH_MAX];
+	int res = 0;
+
+	node_path(path, sizeof(path), ih->nodeid, NULL);
+
+	if (in->valid & FATTR_MODE)
+		res = fchmodat(lower_fd, path, in->mode & 07777, 0);
+	if (!res && (in->valid & (FATTR_UID | FATTR_GID)))
+		res = fchownat(lower_fd, path,
+			       in->valid & FATTR_UID ? in->uid : (uid_t)-1,
+			       in->valid & FATTR_GID ? in->gid : (gid_t)-1,
+			       AT_SYMLINK_NOFOLLOW);
+	if (!res && (in->valid & FATTR_SIZE)) {
+		if (in->valid & FATTR_FH) {
+			res = ftruncate(in->fh, in->size);
+		} else {
+			int fd = openat(lower_fd, path, O_WRONLY);
+
+			res = fd < 0 ? -1 : ftruncate(fd, in->size);
+			if (fd >= 0)
+				close(fd);
+		}
+	}
+	if (!res && (in->valid & (FATTR_ATIME | FATTR_MTIME))) {
+		struct timespec ts[2];
+
+		ts[0].tv_sec = in->atime;
+		ts[0].tv_nsec = in->atimensec;
+		ts[1].tv_sec = in->mtime;
+		ts[1].tv_nsec = in->mtimensec;
+		if (!(in->valid & FATTR_ATIME))
+			ts[0].tv_nsec = UTIME_OMIT;
+		else if (in->valid & FATTR_ATIME_NOW)
+			ts[0].tv_nsec = UTIME_NOW;
+		if (!(in->valid & FATTR_MTIME))
+			ts[1].tv_nsec = UTIME_OMIT;
+		else if (in->valid & FATTR_MTIME_NOW)
+			ts[1].tv_nsec = UTIME_NOW;
+		res = utimensat(lower_fd, path, ts, AT_SYMLINK_NOFOLLOW);
+	}
+	if (res) {
+		reply_err(w, ih, -errno);
+		return;
+	}
+
+	if (in->valid & FATTR_FH) {
+		getattr.getattr_flags = FUSE_GETATTR_FH;
+		getattr.fh = in->fh;
+	}
+	do_getattr(w, ih, &getattr);
+}
+
+/*
+ * With the writeback cache the kernel reads pages in through files opened
+ * write-only, and writes go out with explicit offsets that O_APPEND would
+ * override
+ */
+static int lower_flags(int flags)
+{
+	if (use_writeback) {
+		if ((flags & O_ACCMODE) == O_WRONLY)
+			flags = (flags & ~O_ACCMODE) | O_RDWR;
+		flags &= ~O_APPEND;
+	}
+	return flags;
+}
+
+static void do_open(struct worker *w, struct fuse_in_header *ih,
+		    struct fuse_open_in *in)
+{
+	struct fuse_open_out out;
+	char path[PATH_MAX];
+	int fd;
+
+	node_path(path, sizeof(path), ih->nodeid, NULL);
+	fd = openat(lower_fd, path,
+		    lower_flags(in->flags & ~(O_CREAT | O_EXCL | O_NOCTTY)));
+	if (fd < 0) {
+		reply_err(w, ih, -errno);
+		return;
+	}
+	memset(&out, 0, sizeof(out));
+	out.fh = fd;
+	if (use_passthrough) {
+		out.open_flags = FOPEN_PASSTHROUGH;
+		out.passthrough_fd = fd;
+	}
+	send_reply(w, ih, 0, &out, sizeof(out));
+}
+
+static void do_create(struct worker *w, struct fuse_in_header *ih,
+		      struct fuse_create_in *in)
+{
+	struct {
+		struct fuse_entry_out entry;
+		struct fuse_open_out open;
+	} out;
+	char path[PATH_MAX];
+	int fd, err;
+
+	node_path(path, sizeof(path), ih->nodeid, (char *)(in + 1));
+	fd = openat(lower_fd, path, lower_flags(in->flags | O_CREAT), in->mode);
+	if (fd < 0) {
+		reply_err(w, ih, -errno);
+		return;
+	}
+	err = make_entry(&out.entry, path);
+	if (err) {
+		close(fd);
+		reply_err(w, ih, err);
+		return;
+	}
+	memset(&out.open, 0, sizeof(out.open));
+	out.open.fh = fd;
+	if (use_passthrough) {
+		out.open.open_flags = FOPEN_PASSTHROUGH;
+		out.open.passthrough_fd = fd;
+	}
+	send_reply(w, ih, 0, &out, sizeof(out));
+}
+
+static void do_mkdir(struct worker *w, struct fuse_in_header *ih,
+		     struct fuse_mkdir_in *in)
+{
+	struct fuse_entry_out out;
+	char path[PATH_MAX];
+	int err;
+
+	node_path(path, sizeof(path), ih->nodeid, (char *)(in + 1));
+	if (mkdirat(lower_fd, path, in->mode & ~in->umask)) {
+		reply_err(w, ih, -errno);
+		return;
+	}
+	err = make_entry(&out, path);
+	send_reply(w, ih, err, &out, sizeof(out));
+}
+
+static void do_unlink(struct worker *w, struct fuse_in_header *ih,
+		      const char *name, int flags)
+{
+	char path[PATH_MAX];
+
+	node_path(path, sizeof(path), ih->nodeid, name);
+	reply_err(w, ih, unlinkat(lower_fd, path, flags) ? -errno : 0);
+}
+
+/*
+ * Reply to READ by splicing the file into the pipe behind the reply
+ * header and the pipe into the device, so that the page cache pages of
+ * the lower file end up in the page cache of the fuse file.  Returns
+ * nonzero if the caller has to fall back to a copying reply.
+ */
+static int splice_read_reply(struct worker *w, struct fuse_in_header *ih,
+			     struct fuse_read_in *in)
+{
+	struct fuse_out_header oh;
+	loff_t off = in->offset;
+	size_t len, done = 0;
+	struct stat st;
+	ssize_t res;
+
+	if (fstat(in->fh, &st) || !S_ISREG(st.st_mode))
+		return 1;
+	if ((off_t)in->offset >= st.st_size)
+		return 1;
+	len = st.st_size - in->offset;
+	if (len > in->size)
+		len = in->size;
+
+	oh.unique = ih->unique;
+	oh.error = 0;
+	oh.len = sizeof(oh) + len;
+	if (write(w->pipe[1], &oh, sizeof(oh)) != sizeof(oh))
+		goto drain;
+	while (done < len) {
+		res = splice(in->fh, &off, w->pipe[1], NULL, len - done,
+			     SPLICE_F_MOVE);
+		if (res <= 0)
+			goto drain;
+		done += res;
+	}
+	res = splice(w->pipe[0], NULL, w->fd, NULL, oh.len, SPLICE_F_MOVE);
+	if (res < 0 && errno != ENOENT)
+		perror("fuse splice reply");
+	return 0;
+
+drain:
+	/* The file changed under us, empty the pipe and copy instead */
+	while (read(w->pipe[0], w->out, buf_size) == (ssize_t)buf_size)
+		;
+	return 1;
+}
+
+static void do_read(struct worker *w, struct fuse_in_header *ih,
+		    struct fuse_read_in *in)
+{
+	char *data = w->out;
+	ssize_t res;
+
+	if (use_splice && !splice_read_reply(w, ih, in))
+		return;
+
+	if (in->size > buf_size) {
+		reply_err(w, ih, -EINVAL);
+		return;
+	}
+	res = pread(in->fh, data, in->size, in->offset);
+	send_reply(w, ih, res < 0 ? -errno : 0, data, res < 0 ? 0 : res);
+}
+
+static void do_write(struct worker *w, struct fuse_in_header *ih,
+		     struct fuse_write_in *in, size_t spliced)
+{
+	struct fuse_write_out out;
+	loff_t off = in->offset;
+	size_t done = 0;
+	ssize_t res = 0;
+
+	if (spliced) {
+		/* Data is still in the pipe, move it into the lower file */
+		while (done < spliced) {
+			res = splice(w->pipe[0], NULL, in->fh, &off,
+				     spliced - done, SPLICE_F_MOVE);
+			if (res <= 0)
+				break;
+			done += res;
+		}
+		if (done < spliced) {
+			while (read(w->pipe[0], w->out, buf_size) ==
+			       (ssize_t)buf_size)
+				;
+		}
+	} else {
+		res = pwrite(in->fh, in + 1, in->size, in->offset);
+		if (res > 0)
+			done = res;
+	}
+	if (res < 0) {
+		reply_err(w, ih, -errno);
+		return;
+	}
+	memset(&out, 0, sizeof(out));
+	out.size = done;
+	send_reply(w, ih, 0, &out, sizeof(out));
+}
+
+static void do_opendir(struct worker *w, struct fuse_in_header *ih)
+{
+	struct fuse_open_out out;
+	struct dir_handle *d;
+	char path[PATH_MAX];
+	int fd;
+
+	node_path(path, sizeof(path), ih->nodeid, NULL);
+	d = calloc(1, sizeof(*d));
+	if (!d) {
+		reply_err(w, ih, -ENOMEM);
+		return;
+	}
+	fd = openat(lower_fd, path, O_RDONLY | O_DIRECTORY);
+	if (fd < 0 || !(d->dp = fdopendir(fd))) {
+		reply_err(w, ih, -errno);
+		if (fd >= 0)
+			close(fd);
+		free(d);
+		return;
+	}
+	memset(&out, 0, sizeof(out));
+	out.fh = (uintptr_t)d;
+	send_reply(w, ih, 0, &out, sizeof(out));
+}
+
+static void do_readdir(struct worker *w, struct fuse_in_header *ih,
+		       struct fuse_read_in *in)
+{
+	struct dir_handle *d = (struct dir_handle *)(uintptr_t)in->fh;
+	char *data = w->out;
+	size_t size = in->size, pos = 0;
+
+	if (size > buf_size)
+		size = buf_size;
+
+	if ((off_t)in->offset != d->offset) {
+		seekdir(d->dp, in->offset);
+		d->entry = NULL;
+		d->offset = in->offset;
+	}
+	for (;;) {
+		struct fuse_dirent *dirent = (struct fuse_dirent *)(data + pos);
+		size_t namelen, entsize;
+
+		if (!d->entry) {
+			d->entry = readdir(d->dp);
+			if (!d->entry)
+				break;
+		}
+		namelen = strlen(d->entry->d_name);
+		entsize = FUSE_DIRENT_ALIGN(FUSE_NAME_OFFSET + namelen);
+		if (pos + entsize > size)
+			break;
+
+		d->offset = telldir(d->dp);
+		dirent->ino = d->entry->d_ino;
+		dirent->off = d->offset;
+		dirent->namelen = namelen;
+		dirent->type = d->entry->d_type;
+		memcpy(dirent->name, d->entry->d_name, namelen);
+		memset(dirent->name + namelen, 0,
+		       entsize - FUSE_NAME_OFFSET - namelen);
+		pos += entsize;
+		d->entry = NULL;
+	}
+	send_reply(w, ih, 0, data, pos);
+}
+
+static void do_statfs(struct worker *w, struct fuse_in_header *ih)
+{
+	struct fuse_statfs_out out;
+	struct statvfs st;
+
+	if (fstatvfs(lower_fd, &st)) {
+		reply_err(w, ih, -errno);
+		return;
+	}
+	memset(&out, 0, sizeof(out));
+	out.st.blocks = st.f_blocks;
+	out.st.bfree = st.f_bfree;
+	out.st.bavail = st.f_bavail;
+	out.st.files = st.f_files;
+	out.st.ffree = st.f_ffree;
+	out.st.bsize = st.f_bsize;
+	out.st.namelen = st.f_namemax;
+	out.st.frsize = st.f_frsize;
+	send_reply(w, ih, 0, &out, sizeof(out));
+}
+
+static void do_init(struct worker *w, struct fuse_in_header *ih,
+		    struct fuse_init_in *in)
+{
+	struct fuse_init_out out;
+	size_t len = sizeof(out);
+
+	memset(&out, 0, sizeof(out));
+	out.major = FUSE_KERNEL_VERSION;
+	out.minor = in->minor < FUSE_KERNEL_MINOR_VERSION ?
+		in->minor : FUSE_KERNEL_MINOR_VERSION;
+	out.flags = in->flags & (FUSE_ASYNC_READ | FUSE_BIG_WRITES |
+				 FUSE_ATOMIC_O_TRUNC);
+	out.max_readahead = in->max_readahead;
+
+	if (in->flags & FUSE_MAX_PAGES) {
+		req_pages = max_pages;
+		out.flags |= FUSE_MAX_PAGES;
+		out.max_pages = max_pages;
+		if (out.max_readahead < req_pages * PAGE_BYTES)
+			out.max_readahead = req_pages * PAGE_BYTES;
+	} else {
+		/* The kernel's init_out ends before max_pages */
+		len = offsetof(struct fuse_init_out, time_gran);
+		if (max_pages > 32)
+			fprintf(stderr, "kernel can't do more than 32 pages "
+				"per request\n");
+		req_pages = 32;
+	}
+	out.max_write = req_pages * PAGE_BYTES;
+
+	if (use_passthrough && (in->flags & FUSE_PASSTHROUGH)) {
+		out.flags |= FUSE_PASSTHROUGH;
+	} else if (use_passthrough) {
+		fprintf(stderr, "kernel can't do passthrough\n");
+		use_passthrough = 0;
+	}
+
+	if (use_writeback && (in->flags & FUSE_WRITEBACK_CACHE) &&
+	    len > offsetof(struct fuse_init_out, time_gran)) {
+		out.flags |= FUSE_WRITEBACK_CACHE;
+		out.time_gran = 1;
+	} else if (use_writeback) {
+		fprintf(stderr, "kernel can't do writeback cache\n");
+		use_writeback = 0;
+	}
+
+	if (in->major != FUSE_KERNEL_VERSION) {
+		fprintf(stderr, "unsupported protocol %u.%u\n", in->major,
+			in->minor);
+		reply_err(w, ih, -EPROTO);
+		return;
+	}
+	send_reply(w, ih, 0, &out, len);
+}
+
+static void dispatch(struct worker *w, struct fuse_in_header *ih,
+		     size_t spliced)
+{
+	void *arg = ih + 1;
+
+	switch (ih->opcode) {
+	case FUSE_INIT:
+		do_init(w, ih, arg);
+		break;
+	case FUSE_LOOKUP:
+		do_lookup(w, ih, arg);
+		break;
+	case FUSE_FORGET:
+		forget_node(ih->nodeid, ((struct fuse_forget_in *)arg)->nlookup);
+		break;
+	case FUSE_BATCH_FORGET: {
+		struct fuse_batch_forget_in *in = arg;
+		struct fuse_forget_one *one = (void *)(in + 1);
+		unsigned int i;
+
+		for (i = 0; i < in->count; i++)
+			forget_node(one[i].nodeid, one[i].nlookup);
+		break;
+	}
+	case FUSE_GETATTR:
+		do_getattr(w, ih, arg);
+		break;
+	case FUSE_SETATTR:
+		do_setattr(w, ih, arg);
+		break;
+	case FUSE_OPEN:
+		do_open(w, ih, arg);
+		break;
+	case FUSE_CREATE:
+		do_create(w, ih, arg);
+		break;
+	case FUSE_READ:
+		do_read(w, ih, arg);
+		break;
+	case FUSE_WRITE:
+		do_write(w, ih, arg, spliced);
+		break;
+	case FUSE_FLUSH:
+		reply_err(w, ih, 0);
+		break;
+	case FUSE_FSYNC: {
+		struct fuse_fsync_in *in = arg;
+		int res = in->fsync_flags & 1 ? fdatasync(in->fh) :
+			fsync(in->fh);
+
+		reply_err(w, ih, res ? -errno : 0);
+		break;
+	}
+	case FUSE_RELEASE:
+		close(((struct fuse_release_in *)arg)->fh);
+		reply_err(w, ih, 0);
+		break;
+	case FUSE_MKDIR:
+		do_mkdir(w, ih, arg);
+		break;
+	case FUSE_UNLINK:
+		do_unlink(w, ih, arg, 0);
+		break;
+	case FUSE_RMDIR:
+		do_unlink(w, ih, arg, AT_REMOVEDIR);
+		break;
+	case FUSE_OPENDIR:
+		do_opendir(w, ih);
+		break;
+	case FUSE_READDIR:
+		do_readdir(w, ih, arg);
+		break;
+	case FUSE_RELEASEDIR: {
+		struct fuse_release_in *in = arg;
+		struct dir_handle *d = (struct dir_handle *)(uintptr_t)in->fh;
+
+		closedir(d->dp);
+		free(d);
+		reply_err(w, ih, 0);
+		break;
+	}
+	case FUSE_ACCESS: {
+		char path[PATH_MAX];
+
+		node_path(path, sizeof(path), ih->nodeid, NULL);
+		reply_err(w, ih, faccessat(lower_fd, path,
+			  ((struct fuse_access_in *)arg)->mask, 0) ? -errno : 0);
+		break;
+	}
+	case FUSE_STATFS:
+		do_statfs(w, ih);
+		break;
+	case FUSE_INTERRUPT:
+		/* Nothing here blocks for long, just let it finish */
+		break;
+	case FUSE_DESTROY:
+		reply_err(w, ih, 0);
+		break;
+	default:
+		reply_err(w, ih, -ENOSYS);
+		break;
+	}
+}
+
+static int read_full(int fd, void *buf, size_t len)
+{
+	ssize_t res;
+
+	while (len) {
+		res = read(fd, buf, len);
+		if (res <= 0)
+			return -1;
+		buf = (char *)buf + res;
+		len -= res;
+	}
+	return 0;
+}
+
+/*
+ * Get the next request through the pipe.  WRITE data is left in the pipe
+ * for do_write() to splice on, everything else is read into the buffer.
+ */
+static ssize_t splice_request(struct worker *w, size_t *spliced)
+{
+	struct fuse_in_header *ih = (struct fuse_in_header *)w->buf;
+	size_t head;
+	ssize_t res;
+
+	res = splice(w->fd, NULL, w->pipe[1], NULL, buf_size, 0);
+	if (res <= 0)
+		return res;
+
+	head = sizeof(*ih);
+	if (read_full(w->pipe[0], ih, head))
+		return -EIO;
+	if (ih->opcode == FUSE_WRITE &&
+	    ih->len >= head + sizeof(struct fuse_write_in)) {
+		head += sizeof(struct fuse_write_in);
+		*spliced = ih->len - head;
+	}
+	if (read_full(w->pipe[0], ih + 1, (*spliced ? head : ih->len) -
+		      sizeof(*ih)))
+		return -EIO;
+	return res;
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	struct fuse_in_header *ih;
+	size_t spliced;
+	ssize_t res;
+
+	if (pin_threads) {
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		CPU_SET(w->id % sysconf(_SC_NPROCESSORS_ONLN), &set);
+		sched_setaffinity(0, sizeof(set), &set);
+	}
+
+	for (;;) {
+		spliced = 0;
+		if (use_splice)
+			res = splice_request(w, &spliced);
+		else
+			res = read(w->fd, w->buf, buf_size);
+		if (res < 0) {
+			/* ENOENT: the request was interrupted meanwhile */
+			if (errno == EINTR || errno == EAGAIN ||
+			    errno == ENOENT)
+				continue;
+			if (errno != ENODEV)
+				perror("fuse read");
+			break;
+		}
+		if (res == 0)
+			break;
+
+		ih = (struct fuse_in_header *)w->buf;
+		dispatch(w, ih, spliced);
+	}
+	return NULL;
+}
+
+static int setup_worker(struct worker *w, int id, int mount_fd)
+{
+	uint32_t fd = mount_fd;
+
+	w->id = id;
+	w->fd = mount_fd;
+	if (id && clone_devs) {
+		w->fd = open("/dev/fuse", O_RDWR | O_CLOEXEC);
+		if (w->fd < 0) {
+			perror("/dev/fuse");
+			return -1;
+		}
+		if (ioctl(w->fd, FUSE_DEV_IOC_CLONE, &fd)) {
+			perror("FUSE_DEV_IOC_CLONE");
+			return -1;
+		}
+	}
+	if (use_splice) {
+		if (pipe(w->pipe)) {
+			perror("pipe");
+			return -1;
+		}
+		/* A whole request has to fit, data pages plus the header */
+		if (fcntl(w->pipe[0], F_SETPIPE_SZ, buf_size + PAGE_BYTES) < 0) {
+			perror("F_SETPIPE_SZ, see /proc/sys/fs/pipe-max-size");
+			return -1;
+		}
+	}
+	w->buf = malloc(buf_size);
+	w->out = malloc(buf_size);
+	if (!w->buf || !w->out) {
+		perror("malloc");
+		return -1;
+	}
+	return 0;
+}
+
+static void unmount_handler(int sig)
+{
+	(void)sig;
+	umount2(mnt_path, MNT_DETACH);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] <lower dir> <mountpoint>\n"
+		"  -t nr      daemon threads (%d)\n"
+		"  -c         give each thread a device file of its own\n"
+		"  -a         pin thread n to cpu n\n"
+		"  -p pages   max pages per request, up to 256 (%u)\n"
+		"  -s         move file data with splice\n"
+		"  -P         pass file I/O through to the lower files\n"
+		"  -w         cache writes in the kernel\n",
+		prog, nr_threads, max_pages);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct worker *workers;
+	char opts[256];
+	int c, fd, i;
+
+	while ((c = getopt(argc, argv, "t:cap:sPw")) != -1) {
+		switch (c) {
+		case 't': nr_threads = atoi(optarg); break;
+		case 'c': clone_devs = 1; break;
+		case 'a': pin_threads = 1; break;
+		case 'p': max_pages = atoi(optarg); break;
+		case 's': use_splice = 1; break;
+		case 'P': use_passthrough = 1; break;
+		case 'w': use_writeback = 1; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind != argc - 2 || nr_threads < 1 || max_pages < 1 ||
+	    max_pages > 256)
+		usage(argv[0]);
+	lower_path = argv[optind];
+	mnt_path = argv[optind + 1];
+
+	/* Requests carry up to max_pages of data behind their headers */
+	buf_size = (max_pages + 1) * PAGE_BYTES;
+
+	lower_fd = open(lower_path, O_RDONLY | O_DIRECTORY);
+	if (lower_fd < 0) {
+		perror(lower_path);
+		return 1;
+	}
+
+	fd = open("/dev/fuse", O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		perror("/dev/fuse");
+		return 1;
+	}
+	snprintf(opts, sizeof(opts), "fd=%d,rootmode=40000,user_id=%d,"
+		 "group_id=%d,allow_other,default_permissions", fd,
+		 getuid(), getgid());
+	if (mount("fuse-loopback", mnt_path, "fuse", MS_NOSUID | MS_NODEV,
+		  opts)) {
+		perror("mount");
+		return 1;
+	}
+	signal(SIGINT, unmount_handler);
+	signal(SIGTERM, unmount_handler);
+
+	workers = calloc(nr_threads, sizeof(*workers));
+	if (!workers) {
+		perror("calloc");
+		goto out_umount;
+	}
+	for (i = 0; i < nr_threads; i++)
+		if (setup_worker(&workers[i], i, fd))
+			goto out_umount;
+	for (i = 0; i < nr_threads; i++)
+		pthread_create(&workers[i].thread, NULL, worker_fn,
+			       &workers[i]);
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(workers[i].thread, NULL);
+	return 0;
+
+out_umount:
+	umount2(mnt_path, MNT_DETACH);
+	return 1;
+}
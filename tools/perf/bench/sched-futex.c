@@ -0,0 +1,197 @@
+/*
+ *
+ * sched-futex.c
+ *
+ * futex: Benchmark for futex wait/wake
+ *
+ * Pairs of threads pass a token back and forth, each side sleeping
+ * in FUTEX_WAIT until the other one hands the token over with
+ * FUTEX_WAKE. The pairs are independent of each other, so whatever
+ * stops the throughput from growing with the number of threads is
+ * contention in the kernel, mostly on the futex hash buckets.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#ifndef PR_SET_FUTEX_HASH
+#define PR_SET_FUTEX_HASH	0x59460001
+#endif
+
+static int max_threads = 16;
+static int runtime = 1;
+static bool private_futex;
+static int hash_slots;
+
+static const struct option options[] = {
+	OPT_INTEGER('t', "threads", &max_threads,
+		    "Specify the maximum number of threads (even)"),
+	OPT_INTEGER('r', "runtime", &runtime,
+		    "Specify seconds to run each thread count"),
+	OPT_BOOLEAN('P', "private", &private_futex,
+		    "Use process private futexes"),
+	OPT_INTEGER('H', "hash", &hash_slots,
+		    "Give the process a private futex hash with this many slots"),
+	OPT_END()
+};
+
+static const char * const bench_sched_futex_usage[] = {
+	"perf bench sched futex <options>",
+	NULL
+};
+
+/* One futex word per cache line, the pairs must not share lines */
+struct futex_word {
+	volatile int val;
+} __attribute__((aligned(64)));
+
+struct worker {
+	pthread_t thread;
+	struct futex_word *mine, *peer;
+	unsigned long ops;
+};
+
+static volatile int done;
+static int futex_flags;
+
+static int futex_op(volatile int *uaddr, int op, int val)
+{
+	return syscall(SYS_futex, uaddr, op | futex_flags, val, NULL, NULL, 0);
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+
+	while (!done) {
+		/* Wait for the token, then hand it to the peer */
+		while (!__sync_bool_compare_and_swap(&w->mine->val, 1, 0)) {
+			if (done)
+				return NULL;
+			futex_op(&w->mine->val, FUTEX_WAIT, 0);
+		}
+		__sync_lock_test_and_set(&w->peer->val, 1);
+		futex_op(&w->peer->val, FUTEX_WAKE, 1);
+		w->ops++;
+	}
+	return NULL;
+}
+
+static double run_threads(int nr)
+{
+	struct futex_word *words;
+	struct worker *workers;
+	unsigned long ops = 0;
+	struct timeval start, stop, diff;
+	double secs;
+	int i;
+
+	words = calloc(nr, sizeof(*words));
+	workers = calloc(nr, sizeof(*workers));
+	if (!words || !workers)
+		die("calloc");
+
+	for (i = 0; i < nr; i++) {
+		workers[i].mine = &words[i];
+		workers[i].peer = &words[i ^ 1];
+	}
+	/* The first thread of each pair starts with the token */
+	for (i = 0; i < nr; i += 2)
+		words[i].val = 1;
+
+	done = 0;
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nr; i++)
+		if (pthread_create(&workers[i].thread, NULL, worker_fn,
+				   &workers[i]))
+			die("pthread_create");
+
+	sleep(runtime);
+	done = 1;
+
+	/* Release everybody still waiting */
+	for (i = 0; i < nr; i++) {
+		__sync_lock_test_and_set(&words[i].val, 1);
+		futex_op(&words[i].val, FUTEX_WAKE, 1);
+	}
+	for (i = 0; i < nr; i++) {
+		pthread_join(workers[i].thread, NULL);
+		ops += workers[i].ops;
+	}
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	free(workers);
+	free(words);
+
+	secs = diff.tv_sec + diff.tv_usec / 1000000.0;
+	return ops / secs;
+}
+
+int bench_sched_futex(int argc, const char **argv,
+		      const char *prefix __used)
+{
+	double base = 0, rate;
+	int nr;
+
+	argc = parse_options(argc, argv, options,
+			     bench_sched_futex_usage, 0);
+
+	if (max_threads < 2 || runtime < 1)
+		usage_with_options(bench_sched_futex_usage, options);
+
+	if (private_futex || hash_slots)
+		futex_flags = FUTEX_PRIVATE_FLAG;
+
+	/* Has to happen while we are still single threaded */
+	if (hash_slots && prctl(PR_SET_FUTEX_HASH, hash_slots, 0, 0, 0)) {
+		fprintf(stderr, "PR_SET_FUTEX_HASH: %s\n", strerror(errno));
+		return 1;
+	}
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %s futexes%s, %d sec per step\n\n",
+		       futex_flags ? "Private" : "Shared",
+		       hash_slots ? ", private hash" : "", runtime);
+
+	for (nr = 2; nr <= max_threads; nr *= 2) {
+		rate = run_threads(nr);
+		if (!base)
+			base = rate;
+
+		switch (bench_format) {
+		case BENCH_FORMAT_DEFAULT:
+			printf(" %6d threads: %14.0f ops/sec %8.2f usecs/op"
+			       " (scaling %.2f)\n", nr, rate,
+			       1000000.0 * nr / rate, rate / base);
+			break;
+
+		case BENCH_FORMAT_SIMPLE:
+			printf("%d %.0f\n", nr, rate);
+			break;
+
+		default:
+			/* reaching here is something disaster */
+			fprintf(stderr, "Unknown format:%d\n", bench_format);
+			exit(1);
+			break;
+		}
+	}
+
+	return 0;
+}
@@ -42,6 +42,9 @@ static struct bench_suite sched_suites[] = {
 	{ "pipe",
 	  "Flood of communication over pipe() between two processes",
 	  bench_sched_pipe      },
+	{ "futex",
+	  "Futex wait/wake throughput as the number of threads grows",
+	  bench_sched_futex     },
 	suite_all,
 	{ NULL,
 	  NULL,
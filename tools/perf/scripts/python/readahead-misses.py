@@ -0,0 +1,67 @@
+# readahead misses
+# Licensed under the terms of the GNU GPL License version 2
+#
+# Summarizes synchronous page cache misses and background prefetches per
+# task and per file.  Meant for measuring cold application launches:
+#
+#   echo 3 > /proc/sys/vm/drop_caches
+#   perf script record readahead-misses -a -- <launch the app>
+#   perf script report readahead-misses
+#
+# Run it once with /proc/sys/vm/readahead_history set to 0 and once with
+# it set to 1 (after a warm-up launch) to compare the number of misses
+# the application had to wait for.
+
+import os, sys
+sys.path.append(os.environ['PERF_EXEC_PATH'] + '/scripts/python/Perf-Trace-Util/lib/Perf/Trace')
+from Util import *
+
+comm_misses = {}	# comm -> [misses, pages]
+file_misses = {}	# (dev, ino) -> [misses, pages]
+file_prefetches = {}	# (dev, ino) -> [prefetches, pages]
+
+def bump(d, key, pages):
+	if d.has_key(key):
+		d[key][0] += 1
+		d[key][1] += pages
+	else:
+		d[key] = [1, pages]
+
+def readahead__mm_readahead_miss(event_name, context, common_cpu,
+		common_secs, common_nsecs, common_pid, common_comm,
+		dev, ino, offset, req_size, start, size):
+	bump(comm_misses, common_comm, size)
+	bump(file_misses, (dev, ino), size)
+
+def readahead__mm_readahead_prefetch(event_name, context, common_cpu,
+		common_secs, common_nsecs, common_pid, common_comm,
+		dev, ino, start, size):
+	bump(file_prefetches, (dev, ino), size)
+
+def trace_begin():
+	print "Press control+C to stop and show the summary"
+
+def print_dev_ino(key):
+	dev, ino = key
+	return "%d,%d:%d" % (dev >> 20, dev & ((1 << 20) - 1), ino)
+
+def trace_end():
+	total = 0
+	print "\n%-20s %10s %10s" % ("comm", "misses", "pages")
+	print "%-20s %10s %10s" % ("--------------------", "----------",
+				   "----------")
+	for comm, (misses, pages) in sorted(comm_misses.iteritems(),
+			key = lambda (k, v): v[0], reverse = True):
+		print "%-20s %10d %10d" % (comm, misses, pages)
+		total += misses
+	print "%-20s %10d" % ("total", total)
+
+	print "\n%-24s %10s %10s %10s %10s" % ("file (dev:ino)", "misses",
+			"pages", "prefetches", "pages")
+	print "%-24s %10s %10s %10s %10s" % ("------------------------",
+			"----------", "----------", "----------", "----------")
+	for key, (misses, pages) in sorted(file_misses.iteritems(),
+			key = lambda (k, v): v[0], reverse = True)[:30]:
+		prefetches, prefetched = file_prefetches.get(key, (0, 0))
+		print "%-24s %10d %10d %10d %10d" % (print_dev_ino(key),
+				misses, pages, prefetches, prefetched)
@@ -0,0 +1,287 @@
+/* $(CROSS_COMPILE)cc -Wall -Wextra -O2 -lpthread -o yaffs-bench yaffs-bench.c */
+
+/*
+ * yaffs-bench: small reads and writes, and lookups, on a yaffs2 mount
+ *
+ * Creates -f files of -s bytes each in the directory given, stats them
+ * all, then does -n reads and writes of -b bytes at random offsets of
+ * random files, -r percent of them reads.  Prints operations per second
+ * for each phase and what the short op cache and the object hash of the
+ * device did meanwhile, from /proc/yaffs.  -m picks the device in there
+ * by its mtd name, the first one is used otherwise.
+ *
+ * No flash is needed, nandsim makes a 128MiB device of 2KiB pages:
+ *
+ *	modprobe nandsim first_id_byte=0x20 second_id_byte=0xf1 \
+ *		third_id_byte=0x00 fourth_id_byte=0x1d
+ *	mount -t yaffs2 -o cache-chunks=64 /dev/mtdblock0 /mnt
+ *	yaffs-bench -f 5000 -D /mnt
+ *
+ * -D drops the dentry and inode caches before the stat phase, so that the
+ * lookups get down to yaffs.  Remount with a different cache-chunks= to
+ * compare cache sizes.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+enum {
+	S_CACHE_HITS,
+	S_CACHE_MISSES,
+	S_OBJ_LOOKUPS,
+	S_OBJ_PROBES,
+	S_OBJ_BUCKETS,
+	S_PAGE_READS,
+	S_PAGE_WRITES,
+	NR_STATS,
+};
+
+static const char * const stat_names[NR_STATS] = {
+	"cache_hits", "cache_misses", "obj_lookups", "obj_probes",
+	"obj_buckets", "n_page_reads", "n_page_writes",
+};
+
+static const char *dir;
+static const char *mtd_name;
+static int nr_files = 1000;
+static size_t file_size = 65536;
+static size_t io_size = 512;
+static int nr_ops = 20000;
+static int read_pct = 50;
+static int drop_caches;
+
+static uint64_t now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static void *alloc_buf(size_t len)
+{
+	void *buf;
+
+	if (posix_memalign(&buf, 4096, len))
+		die("posix_memalign");
+	memset(buf, 0x5a, len);
+	return buf;
+}
+
+/* The counters of our device in /proc/yaffs, zero if it has none of them */
+static void read_stats(uint64_t *stats)
+{
+	char line[256], name[64];
+	unsigned long long val;
+	int ours = 0, seen = 0, i;
+	FILE *f;
+
+	memset(stats, 0, NR_STATS * sizeof(*stats));
+	f = fopen("/proc/yaffs", "r");
+	if (!f)
+		return;
+	while (fgets(line, sizeof(line), f)) {
+		if (!strncmp(line, "Device ", 7)) {
+			ours = !seen && (!mtd_name || strstr(line, mtd_name));
+			seen |= ours;
+			continue;
+		}
+		if (!ours || sscanf(line, "%63[a-z_0-9]%*[.] %llu", name,
+				    &val) != 2)
+			continue;
+		for (i = 0; i < NR_STATS; i++)
+			if (!strcmp(name, stat_names[i]))
+				stats[i] = val;
+	}
+	fclose(f);
+}
+
+static void file_path(char *path, int i)
+{
+	snprintf(path, PATH_MAX, "%s/yaffs-bench.%d", dir, i);
+}
+
+static void create_files(char *buf)
+{
+	char path[PATH_MAX];
+	size_t off;
+	int i, fd;
+
+	for (i = 0; i < nr_files; i++) {
+		file_path(path, i);
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+			die(path);
+		for (off = 0; off < file_size; off += io_size)
+			if (pwrite(fd, buf, io_size, off) != (ssize_t)io_size)
+				die("pwrite");
+		close(fd);
+	}
+	sync();
+}
+
+static void stat_files(void)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	int i;
+
+	for (i = 0; i < nr_files; i++) {
+		file_path(path, i);
+		if (stat(path, &st))
+			die(path);
+	}
+}
+
+static void random_io(char *buf)
+{
+	char path[PATH_MAX];
+	unsigned int seed = 1;
+	size_t slots = file_size / io_size;
+	off_t off;
+	int i, fd;
+
+	for (i = 0; i < nr_ops; i++) {
+		file_path(path, rand_r(&seed) % nr_files);
+		off = (off_t)(rand_r(&seed) % slots) * io_size;
+		fd = open(path, O_RDWR);
+		if (fd < 0)
+			die(path);
+		if ((int)(rand_r(&seed) % 100) < read_pct) {
+			if (pread(fd, buf, io_size, off) != (ssize_t)io_size)
+				die("pread");
+		} else {
+			buf[0] = i;
+			if (pwrite(fd, buf, io_size, off) != (ssize_t)io_size)
+				die("pwrite");
+		}
+		close(fd);
+	}
+	sync();
+}
+
+static void do_drop_caches(void)
+{
+	int fd;
+
+	sync();
+	fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+	if (fd < 0 || write(fd, "2", 1) != 1)
+		die("drop_caches");
+	close(fd);
+}
+
+static void report(const char *phase, int ops, uint64_t usec,
+		   const uint64_t *before, const uint64_t *after)
+{
+	uint64_t d[NR_STATS];
+	double hit = 0, probes = 0;
+	int i;
+
+	for (i = 0; i < NR_STATS; i++)
+		d[i] = after[i] - before[i];
+	if (d[S_CACHE_HITS] + d[S_CACHE_MISSES])
+		hit = 100.0 * d[S_CACHE_HITS] /
+			(d[S_CACHE_HITS] + d[S_CACHE_MISSES]);
+	if (d[S_OBJ_LOOKUPS])
+		probes = (double)d[S_OBJ_PROBES] / d[S_OBJ_LOOKUPS];
+
+	printf("%-8s %10.1f %8.1f %10llu %8.2f %8llu %10llu %10llu\n",
+	       phase, ops / (usec / 1000000.0), hit,
+	       (unsigned long long)d[S_OBJ_LOOKUPS], probes,
+	       (unsigned long long)after[S_OBJ_BUCKETS],
+	       (unsigned long long)d[S_PAGE_READS],
+	       (unsigned long long)d[S_PAGE_WRITES]);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] <dir>\n"
+		"  -f nr      files (%d)\n"
+		"  -s bytes   file size (%zu)\n"
+		"  -b bytes   read and write size (%zu)\n"
+		"  -n nr      random reads and writes (%d)\n"
+		"  -r pct     of them reads (%d)\n"
+		"  -m name    mtd name of the device in /proc/yaffs (first one)\n"
+		"  -D         drop the dentry and inode caches before stat\n",
+		prog, nr_files, file_size, io_size, nr_ops, read_pct);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t before[NR_STATS], after[NR_STATS], start;
+	char path[PATH_MAX];
+	char *buf;
+	int c, i;
+
+	while ((c = getopt(argc, argv, "f:s:b:n:r:m:D")) != -1) {
+		switch (c) {
+		case 'f': nr_files = atoi(optarg); break;
+		case 's': file_size = strtoul(optarg, NULL, 0); break;
+		case 'b': io_size = strtoul(optarg, NULL, 0); break;
+		case 'n': nr_ops = atoi(optarg); break;
+		case 'r': read_pct = atoi(optarg); break;
+		case 'm': mtd_name = optarg; break;
+		case 'D': drop_caches = 1; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || nr_files < 1 || io_size < 1 ||
+	    file_size < io_size || nr_ops < 1 || read_pct < 0 ||
+	    read_pct > 100)
+		usage(argv[0]);
+	dir = argv[optind];
+	buf = alloc_buf(io_size);
+
+	printf("%-8s %10s %8s %10s %8s %8s %10s %10s\n", "phase", "ops/s",
+	       "hit %", "lookups", "probes", "buckets", "nand rd", "nand wr");
+
+	read_stats(before);
+	start = now_usec();
+	create_files(buf);
+	read_stats(after);
+	report("create", nr_files, now_usec() - start, before, after);
+
+	if (drop_caches)
+		do_drop_caches();
+	read_stats(before);
+	start = now_usec();
+	stat_files();
+	read_stats(after);
+	report("stat", nr_files, now_usec() - start, before, after);
+
+	read_stats(before);
+	start = now_usec();
+	random_io(buf);
+	read_stats(after);
+	report("rw", nr_ops, now_usec() - start, before, after);
+
+	for (i = 0; i < nr_files; i++) {
+		file_path(path, i);
+		unlink(path);
+	}
+	free(buf);
+	return 0;
+}
@@ -0,0 +1,260 @@
+/* $(CROSS_COMPILE)cc -Wall -Wextra -O2 -lpthread -o yaffs-mount-bench yaffs-mount-bench.c */
+
+/*
+ * yaffs-mount-bench: how long mounting a yaffs2 partition takes
+ *
+ * Mounts the device on the directory given -n times in each of these ways
+ * and prints how long mount(2) took, along with the mount_* counters yaffs
+ * keeps in /proc/yaffs:
+ *
+ *	checkpt		from the checkpoint the last unmount wrote
+ *	scan		with no-checkpoint, so that every block gets scanned as
+ *			after losing power, once for each -t number of threads
+ *			reading ahead (the yaffs_scan_threads parameter)
+ *
+ * -f files of -s bytes are written first to have something to scan.
+ * Everything runs on nandsim as well as on real flash, e.g.
+ *
+ *	modprobe nandsim first_id_byte=0x20 second_id_byte=0xf1 \
+ *		third_id_byte=0x00 fourth_id_byte=0x1d
+ *	yaffs-mount-bench -f 2000 -t 0,1,2,4 /dev/mtdblock0 /mnt
+ *
+ * -m picks the device in /proc/yaffs by its mtd name, the first one is
+ * used otherwise.  The files are left on the device.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mount.h>
+
+#define SCAN_THREADS_PARAM "/sys/module/yaffs/parameters/yaffs_scan_threads"
+#define MAX_THREAD_COUNTS 16
+
+enum {
+	S_FROM_CHECKPT,
+	S_MOUNT_US,
+	S_CHECKPT_US,
+	S_SCAN_US,
+	S_SCAN_BLOCKS,
+	S_SCAN_THREADS,
+	S_PAGE_READS,
+	NR_STATS,
+};
+
+static const char * const stat_names[NR_STATS] = {
+	"mount_from_checkpt", "mount_us", "mount_checkpt_us", "mount_scan_us",
+	"mount_scan_blocks", "mount_scan_threads", "mount_page_reads",
+};
+
+static const char *dev_path;
+static const char *dir;
+static const char *mtd_name;
+static int nr_runs = 3;
+static int nr_files;
+static size_t file_size = 65536;
+static int thread_counts[MAX_THREAD_COUNTS] = { -1 };
+static int nr_thread_counts = 1;
+
+static uint64_t now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static void *alloc_buf(size_t len)
+{
+	void *buf;
+
+	if (posix_memalign(&buf, 4096, len))
+		die("posix_memalign");
+	memset(buf, 0x5a, len);
+	return buf;
+}
+
+/* The counters of our device in /proc/yaffs, zero if it has none of them */
+static void read_stats(uint64_t *stats)
+{
+	char line[256], name[64];
+	unsigned long long val;
+	int ours = 0, seen = 0, i;
+	FILE *f;
+
+	memset(stats, 0, NR_STATS * sizeof(*stats));
+	f = fopen("/proc/yaffs", "r");
+	if (!f)
+		return;
+	while (fgets(line, sizeof(line), f)) {
+		if (!strncmp(line, "Device ", 7)) {
+			ours = !seen && (!mtd_name || strstr(line, mtd_name));
+			seen |= ours;
+			continue;
+		}
+		if (!ours || sscanf(line, "%63[a-z_0-9]%*[.] %llu", name,
+				    &val) != 2)
+			continue;
+		for (i = 0; i < NR_STATS; i++)
+			if (!strcmp(name, stat_names[i]))
+				stats[i] = val;
+	}
+	fclose(f);
+}
+
+static void set_scan_threads(int n)
+{
+	char val[16];
+	int fd, len;
+
+	len = snprintf(val, sizeof(val), "%d", n);
+	fd = open(SCAN_THREADS_PARAM, O_WRONLY);
+	if (fd < 0 || write(fd, val, len) != len)
+		die(SCAN_THREADS_PARAM);
+	close(fd);
+}
+
+static uint64_t do_mount(const char *opts)
+{
+	uint64_t start = now_usec();
+
+	if (mount(dev_path, dir, "yaffs2", 0, opts))
+		die("mount");
+	return now_usec() - start;
+}
+
+static void do_umount(void)
+{
+	if (umount(dir))
+		die("umount");
+}
+
+static void populate(void)
+{
+	char path[PATH_MAX];
+	char *buf = alloc_buf(file_size);
+	int i, fd;
+
+	do_mount("");
+	for (i = 0; i < nr_files; i++) {
+		snprintf(path, sizeof(path), "%s/yaffs-mount-bench.%d", dir, i);
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+			die(path);
+		if (write(fd, buf, file_size) != (ssize_t)file_size)
+			die("write");
+		close(fd);
+	}
+	/* Unmounting writes the checkpoint */
+	do_umount();
+	free(buf);
+}
+
+static void run(const char *opts, int threads)
+{
+	uint64_t stats[NR_STATS], usec;
+	char tbuf[16];
+	int i;
+
+	for (i = 0; i < nr_runs; i++) {
+		usec = do_mount(opts);
+		read_stats(stats);
+		do_umount();
+
+		if (threads < 0)
+			snprintf(tbuf, sizeof(tbuf), "-");
+		else
+			snprintf(tbuf, sizeof(tbuf), "%d", threads);
+		printf("%-8s %7s %10.1f %10.1f %10.1f %10.1f %8llu %8llu %10llu\n",
+		       stats[S_FROM_CHECKPT] ? "checkpt" : "scan", tbuf,
+		       usec / 1000.0, stats[S_MOUNT_US] / 1000.0,
+		       stats[S_CHECKPT_US] / 1000.0, stats[S_SCAN_US] / 1000.0,
+		       (unsigned long long)stats[S_SCAN_BLOCKS],
+		       (unsigned long long)stats[S_SCAN_THREADS],
+		       (unsigned long long)stats[S_PAGE_READS]);
+	}
+}
+
+static void parse_threads(char *list)
+{
+	char *tok;
+
+	nr_thread_counts = 0;
+	for (tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+		if (nr_thread_counts == MAX_THREAD_COUNTS)
+			break;
+		thread_counts[nr_thread_counts++] = atoi(tok);
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] <mtdblock device> <dir>\n"
+		"  -n nr      mounts of each kind (%d)\n"
+		"  -f nr      files to write first (%d)\n"
+		"  -s bytes   their size (%zu)\n"
+		"  -t list    scan threads to try, e.g. 0,1,2,4 (as configured)\n"
+		"  -m name    mtd name of the device in /proc/yaffs (first one)\n",
+		prog, nr_runs, nr_files, file_size);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int c, i;
+
+	while ((c = getopt(argc, argv, "n:f:s:t:m:")) != -1) {
+		switch (c) {
+		case 'n': nr_runs = atoi(optarg); break;
+		case 'f': nr_files = atoi(optarg); break;
+		case 's': file_size = strtoul(optarg, NULL, 0); break;
+		case 't': parse_threads(optarg); break;
+		case 'm': mtd_name = optarg; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind != argc - 2 || nr_runs < 1 || nr_files < 0 ||
+	    file_size < 1 || nr_thread_counts < 1)
+		usage(argv[0]);
+	dev_path = argv[optind];
+	dir = argv[optind + 1];
+
+	if (nr_files)
+		populate();
+
+	printf("%-8s %7s %10s %10s %10s %10s %8s %8s %10s\n", "mode",
+	       "threads", "mount ms", "yaffs ms", "checkpt ms", "scan ms",
+	       "blocks", "readers", "page reads");
+
+	for (i = 0; i < nr_thread_counts; i++) {
+		if (thread_counts[i] >= 0)
+			set_scan_threads(thread_counts[i]);
+		run("no-checkpoint", thread_counts[i]);
+	}
+
+	/* A scanning mount drops the checkpoint, have one written again */
+	do_mount("");
+	do_umount();
+	run("", -1);
+	return 0;
+}